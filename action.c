@@ -175,6 +175,14 @@ int iActionNbr = 0;
 int bActionReportSuspension = 1;
 int bActionReportSuspensionCont = 0;
 
+/* statistics for the template cache (see actionTplToString()). The stats
+ * object is only registered once a template is actually shared, so configs
+ * that do not use the cache keep their stats output unchanged.
+ */
+static statsobj_t *tplCacheStats;
+static STATSCOUNTER_SHARDED_DEF(ctrTplCacheHits)
+static STATSCOUNTER_SHARDED_DEF(ctrTplCacheMisses)
+
 /* tables for interfacing with the v6 config system */
 static struct cnfparamdescr cnfparamdescr[] = {
 	{ "name", eCmdHdlrGetWord, 0 }, /* legacy: actionname */
@@ -373,12 +381,35 @@ finalize_it:
 }
 
 
+/* register the template cache stats object, if not already done */
+static rsRetVal
+actionTplCacheStatsInit(void)
+{
+	DEFiRet;
+
+	if(tplCacheStats != NULL)
+		FINALIZE;
+	CHKiRet(statsobj.Construct(&tplCacheStats));
+	CHKiRet(statsobj.SetName(tplCacheStats, UCHAR_CONSTANT("template cache")));
+	CHKiRet(statsobj.SetOrigin(tplCacheStats, UCHAR_CONSTANT("core.action")));
+	CHKiRet(statsobj.AddCounter(tplCacheStats, UCHAR_CONSTANT("hits"),
+		ctrType_ShardedCtr, CTR_FLAG_RESETTABLE, &ctrTplCacheHits));
+	CHKiRet(statsobj.AddCounter(tplCacheStats, UCHAR_CONSTANT("misses"),
+		ctrType_ShardedCtr, CTR_FLAG_RESETTABLE, &ctrTplCacheMisses));
+	CHKiRet(statsobj.ConstructFinalize(tplCacheStats));
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* action construction finalizer
  */
 rsRetVal
 actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 {
 	DEFiRet;
+	int i;
 	uchar pszAName[64]; /* friendly name of our action */
 
 	if(!strcmp((char*)modGetName(pThis->pMod), "builtin:omdiscard")) {
@@ -394,7 +425,6 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 	/* cache transactional attribute */
 	pThis->isTransactional = pThis->pMod->mod.om.supportsTX;
 	if(pThis->isTransactional) {
-		int i;
 		for(i = 0 ; i < pThis->iNumTpls ; ++i) {
 			if(pThis->peParamPassing[i] != ACT_STRING_PASSING) {
 				errmsg.LogError(0, RS_RET_INVLD_OMOD, "action '%s'(%d) is transactional but "
@@ -416,9 +446,9 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 	CHKiRet(statsobj.SetName(pThis->statsobj, pThis->pszName));
 	CHKiRet(statsobj.SetOrigin(pThis->statsobj, (uchar*)"core.action"));
 
-	STATSCOUNTER_INIT(pThis->ctrProcessed, pThis->mutCtrProcessed);
+	STATSCOUNTER_SHARDED_INIT(pThis->ctrProcessed);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("processed"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrProcessed));
+		ctrType_ShardedCtr, CTR_FLAG_RESETTABLE, &pThis->ctrProcessed));
 
 	STATSCOUNTER_INIT(pThis->ctrFail, pThis->mutCtrFail);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("failed"),
@@ -525,6 +555,16 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 			"non-direct queue. This most probably leads to undesired "
 			"results", (char*)modGetName(pThis->pMod));
 	}
+
+	if(pThis->pQueue->qType == QUEUETYPE_DIRECT) {
+		for(i = 0 ; i < pThis->iNumTpls ; ++i) {
+			if(pThis->peParamPassing[i] != ACT_STRING_PASSING)
+				continue;
+			tplAddCacheUser(pThis->ppTpl[i]);
+			if(pThis->ppTpl[i]->iCacheUsers >= 2)
+				CHKiRet(actionTplCacheStatsInit());
+		}
+	}
 	
 	/* and now reset the queue params (see comment in its function header!) */
 	actionResetQueueParams();
@@ -914,6 +954,64 @@ static rsRetVal actionDbgPrint(action_t *pThis)
 #endif
 
 
+/* render a template as string into an action parameter. Templates that
+ * are used by more than one direct action are rendered only once per
+ * message by each worker: the first action stores the result in the
+ * worker's template cache, all others just copy it from there.
+ * bDirect tells if the action is run directly by the ruleset's workers.
+ * Action queue workers do not use the cache, as the sharing it is meant
+ * for only happens between the direct actions of a ruleset.
+ */
+static rsRetVal
+actionTplToString(wti_t *__restrict__ const pWti,
+		  struct template *__restrict__ const pTpl,
+		  msg_t *__restrict__ const pMsg,
+		  actWrkrIParams_t *__restrict__ const iparam,
+		  struct syslogTime *ttNow,
+		  const sbool bDirect)
+{
+	actWrkrIParams_t *cached;
+	int i;
+	DEFiRet;
+
+	if(!bDirect || pTpl->iCacheUsers < 2) {
+		CHKiRet(tplToString(pTpl, pMsg, iparam, ttNow));
+		FINALIZE;
+	}
+
+	if(pWti->tplCache.pMsg != pMsg) {
+		pWti->tplCache.pMsg = pMsg;
+		pWti->tplCache.nEntries = 0;
+	}
+	for(i = 0 ; i < pWti->tplCache.nEntries ; ++i) {
+		if(pWti->tplCache.entries[i].pTpl == pTpl)
+			break;
+	}
+	if(i < pWti->tplCache.nEntries) {
+		STATSCOUNTER_SHARDED_INC(ctrTplCacheHits);
+		cached = &pWti->tplCache.entries[i].str;
+	} else if(i < CONF_TPLCACHE_MAXENTRIES) {
+		STATSCOUNTER_SHARDED_INC(ctrTplCacheMisses);
+		cached = &pWti->tplCache.entries[i].str;
+		CHKiRet(tplToString(pTpl, pMsg, cached, ttNow));
+		pWti->tplCache.entries[i].pTpl = pTpl;
+		pWti->tplCache.nEntries = i + 1;
+	} else {
+		/* cache full, render without caching */
+		CHKiRet(tplToString(pTpl, pMsg, iparam, ttNow));
+		FINALIZE;
+	}
+
+	if(cached->lenStr >= iparam->lenBuf)
+		CHKiRet(ExtendBuf(iparam, cached->lenStr + 1));
+	memcpy(iparam->param, cached->param, cached->lenStr + 1);
+	iparam->lenStr = cached->lenStr;
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* prepare the calling parameters for doAction()
  * rgerhards, 2009-05-07
  */
@@ -927,23 +1025,24 @@ prepareDoActionParams(action_t * __restrict__ const pAction,
 	struct json_object *json;
 	actWrkrIParams_t *iparams;
 	actWrkrInfo_t *__restrict__ pWrkrInfo;
+	const sbool bDirect = pAction->pQueue->qType == QUEUETYPE_DIRECT;
 	DEFiRet;
 
 	pWrkrInfo = &(pWti->actWrkrInfo[pAction->iActionNbr]);
 	if(pAction->isTransactional) {
 		CHKiRet(wtiNewIParam(pWti, pAction, &iparams));
 		for(i = 0 ; i < pAction->iNumTpls ; ++i) {
-			CHKiRet(tplToString(pAction->ppTpl[i], pMsg, 
+			CHKiRet(actionTplToString(pWti, pAction->ppTpl[i], pMsg,
 					    &actParam(iparams, pAction->iNumTpls, 0, i),
-				            ttNow));
+				            ttNow, bDirect));
 		}
 	} else {
 		for(i = 0 ; i < pAction->iNumTpls ; ++i) {
 			switch(pAction->peParamPassing[i]) {
 			case ACT_STRING_PASSING:
-				CHKiRet(tplToString(pAction->ppTpl[i], pMsg,
+				CHKiRet(actionTplToString(pWti, pAction->ppTpl[i], pMsg,
 					   &(pWrkrInfo->p.nontx.actParams[i]),
-					   ttNow));
+					   ttNow, bDirect));
 				break;
 			case ACT_ARRAY_PASSING:
 				CHKiRet(tplToArray(pAction->ppTpl[i], pMsg,
@@ -1273,24 +1372,29 @@ finalize_it:
 	RETiRet;
 }
 
-/* Commit all active transactions in *DIRECT mode* */
+/* Commit all active transactions in *DIRECT mode*. Only actions
+ * that received messages since the last call can have something to
+ * commit, and these are tracked by the worker (see wtiNewIParam()). So
+ * the cost of this does not depend on how many actions the config has.
+ */
 void
 actionCommitAllDirect(wti_t *__restrict__ const pWti)
 {
 	int i;
 	action_t *pAction;
 
-	for(i = 0 ; i < iActionNbr ; ++i) {
-		pAction = pWti->actWrkrInfo[i].pAction;
-		if(pAction == NULL)
-			continue;
+	for(i = 0 ; i < pWti->nDirtyActions ; ++i) {
+		pAction = pWti->dirtyActions[i];
+		pWti->actWrkrInfo[pAction->iActionNbr].flags.bDirty = 0;
 		DBGPRINTF("actionCommitAll: action %d, state %u, nbr to commit %d "
 			  "isTransactional %d\n",
-			  i, getActionStateByNbr(pWti, i), pWti->actWrkrInfo->p.tx.currIParam,
+			  pAction->iActionNbr, getActionState(pWti, pAction),
+			  pWti->actWrkrInfo[pAction->iActionNbr].p.tx.currIParam,
 			  pAction->isTransactional);
 		if(pAction->pQueue->qType == QUEUETYPE_DIRECT)
 			actionCommit(pAction, pWti);
 	}
+	pWti->nDirtyActions = 0;
 }
 
 /* process a single message. This is both called if we run from the
@@ -1318,6 +1422,8 @@ processMsgMain(action_t *__restrict__ const pAction,
 	iRet = actionProcessMessage(pAction,
 				    pWti->actWrkrInfo[pAction->iActionNbr].p.nontx.actParams,
 				    pWti);
+	if(pAction->bUsesMsgPassingMode)
+		wtiTplCacheInvalidate(pWti); /* the action may have modified the message */
 	if(pAction->bNeedReleaseBatch)
 		releaseDoActionParams(pAction, pWti);
 finalize_it:
@@ -1438,6 +1544,9 @@ static rsRetVal setActionQueType(void __attribute__((unused)) *pVal, uchar *pszT
 	} else if (!strcasecmp((char *) pszType, "direct")) {
 		cs.ActionQueType = QUEUETYPE_DIRECT;
 		DBGPRINTF("action queue type set to DIRECT (no queueing at all)\n");
+	} else if (!strcasecmp((char *) pszType, "ringbuffer")) {
+		cs.ActionQueType = QUEUETYPE_RINGBUFFER;
+		DBGPRINTF("action queue type set to RINGBUFFER\n");
 	} else {
 		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "unknown actionqueue parameter: %s", (char *) pszType);
 		iRet = RS_RET_INVALID_PARAMS;
@@ -1472,7 +1581,7 @@ doSubmitToActionQ(action_t * const pAction, wti_t * const pWti, msg_t *pMsg)
 		FINALIZE;
 	}
 
-	STATSCOUNTER_INC(pAction->ctrProcessed, pAction->mutCtrProcessed);
+	STATSCOUNTER_SHARDED_INC(pAction->ctrProcessed);
 	if(pAction->pQueue->qType == QUEUETYPE_DIRECT) {
 		ttNow.year = 0;
 		iRet = processMsgMain(pAction, pWti, pMsg, &ttNow);
@@ -1938,6 +2047,9 @@ rsRetVal actionClassInit(void)
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 	CHKiRet(objUse(ruleset, CORE_COMPONENT));
 
+	STATSCOUNTER_SHARDED_INIT(ctrTplCacheHits);
+	STATSCOUNTER_SHARDED_INIT(ctrTplCacheMisses);
+
 	CHKiRet(regCfSysLineHdlr((uchar *)"actionname", 0, eCmdHdlrGetWord, NULL, &cs.pszActionName, NULL));
 	CHKiRet(regCfSysLineHdlr((uchar *)"actionqueuefilename", 0, eCmdHdlrGetWord, NULL, &cs.pszActionQFName, NULL));
 	CHKiRet(regCfSysLineHdlr((uchar *)"actionqueuesize", 0, eCmdHdlrInt, NULL, &cs.iActionQueueSize, NULL));
@@ -80,7 +80,7 @@ struct action_s {
 	int nWrkr;
 	/* for statistics subsystem */
 	statsobj_t *statsobj;
-	STATSCOUNTER_DEF(ctrProcessed, mutCtrProcessed)
+	STATSCOUNTER_SHARDED_DEF(ctrProcessed)
 	STATSCOUNTER_DEF(ctrFail, mutCtrFail)
 	STATSCOUNTER_DEF(ctrSuspend, mutCtrSuspend)
 	STATSCOUNTER_DEF(ctrSuspendDuration, mutCtrSuspendDuration)
@@ -51,6 +51,7 @@
 #include "msg.h"
 #include "wti.h"
 #include "unicode-helper.h"
+#include "ratelimit.h"
 
 DEFobjCurrIf(obj)
 DEFobjCurrIf(regexp)
@@ -714,6 +715,8 @@ doGetQueueType(struct nvlst *valnode, struct cnfparamdescr *param,
 		val->val.d.n = QUEUETYPE_DISK;
 	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"direct", 6)) {
 		val->val.d.n = QUEUETYPE_DIRECT;
+	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"ringbuffer", 10)) {
+		val->val.d.n = QUEUETYPE_RINGBUFFER;
 	} else {
 		cstr = es_str2cstr(valnode->val.d.estr, NULL);
 		parser_errmsg("param '%s': unknown queue type: '%s'",
@@ -1204,30 +1207,35 @@ done:
 
 
 static inline int64_t
-str2num(es_str_t *s, int *bSuccess)
+buf2num(const uchar *const c, const size_t len, int *bSuccess)
 {
 	size_t i;
 	int neg;
 	int64_t num = 0;
-	const uchar *const c = es_getBufAddr(s);
 
-	if(c[0] == '-') {
+	if(len > 0 && c[0] == '-') {
 		neg = -1;
 		i = -1;
 	} else {
 		neg = 1;
 		i = 0;
 	}
-	while(i < s->lenStr && isdigit(c[i])) {
+	while(i < len && isdigit(c[i])) {
 		num = num * 10 + c[i] - '0';
 		++i;
 	}
 	num *= neg;
 	if(bSuccess != NULL)
-		*bSuccess = (i == s->lenStr) ? 1 : 0;
+		*bSuccess = (i == len) ? 1 : 0;
 	return num;
 }
 
+static inline int64_t
+str2num(es_str_t *s, int *bSuccess)
+{
+	return buf2num(es_getBufAddr(s), s->lenStr, bSuccess);
+}
+
 /* We support decimal integers. Unfortunately, previous versions
  * said they support oct and hex, but that wasn't really the case.
  * Everything based on JSON was just dec-converted. As this was/is
@@ -1241,6 +1249,8 @@ var2Number(struct var *r, int *bSuccess)
 	long long n = 0;
 	if(r->datatype == 'S') {
 		n = str2num(r->d.estr, bSuccess);
+	} else if(r->datatype == 'B') {
+		n = buf2num(r->d.sv.str, r->d.sv.len, bSuccess);
 	} else {
 		if(r->datatype == 'J') {
 			n = (r->d.json == NULL) ? 0 : json_object_get_int64(r->d.json);
@@ -1274,6 +1284,9 @@ var2String(struct var *__restrict__ const r, int *__restrict__ const bMustFree)
 			lenstr = strlen(cstr);
 		}
 		estr = es_newStrFromCStr(cstr, lenstr);
+	} else if(r->datatype == 'B') {
+		*bMustFree = 1;
+		estr = es_newStrFromBuf((char*) r->d.sv.str, r->d.sv.len);
 	} else {
 		*bMustFree = 0;
 		estr = r->d.estr;
@@ -1666,6 +1679,8 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 	lookup_key_t key;
 	uint8_t lookup_key_type;
 	lookup_t *lookup_table;
+	const uchar *lookup_val;
+	int lookup_epoch;
 
 	DBGPRINTF("rainerscript: executing function id %d\n", func->fID);
 	switch(func->fID) {
@@ -1834,7 +1849,7 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 			break;
 		}
 		cnfexprEval(func->expr[1], &r[1], usrptr);
-		lookup_table = ((lookup_ref_t*)func->funcdata)->self;
+		lookup_table = lookupEnterReader((lookup_ref_t*)func->funcdata, &lookup_epoch);
 		if (lookup_table != NULL) {
 			lookup_key_type = lookup_table->key_type;
 			bMustFree = 0;
@@ -1843,11 +1858,13 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 			} else if (lookup_key_type == LOOKUP_KEY_TYPE_UINT) {
 				key.k_uint = var2Number(&r[1], NULL);
 			}
-			ret->d.estr = lookupKey((lookup_ref_t*)func->funcdata, key);
+			lookup_val = lookup_table->lookup(lookup_table, key);
+			ret->d.estr = es_newStrFromCStr((char*) lookup_val, ustrlen(lookup_val));
 			if(bMustFree) free(key.k_str);
 		} else {
 			ret->d.estr = es_newStrFromCStr("", 1);
 		}
+		lookupLeaveReader((lookup_ref_t*)func->funcdata, lookup_epoch);
 		varFreeMembers(&r[1]);
 		break;
 	case CNFFUNC_DYN_INC:
@@ -1862,6 +1879,19 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 		if(bMustFree) free(str);
 		varFreeMembers(&r[1]);
 		break;
+	case CNFFUNC_RATELIMIT:
+		/* 1 - within limit, 0 - over limit for this key */
+		ret->datatype = 'N';
+		if(func->funcdata == NULL) {
+			ret->d.n = 1;
+			break;
+		}
+		cnfexprEval(func->expr[1], &r[1], usrptr);
+		str = (char*) var2CString(&r[1], &bMustFree);
+		ret->d.n = keyratelimitCheck(func->funcdata, (uchar*)str, strlen(str));
+		if(bMustFree) free(str);
+		varFreeMembers(&r[1]);
+		break;
 	default:
 		if(Debug) {
 			char *fname = es_str2cstr(func->fname, NULL);
@@ -1914,6 +1944,194 @@ evalVar(struct cnfvar *__restrict__ const var, void *__restrict__ const usrptr,
 
 }
 
+/* Multi-pattern matcher for "contains" and "startswith" against constant
+ * arrays and for the "contains" property filter. The patterns are compiled
+ * at config load into an Aho-Corasick automaton, which is turned into a
+ * DFA so that matching needs exactly one table lookup per input character,
+ * no matter how many patterns there are. To keep the table small, input
+ * characters are mapped to classes first; all characters not used in any
+ * pattern share class 0.
+ */
+#define CNFACM_MAXTABLE (64 * 1024 * 1024) /* max size of transition table */
+#define CNFACM_TERM 0x01 /* a pattern ends in this state */
+#define CNFACM_OUT  0x02 /* a pattern ends in this state or a suffix of it */
+
+struct cnfacm {
+	int nCls;		/* number of character classes */
+	int nStates;
+	uchar cls[256];		/* character -> class */
+	int *delta;		/* transition table, nStates * nCls */
+	int *depth;		/* length of the trie path to the state */
+	uchar *flags;		/* CNFACM_* */
+};
+
+void
+cnfacmDestruct(struct cnfacm *const acm)
+{
+	if(acm == NULL)
+		return;
+	free(acm->delta);
+	free(acm->depth);
+	free(acm->flags);
+	free(acm);
+}
+
+/* build the automaton for nPats patterns. Returns NULL if this is not
+ * possible, in which case the caller must match the patterns one by one.
+ */
+struct cnfacm *
+cnfacmConstruct(const uchar *const *const pats, const int *const lens, const int nPats,
+	const int bCaseInsens)
+{
+	struct cnfacm *acm;
+	uchar clsOfKey[256];
+	int *fail = NULL;
+	int *queue = NULL;
+	int maxStates;
+	int head, tail;
+	int i, j, c, s, t;
+	int key;
+
+	if((acm = calloc(1, sizeof(struct cnfacm))) == NULL)
+		goto fail;
+
+	maxStates = 1;
+	memset(clsOfKey, 0, sizeof(clsOfKey));
+	acm->nCls = 1;
+	for(i = 0 ; i < nPats ; ++i) {
+		maxStates += lens[i];
+		for(j = 0 ; j < lens[i] ; ++j) {
+			key = bCaseInsens ? tolower(pats[i][j]) : pats[i][j];
+			if(clsOfKey[key] == 0)
+				clsOfKey[key] = acm->nCls++;
+		}
+	}
+	for(i = 0 ; i < 256 ; ++i)
+		acm->cls[i] = clsOfKey[bCaseInsens ? tolower(i) : i];
+	if((size_t) maxStates * acm->nCls > CNFACM_MAXTABLE / sizeof(int)) {
+		DBGPRINTF("cnfacm: %d states with %d classes is too large, not compiled\n",
+			  maxStates, acm->nCls);
+		goto fail;
+	}
+
+	if(   (acm->delta = malloc(sizeof(int) * maxStates * acm->nCls)) == NULL
+	   || (acm->depth = calloc(maxStates, sizeof(int))) == NULL
+	   || (acm->flags = calloc(maxStates, sizeof(uchar))) == NULL
+	   || (fail = malloc(sizeof(int) * maxStates)) == NULL
+	   || (queue = malloc(sizeof(int) * maxStates)) == NULL)
+		goto fail;
+	memset(acm->delta, 0xff, sizeof(int) * maxStates * acm->nCls); /* all -1 */
+
+	/* build the trie */
+	acm->nStates = 1;
+	for(i = 0 ; i < nPats ; ++i) {
+		s = 0;
+		for(j = 0 ; j < lens[i] ; ++j) {
+			c = acm->cls[pats[i][j]];
+			if(acm->delta[s * acm->nCls + c] < 0) {
+				acm->depth[acm->nStates] = acm->depth[s] + 1;
+				acm->delta[s * acm->nCls + c] = acm->nStates++;
+			}
+			s = acm->delta[s * acm->nCls + c];
+		}
+		acm->flags[s] |= CNFACM_TERM | CNFACM_OUT;
+	}
+
+	/* add the failure transitions in breadth-first order, so that the
+	 * state a failure leads to is always complete when it is needed.
+	 */
+	head = tail = 0;
+	for(c = 0 ; c < acm->nCls ; ++c) {
+		t = acm->delta[c];
+		if(t < 0) {
+			acm->delta[c] = 0;
+		} else {
+			fail[t] = 0;
+			queue[tail++] = t;
+		}
+	}
+	while(head < tail) {
+		s = queue[head++];
+		acm->flags[s] |= acm->flags[fail[s]] & CNFACM_OUT;
+		for(c = 0 ; c < acm->nCls ; ++c) {
+			t = acm->delta[s * acm->nCls + c];
+			if(t < 0) {
+				acm->delta[s * acm->nCls + c] = acm->delta[fail[s] * acm->nCls + c];
+			} else {
+				fail[t] = acm->delta[fail[s] * acm->nCls + c];
+				queue[tail++] = t;
+			}
+		}
+	}
+
+	free(fail);
+	free(queue);
+	DBGPRINTF("cnfacm: compiled %d patterns into %d states, %d character classes\n",
+		  nPats, acm->nStates, acm->nCls);
+	return acm;
+
+fail:
+	free(fail);
+	free(queue);
+	cnfacmDestruct(acm);
+	return NULL;
+}
+
+/* compile a constant array for use with cmpop */
+static void
+cnfacmCompileArray(struct cnfarray *const ar, const int cmpop)
+{
+	const uchar **pats;
+	int *lens;
+	int i;
+
+	if(ar->acm != NULL)
+		return;
+	pats = malloc(sizeof(uchar*) * ar->nmemb);
+	lens = malloc(sizeof(int) * ar->nmemb);
+	if(pats != NULL && lens != NULL) {
+		for(i = 0 ; i < ar->nmemb ; ++i) {
+			pats[i] = es_getBufAddr(ar->arr[i]);
+			lens[i] = es_strlen(ar->arr[i]);
+		}
+		ar->acm = cnfacmConstruct(pats, lens, ar->nmemb,
+				cmpop == CMP_STARTSWITHI || cmpop == CMP_CONTAINSI);
+	}
+	free(pats);
+	free(lens);
+}
+
+/* returns 1 if buf contains one of the patterns or, if bPrefix is set,
+ * starts with one of them.
+ */
+int
+cnfacmMatch(const struct cnfacm *const acm, const uchar *const buf, const int len,
+	const int bPrefix)
+{
+	int i;
+	int s = 0;
+
+	if(bPrefix) {
+		for(i = 0 ; i < len ; ++i) {
+			if(acm->flags[s] & CNFACM_TERM)
+				return 1;
+			s = acm->delta[s * acm->nCls + acm->cls[buf[i]]];
+			if(acm->depth[s] != i + 1)
+				return 0; /* left the trie, no pattern can match */
+		}
+		return (acm->flags[s] & CNFACM_TERM) ? 1 : 0;
+	}
+
+	if(acm->flags[0] & CNFACM_OUT)
+		return 1; /* empty pattern */
+	for(i = 0 ; i < len ; ++i) {
+		s = acm->delta[s * acm->nCls + acm->cls[buf[i]]];
+		if(acm->flags[s] & CNFACM_OUT)
+			return 1;
+	}
+	return 0;
+}
+
 /* perform a string comparision operation against a while array. Semantic is
  * that one one comparison is true, the whole construct is true.
  * TODO: we can obviously optimize this process. One idea is to
@@ -1935,6 +2153,9 @@ evalStrArrayCmp(es_str_t *const estr_l,
 	} else if(cmpop == CMP_NE) {
 		res = bsearch(&estr_l, ar->arr, ar->nmemb, sizeof(es_str_t*), qs_arrcmp);
 		r = res == NULL;
+	} else if(ar->acm != NULL) {
+		r = cnfacmMatch(ar->acm, es_getBufAddr(estr_l), es_strlen(estr_l),
+				cmpop == CMP_STARTSWITH || cmpop == CMP_STARTSWITHI);
 	} else {
 		for(i = 0 ; (r == 0) && (i < ar->nmemb) ; ++i) {
 			switch(cmpop) {
@@ -2494,6 +2715,7 @@ cnfarrayContentDestruct(struct cnfarray *ar)
 		es_deleteStr(ar->arr[i]);
 	}
 	free(ar->arr);
+	cnfacmDestruct(ar->acm);
 }
 
 static inline void
@@ -2511,6 +2733,9 @@ cnffuncDestruct(struct cnffunc *func)
 			if(func->funcdata != NULL)
 				regexp.regfree(func->funcdata);
 			break;
+		case CNFFUNC_RATELIMIT:
+			keyratelimitDestruct(func->funcdata);
+			break;
 		default:break;
 	}
 	if(func->destructable_funcdata) {
@@ -2619,6 +2844,947 @@ doIndent(int indent)
 		dbgprintf("  ");
 }
 
+
+/* ------------------------------ bytecode ------------------------------ */
+/* The expressions of "if" and "set" statements are compiled into a flat
+ * program for a small register machine after the optimizer has run. This
+ * saves the recursion and the per-node dispatch of cnfexprEval(), permits
+ * to specialize operations on operands whose type is already known at
+ * compile time and to use string constants in place (cnfexprEval() must
+ * duplicate them).
+ * Each instruction reads its operand registers, releases them and writes
+ * its result to the destination register. Registers are allocated in stack
+ * order, so an expression's result is in the register it was compiled to.
+ * The semantics are exactly those of cnfexprEval(); node types that have
+ * no special instruction are evaluated by calling cnfexprEval() for them.
+ * Message properties are not copied: they are loaded as borrowed strings
+ * ('B', pointer and length into the message) and the string operations
+ * work on them in place. Only a result that leaves the machine, e.g. the
+ * value assigned by "set", is turned into an owned string.
+ * Values returned by lookup() are borrowed from the lookup table in the
+ * same way. The machine stays a reader of each table it used until it is
+ * done, so that a reload cannot destruct the table in the meantime.
+ * Expressions needing more than CNFVM_MAXREGS registers are not compiled
+ * at all and are interpreted as before.
+ */
+#define CNFVM_MAXREGS 32
+#define CNFVM_MAXLOOKUPS 8	/* max lookup() instructions per expression */
+
+enum cnfvmop {
+	VMOP_LOADN,	/* dst = number constant */
+	VMOP_LOADS,	/* dst = string constant (not copied) */
+	VMOP_VAR,	/* dst = variable or message property */
+	VMOP_FUNC,	/* dst = result of function call */
+	VMOP_EVAL,	/* dst = cnfexprEval(expr) */
+	VMOP_CMP,	/* dst = a <sub> b, sub is CMP_EQ...CMP_GT */
+	VMOP_CMPNN,	/* same, both operands known to be numbers */
+	VMOP_CMPSS,	/* same, both operands known to be strings */
+	VMOP_CMPARR,	/* dst = a <sub> array, sub is CMP_EQ or CMP_NE */
+	VMOP_STRCMP,	/* dst = a <sub> b, sub is CMP_STARTSWITH...CMP_CONTAINSI */
+	VMOP_STRCMPARR,	/* dst = a <sub> array, same subs as VMOP_STRCMP */
+	VMOP_CONCAT,	/* dst = a & b */
+	VMOP_STRLEN,	/* dst = strlen(a) */
+	VMOP_REMATCH,	/* dst = re_match(a, <regex of func>) */
+	VMOP_LOOKUP,	/* dst = lookup(<table of func>, a), value not copied */
+	VMOP_ARITH,	/* dst = a <sub> b, sub is '+', '-', '*', '/' or '%' */
+	VMOP_NEG,	/* dst = -a */
+	VMOP_NOT,	/* dst = !a */
+	VMOP_BOOL,	/* dst = a ? 1 : 0 */
+	VMOP_JZ,	/* if dst (bool) is 0, jump to target */
+	VMOP_JNZ,	/* if dst (bool) is not 0, jump to target */
+	VMOP_RET	/* result is in dst */
+};
+
+struct cnfvminstr {
+	unsigned char op;
+	unsigned char dst;
+	unsigned char a;
+	unsigned char b;
+	unsigned sub;
+	union {
+		long long n;
+		es_str_t *estr;
+		struct cnfarray *ar;
+		struct cnfvar *var;
+		struct cnffunc *func;
+		struct cnfexpr *expr;
+		unsigned target;
+	} d;
+};
+
+struct cnfvmprog {
+	unsigned nInstr;
+	unsigned nRegs;
+	struct cnfvminstr *instr;
+};
+
+/* compile-time state */
+struct cnfvmcomp {
+	struct cnfvmprog *prog;
+	unsigned maxInstr;
+	unsigned nLookups;
+};
+
+static const char *const cnfvmOpNames[] = { "LOADN", "LOADS", "VAR", "FUNC",
+	"EVAL", "CMP", "CMPNN", "CMPSS", "CMPARR", "STRCMP", "STRCMPARR",
+	"CONCAT", "STRLEN", "REMATCH", "LOOKUP", "ARITH", "NEG", "NOT", "BOOL", "JZ", "JNZ", "RET" };
+
+/* return the datatype an expression is guaranteed to evaluate to, or
+ * '\0' if this is only known at runtime.
+ */
+static char
+cnfvmStaticType(const struct cnfexpr *const expr)
+{
+	switch(expr->nodetype) {
+	case 'N':
+	case CMP_EQ: case CMP_NE: case CMP_LE: case CMP_GE: case CMP_LT: case CMP_GT:
+	case CMP_STARTSWITH: case CMP_STARTSWITHI: case CMP_CONTAINS: case CMP_CONTAINSI:
+	case AND: case OR: case NOT:
+	case '+': case '-': case '*': case '/': case '%': case 'M':
+		return 'N';
+	case 'S':
+	case 'A':
+	case '&':
+		return 'S';
+	case 'V':
+		switch(((struct cnfvar*)expr)->prop.id) {
+		case PROP_CEE:
+		case PROP_LOCAL_VAR:
+		case PROP_GLOBAL_VAR:
+			return '\0';
+		default:
+			return 'S';
+		}
+	default:
+		return '\0';
+	}
+}
+
+/* add an instruction, returns its index or -1 on error */
+static int
+cnfvmEmit(struct cnfvmcomp *const comp, const enum cnfvmop op, const unsigned dst,
+	const unsigned a, const unsigned b, const unsigned sub)
+{
+	struct cnfvmprog *const prog = comp->prog;
+	struct cnfvminstr *newInstr;
+	struct cnfvminstr *instr;
+
+	if(dst >= CNFVM_MAXREGS || a >= CNFVM_MAXREGS || b >= CNFVM_MAXREGS)
+		return -1;
+	if(prog->nInstr == comp->maxInstr) {
+		comp->maxInstr = (comp->maxInstr == 0) ? 16 : comp->maxInstr * 2;
+		newInstr = realloc(prog->instr, comp->maxInstr * sizeof(struct cnfvminstr));
+		if(newInstr == NULL)
+			return -1;
+		prog->instr = newInstr;
+	}
+	instr = prog->instr + prog->nInstr;
+	instr->op = op;
+	instr->dst = dst;
+	instr->a = a;
+	instr->b = b;
+	instr->sub = sub;
+	instr->d.n = 0;
+	if(dst >= prog->nRegs)
+		prog->nRegs = dst + 1;
+	return prog->nInstr++;
+}
+
+/* compile expr so that its result ends up in register dst. Registers above
+ * dst may be used as temporaries. Returns 0 on success, -1 otherwise.
+ */
+static int
+cnfvmCompileExpr(struct cnfvmcomp *const comp, struct cnfexpr *const expr, const unsigned dst)
+{
+	int i;
+	int iJmp;
+	enum cnfvmop op;
+	struct cnffunc *func;
+
+	switch(expr->nodetype) {
+	case 'N':
+		if((i = cnfvmEmit(comp, VMOP_LOADN, dst, 0, 0, 0)) < 0) return -1;
+		comp->prog->instr[i].d.n = ((struct cnfnumval*)expr)->val;
+		break;
+	case 'S':
+		if((i = cnfvmEmit(comp, VMOP_LOADS, dst, 0, 0, 0)) < 0) return -1;
+		comp->prog->instr[i].d.estr = ((struct cnfstringval*)expr)->estr;
+		break;
+	case 'A':
+		/* outside of comparisons, an array evaluates to its first element */
+		if((i = cnfvmEmit(comp, VMOP_LOADS, dst, 0, 0, 0)) < 0) return -1;
+		comp->prog->instr[i].d.estr = ((struct cnfarray*)expr)->arr[0];
+		break;
+	case 'V':
+		if((i = cnfvmEmit(comp, VMOP_VAR, dst, 0, 0, 0)) < 0) return -1;
+		comp->prog->instr[i].d.var = (struct cnfvar*)expr;
+		break;
+	case 'F':
+		func = (struct cnffunc*)expr;
+		/* functions that only inspect a string can work on a view */
+		if(func->fID == CNFFUNC_STRLEN
+		   || (func->fID == CNFFUNC_RE_MATCH && func->funcdata != NULL)) {
+			if(cnfvmCompileExpr(comp, func->expr[0], dst) != 0) return -1;
+			if((i = cnfvmEmit(comp, (func->fID == CNFFUNC_STRLEN) ? VMOP_STRLEN : VMOP_REMATCH,
+					  dst, dst, 0, 0)) < 0)
+				return -1;
+		} else if(func->fID == CNFFUNC_LOOKUP && func->funcdata != NULL
+			  && comp->nLookups < CNFVM_MAXLOOKUPS) {
+			/* the value is used directly from the table, see VMOP_LOOKUP */
+			if(cnfvmCompileExpr(comp, func->expr[1], dst) != 0) return -1;
+			if((i = cnfvmEmit(comp, VMOP_LOOKUP, dst, dst, 0, 0)) < 0) return -1;
+			++comp->nLookups;
+		} else {
+			if((i = cnfvmEmit(comp, VMOP_FUNC, dst, 0, 0, 0)) < 0) return -1;
+		}
+		comp->prog->instr[i].d.func = func;
+		break;
+	case CMP_EQ:
+	case CMP_NE:
+	case CMP_LE:
+	case CMP_GE:
+	case CMP_LT:
+	case CMP_GT:
+		if(cnfvmCompileExpr(comp, expr->l, dst) != 0) return -1;
+		if(expr->r->nodetype == 'A' && (expr->nodetype == CMP_EQ || expr->nodetype == CMP_NE)) {
+			if((i = cnfvmEmit(comp, VMOP_CMPARR, dst, dst, 0, expr->nodetype)) < 0) return -1;
+			comp->prog->instr[i].d.ar = (struct cnfarray*)expr->r;
+		} else {
+			if(cnfvmCompileExpr(comp, expr->r, dst + 1) != 0) return -1;
+			if(cnfvmStaticType(expr->l) == 'N' && cnfvmStaticType(expr->r) == 'N')
+				op = VMOP_CMPNN;
+			else if(cnfvmStaticType(expr->l) == 'S' && cnfvmStaticType(expr->r) == 'S')
+				op = VMOP_CMPSS;
+			else
+				op = VMOP_CMP;
+			if(cnfvmEmit(comp, op, dst, dst, dst + 1, expr->nodetype) < 0) return -1;
+		}
+		break;
+	case CMP_STARTSWITH:
+	case CMP_STARTSWITHI:
+	case CMP_CONTAINS:
+	case CMP_CONTAINSI:
+		if(cnfvmCompileExpr(comp, expr->l, dst) != 0) return -1;
+		if(expr->r->nodetype == 'A') {
+			if((i = cnfvmEmit(comp, VMOP_STRCMPARR, dst, dst, 0, expr->nodetype)) < 0) return -1;
+			comp->prog->instr[i].d.ar = (struct cnfarray*)expr->r;
+		} else {
+			if(cnfvmCompileExpr(comp, expr->r, dst + 1) != 0) return -1;
+			if(cnfvmEmit(comp, VMOP_STRCMP, dst, dst, dst + 1, expr->nodetype) < 0) return -1;
+		}
+		break;
+	case '&':
+		if(cnfvmCompileExpr(comp, expr->l, dst) != 0) return -1;
+		if(cnfvmCompileExpr(comp, expr->r, dst + 1) != 0) return -1;
+		if(cnfvmEmit(comp, VMOP_CONCAT, dst, dst, dst + 1, 0) < 0) return -1;
+		break;
+	case '+':
+	case '-':
+	case '*':
+	case '/':
+	case '%':
+		if(cnfvmCompileExpr(comp, expr->l, dst) != 0) return -1;
+		if(cnfvmCompileExpr(comp, expr->r, dst + 1) != 0) return -1;
+		if(cnfvmEmit(comp, VMOP_ARITH, dst, dst, dst + 1, expr->nodetype) < 0) return -1;
+		break;
+	case 'M':
+		if(cnfvmCompileExpr(comp, expr->r, dst) != 0) return -1;
+		if(cnfvmEmit(comp, VMOP_NEG, dst, dst, 0, 0) < 0) return -1;
+		break;
+	case NOT:
+		if(cnfvmCompileExpr(comp, expr->r, dst) != 0) return -1;
+		if(cnfvmEmit(comp, VMOP_NOT, dst, dst, 0, 0) < 0) return -1;
+		break;
+	case AND:
+	case OR:
+		/* boolean shortcut: the right side is only evaluated if the
+		 * left one does not already decide the result.
+		 */
+		if(cnfvmCompileExpr(comp, expr->l, dst) != 0) return -1;
+		if(cnfvmEmit(comp, VMOP_BOOL, dst, dst, 0, 0) < 0) return -1;
+		if((iJmp = cnfvmEmit(comp, (expr->nodetype == AND) ? VMOP_JZ : VMOP_JNZ,
+				     dst, 0, 0, 0)) < 0)
+			return -1;
+		if(cnfvmCompileExpr(comp, expr->r, dst) != 0) return -1;
+		if(cnfvmEmit(comp, VMOP_BOOL, dst, dst, 0, 0) < 0) return -1;
+		comp->prog->instr[iJmp].d.target = comp->prog->nInstr;
+		break;
+	default:
+		if((i = cnfvmEmit(comp, VMOP_EVAL, dst, 0, 0, 0)) < 0) return -1;
+		comp->prog->instr[i].d.expr = expr;
+		break;
+	}
+	return 0;
+}
+
+static void
+cnfvmprogDestruct(struct cnfvmprog *const prog)
+{
+	if(prog == NULL)
+		return;
+	free(prog->instr);
+	free(prog);
+}
+
+static void
+cnfvmprogPrint(const struct cnfvmprog *const prog, const int indent)
+{
+	unsigned i;
+	const struct cnfvminstr *instr;
+
+	doIndent(indent);
+	dbgprintf("bytecode, %u instructions, %u registers:\n", prog->nInstr, prog->nRegs);
+	for(i = 0 ; i < prog->nInstr ; ++i) {
+		instr = prog->instr + i;
+		doIndent(indent);
+		dbgprintf("%3u: %-9s r%u, r%u, r%u", i, cnfvmOpNames[instr->op],
+			  instr->dst, instr->a, instr->b);
+		if(instr->sub != 0)
+			dbgprintf(" [%s]", tokenToString(instr->sub));
+		if(instr->op == VMOP_JZ || instr->op == VMOP_JNZ)
+			dbgprintf(" -> %u", instr->d.target);
+		else if(instr->op == VMOP_LOADN)
+			dbgprintf(" #%lld", instr->d.n);
+		dbgprintf("\n");
+	}
+}
+
+/* compile an expression, returns NULL if that is not possible. In that
+ * case, the caller must use cnfexprEval(), which is always safe.
+ */
+static struct cnfvmprog *
+cnfvmCompile(struct cnfexpr *const expr)
+{
+	struct cnfvmcomp comp;
+
+	if((comp.prog = calloc(1, sizeof(struct cnfvmprog))) == NULL)
+		goto fail;
+	comp.maxInstr = 0;
+	comp.nLookups = 0;
+	if(cnfvmCompileExpr(&comp, expr, 0) != 0)
+		goto fail;
+	if(cnfvmEmit(&comp, VMOP_RET, 0, 0, 0, 0) < 0)
+		goto fail;
+	return comp.prog;
+
+fail:
+	DBGPRINTF("rainerscript: expression %p not compiled, using interpreter\n", expr);
+	cnfvmprogDestruct(comp.prog);
+	return NULL;
+}
+
+
+/* helpers for borrowed strings. A 'B' value is a pointer and length into
+ * a buffer owned by someone else (usually the message). These functions
+ * mirror the libestr functions used by cnfexprEval() for es_str_t.
+ */
+#define VAR_IS_STR(v) ((v)->datatype == 'S' || (v)->datatype == 'B')
+
+/* obtain buffer and length of a string value; if the value is no string,
+ * it is converted and *tmp receives the converted string, which the caller
+ * must free.
+ */
+static const uchar *
+cnfvmVar2Buf(struct var *const v, int *const len, es_str_t **const tmp)
+{
+	int bMustFree;
+
+	*tmp = NULL;
+	if(v->datatype == 'B') {
+		*len = v->d.sv.len;
+		return v->d.sv.str;
+	}
+	if(v->datatype != 'S') {
+		*tmp = var2String(v, &bMustFree);
+		*len = es_strlen(*tmp);
+		return es_getBufAddr(*tmp);
+	}
+	*len = es_strlen(v->d.estr);
+	return es_getBufAddr(v->d.estr);
+}
+
+/* same ordering as es_strbufcmp() */
+static int
+cnfvmBufCmp(const uchar *const b1, const int len1, const uchar *const b2, const int len2)
+{
+	int i;
+
+	for(i = 0 ; i < len1 ; ++i) {
+		if(i == len2)
+			return 1;
+		if(b1[i] != b2[i])
+			return b1[i] - b2[i];
+	}
+	return (i < len2) ? -1 : 0;
+}
+
+/* compare two string values ('S' or 'B') */
+static int
+cnfvmVarStrCmp(const struct var *const l, const struct var *const r)
+{
+	if(l->datatype == 'S') {
+		if(r->datatype == 'S')
+			return es_strcmp(l->d.estr, r->d.estr);
+		return es_strbufcmp(l->d.estr, r->d.sv.str, r->d.sv.len);
+	}
+	if(r->datatype == 'S')
+		return -es_strbufcmp(r->d.estr, l->d.sv.str, l->d.sv.len);
+	return cnfvmBufCmp(l->d.sv.str, l->d.sv.len, r->d.sv.str, r->d.sv.len);
+}
+
+static int
+cnfvmBufStartsWith(const uchar *const b, const int len, const uchar *const pfx, const int lenPfx,
+	const int bCaseInsens)
+{
+	int i;
+
+	if(lenPfx > len)
+		return 0;
+	if(!bCaseInsens)
+		return memcmp(b, pfx, lenPfx) == 0;
+	for(i = 0 ; i < lenPfx ; ++i)
+		if(tolower(b[i]) != tolower(pfx[i]))
+			return 0;
+	return 1;
+}
+
+static int
+cnfvmBufContains(const uchar *const b, const int len, const uchar *const needle, const int lenNeedle,
+	const int bCaseInsens)
+{
+	int i, j;
+
+	for(i = 0 ; i + lenNeedle <= len ; ++i) {
+		if(bCaseInsens) {
+			for(j = 0 ; j < lenNeedle && tolower(b[i+j]) == tolower(needle[j]) ; ++j)
+				/* just scan */;
+		} else {
+			for(j = 0 ; j < lenNeedle && b[i+j] == needle[j] ; ++j)
+				/* just scan */;
+		}
+		if(j == lenNeedle)
+			return 1;
+	}
+	return 0;
+}
+
+/* CMP_STARTSWITH ... CMP_CONTAINSI on plain buffers */
+static long long
+cnfvmBufStrCmp(const unsigned cmpop, const uchar *const b_l, const int len_l,
+	const uchar *const b_r, const int len_r)
+{
+	switch(cmpop) {
+	case CMP_STARTSWITH:
+		return cnfvmBufStartsWith(b_l, len_l, b_r, len_r, 0);
+	case CMP_STARTSWITHI:
+		return cnfvmBufStartsWith(b_l, len_l, b_r, len_r, 1);
+	case CMP_CONTAINS:
+		return cnfvmBufContains(b_l, len_l, b_r, len_r, 0);
+	default:
+		return cnfvmBufContains(b_l, len_l, b_r, len_r, 1);
+	}
+}
+
+/* bsearch() comparison of a borrowed string against array elements */
+static int
+cnfvmArrKeyCmp(const void *const key, const void *const elem)
+{
+	const struct var *const v = (const struct var*) key;
+	return -es_strbufcmp(*((es_str_t**)elem), v->d.sv.str, v->d.sv.len);
+}
+
+/* evalStrArrayCmp() for a borrowed string */
+static long long
+cnfvmArrCmpView(const struct var *const v, const struct cnfarray *const ar, const unsigned cmpop)
+{
+	int i;
+	long long r = 0;
+
+	if(cmpop == CMP_EQ || cmpop == CMP_NE) {
+		r = bsearch(v, ar->arr, ar->nmemb, sizeof(es_str_t*), cnfvmArrKeyCmp) != NULL;
+		return (cmpop == CMP_EQ) ? r : !r;
+	}
+	if(ar->acm != NULL)
+		return cnfacmMatch(ar->acm, v->d.sv.str, v->d.sv.len,
+				   cmpop == CMP_STARTSWITH || cmpop == CMP_STARTSWITHI);
+	for(i = 0 ; (r == 0) && (i < ar->nmemb) ; ++i) {
+		r = cnfvmBufStrCmp(cmpop, v->d.sv.str, v->d.sv.len,
+				   es_getBufAddr(ar->arr[i]), es_strlen(ar->arr[i]));
+	}
+	return r;
+}
+
+/* compare two values as cnfexprEval() does for CMP_EQ ... CMP_GT. This
+ * includes its quirks (e.g. CMP_NE returns the es_strcmp() result), so that
+ * results do not depend on whether or not an expression was compiled.
+ */
+static long long
+cnfvmCmp(const unsigned cmpop, struct var *const l, struct var *const r)
+{
+	struct var tmp;
+	int bMustFree;
+	int convok;
+	long long n_l = 0, n_r = 0;
+	int c = 0;
+	int bStrCmp;
+	long long res;
+
+	tmp.datatype = 'S';
+	if(VAR_IS_STR(l)) {
+		if(VAR_IS_STR(r)) {
+			c = cnfvmVarStrCmp(l, r);
+			bStrCmp = 1;
+		} else {
+			n_l = var2Number(l, &convok);
+			if(convok) {
+				n_r = var2Number(r, NULL);
+				bStrCmp = 0;
+			} else {
+				tmp.d.estr = var2String(r, &bMustFree);
+				c = cnfvmVarStrCmp(l, &tmp);
+				if(bMustFree) es_deleteStr(tmp.d.estr);
+				bStrCmp = 1;
+			}
+		}
+	} else if(l->datatype == 'J') {
+		if(VAR_IS_STR(r)) {
+			tmp.d.estr = var2String(l, &bMustFree);
+			c = cnfvmVarStrCmp(&tmp, r);
+			if(bMustFree) es_deleteStr(tmp.d.estr);
+			bStrCmp = 1;
+		} else {
+			n_l = var2Number(l, NULL);
+			n_r = var2Number(r, NULL);
+			bStrCmp = 0;
+		}
+	} else {
+		n_l = l->d.n;
+		if(VAR_IS_STR(r)) {
+			n_r = var2Number(r, &convok);
+			if(convok) {
+				bStrCmp = 0;
+			} else {
+				/* note: operands swapped, as done by cnfexprEval() */
+				tmp.d.estr = var2String(l, &bMustFree);
+				c = cnfvmVarStrCmp(r, &tmp);
+				if(bMustFree) es_deleteStr(tmp.d.estr);
+				bStrCmp = 1;
+			}
+		} else {
+			n_r = var2Number(r, NULL);
+			bStrCmp = 0;
+		}
+	}
+
+	if(bStrCmp) {
+		switch(cmpop) {
+		case CMP_EQ: res = (c == 0); break;
+		case CMP_NE: res = c; break;
+		case CMP_LE: res = (c <= 0); break;
+		case CMP_GE: res = (c >= 0); break;
+		case CMP_LT: res = (c < 0); break;
+		default:     res = (c > 0); break;
+		}
+	} else {
+		switch(cmpop) {
+		case CMP_EQ: res = (n_l == n_r); break;
+		case CMP_NE: res = (n_l != n_r); break;
+		case CMP_LE: res = (n_l <= n_r); break;
+		case CMP_GE: res = (n_l >= n_r); break;
+		case CMP_LT: res = (n_l < n_r); break;
+		default:     res = (n_l > n_r); break;
+		}
+	}
+	return res;
+}
+
+static long long
+cnfvmStrCmp(const unsigned cmpop, es_str_t *const estr_l, es_str_t *const estr_r)
+{
+	switch(cmpop) {
+	case CMP_STARTSWITH:
+		return es_strncmp(estr_l, estr_r, estr_r->lenStr) == 0;
+	case CMP_STARTSWITHI:
+		return es_strncasecmp(estr_l, estr_r, estr_r->lenStr) == 0;
+	case CMP_CONTAINS:
+		return es_strContains(estr_l, estr_r) != -1;
+	default:
+		return es_strCaseContains(estr_l, estr_r) != -1;
+	}
+}
+
+/* register helpers for cnfvmExec(). A register holding a constant string
+ * is not owned and must not be freed (nor must a borrowed string).
+ */
+#define VMREG_FREE(i) \
+	if(owned[i]) varFreeMembers(&regs[i])
+#define VMREG_SETN(i, val) \
+	regs[i].datatype = 'N'; regs[i].d.n = (val); owned[i] = 1
+
+#if defined(__GNUC__)
+#	define CNFVM_THREADED_DISPATCH
+#endif
+#ifdef CNFVM_THREADED_DISPATCH
+#	define VMCASE(op) vm_##op:
+#	define VMDISPATCH() goto *dispatch[pc->op]
+#else
+#	define VMCASE(op) case op:
+#	define VMDISPATCH() continue
+#endif
+#define VMNEXT() ++pc; VMDISPATCH()
+
+/* execute a compiled expression. The result is returned in ret. It may
+ * be a borrowed or constant string; *bOwned tells if the caller must free
+ * it.
+ */
+static void
+cnfvmExec(const struct cnfvmprog *__restrict__ const prog, struct var *__restrict__ const ret,
+	sbool *__restrict__ const bOwned, void *__restrict__ const usrptr)
+{
+	struct var regs[CNFVM_MAXREGS];
+	sbool owned[CNFVM_MAXREGS];
+	const struct cnfvminstr *pc = prog->instr;
+	struct var tmp;
+	es_str_t *estr_l, *estr_r;
+	const uchar *buf_l, *buf_r;
+	int len_l, len_r;
+	int bMustFree, bMustFree2;
+	unsigned short bMustBeFreed;
+	rs_size_t propLen;
+	uchar *pszProp;
+	char *str;
+	long long n_l, n_r;
+	int useArr;
+	lookup_t *lookupTab;
+	lookup_key_t lookupKey;
+	const uchar *lookupVal;
+	uchar lookupKeyBuf[256];
+	lookup_ref_t *heldRefs[CNFVM_MAXLOOKUPS];
+	int heldEpochs[CNFVM_MAXLOOKUPS];
+	int nHeld = 0;
+	int i;
+#ifdef CNFVM_THREADED_DISPATCH
+	static const void *const dispatch[] = {
+		[VMOP_LOADN] = &&vm_VMOP_LOADN,
+		[VMOP_LOADS] = &&vm_VMOP_LOADS,
+		[VMOP_VAR] = &&vm_VMOP_VAR,
+		[VMOP_FUNC] = &&vm_VMOP_FUNC,
+		[VMOP_EVAL] = &&vm_VMOP_EVAL,
+		[VMOP_CMP] = &&vm_VMOP_CMP,
+		[VMOP_CMPNN] = &&vm_VMOP_CMPNN,
+		[VMOP_CMPSS] = &&vm_VMOP_CMPSS,
+		[VMOP_CMPARR] = &&vm_VMOP_CMPARR,
+		[VMOP_STRCMP] = &&vm_VMOP_STRCMP,
+		[VMOP_STRCMPARR] = &&vm_VMOP_STRCMPARR,
+		[VMOP_CONCAT] = &&vm_VMOP_CONCAT,
+		[VMOP_STRLEN] = &&vm_VMOP_STRLEN,
+		[VMOP_REMATCH] = &&vm_VMOP_REMATCH,
+		[VMOP_LOOKUP] = &&vm_VMOP_LOOKUP,
+		[VMOP_ARITH] = &&vm_VMOP_ARITH,
+		[VMOP_NEG] = &&vm_VMOP_NEG,
+		[VMOP_NOT] = &&vm_VMOP_NOT,
+		[VMOP_BOOL] = &&vm_VMOP_BOOL,
+		[VMOP_JZ] = &&vm_VMOP_JZ,
+		[VMOP_JNZ] = &&vm_VMOP_JNZ,
+		[VMOP_RET] = &&vm_VMOP_RET
+	};
+
+	VMDISPATCH();
+#else
+	for(;;) switch(pc->op) {
+#endif
+	VMCASE(VMOP_LOADN)
+		VMREG_SETN(pc->dst, pc->d.n);
+		VMNEXT();
+	VMCASE(VMOP_LOADS)
+		regs[pc->dst].datatype = 'S';
+		regs[pc->dst].d.estr = pc->d.estr;
+		owned[pc->dst] = 0;
+		VMNEXT();
+	VMCASE(VMOP_VAR)
+		owned[pc->dst] = 1;
+		if(pc->d.var->prop.id == PROP_CEE
+		   || pc->d.var->prop.id == PROP_LOCAL_VAR
+		   || pc->d.var->prop.id == PROP_GLOBAL_VAR) {
+			evalVar(pc->d.var, usrptr, &regs[pc->dst]);
+			VMNEXT();
+		}
+		bMustBeFreed = 0;
+		pszProp = (uchar*) MsgGetProp((msg_t*)usrptr, NULL, &pc->d.var->prop, &propLen,
+					      &bMustBeFreed, NULL);
+		if(bMustBeFreed) {
+			regs[pc->dst].datatype = 'S';
+			regs[pc->dst].d.estr = es_newStrFromCStr((char*)pszProp, propLen);
+			free(pszProp);
+		} else {
+			/* lives as long as the message, which outlives us */
+			regs[pc->dst].datatype = 'B';
+			regs[pc->dst].d.sv.str = pszProp;
+			regs[pc->dst].d.sv.len = propLen;
+		}
+		VMNEXT();
+	VMCASE(VMOP_FUNC)
+		doFuncCall(pc->d.func, &regs[pc->dst], usrptr);
+		owned[pc->dst] = 1;
+		VMNEXT();
+	VMCASE(VMOP_EVAL)
+		cnfexprEval(pc->d.expr, &regs[pc->dst], usrptr);
+		owned[pc->dst] = 1;
+		VMNEXT();
+	VMCASE(VMOP_CMP)
+		n_l = cnfvmCmp(pc->sub, &regs[pc->a], &regs[pc->b]);
+		VMREG_FREE(pc->a);
+		VMREG_FREE(pc->b);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_CMPNN)
+		n_l = regs[pc->a].d.n;
+		n_r = regs[pc->b].d.n;
+		switch(pc->sub) {
+		case CMP_EQ: n_l = (n_l == n_r); break;
+		case CMP_NE: n_l = (n_l != n_r); break;
+		case CMP_LE: n_l = (n_l <= n_r); break;
+		case CMP_GE: n_l = (n_l >= n_r); break;
+		case CMP_LT: n_l = (n_l < n_r); break;
+		default:     n_l = (n_l > n_r); break;
+		}
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_CMPSS)
+		n_l = cnfvmVarStrCmp(&regs[pc->a], &regs[pc->b]);
+		switch(pc->sub) {
+		case CMP_EQ: n_l = (n_l == 0); break;
+		case CMP_NE: break;
+		case CMP_LE: n_l = (n_l <= 0); break;
+		case CMP_GE: n_l = (n_l >= 0); break;
+		case CMP_LT: n_l = (n_l < 0); break;
+		default:     n_l = (n_l > 0); break;
+		}
+		VMREG_FREE(pc->a);
+		VMREG_FREE(pc->b);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_CMPARR)
+		/* cnfexprEval() uses the whole array only for these cases, else
+		 * just its first element.
+		 */
+		useArr = VAR_IS_STR(&regs[pc->a])
+			 || (pc->sub == CMP_EQ && regs[pc->a].datatype == 'J');
+		if(useArr && regs[pc->a].datatype == 'B') {
+			n_l = cnfvmArrCmpView(&regs[pc->a], pc->d.ar, pc->sub);
+		} else if(useArr) {
+			estr_l = var2String(&regs[pc->a], &bMustFree);
+			n_l = evalStrArrayCmp(estr_l, pc->d.ar, pc->sub);
+			if(bMustFree) es_deleteStr(estr_l);
+		} else {
+			tmp.datatype = 'S';
+			tmp.d.estr = pc->d.ar->arr[0];
+			n_l = cnfvmCmp(pc->sub, &regs[pc->a], &tmp);
+		}
+		VMREG_FREE(pc->a);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_STRCMP)
+		if(regs[pc->a].datatype == 'B' || regs[pc->b].datatype == 'B') {
+			buf_l = cnfvmVar2Buf(&regs[pc->a], &len_l, &estr_l);
+			buf_r = cnfvmVar2Buf(&regs[pc->b], &len_r, &estr_r);
+			n_l = cnfvmBufStrCmp(pc->sub, buf_l, len_l, buf_r, len_r);
+			if(estr_l != NULL) es_deleteStr(estr_l);
+			if(estr_r != NULL) es_deleteStr(estr_r);
+		} else {
+			estr_l = var2String(&regs[pc->a], &bMustFree);
+			estr_r = var2String(&regs[pc->b], &bMustFree2);
+			n_l = cnfvmStrCmp(pc->sub, estr_l, estr_r);
+			if(bMustFree) es_deleteStr(estr_l);
+			if(bMustFree2) es_deleteStr(estr_r);
+		}
+		VMREG_FREE(pc->a);
+		VMREG_FREE(pc->b);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_STRCMPARR)
+		if(regs[pc->a].datatype == 'B') {
+			n_l = cnfvmArrCmpView(&regs[pc->a], pc->d.ar, pc->sub);
+		} else {
+			estr_l = var2String(&regs[pc->a], &bMustFree);
+			n_l = evalStrArrayCmp(estr_l, pc->d.ar, pc->sub);
+			if(bMustFree) es_deleteStr(estr_l);
+		}
+		VMREG_FREE(pc->a);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_CONCAT)
+		estr_l = var2String(&regs[pc->a], &bMustFree);
+		/* if estr_l is a temporary anyhow, we can append to it */
+		tmp.d.estr = bMustFree ? estr_l : es_strdup(estr_l);
+		if(regs[pc->b].datatype == 'B') {
+			es_addBuf(&tmp.d.estr, (const char*) regs[pc->b].d.sv.str, regs[pc->b].d.sv.len);
+		} else {
+			estr_r = var2String(&regs[pc->b], &bMustFree2);
+			es_addStr(&tmp.d.estr, estr_r);
+			if(bMustFree2) es_deleteStr(estr_r);
+		}
+		VMREG_FREE(pc->a);
+		VMREG_FREE(pc->b);
+		regs[pc->dst].datatype = 'S';
+		regs[pc->dst].d.estr = tmp.d.estr;
+		owned[pc->dst] = 1;
+		VMNEXT();
+	VMCASE(VMOP_STRLEN)
+		buf_l = cnfvmVar2Buf(&regs[pc->a], &len_l, &estr_l);
+		if(estr_l != NULL) es_deleteStr(estr_l);
+		VMREG_FREE(pc->a);
+		VMREG_SETN(pc->dst, len_l);
+		VMNEXT();
+	VMCASE(VMOP_REMATCH)
+		/* regexec() needs a C string; message properties already are */
+		if(regs[pc->a].datatype == 'B' && regs[pc->a].d.sv.str[regs[pc->a].d.sv.len] == '\0') {
+			str = (char*) regs[pc->a].d.sv.str;
+			bMustFree = 0;
+		} else {
+			str = (char*) var2CString(&regs[pc->a], &bMustFree);
+		}
+		n_l = regexp.regexec(pc->d.func->funcdata, str, 0, NULL, 0);
+		if(n_l != 0 && n_l != REG_NOMATCH) {
+			DBGPRINTF("re_match: regexec returned error %lld\n", n_l);
+		}
+		if(bMustFree) free(str);
+		VMREG_FREE(pc->a);
+		VMREG_SETN(pc->dst, n_l == 0);
+		VMNEXT();
+	VMCASE(VMOP_LOOKUP)
+		/* each instruction runs at most once (jumps only go forward), so
+		 * there is a slot for this table in heldRefs */
+		heldRefs[nHeld] = (lookup_ref_t*) pc->d.func->funcdata;
+		lookupTab = lookupEnterReader(heldRefs[nHeld], &heldEpochs[nHeld]);
+		++nHeld;
+		if(lookupTab == NULL) {
+			lookupVal = (const uchar*) "";
+		} else {
+			bMustFree = 0;
+			if(lookupTab->key_type == LOOKUP_KEY_TYPE_STRING) {
+				buf_l = cnfvmVar2Buf(&regs[pc->a], &len_l, &estr_l);
+				if(regs[pc->a].datatype == 'B' && buf_l[len_l] == '\0') {
+					lookupKey.k_str = (uchar*) buf_l;
+				} else if(len_l < (int) sizeof(lookupKeyBuf)) {
+					memcpy(lookupKeyBuf, buf_l, len_l);
+					lookupKeyBuf[len_l] = '\0';
+					lookupKey.k_str = lookupKeyBuf;
+				} else {
+					lookupKey.k_str = var2CString(&regs[pc->a], &bMustFree);
+				}
+				if(estr_l != NULL) es_deleteStr(estr_l);
+			} else if(lookupTab->key_type == LOOKUP_KEY_TYPE_UINT) {
+				lookupKey.k_uint = var2Number(&regs[pc->a], NULL);
+			}
+			lookupVal = lookupTab->lookup(lookupTab, lookupKey);
+			if(bMustFree) free(lookupKey.k_str);
+		}
+		VMREG_FREE(pc->a);
+		regs[pc->dst].datatype = 'B';
+		regs[pc->dst].d.sv.str = lookupVal;
+		regs[pc->dst].d.sv.len = ustrlen(lookupVal);
+		owned[pc->dst] = 0;
+		VMNEXT();
+	VMCASE(VMOP_ARITH)
+		n_l = var2Number(&regs[pc->a], NULL);
+		n_r = var2Number(&regs[pc->b], NULL);
+		switch(pc->sub) {
+		case '+': n_l = n_l + n_r; break;
+		case '-': n_l = n_l - n_r; break;
+		case '*': n_l = n_l * n_r; break;
+		case '/': n_l = (n_r == 0) ? 0 : n_l / n_r; break;
+		default:  n_l = (n_r == 0) ? 0 : n_l % n_r; break;
+		}
+		VMREG_FREE(pc->a);
+		VMREG_FREE(pc->b);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_NEG)
+		n_l = -var2Number(&regs[pc->a], NULL);
+		VMREG_FREE(pc->a);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_NOT)
+		n_l = !var2Number(&regs[pc->a], NULL);
+		VMREG_FREE(pc->a);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_BOOL)
+		n_l = var2Number(&regs[pc->a], NULL) ? 1 : 0;
+		VMREG_FREE(pc->a);
+		VMREG_SETN(pc->dst, n_l);
+		VMNEXT();
+	VMCASE(VMOP_JZ)
+		if(regs[pc->dst].d.n == 0) {
+			pc = prog->instr + pc->d.target;
+			VMDISPATCH();
+		}
+		VMNEXT();
+	VMCASE(VMOP_JNZ)
+		if(regs[pc->dst].d.n != 0) {
+			pc = prog->instr + pc->d.target;
+			VMDISPATCH();
+		}
+		VMNEXT();
+	VMCASE(VMOP_RET)
+		goto done;
+#ifndef CNFVM_THREADED_DISPATCH
+	}
+#endif
+
+done:
+	*ret = regs[pc->dst];
+	*bOwned = owned[pc->dst] && ret->datatype != 'B';
+	if(nHeld > 0) {
+		/* the result may be a value from a table we are about to leave */
+		if(ret->datatype == 'B') {
+			ret->datatype = 'S';
+			ret->d.estr = es_newStrFromBuf((char*) ret->d.sv.str, ret->d.sv.len);
+			*bOwned = 1;
+		}
+		for(i = 0 ; i < nHeld ; ++i)
+			lookupLeaveReader(heldRefs[i], heldEpochs[i]);
+	}
+}
+#undef VMCASE
+#undef VMDISPATCH
+#undef VMNEXT
+#undef VMREG_FREE
+#undef VMREG_SETN
+
+/* execute a compiled expression. The result is returned in ret, which
+ * the caller must free (just like with cnfexprEval()).
+ */
+void
+cnfvmEval(const struct cnfvmprog *__restrict__ const prog, struct var *__restrict__ const ret,
+	void *__restrict__ const usrptr)
+{
+	sbool bOwned;
+
+	cnfvmExec(prog, ret, &bOwned, usrptr);
+	if(ret->datatype == 'B') {
+		/* the value leaves the machine, so it needs its own copy now */
+		ret->datatype = 'S';
+		ret->d.estr = es_newStrFromBuf((char*) ret->d.sv.str, ret->d.sv.len);
+	} else if(!bOwned) {
+		ret->d.estr = es_strdup(ret->d.estr);
+	}
+}
+
+int
+cnfvmEvalBool(const struct cnfvmprog *__restrict__ const prog, void *__restrict__ const usrptr)
+{
+	struct var ret;
+	sbool bOwned;
+	int retVal;
+	cnfvmExec(prog, &ret, &bOwned, usrptr);
+	retVal = var2Number(&ret, NULL);
+	if(bOwned)
+		varFreeMembers(&ret);
+	return retVal;
+}
+
 static void
 pmaskPrint(uchar *pmask, int indent)
 {
@@ -2806,6 +3972,8 @@ cnfstmtPrintOnly(struct cnfstmt *stmt, int indent, sbool subtree)
 	case S_IF:
 		doIndent(indent); dbgprintf("IF\n");
 		cnfexprPrint(stmt->d.s_if.expr, indent+1);
+		if(stmt->d.s_if.prog != NULL)
+			cnfvmprogPrint(stmt->d.s_if.prog, indent+1);
 		if(subtree) {
 			doIndent(indent); dbgprintf("THEN\n");
 			cnfstmtPrint(stmt->d.s_if.t_then, indent+1);
@@ -2830,6 +3998,8 @@ cnfstmtPrintOnly(struct cnfstmt *stmt, int indent, sbool subtree)
 		doIndent(indent); dbgprintf("SET %s =\n",
 				  stmt->d.s_set.varname);
 		cnfexprPrint(stmt->d.s_set.expr, indent+1);
+		if(stmt->d.s_set.prog != NULL)
+			cnfvmprogPrint(stmt->d.s_set.prog, indent+1);
 		doIndent(indent); dbgprintf("END SET\n");
 		break;
 	case S_UNSET:
@@ -2923,6 +4093,7 @@ cnfarrayNew(es_str_t *val)
 	if((ar = malloc(sizeof(struct cnfarray))) != NULL) {
 		ar->nodetype = 'A';
 		ar->nmemb = 1;
+		ar->acm = NULL;
 		if((ar->arr = malloc(sizeof(es_str_t*))) == NULL) {
 			free(ar);
 			ar = NULL;
@@ -2977,7 +4148,7 @@ struct cnfstmt *
 cnfstmtNew(unsigned s_type)
 {
 	struct cnfstmt* cnfstmt;
-	if((cnfstmt = malloc(sizeof(struct cnfstmt))) != NULL) {
+	if((cnfstmt = calloc(1, sizeof(struct cnfstmt))) != NULL) {
 		cnfstmt->nodetype = s_type;
 		cnfstmt->printable = NULL;
 		cnfstmt->next = NULL;
@@ -3004,6 +4175,7 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 		actionDestruct(stmt->d.act);
 		break;
 	case S_IF:
+		cnfvmprogDestruct(stmt->d.s_if.prog);
 		cnfexprDestruct(stmt->d.s_if.expr);
 		if(stmt->d.s_if.t_then != NULL) {
 			cnfstmtDestructLst(stmt->d.s_if.t_then);
@@ -3018,6 +4190,7 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 		break;
 	case S_SET:
 		free(stmt->d.s_set.varname);
+		cnfvmprogDestruct(stmt->d.s_set.prog);
 		cnfexprDestruct(stmt->d.s_set.expr);
 		break;
 	case S_UNSET:
@@ -3033,6 +4206,7 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 			rsCStrRegexDestruct(&stmt->d.s_propfilt.regex_cache);
 		if(stmt->d.s_propfilt.pCSCompValue != NULL)
 			cstrDestruct(&stmt->d.s_propfilt.pCSCompValue);
+		cnfacmDestruct(stmt->d.s_propfilt.acm);
 		cnfstmtDestructLst(stmt->d.s_propfilt.t_then);
 		break;
     case S_RELOAD_LOOKUP_TABLE:
@@ -3200,14 +4374,21 @@ struct cnfstmt *
 cnfstmtNewPROPFILT(char *propfilt, struct cnfstmt *t_then)
 {
 	struct cnfstmt* cnfstmt;
+	const uchar *pat;
+	int lenPat;
 	if((cnfstmt = cnfstmtNew(S_PROPFILT)) != NULL) {
 		cnfstmt->printable = (uchar*)propfilt;
 		cnfstmt->d.s_propfilt.t_then = t_then;
 		cnfstmt->d.s_propfilt.regex_cache = NULL;
 		cnfstmt->d.s_propfilt.pCSCompValue = NULL;
+		cnfstmt->d.s_propfilt.acm = NULL;
 		if(DecodePropFilter((uchar*)propfilt, cnfstmt) != RS_RET_OK) {
 			cnfstmt->nodetype = S_NOP; /* disable action! */
 			cnfstmtDestructLst(t_then); /* we do no longer need this */
+		} else if(cnfstmt->d.s_propfilt.operation == FIOP_CONTAINS) {
+			pat = rsCStrGetSzStrNoNULL(cnfstmt->d.s_propfilt.pCSCompValue);
+			lenPat = cstrLen(cnfstmt->d.s_propfilt.pCSCompValue);
+			cnfstmt->d.s_propfilt.acm = cnfacmConstruct(&pat, &lenPat, 1, 0);
 		}
 	}
 	return cnfstmt;
@@ -3592,6 +4773,9 @@ cnfexprOptimize(struct cnfexpr *expr)
 	case CMP_STARTSWITHI:
 		expr->l = cnfexprOptimize(expr->l);
 		expr->r = cnfexprOptimize(expr->r);
+		if(expr->r->nodetype == 'A') {
+			cnfacmCompileArray((struct cnfarray *)expr->r, expr->nodetype);
+		}
 		break;
 	case AND:
 	case OR:
@@ -3830,6 +5014,42 @@ cnfstmtOptimize(struct cnfstmt *root)
 done:	return;
 }
 
+/* (recursively) compile the expressions of a statement list into bytecode.
+ * This must be done after the optimizer has run, as the program refers to
+ * the (final) expression tree nodes.
+ */
+void
+cnfstmtCompile(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt;
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		switch(stmt->nodetype) {
+		case S_IF:
+			if(stmt->d.s_if.prog == NULL)
+				stmt->d.s_if.prog = cnfvmCompile(stmt->d.s_if.expr);
+			cnfstmtCompile(stmt->d.s_if.t_then);
+			cnfstmtCompile(stmt->d.s_if.t_else);
+			break;
+		case S_SET:
+			if(stmt->d.s_set.prog == NULL)
+				stmt->d.s_set.prog = cnfvmCompile(stmt->d.s_set.expr);
+			break;
+		case S_FOREACH:
+			cnfstmtCompile(stmt->d.s_foreach.body);
+			break;
+		case S_PRIFILT:
+			cnfstmtCompile(stmt->d.s_prifilt.t_then);
+			cnfstmtCompile(stmt->d.s_prifilt.t_else);
+			break;
+		case S_PROPFILT:
+			cnfstmtCompile(stmt->d.s_propfilt.t_then);
+			break;
+		default: /* nothing to compile */
+			break;
+		}
+	}
+}
+
 
 struct cnffparamlst *
 cnffparamlstNew(struct cnfexpr *expr, struct cnffparamlst *next)
@@ -3900,6 +5120,12 @@ funcName2ID(es_str_t *fname, unsigned short nParams)
 		GENERATE_FUNC("lookup", 2, CNFFUNC_LOOKUP);
 	} else if(FUNC_NAME("dyn_inc")) {
 		GENERATE_FUNC("dyn_inc", 2, CNFFUNC_DYN_INC);
+	} else if(FUNC_NAME("ratelimit")) {
+		GENERATE_FUNC_WITH_ERR_MSG(
+			"ratelimit", 4, CNFFUNC_RATELIMIT,
+			"number of parameters for %s() must be %s "
+			"(limiter_name, key, interval, burst) "
+			"but is %d.");
 	} else if(FUNC_NAME("replace")) {
 		GENERATE_FUNC_WITH_ERR_MSG(
 			"replace", 3, CNFFUNC_REPLACE,
@@ -4058,6 +5284,57 @@ finalize_it:
 	RETiRet;
 }
 
+/* ratelimit(name, key, interval, burst): name, interval and burst
+ * must be constants, as the limiter (and its stats object) is created
+ * once at config load. Only the key is evaluated per message. Call
+ * sites using the same name share one limiter.
+ */
+static rsRetVal
+initFunc_ratelimit(struct cnffunc *func)
+{
+	uchar *name = NULL;
+	long long interval, burst;
+	DEFiRet;
+
+	func->destructable_funcdata = 0;
+	func->funcdata = NULL;
+
+	if(func->nParams != 4) {
+		parser_errmsg("rsyslog logic error in line %d of file %s\n",
+					  __LINE__, __FILE__);
+		FINALIZE;
+	}
+
+	if(func->expr[0]->nodetype != 'S') {
+		parser_errmsg("limiter name (param 1) of ratelimit() must be a constant string");
+		FINALIZE;
+	}
+	if(func->expr[2]->nodetype != 'N' || func->expr[3]->nodetype != 'N') {
+		parser_errmsg("interval and burst (param 3 and 4) of ratelimit() must be constant numbers");
+		FINALIZE;
+	}
+	interval = ((struct cnfnumval*) func->expr[2])->val;
+	burst = ((struct cnfnumval*) func->expr[3])->val;
+	if(interval <= 0 || burst <= 0) {
+		parser_errmsg("interval and burst of ratelimit() must be greater than zero");
+		FINALIZE;
+	}
+
+	name = (uchar*)es_str2cstr(((struct cnfstringval*) func->expr[0])->estr, NULL);
+	iRet = keyratelimitGetShared((keyratelimit_t**)&func->funcdata, (char*)name,
+				(unsigned) interval, (unsigned) burst);
+	if(iRet == RS_RET_DUP_PARAM) {
+		parser_errmsg("ratelimit(): limiter '%s' is already used with a different "
+			"interval or burst", name);
+	} else if(iRet != RS_RET_OK) {
+		parser_errmsg("ratelimit(): could not create limiter '%s'", name);
+	}
+
+finalize_it:
+	free(name);
+	RETiRet;
+}
+
 static inline rsRetVal
 initFunc_dyn_stats(struct cnffunc *func)
 {
@@ -4136,6 +5413,9 @@ cnffuncNew(es_str_t *fname, struct cnffparamlst* paramlst)
 			case CNFFUNC_DYN_INC:
 				initFunc_dyn_stats(func);
 				break;
+			case CNFFUNC_RATELIMIT:
+				initFunc_ratelimit(func);
+				break;
 			default:break;
 		}
 	}
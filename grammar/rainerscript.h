@@ -105,9 +105,15 @@ struct var {
 		struct cnfarray *ar;
 		long long n;
 		struct json_object *json;
+		struct {
+			const uchar *str;
+			int len;
+		} sv;
 	} d;
-	char datatype; /* 'N' number, 'S' string, 'J' JSON, 'A' array
-			* Note: 'A' is only supported during config phase
+	char datatype; /* 'N' number, 'S' string, 'J' JSON, 'A' array,
+			* 'B' borrowed string (view, not owned)
+			* Note: 'A' is only supported during config phase,
+			* 'B' only inside the bytecode interpreter
 			*/
 };
 
@@ -177,6 +183,9 @@ cnfFiltType2str(enum cnfFiltType filttype)
 }
 
 
+struct cnfvmprog; /* compiled expression (bytecode), opaque */
+struct cnfacm; /* compiled multi-pattern matcher, opaque */
+
 struct cnfstmt {
 	unsigned nodetype;
 	struct cnfstmt *next;
@@ -186,11 +195,13 @@ struct cnfstmt {
 			struct cnfexpr *expr;
 			struct cnfstmt *t_then;
 			struct cnfstmt *t_else;
+			struct cnfvmprog *prog;	/* compiled expr, NULL if not compiled */
 		} s_if;
 		struct {
 			uchar *varname;
 			struct cnfexpr *expr;
 			int force_reset;
+			struct cnfvmprog *prog;	/* compiled expr, NULL if not compiled */
 		} s_set;
 		struct {
 			uchar *varname;
@@ -209,6 +220,7 @@ struct cnfstmt {
 			fiop_t operation;
 			regex_t *regex_cache;/* cache for compiled REs, if used */
 			struct cstr_s *pCSCompValue;/* value to "compare" against */
+			struct cnfacm *acm;	/* compiled matcher for "contains" */
 			sbool isNegated;
 			msgPropDescr_t prop; /* requested property */
 			struct cnfstmt *t_then;
@@ -258,6 +270,7 @@ struct cnfarray {
 	unsigned nodetype;
 	int nmemb;
 	es_str_t **arr;
+	struct cnfacm *acm; /* matcher for contains/startswith, if compiled */
 };
 
 struct cnffparamlst {
@@ -283,7 +296,8 @@ enum cnffuncid {
 	CNFFUNC_REPLACE,
 	CNFFUNC_WRAP,
 	CNFFUNC_RANDOM,
-	CNFFUNC_DYN_INC
+	CNFFUNC_DYN_INC,
+	CNFFUNC_RATELIMIT
 };
 
 struct cnffunc {
@@ -393,6 +407,12 @@ struct cnfstmt * cnfstmtNewContinue(void);
 struct cnfstmt * cnfstmtNewReloadLookupTable(struct cnffparamlst *fparams);
 void cnfstmtDestructLst(struct cnfstmt *root);
 void cnfstmtOptimize(struct cnfstmt *root);
+void cnfstmtCompile(struct cnfstmt *root);
+void cnfvmEval(const struct cnfvmprog *prog, struct var *ret, void *usrptr);
+int cnfvmEvalBool(const struct cnfvmprog *prog, void *usrptr);
+struct cnfacm *cnfacmConstruct(const uchar *const *pats, const int *lens, int nPats, int bCaseInsens);
+int cnfacmMatch(const struct cnfacm *acm, const uchar *buf, int len, int bPrefix);
+void cnfacmDestruct(struct cnfacm *acm);
 struct cnfarray* cnfarrayNew(es_str_t *val);
 struct cnfarray* cnfarrayDup(struct cnfarray *old);
 struct cnfarray* cnfarrayAdd(struct cnfarray *ar, es_str_t *val);
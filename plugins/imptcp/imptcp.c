@@ -73,6 +73,7 @@
 #include "statsobj.h"
 #include "ratelimit.h"
 #include "net.h" /* for permittedPeers, may be removed when this is removed */
+#include "delimscan.h"
 
 /* the define is from tcpsrv.h, we need to find a new (but easier!!!) abstraction layer some time ... */
 #define TCPSRV_NO_ADDTL_DELIMITER -1 /* specifies that no additional delimiter is to be used in TCP framing */
@@ -797,13 +798,14 @@ finalize_it:
  * EXTRACT from tcps_sess.c
  */
 static rsRetVal
-doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+doSubmitMsgBuf(ptcpsess_t *pThis, const char *const pRaw, const int lenRaw,
+	struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
 {
 	msg_t *pMsg;
 	ptcpsrv_t *pSrv;
 	DEFiRet;
 
-	if(pThis->iMsg == 0) {
+	if(lenRaw == 0) {
 		DBGPRINTF("discarding zero-sized message\n");
 		FINALIZE;
 	}
@@ -811,7 +813,7 @@ doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, mult
 
 	/* we now create our own message object and submit it to the queue */
 	CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
-	MsgSetRawMsg(pMsg, (char*)pThis->pMsg, pThis->iMsg);
+	MsgSetRawMsg(pMsg, pRaw, lenRaw);
 	MsgSetInputName(pMsg, pSrv->pInputName);
 	MsgSetFlowControlType(pMsg, eFLOWCTL_LIGHT_DELAY);
 	if(pSrv->dfltTZ != NULL)
@@ -832,6 +834,13 @@ finalize_it:
 	RETiRet;
 }
 
+/* submit the message collected in the session buffer */
+static inline rsRetVal
+doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	return doSubmitMsgBuf(pThis, (char*)pThis->pMsg, pThis->iMsg, stTime, ttGenTime, pMultiSub);
+}
+
 
 /* process the data received. As TCP is stream based, we need to process the
  * data inside a state machine. The actual data received is passed in byte-by-byte
@@ -839,6 +848,9 @@ finalize_it:
  * the end result to the queue. Introducing this function fixes a long-term bug ;)
  * rgerhards, 2008-03-14
  * EXTRACT from tcps_sess.c
+ * Frame data is not processed byte-by-byte: the function consumes as much of
+ * the buffer as belongs to the current frame and advances *buff to the last
+ * byte it consumed.
  */
 static rsRetVal
 processDataRcvd(ptcpsess_t *const __restrict__ pThis,
@@ -852,6 +864,9 @@ processDataRcvd(ptcpsess_t *const __restrict__ pThis,
 	DEFiRet;
 	char c = **buff;
 	int octatesToCopy, octatesToDiscard;
+	int addtlDelim;
+	int lenData;
+	char *pData;
 
 	if(pThis->inputState == eAtStrtFram) {
 		if(pThis->bSuppOctetFram && isdigit((int) c)) {
@@ -900,33 +915,58 @@ processDataRcvd(ptcpsess_t *const __restrict__ pThis,
 		assert(pThis->inputState == eInMsg);
 
 		if (pThis->eFraming == TCP_FRAMING_OCTET_STUFFING) {
-			if(pThis->iMsg >= iMaxLine) {
-				/* emergency, we now need to flush, no matter if we are at end of message or not... */
-				DBGPRINTF("error: message received is larger than max msg size, we split it\n");
-				doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
-				++(*pnMsgs);
-				/* we might think if it is better to ignore the rest of the
-				 * message than to treat it as a new one. Maybe this is a good
-				 * candidate for a configuration parameter...
-				 * rgerhards, 2006-12-04
+			/* we do not look at each byte individually but search the
+			 * rest of the buffer for the delimiter and then process the
+			 * frame data in one step.
+			 */
+			addtlDelim = pThis->pLstn->pSrv->iAddtlFrameDelim;
+			lenData = delimScan(*buff, buffLen,
+				(addtlDelim == TCPSRV_NO_ADDTL_DELIMITER) ? '\n' : addtlDelim);
+			if(lenData < buffLen && pThis->iMsg == 0 && lenData < iMaxLine) {
+				/* complete frame inside the buffer: no need to copy it
+				 * to the session buffer first.
 				 */
-			}
-
-			if ((c == '\n')
-				   || ((pThis->pLstn->pSrv->iAddtlFrameDelim != TCPSRV_NO_ADDTL_DELIMITER)
-					   && (c == pThis->pLstn->pSrv->iAddtlFrameDelim))
-				   ) { /* record delimiter? */
-				doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+				doSubmitMsgBuf(pThis, *buff, lenData, stTime, ttGenTime, pMultiSub);
 				++(*pnMsgs);
 				pThis->inputState = eAtStrtFram;
-			} else {
+				*buff += lenData; /* delimiter is the last byte consumed */
+				FINALIZE;
+			}
+			pData = *buff;
+			while(lenData > 0) {
+				if(pThis->iMsg >= iMaxLine) {
+					/* emergency, we now need to flush, no matter if we are at end of message or not... */
+					DBGPRINTF("error: message received is larger than max msg size, we split it\n");
+					doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+					++(*pnMsgs);
+					/* we might think if it is better to ignore the rest of the
+					 * message than to treat it as a new one. Maybe this is a good
+					 * candidate for a configuration parameter...
+					 * rgerhards, 2006-12-04
+					 */
+				}
 				/* IMPORTANT: here we copy the actual frame content to the message - for BOTH framing modes!
 				 * If we have a message that is larger than the max msg size, we truncate it. This is the best
 				 * we can do in light of what the engine supports. -- rgerhards, 2008-03-14
 				 */
-				if(pThis->iMsg < iMaxLine) {
-					*(pThis->pMsg + pThis->iMsg++) = c;
+				octatesToCopy = (lenData < iMaxLine - pThis->iMsg) ? lenData : iMaxLine - pThis->iMsg;
+				memcpy(pThis->pMsg + pThis->iMsg, pData, octatesToCopy);
+				pThis->iMsg += octatesToCopy;
+				pData += octatesToCopy;
+				lenData -= octatesToCopy;
+			}
+			if(pData < *buff + buffLen) { /* record delimiter? */
+				if(pThis->iMsg >= iMaxLine) {
+					DBGPRINTF("error: message received is larger than max msg size, we split it\n");
+					doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+					++(*pnMsgs);
 				}
+				doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+				++(*pnMsgs);
+				pThis->inputState = eAtStrtFram;
+				*buff = pData; /* the delimiter */
+			} else {
+				*buff = pData - 1; /* all data consumed */
 			}
 		} else {
 			assert(pThis->eFraming == TCP_FRAMING_OCTET_COUNTING);
@@ -62,6 +62,8 @@
 #include "tcpsrv.h"
 #include "ruleset.h"
 #include "rainerscript.h"
+#include "msg.h"
+#include "ratelimit.h"
 #include "net.h" /* for permittedPeers, may be removed when this is removed */
 
 MODULE_TYPE_INPUT
@@ -115,6 +117,12 @@ struct instanceConf_s {
 	sbool bSPFramingFix;
 	int ratelimitInterval;
 	int ratelimitBurst;
+	uchar *pszRatelimitKey;		/* property to limit by, NULL = fromhost-ip */
+	int ratelimitKeyInterval;	/* 0 = no per-key limit */
+	int ratelimitKeyBurst;
+	int ratelimitKeyMaxKeys;
+	uchar *pszRatelimitKeyDropStats; /* dyn-stats bucket for per-key drops */
+	keyratelimit_t *pKeyRatelimit;
 	int bSuppOctetFram;
 	struct instanceConf_s *next;
 };
@@ -179,7 +187,12 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "supportoctetcountedframing", eCmdHdlrBinary, 0 },
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "framingfix.cisco.asa", eCmdHdlrBinary, 0 },
-	{ "ratelimit.burst", eCmdHdlrInt, 0 }
+	{ "ratelimit.burst", eCmdHdlrInt, 0 },
+	{ "ratelimit.key", eCmdHdlrGetWord, 0 },
+	{ "ratelimit.key.interval", eCmdHdlrInt, 0 },
+	{ "ratelimit.key.burst", eCmdHdlrInt, 0 },
+	{ "ratelimit.key.maxkeys", eCmdHdlrPositiveInt, 0 },
+	{ "ratelimit.key.dropstats", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk inppblk =
 	{ CNFPARAMBLK_VERSION,
@@ -280,6 +293,12 @@ createInstance(instanceConf_t **pinst)
 	inst->bSPFramingFix = 0;
 	inst->ratelimitInterval = 0;
 	inst->ratelimitBurst = 10000;
+	inst->pszRatelimitKey = NULL;
+	inst->ratelimitKeyInterval = 0;
+	inst->ratelimitKeyBurst = 10000;
+	inst->ratelimitKeyMaxKeys = 0; /* use default */
+	inst->pszRatelimitKeyDropStats = NULL;
+	inst->pKeyRatelimit = NULL;
 
 	/* node created, let's add to config */
 	if(loadModConf->tail == NULL) {
@@ -333,6 +352,33 @@ finalize_it:
 }
 
 
+/* create the per-key ratelimiter of an instance */
+static rsRetVal
+createKeyRatelimit(instanceConf_t *inst)
+{
+	char name[128];
+	DEFiRet;
+
+	snprintf(name, sizeof(name), "%s(%s).ratelimit",
+		 (inst->pszInputName == NULL) ? "imtcp" : (char*)inst->pszInputName, inst->pszBindPort);
+	CHKiRet(keyratelimitNew(&inst->pKeyRatelimit, name, inst->ratelimitKeyInterval,
+				inst->ratelimitKeyBurst));
+	if(inst->pszRatelimitKey != NULL)
+		CHKiRet(keyratelimitSetKeyProp(inst->pKeyRatelimit, inst->pszRatelimitKey));
+	if(inst->ratelimitKeyMaxKeys > 0)
+		keyratelimitSetMaxKeys(inst->pKeyRatelimit, inst->ratelimitKeyMaxKeys);
+	if(inst->pszRatelimitKeyDropStats != NULL)
+		CHKiRet(keyratelimitSetDropStats(inst->pKeyRatelimit, inst->pszRatelimitKeyDropStats));
+	CHKiRet(keyratelimitConstructFinalize(inst->pKeyRatelimit));
+finalize_it:
+	if(iRet != RS_RET_OK && inst->pKeyRatelimit != NULL) {
+		keyratelimitDestruct(inst->pKeyRatelimit);
+		inst->pKeyRatelimit = NULL;
+	}
+	RETiRet;
+}
+
+
 static rsRetVal
 addListner(modConfData_t *modConf, instanceConf_t *inst)
 {
@@ -379,6 +425,9 @@ addListner(modConfData_t *modConf, instanceConf_t *inst)
 	CHKiRet(tcpsrv.SetDfltTZ(pOurTcpsrv, (inst->dfltTZ == NULL) ? (uchar*)"" : inst->dfltTZ));
 	CHKiRet(tcpsrv.SetbSPFramingFix(pOurTcpsrv, inst->bSPFramingFix));
 	CHKiRet(tcpsrv.SetLinuxLikeRatelimiters(pOurTcpsrv, inst->ratelimitInterval, inst->ratelimitBurst));
+	if(inst->ratelimitKeyInterval > 0 && inst->pKeyRatelimit == NULL)
+		CHKiRet(createKeyRatelimit(inst));
+	CHKiRet(tcpsrv.SetKeyedRatelimiter(pOurTcpsrv, inst->pKeyRatelimit));
 	tcpsrv.configureTCPListen(pOurTcpsrv, inst->pszBindPort, inst->bSuppOctetFram, inst->pszBindAddr);
 
 finalize_it:
@@ -431,6 +480,22 @@ CODESTARTnewInpInst
 			inst->ratelimitBurst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.interval")) {
 			inst->ratelimitInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key")) {
+			propid_t propid;
+			inst->pszRatelimitKey = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(propNameToID(inst->pszRatelimitKey, &propid) != RS_RET_OK) {
+				errmsg.LogError(0, RS_RET_INVLD_PROP, "imtcp: invalid property '%s' "
+						"for ratelimit.key", inst->pszRatelimitKey);
+				ABORT_FINALIZE(RS_RET_INVLD_PROP);
+			}
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key.interval")) {
+			inst->ratelimitKeyInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key.burst")) {
+			inst->ratelimitKeyBurst = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key.maxkeys")) {
+			inst->ratelimitKeyMaxKeys = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key.dropstats")) {
+			inst->pszRatelimitKeyDropStats = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			dbgprintf("imtcp: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
@@ -634,6 +699,9 @@ CODESTARTfreeCnf
 		free(inst->pszBindAddr);
 		free(inst->pszInputName);
 		free(inst->dfltTZ);
+		free(inst->pszRatelimitKey);
+		free(inst->pszRatelimitKeyDropStats);
+		keyratelimitDestruct(inst->pKeyRatelimit);
 		del = inst;
 		inst = inst->next;
 		free(del);
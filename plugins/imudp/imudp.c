@@ -40,6 +40,9 @@
 #ifdef HAVE_SCHED_H
 #	include <sched.h>
 #endif
+#ifdef HAVE_LINUX_FILTER_H
+#	include <linux/filter.h>
+#endif
 #include "rsyslog.h"
 #include "dirty.h"
 #include "net.h"
@@ -83,7 +86,10 @@ static struct lstn_s {
 	statsobj_t *stats;	/* listener stats */
 	ratelimit_t *ratelimiter;
 	uchar *dfltTZ;
-	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+	int iReusePort;		/* index in SO_REUSEPORT group, -1 if socket is not part of one */
+	STATSCOUNTER_SHARDED_DEF(ctrSubmit)
+	STATSCOUNTER_DEF(ctrRcvd, mutCtrRcvd)
+	intctr_t ctrDrops;	/* packets dropped by the kernel (SO_RXQ_OVFL), cumulative */
 } *lcnfRoot = NULL, *lcnfLast = NULL;
 
 
@@ -95,6 +101,7 @@ static time_t ttLastDiscard = 0;	/* timestamp when a message from a non-permitte
 					 * message is configured to be logged on occurance of such a case.
 					 */
 #define BATCH_SIZE_DFLT 32		/* do not overdo, has heavy toll on memory, especially with large msgs */
+#define RCV_CTLBUF_LEN 64		/* per-packet buffer for ancillary data (SO_RXQ_OVFL) */
 #define TIME_REQUERY_DFLT 2
 #define SCHED_PRIO_UNSET -12345678	/* a value that indicates that the scheduling priority has not been set */
 /* config vars for legacy config system */
@@ -115,15 +122,33 @@ struct instanceConf_s {
 	uchar *dfltTZ;
 	int ratelimitInterval;
 	int ratelimitBurst;
+	uchar *pszRatelimitKey;		/* property to limit by, NULL = fromhost-ip */
+	int ratelimitKeyInterval;	/* 0 = no per-key limit */
+	int ratelimitKeyBurst;
+	int ratelimitKeyMaxKeys;
+	uchar *pszRatelimitKeyDropStats; /* dyn-stats bucket for per-key drops */
+	keyratelimit_t *pKeyRatelimit;	/* shared by all sockets of this instance */
 	int rcvbuf;			/* 0 means: do not set, keep OS default */
 	/*  0 means:  IP_FREEBIND is disabled
 	1 means:  IP_FREEBIND enabled + warning disabled
 	1+ means: IP+FREEBIND enabled + warning enabled */
 	int ipfreebind;
+	int nReusePort;			/* nbr of SO_REUSEPORT sockets, 0 = single socket without SO_REUSEPORT */
+	sbool bReusePortCPU;		/* steer packets to socket by receiving CPU (instead of hash)? */
 	struct instanceConf_s *next;
 	sbool bAppendPortToInpname;
 };
 
+/* Small per-worker cache of recent ACL verdicts, so that interleaved
+ * senders do not need a full ACL check for each packet (we used to cache
+ * only the previous sender). Direct-mapped by sender address.
+ */
+#define ACL_CACHE_SIZE 32	/* must be a power of 2 */
+typedef struct aclCache_s {
+	struct sockaddr_storage addr[ACL_CACHE_SIZE];
+	int bIsPermitted[ACL_CACHE_SIZE];
+} aclCache_t;
+
 /* The following structure controls the worker threads. Global data is
  * needed for their access.
  */
@@ -140,6 +165,8 @@ static struct wrkrInfo_s {
 	struct sockaddr_storage *frominet;
 	struct mmsghdr *recvmsg_mmh;
 	struct iovec *recvmsg_iov;
+	uchar *recvmsg_ctl;	/* ancillary data buffers, RCV_CTLBUF_LEN per packet */
+	msgRawPool_t *pRawPool;	/* zero-copy receive slabs, NULL if not enabled */
 #	endif
 } wrkrInfo[MAX_WRKR_THREADS];
 
@@ -151,6 +178,9 @@ struct modConfData_s {
 	int iSchedPrio;			/* scheduling priority */
 	int iTimeRequery;		/* how often is time to be queried inside tight recv loop? 0=always */
 	int batchSize;			/* max nbr of input batch --> also recvmmsg() max count */
+	int nZeroCopySlabs;		/* nbr of receive slabs per worker, 0 = always copy */
+	int *cpus;			/* CPUs to pin workers to (worker i uses cpus[i % nCPUs]) */
+	int nCPUs;			/* 0 = do not pin workers */
 	int8_t wrkrMax;			/* max nbr of worker threads */
 	sbool configSetViaV2Method;
 };
@@ -163,7 +193,9 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "schedulingpriority", eCmdHdlrInt, 0 },
 	{ "batchsize", eCmdHdlrInt, 0 },
 	{ "threads", eCmdHdlrPositiveInt, 0 },
-	{ "timerequery", eCmdHdlrInt, 0 }
+	{ "timerequery", eCmdHdlrInt, 0 },
+	{ "zerocopyslabs", eCmdHdlrNonNegInt, 0 },
+	{ "threads.cpus", eCmdHdlrString, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -182,9 +214,16 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "address", eCmdHdlrString, 0 },
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "ratelimit.burst", eCmdHdlrInt, 0 },
+	{ "ratelimit.key", eCmdHdlrGetWord, 0 },
+	{ "ratelimit.key.interval", eCmdHdlrInt, 0 },
+	{ "ratelimit.key.burst", eCmdHdlrInt, 0 },
+	{ "ratelimit.key.maxkeys", eCmdHdlrPositiveInt, 0 },
+	{ "ratelimit.key.dropstats", eCmdHdlrGetWord, 0 },
 	{ "rcvbufsize", eCmdHdlrSize, 0 },
 	{ "ipfreebind", eCmdHdlrInt, 0 },
-	{ "ruleset", eCmdHdlrString, 0 }
+	{ "ruleset", eCmdHdlrString, 0 },
+	{ "reuseport.threads", eCmdHdlrPositiveInt, 0 },
+	{ "reuseport.steering", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk inppblk =
 	{ CNFPARAMBLK_VERSION,
@@ -213,8 +252,16 @@ createInstance(instanceConf_t **pinst)
 	inst->bAppendPortToInpname = 0;
 	inst->ratelimitBurst = 10000; /* arbitrary high limit */
 	inst->ratelimitInterval = 0; /* off */
+	inst->pszRatelimitKey = NULL;
+	inst->ratelimitKeyInterval = 0; /* off */
+	inst->ratelimitKeyBurst = 10000;
+	inst->ratelimitKeyMaxKeys = 0; /* use default */
+	inst->pszRatelimitKeyDropStats = NULL;
+	inst->pKeyRatelimit = NULL;
 	inst->rcvbuf = 0;
 	inst->ipfreebind = IPFREEBIND_ENABLED_WITH_LOG;
+	inst->nReusePort = 0;
+	inst->bReusePortCPU = 0;
 	inst->dfltTZ = NULL;
 
 	/* node created, let's add to config */
@@ -260,22 +307,177 @@ finalize_it:
 }
 
 
+/* attach a classic BPF program to a SO_REUSEPORT socket which selects the
+ * group member by the CPU that received the packet. That keeps a packet on
+ * the CPU whose worker (if pinned accordingly) reads the socket.
+ */
+static void
+attachReusePortCPUFilter(const int sock, const int nReusePort)
+{
+#	if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU }, /* A = cpu */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, nReusePort },	/* A %= nReusePort */
+		{ BPF_RET | BPF_A, 0, 0, 0 }				/* socket index = A */
+	};
+	struct sock_fprog prog = { sizeof(code)/sizeof(code[0]), code };
+	char errStr[1024];
+
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_ERR, "imudp: could not attach reuseport CPU "
+				"steering program to socket %d: %s - using hash steering", sock, errStr);
+	}
+#	else
+	errmsg.LogError(0, RS_RET_ERR, "imudp: reuseport.steering=\"cpu\" not supported on "
+			"this platform - using hash steering (socket %d, group size %d)", sock, nReusePort);
+#	endif
+}
+
+
+/* add a single (already bound) socket to the listener list. On failure,
+ * the socket is closed.
+ */
+static rsRetVal
+addListnerSock(instanceConf_t *inst, const int sock, uchar *bindName, uchar *port, const int iReusePort)
+{
+	DEFiRet;
+	struct lstn_s *newlcnfinfo = NULL;
+	uchar dispname[64], inpnameBuf[128];
+	uchar *inputname;
+#	ifdef SO_RXQ_OVFL
+	int on = 1;
+#	endif
+
+	CHKmalloc(newlcnfinfo = (struct lstn_s*) calloc(1, sizeof(struct lstn_s)));
+	newlcnfinfo->next = NULL;
+	newlcnfinfo->sock = sock;
+	newlcnfinfo->pRuleset = inst->pBindRuleset;
+	newlcnfinfo->dfltTZ = inst->dfltTZ;
+	newlcnfinfo->iReusePort = iReusePort;
+	if(inst->inputname == NULL) {
+		inputname = (uchar*)"imudp";
+	} else {
+		inputname = inst->inputname;
+	}
+	if(iReusePort == -1) {
+		snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
+	} else {
+		snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s#%d)", inputname, bindName, port,
+			 iReusePort);
+	}
+	dispname[sizeof(dispname)-1] = '\0'; /* just to be on the save side... */
+	CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
+	if(inst->bAppendPortToInpname) {
+		snprintf((char*)inpnameBuf, sizeof(inpnameBuf), "%s%s",
+			inputname, port);
+		inpnameBuf[sizeof(inpnameBuf)-1] = '\0';
+		inputname = inpnameBuf;
+	}
+	CHKiRet(prop.Construct(&newlcnfinfo->pInputName));
+	CHKiRet(prop.SetString(newlcnfinfo->pInputName,
+		inputname, ustrlen(inputname)));
+	CHKiRet(prop.ConstructFinalize(newlcnfinfo->pInputName));
+	ratelimitSetLinuxLike(newlcnfinfo->ratelimiter, inst->ratelimitInterval,
+			      inst->ratelimitBurst);
+	if(inst->pKeyRatelimit != NULL)
+		ratelimitSetKeyed(newlcnfinfo->ratelimiter, inst->pKeyRatelimit);
+#	ifdef SO_RXQ_OVFL
+	/* have the kernel report its drop counter, for the "drops" stats counter */
+	if(setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0)
+		DBGPRINTF("imudp: could not enable SO_RXQ_OVFL on socket %d\n", sock);
+#	endif
+	/* support statistics gathering */
+	CHKiRet(statsobj.Construct(&(newlcnfinfo->stats)));
+	CHKiRet(statsobj.SetName(newlcnfinfo->stats, dispname));
+	CHKiRet(statsobj.SetOrigin(newlcnfinfo->stats, (uchar*)"imudp"));
+	STATSCOUNTER_SHARDED_INIT(newlcnfinfo->ctrSubmit);
+	CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("submitted"),
+		ctrType_ShardedCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrSubmit)));
+	STATSCOUNTER_INIT(newlcnfinfo->ctrRcvd, newlcnfinfo->mutCtrRcvd);
+	CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("received"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrRcvd)));
+	CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("drops"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &(newlcnfinfo->ctrDrops)));
+	CHKiRet(statsobj.ConstructFinalize(newlcnfinfo->stats));
+	/* link to list. Order must be preserved to take care for
+	 * conflicting matches.
+	 */
+	if(lcnfRoot == NULL)
+		lcnfRoot = newlcnfinfo;
+	if(lcnfLast == NULL)
+		lcnfLast = newlcnfinfo;
+	else {
+		lcnfLast->next = newlcnfinfo;
+		lcnfLast = newlcnfinfo;
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		if(newlcnfinfo != NULL) {
+			if(newlcnfinfo->ratelimiter != NULL)
+				ratelimitDestruct(newlcnfinfo->ratelimiter);
+			if(newlcnfinfo->pInputName != NULL)
+				prop.Destruct(&newlcnfinfo->pInputName);
+			if(newlcnfinfo->stats != NULL)
+				statsobj.Destruct(&newlcnfinfo->stats);
+			free(newlcnfinfo);
+		}
+		close(sock);
+	}
+	RETiRet;
+}
+
+
+/* create the per-key ratelimiter of an instance. Its stats object is
+ * named after the listener, with ".ratelimit" appended.
+ */
+static rsRetVal
+createKeyRatelimit(instanceConf_t *inst, uchar *bindName, uchar *port)
+{
+	char name[128];
+	DEFiRet;
+
+	snprintf(name, sizeof(name), "%s(%s:%s).ratelimit",
+		 (inst->inputname == NULL) ? "imudp" : (char*)inst->inputname, bindName, port);
+	CHKiRet(keyratelimitNew(&inst->pKeyRatelimit, name, inst->ratelimitKeyInterval,
+				inst->ratelimitKeyBurst));
+	if(inst->pszRatelimitKey != NULL)
+		CHKiRet(keyratelimitSetKeyProp(inst->pKeyRatelimit, inst->pszRatelimitKey));
+	if(inst->ratelimitKeyMaxKeys > 0)
+		keyratelimitSetMaxKeys(inst->pKeyRatelimit, inst->ratelimitKeyMaxKeys);
+	if(inst->pszRatelimitKeyDropStats != NULL)
+		CHKiRet(keyratelimitSetDropStats(inst->pKeyRatelimit, inst->pszRatelimitKeyDropStats));
+	CHKiRet(keyratelimitConstructFinalize(inst->pKeyRatelimit));
+finalize_it:
+	if(iRet != RS_RET_OK && inst->pKeyRatelimit != NULL) {
+		keyratelimitDestruct(inst->pKeyRatelimit);
+		inst->pKeyRatelimit = NULL;
+	}
+	RETiRet;
+}
+
+
 /* This function is called when a new listener shall be added. It takes
  * the instance config description, tries to bind the socket and, if that
  * succeeds, adds it to the list of existing listen sockets.
+ * With reuseport.threads, we bind that many sockets to the same address
+ * and port, so that the kernel can spread the load over multiple receive
+ * queues and worker threads.
  */
 static inline rsRetVal
 addListner(instanceConf_t *inst)
 {
 	DEFiRet;
 	uchar *bindAddr;
-	int *newSocks;
-	int iSrc;
-	struct lstn_s *newlcnfinfo;
+	int *newSocks = NULL;
+	int iSrc = 1;
+	int iReusePort;
+	int nReusePortOK = 0;
+	struct lstn_s *lstnPrev = lcnfLast;
+	struct lstn_s *lstn;
 	uchar *bindName;
 	uchar *port;
-	uchar dispname[64], inpnameBuf[128];
-	uchar *inputname;
 
 	/* check which address to bind to. We could do this more compact, but have not
 	 * done so in order to make the code more readable. -- rgerhards, 2007-12-27
@@ -291,72 +493,44 @@ addListner(instanceConf_t *inst)
 
 	DBGPRINTF("Trying to open syslog UDP ports at %s:%s.\n", bindName, inst->pszBindPort);
 
-	newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf, inst->ipfreebind);
-	if(newSocks != NULL) {
+	if(inst->ratelimitKeyInterval > 0 && inst->pKeyRatelimit == NULL)
+		CHKiRet(createKeyRatelimit(inst, bindName, port));
+
+	/* without reuseport, we run the loop once and the socket belongs to no group (-1) */
+	for(iReusePort = (inst->nReusePort == 0) ? -1 : 0 ; iReusePort < inst->nReusePort ; ++iReusePort) {
+		newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf, inst->ipfreebind,
+						 inst->nReusePort > 0);
+		if(newSocks == NULL)
+			break; /* error already reported, a retry would fail as well */
 		/* we now need to add the new sockets to the existing set */
-		/* ready to copy */
 		for(iSrc = 1 ; iSrc <= newSocks[0] ; ++iSrc) {
-			CHKmalloc(newlcnfinfo = (struct lstn_s*) calloc(1, sizeof(struct lstn_s)));
-			newlcnfinfo->next = NULL;
-			newlcnfinfo->sock = newSocks[iSrc];
-			newlcnfinfo->pRuleset = inst->pBindRuleset;
-			newlcnfinfo->dfltTZ = inst->dfltTZ;
-			if(inst->inputname == NULL) {
-				inputname = (uchar*)"imudp";
-			} else {
-				inputname = inst->inputname;
-			}
-			snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
-			dispname[sizeof(dispname)-1] = '\0'; /* just to be on the save side... */
-			CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
-			if(inst->bAppendPortToInpname) {
-				snprintf((char*)inpnameBuf, sizeof(inpnameBuf), "%s%s",
-					inputname, port);
-				inpnameBuf[sizeof(inpnameBuf)-1] = '\0';
-				inputname = inpnameBuf;
-			}
-			CHKiRet(prop.Construct(&newlcnfinfo->pInputName));
-			CHKiRet(prop.SetString(newlcnfinfo->pInputName,
-				inputname, ustrlen(inputname)));
-			CHKiRet(prop.ConstructFinalize(newlcnfinfo->pInputName));
-			ratelimitSetLinuxLike(newlcnfinfo->ratelimiter, inst->ratelimitInterval,
-					      inst->ratelimitBurst);
-			/* support statistics gathering */
-			CHKiRet(statsobj.Construct(&(newlcnfinfo->stats)));
-			CHKiRet(statsobj.SetName(newlcnfinfo->stats, dispname));
-			CHKiRet(statsobj.SetOrigin(newlcnfinfo->stats, (uchar*)"imudp"));
-			STATSCOUNTER_INIT(newlcnfinfo->ctrSubmit, newlcnfinfo->mutCtrSubmit);
-			CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("submitted"),
-				ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrSubmit)));
-			CHKiRet(statsobj.ConstructFinalize(newlcnfinfo->stats));
-			/* link to list. Order must be preserved to take care for 
-			 * conflicting matches.
-			 */
-			if(lcnfRoot == NULL)
-				lcnfRoot = newlcnfinfo;
-			if(lcnfLast == NULL)
-				lcnfLast = newlcnfinfo;
-			else {
-				lcnfLast->next = newlcnfinfo;
-				lcnfLast = newlcnfinfo;
-			}
+			CHKiRet(addListnerSock(inst, newSocks[iSrc], bindName, port, iReusePort));
+		}
+		free(newSocks);
+		newSocks = NULL;
+		++nReusePortOK;
+	}
+
+	if(inst->nReusePort > 0 && nReusePortOK < inst->nReusePort) {
+		errmsg.LogError(0, RS_RET_ERR, "imudp: could only create %d of %d reuseport "
+				"sockets for %s:%s", nReusePortOK, inst->nReusePort, bindName, port);
+	}
+	/* the CPU steering program selects a socket by its index in the group,
+	 * so it must be built for the number of sockets that actually exist.
+	 * It applies to the whole group, so we attach it to the first member.
+	 */
+	if(inst->bReusePortCPU && nReusePortOK > 0) {
+		for(lstn = (lstnPrev == NULL) ? lcnfRoot : lstnPrev->next ; lstn != NULL ; lstn = lstn->next) {
+			if(lstn->iReusePort == 0)
+				attachReusePortCPUFilter(lstn->sock, nReusePortOK);
 		}
 	}
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
-		if(newlcnfinfo != NULL) {
-			if(newlcnfinfo->ratelimiter != NULL)
-				ratelimitDestruct(newlcnfinfo->ratelimiter);
-			if(newlcnfinfo->pInputName != NULL)
-				prop.Destruct(&newlcnfinfo->pInputName);
-			if(newlcnfinfo->stats != NULL)
-				statsobj.Destruct(&newlcnfinfo->stats);
-			free(newlcnfinfo);
-		}
 		/* close the rest of the open sockets as there's
-		   nowhere to put them */
-		for(; iSrc <= newSocks[0]; iSrc++) {
+		   nowhere to put them (the failed one is already closed) */
+		for(++iSrc ; iSrc <= newSocks[0]; iSrc++) {
 			close(newSocks[iSrc]);
 		}
 	}
@@ -376,26 +550,51 @@ std_checkRuleset_genErrMsg(__attribute__((unused)) modConfData_t *modConf, insta
 }
 
 
+/* select the ACL cache slot for a sender address */
+static inline unsigned
+aclCacheSlot(struct sockaddr_storage *frominet)
+{
+	uint32_t h;
+
+	if(frominet->ss_family == AF_INET6)
+		h = ((struct sockaddr_in6*)frominet)->sin6_addr.s6_addr32[2]
+		    ^ ((struct sockaddr_in6*)frominet)->sin6_addr.s6_addr32[3];
+	else
+		h = ((struct sockaddr_in*)frominet)->sin_addr.s_addr;
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return h & (ACL_CACHE_SIZE - 1);
+}
+
+
 /* This function processes received data. It provides unified handling
  * in cases where recvmmsg() is available and not.
  */
+/* If pSlab is non-NULL, rcvBuf is a slice of it (with room for the
+ * terminating NUL) and is handed over to the message without copying.
+ */
 static inline rsRetVal
-processPacket(struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted,
-	uchar *rcvBuf, ssize_t lenRcvBuf, struct syslogTime *stTime, time_t ttGenTime,
+processPacket(struct lstn_s *lstn, aclCache_t *aclCache,
+	uchar *rcvBuf, ssize_t lenRcvBuf, msgRawSlab_t *pSlab, struct syslogTime *stTime, time_t ttGenTime,
 	struct sockaddr_storage *frominet, socklen_t socklen, multi_submit_t *multiSub)
 {
 	DEFiRet;
 	msg_t *pMsg = NULL;
+	int bIsPermitted;
+	int *pbIsPermitted = &bIsPermitted;
+	unsigned slot;
 
 	if(lenRcvBuf == 0)
 		FINALIZE; /* this looks a bit strange, but practice shows it happens... */
 
 	/* if we reach this point, we had a good receive and can process the packet received */
-	/* check if we have a different sender than before, if so, we need to query some new values */
+	/* check if we have a sender not seen recently, if so, we need to query some new values */
 	if(bDoACLCheck) {
 		socklen = sizeof(struct sockaddr_storage);
-		if(net.CmpHost(frominet, frominetPrev, socklen) != 0) {
-			memcpy(frominetPrev, frominet, socklen); /* update cache indicator */
+		slot = aclCacheSlot(frominet);
+		pbIsPermitted = &aclCache->bIsPermitted[slot];
+		if(net.CmpHost(frominet, &aclCache->addr[slot], socklen) != 0) {
+			memcpy(&aclCache->addr[slot], frominet, socklen); /* update cache indicator */
 			/* Here we check if a host is permitted to send us syslog messages. If it isn't,
 			 * we do not further process the message but log a warning (if we are
 			 * configured to do this). However, if the check would require name resolution,
@@ -428,7 +627,10 @@ processPacket(struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *p
 	if(*pbIsPermitted != 0)  {
 		/* we now create our own message object and submit it to the queue */
 		CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
-		MsgSetRawMsg(pMsg, (char*)rcvBuf, lenRcvBuf);
+		if(pSlab == NULL)
+			MsgSetRawMsg(pMsg, (char*)rcvBuf, lenRcvBuf);
+		else
+			MsgSetRawMsgFromSlab(pMsg, pSlab, rcvBuf, lenRcvBuf);
 		MsgSetInputName(pMsg, lstn->pInputName);
 		MsgSetRuleset(pMsg, lstn->pRuleset);
 		MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
@@ -439,7 +641,7 @@ processPacket(struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *p
 			pMsg->msgFlags  |= NEEDS_ACLCHK_U; /* request ACL check after resolution */
 		CHKiRet(msgSetFromSockinfo(pMsg, frominet));
 		CHKiRet(ratelimitAddMsg(lstn->ratelimiter, multiSub, pMsg));
-		STATSCOUNTER_INC(lstn->ctrSubmit, lstn->mutCtrSubmit);
+		STATSCOUNTER_SHARDED_INC(lstn->ctrSubmit);
 	}
 
 finalize_it:
@@ -455,13 +657,34 @@ finalize_it:
 
 
 
+/* update the listener's kernel drop counter from the SO_RXQ_OVFL ancillary
+ * data of a received packet. The kernel reports the socket's cumulative
+ * count (and only once something was dropped).
+ */
+static inline void
+updateDropStats(struct lstn_s *lstn, struct msghdr *mh)
+{
+#	ifdef SO_RXQ_OVFL
+	struct cmsghdr *cmsg;
+	uint32_t drops;
+
+	for(cmsg = CMSG_FIRSTHDR(mh) ; cmsg != NULL ; cmsg = CMSG_NXTHDR(mh, cmsg)) {
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+			STATSCOUNTER_SETMAX_NOMUT(lstn->ctrDrops, (intctr_t) drops);
+		}
+	}
+#	endif
+}
+
+
 /* The following "two" functions are helpers to runInput. Actually, it is
  * just one function. Depending on whether or not we have recvmmsg(),
  * an appropriate version is compiled (as such we need to maintain both!).
  */
 #ifdef HAVE_RECVMMSG
 static inline rsRetVal
-processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted)
+processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, aclCache_t *aclCache)
 {
 	DEFiRet;
 	int iNbrTimeUsed;
@@ -472,6 +695,8 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 	char errStr[1024];
 	msg_t *pMsgs[CONF_NUM_MULTISUB];
 	multi_submit_t multiSub;
+	msgRawSlab_t *pSlab = NULL;
+	uchar *pRcvBuf;
 	int nelem;
 	int i;
 
@@ -482,15 +707,23 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 	while(1) { /* loop is terminated if we have a "bad" receive, done below in the body */
 		if(pWrkr->pThrd->bShallStop == RSTRUE)
 			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		/* with zero-copy, receive into a slab if one is free. If all are
+		 * still referenced by queued messages, we copy as usual.
+		 */
+		if(pSlab == NULL && pWrkr->pRawPool != NULL)
+			pSlab = msgRawPoolGet(pWrkr->pRawPool);
+		pRcvBuf = (pSlab == NULL) ? pWrkr->pRcvBuf : pSlab->buf;
 		memset(pWrkr->recvmsg_iov, 0, runModConf->batchSize * sizeof(struct iovec));
 		memset(pWrkr->recvmsg_mmh, 0, runModConf->batchSize * sizeof(struct mmsghdr));
 		for(i = 0 ; i < runModConf->batchSize ; ++i) {
-			pWrkr->recvmsg_iov[i].iov_base = pWrkr->pRcvBuf+(i*(iMaxLine+1));
+			pWrkr->recvmsg_iov[i].iov_base = pRcvBuf+(i*(iMaxLine+1));
 			pWrkr->recvmsg_iov[i].iov_len = iMaxLine;
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage); 
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_name = &(pWrkr->frominet[i]);
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov = &(pWrkr->recvmsg_iov[i]);
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_iovlen = 1;
+			pWrkr->recvmsg_mmh[i].msg_hdr.msg_control = pWrkr->recvmsg_ctl + i * RCV_CTLBUF_LEN;
+			pWrkr->recvmsg_mmh[i].msg_hdr.msg_controllen = RCV_CTLBUF_LEN;
 		}
 		nelem = recvmmsg(lstn->sock, pWrkr->recvmsg_mmh, runModConf->batchSize, 0, NULL);
 		STATSCOUNTER_INC(pWrkr->ctrCall_recvmmsg, pWrkr->mutCtrCall_recvmmsg);
@@ -519,15 +752,28 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 		}
 
 		pWrkr->ctrMsgsRcvd += nelem;
+		STATSCOUNTER_BUMP(lstn->ctrRcvd, lstn->mutCtrRcvd, nelem);
+		if(nelem > 0) /* drop count is cumulative, so the latest packet is sufficient */
+			updateDropStats(lstn, &pWrkr->recvmsg_mmh[nelem-1].msg_hdr);
 		for(i = 0 ; i < nelem ; ++i) {
-			processPacket(lstn, frominetPrev, pbIsPermitted, pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov->iov_base,
-				      pWrkr->recvmsg_mmh[i].msg_len, &stTime, ttGenTime, &(pWrkr->frominet[i]),
+			processPacket(lstn, aclCache, pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov->iov_base,
+				      pWrkr->recvmsg_mmh[i].msg_len, pSlab, &stTime, ttGenTime, &(pWrkr->frominet[i]),
 				      pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen, &multiSub);
 		}
+		/* if no message took a reference (e.g. all were small), we only
+		 * hold the slab and can reuse it right away. Nobody else can
+		 * increment the count, so checking it without atomics is safe.
+		 */
+		if(pSlab != NULL && pSlab->nRefs > 1) {
+			msgRawSlabRelease(pSlab);
+			pSlab = NULL;
+		}
 	}
 
 finalize_it:
 	multiSubmitFlush(&multiSub);
+	if(pSlab != NULL)
+		msgRawSlabRelease(pSlab);
 	RETiRet;
 }
 #else /* we do not have recvmmsg() */
@@ -546,7 +792,7 @@ finalize_it:
  * on scheduling order. -- rgerhards, 2008-10-02
  */
 static inline rsRetVal
-processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted)
+processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, aclCache_t *aclCache)
 {
 	int iNbrTimeUsed;
 	time_t ttGenTime;
@@ -558,6 +804,10 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 	char errStr[1024];
 	struct msghdr mh;
 	struct iovec iov[1];
+	union {
+		struct cmsghdr align;	/* just for alignment */
+		uchar buf[RCV_CTLBUF_LEN];
+	} ctl;
 	DEFiRet;
 
 	multiSub.ppMsgs = pMsgs;
@@ -575,6 +825,8 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 		mh.msg_namelen = sizeof(struct sockaddr_storage); 
 		mh.msg_iov = iov;
 		mh.msg_iovlen = 1;
+		mh.msg_control = ctl.buf;
+		mh.msg_controllen = sizeof(ctl.buf);
 		lenRcvBuf = recvmsg(lstn->sock, &mh, 0);
 		STATSCOUNTER_INC(pWrkr->ctrCall_recvmsg, pWrkr->mutCtrCall_recvmsg);
 		if(lenRcvBuf < 0) {
@@ -587,11 +839,13 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 		}
 
 		++pWrkr->ctrMsgsRcvd;
+		STATSCOUNTER_INC(lstn->ctrRcvd, lstn->mutCtrRcvd);
+		updateDropStats(lstn, &mh);
 		if((runModConf->iTimeRequery == 0) || (iNbrTimeUsed++ % runModConf->iTimeRequery) == 0) {
 			datetime.getCurrTime(&stTime, &ttGenTime, TIME_IN_LOCALTIME);
 		}
 
-		CHKiRet(processPacket(lstn, frominetPrev, pbIsPermitted, pWrkr->pRcvBuf, lenRcvBuf, &stTime,
+		CHKiRet(processPacket(lstn, aclCache, pWrkr->pRcvBuf, lenRcvBuf, NULL, &stTime,
 			ttGenTime, &frominet, mh.msg_namelen, &multiSub));
 	}
 
@@ -696,6 +950,80 @@ finalize_it:
 	RETiRet;
 }
 
+/* parse the threads.cpus list, which consists of comma-separated CPU
+ * numbers and ranges (like "0-3,8"). On error, the setting is ignored.
+ */
+static void
+parseCPUList(modConfData_t *modConf, es_str_t *estr)
+{
+	char *cstr, *p;
+	long lower, upper, cpu;
+	int *newCPUs;
+
+	if((cstr = es_str2cstr(estr, NULL)) == NULL)
+		return;
+	p = cstr;
+	while(*p != '\0') {
+		lower = upper = strtol(p, &p, 10);
+		if(*p == '-')
+			upper = strtol(p + 1, &p, 10);
+		if(lower < 0 || upper < lower || (*p != ',' && *p != '\0')
+#		   ifdef CPU_SETSIZE
+		   || upper >= CPU_SETSIZE
+#		   endif
+		  ) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: invalid threads.cpus "
+					"'%s' - workers are not pinned to CPUs", cstr);
+			free(modConf->cpus);
+			modConf->cpus = NULL;
+			modConf->nCPUs = 0;
+			goto done;
+		}
+		for(cpu = lower ; cpu <= upper ; ++cpu) {
+			if((newCPUs = realloc(modConf->cpus, (modConf->nCPUs + 1) * sizeof(int))) == NULL)
+				goto done;
+			modConf->cpus = newCPUs;
+			modConf->cpus[modConf->nCPUs++] = (int) cpu;
+		}
+		if(*p == ',')
+			++p;
+	}
+#	ifndef HAVE_PTHREAD_SETAFFINITY_NP
+	errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: threads.cpus set, but "
+			"pthread_setaffinity_np() not available - ignored");
+#	endif
+done:
+	free(cstr);
+}
+
+
+/* pin the worker to its CPU as configured via threads.cpus */
+static void
+setCPUAffinity(struct wrkrInfo_s *pWrkr)
+{
+#	ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t cpuset;
+	int cpu;
+	int err;
+
+	if(runModConf->nCPUs == 0)
+		return;
+	cpu = runModConf->cpus[pWrkr->id % runModConf->nCPUs];
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if(err != 0) {
+		errmsg.LogError(err, NO_ERRCODE, "imudp: could not pin worker %d to CPU %d - ignoring",
+				pWrkr->id, cpu);
+	} else {
+		DBGPRINTF("imudp: worker %d pinned to CPU %d\n", pWrkr->id, cpu);
+	}
+#	else
+	(void) pWrkr;
+#	endif
+}
+
+
 /* set the configured scheduling policy (if possible) */
 static rsRetVal
 setSchedParams(modConfData_t *modConf)
@@ -729,16 +1057,25 @@ finalize_it:
  * interface. ./configure settings control which one is used.
  * rgerhards, 2009-09-09
  */
+/* does this worker serve the listener? The members of a SO_REUSEPORT group
+ * are spread over the workers, all other sockets are served by every worker.
+ */
+static inline int
+wrkrServesLstn(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn)
+{
+	return lstn->iReusePort == -1 || lstn->iReusePort % runModConf->wrkrMax == pWrkr->id;
+}
+
 #if defined(HAVE_EPOLL_CREATE1) || defined(HAVE_EPOLL_CREATE)
 #define NUM_EPOLL_EVENTS 10
+
 rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 {
 	DEFiRet;
 	int nfds;
 	int efd;
 	int i;
-	struct sockaddr_storage frominetPrev;
-	int bIsPermitted;
+	aclCache_t aclCache;
 	struct epoll_event *udpEPollEvt = NULL;
 	struct epoll_event currEvt[NUM_EPOLL_EVENTS];
 	char errStr[1024];
@@ -748,8 +1085,7 @@ rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 	/* start "name caching" algo by making sure the previous system indicator
 	 * is invalidated.
 	 */
-	bIsPermitted = 0;
-	memset(&frominetPrev, 0, sizeof(frominetPrev));
+	memset(&aclCache, 0, sizeof(aclCache));
 
 	/* count num listeners -- do it here in order to avoid inconsistency */
 	nLstn = 0;
@@ -784,7 +1120,7 @@ rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 	 */
 	i = 0;
 	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-		if(lstn->sock != -1) {
+		if(lstn->sock != -1 && wrkrServesLstn(pWrkr, lstn)) {
 			udpEPollEvt[i].events = EPOLLIN | EPOLLET;
 			udpEPollEvt[i].data.ptr = lstn;
 			if(epoll_ctl(efd, EPOLL_CTL_ADD,  lstn->sock, &(udpEPollEvt[i])) < 0) {
@@ -805,7 +1141,7 @@ rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 			break; /* terminate input! */
 
 		for(i = 0 ; i < nfds ; ++i) {
-			processSocket(pWrkr, currEvt[i].data.ptr, &frominetPrev, &bIsPermitted);
+			processSocket(pWrkr, currEvt[i].data.ptr, &aclCache);
 		}
 		if(pWrkr->pThrd->bShallStop == RSTRUE)
 			break; /* terminate input! */
@@ -819,21 +1155,19 @@ finalize_it:
 }
 #else /* #if HAVE_EPOLL_CREATE1 */
 /* this is the code for the select() interface */
-rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
+rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 {
 	DEFiRet;
 	int maxfds;
 	int nfds;
 	fd_set readfds;
-	struct sockaddr_storage frominetPrev;
-	int bIsPermitted;
+	aclCache_t aclCache;
 	struct lstn_s *lstn;
 
 	/* start "name caching" algo by making sure the previous system indicator
 	 * is invalidated.
 	 */
-	bIsPermitted = 0;
-	memset(&frominetPrev, 0, sizeof(frominetPrev));
+	memset(&aclCache, 0, sizeof(aclCache));
 	DBGPRINTF("imudp uses select()\n");
 
 	while(1) {
@@ -844,7 +1178,7 @@ rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
 
 		/* Add the UDP listen sockets to the list of read descriptors. */
 		for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-			if (lstn->sock != -1) {
+			if (lstn->sock != -1 && wrkrServesLstn(pWrkr, lstn)) {
 				if(Debug)
 					net.debugListenInfo(lstn->sock, "UDP");
 				FD_SET(lstn->sock, &readfds);
@@ -865,8 +1199,8 @@ rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
 			break; /* terminate input! */
 
 		for(lstn = lcnfRoot ; nfds && lstn != NULL ; lstn = lstn->next) {
-			if(FD_ISSET(lstn->sock, &readfds)) {
-		       		processSocket(pWrkr, lstn, &frominetPrev, &bIsPermitted);
+			if(lstn->sock != -1 && FD_ISSET(lstn->sock, &readfds)) {
+		       		processSocket(pWrkr, lstn, &aclCache);
 			--nfds; /* indicate we have processed one descriptor */
 			}
 	       }
@@ -937,10 +1271,45 @@ createListner(es_str_t *port, struct cnfparamvals *pvals)
 			inst->ratelimitBurst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.interval")) {
 			inst->ratelimitInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key")) {
+			propid_t propid;
+			inst->pszRatelimitKey = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(propNameToID(inst->pszRatelimitKey, &propid) != RS_RET_OK) {
+				errmsg.LogError(0, RS_RET_INVLD_PROP, "imudp: invalid property '%s' "
+						"for ratelimit.key", inst->pszRatelimitKey);
+				ABORT_FINALIZE(RS_RET_INVLD_PROP);
+			}
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key.interval")) {
+			inst->ratelimitKeyInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key.burst")) {
+			inst->ratelimitKeyBurst = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key.maxkeys")) {
+			inst->ratelimitKeyMaxKeys = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.key.dropstats")) {
+			inst->pszRatelimitKeyDropStats = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(inppblk.descr[i].name, "rcvbufsize")) {
 			inst->rcvbuf = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "ipfreebind")) {
 			inst->ipfreebind = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport.threads")) {
+#			ifdef SO_REUSEPORT
+			inst->nReusePort = (int) pvals[i].val.d.n;
+#			else
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: reuseport.threads is not "
+					"supported on this platform - ignored");
+#			endif
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport.steering")) {
+			if(!es_strconstcmp(pvals[i].val.d.estr, "cpu")) {
+				inst->bReusePortCPU = 1;
+			} else if(!es_strconstcmp(pvals[i].val.d.estr, "hash")) {
+				inst->bReusePortCPU = 0;
+			} else {
+				char *cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: invalid reuseport.steering "
+						"'%s', must be \"hash\" or \"cpu\"", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
 		} else {
 			dbgprintf("imudp: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
@@ -986,6 +1355,9 @@ CODESTARTbeginCnfLoad
 	loadModConf->configSetViaV2Method = 0;
 	loadModConf->wrkrMax = 1; /* conservative, but least msg reordering */
 	loadModConf->batchSize = BATCH_SIZE_DFLT;
+	loadModConf->nZeroCopySlabs = 0;
+	loadModConf->cpus = NULL;
+	loadModConf->nCPUs = 0;
 	loadModConf->iTimeRequery = TIME_REQUERY_DFLT;
 	loadModConf->iSchedPrio = SCHED_PRIO_UNSET;
 	loadModConf->pszSchedPolicy = NULL;
@@ -1023,6 +1395,10 @@ CODESTARTsetModCnf
 			loadModConf->iTimeRequery = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "batchsize")) {
 			loadModConf->batchSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "zerocopyslabs")) {
+			loadModConf->nZeroCopySlabs = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "threads.cpus")) {
+			parseCPUList(loadModConf, pvals[i].val.d.estr);
 		} else if(!strcmp(modpblk.descr[i].name, "schedulingpriority")) {
 			loadModConf->iSchedPrio = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "schedulingpolicy")) {
@@ -1123,6 +1499,10 @@ CODESTARTactivateCnf
 		CHKmalloc(wrkrInfo[i].recvmsg_iov = MALLOC(runModConf->batchSize * sizeof(struct iovec)));
 		CHKmalloc(wrkrInfo[i].recvmsg_mmh = MALLOC(runModConf->batchSize * sizeof(struct mmsghdr)));
 		CHKmalloc(wrkrInfo[i].frominet = MALLOC(runModConf->batchSize * sizeof(struct sockaddr_storage)));
+		CHKmalloc(wrkrInfo[i].recvmsg_ctl = MALLOC(runModConf->batchSize * RCV_CTLBUF_LEN));
+		wrkrInfo[i].pRawPool = NULL;
+		if(runModConf->nZeroCopySlabs > 0)
+			CHKiRet(msgRawPoolConstruct(&wrkrInfo[i].pRawPool, runModConf->nZeroCopySlabs, lenRcvBuf));
 #		endif
 		CHKmalloc(wrkrInfo[i].pRcvBuf = MALLOC(lenRcvBuf));
 		wrkrInfo[i].id = i;
@@ -1139,10 +1519,14 @@ CODESTARTfreeCnf
 		free(inst->pszBindAddr);
 		free(inst->inputname);
 		free(inst->dfltTZ);
+		free(inst->pszRatelimitKey);
+		free(inst->pszRatelimitKeyDropStats);
+		keyratelimitDestruct(inst->pKeyRatelimit);
 		del = inst;
 		inst = inst->next;
 		free(del);
 	}
+	free(pModConf->cpus);
 ENDfreeCnf
 
 
@@ -1173,6 +1557,7 @@ wrkr(void *myself)
 	 * privileges within the same instance.
 	 */
 	setSchedParams(runModConf);
+	setCPUAffinity(pWrkr);
 
 	/* support statistics gathering */
 	statsobj.Construct(&(pWrkr->stats));
@@ -1254,6 +1639,10 @@ CODESTARTafterRun
 		free(wrkrInfo[i].recvmsg_iov);
 		free(wrkrInfo[i].recvmsg_mmh);
 		free(wrkrInfo[i].frominet);
+		free(wrkrInfo[i].recvmsg_ctl);
+		/* slabs still referenced by queued messages are freed on release */
+		if(wrkrInfo[i].pRawPool != NULL)
+			msgRawPoolDestruct(&wrkrInfo[i].pRawPool);
 #		endif
 		free(wrkrInfo[i].pRcvBuf);
 	}
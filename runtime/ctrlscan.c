@@ -0,0 +1,156 @@
+/* ctrlscan.c
+ * Locates control characters (and optionally 8-bit characters) in received
+ * messages. Every message is checked for them before parsing, and almost
+ * none contain any, so the check is a plain scan over the whole message.
+ * On x86, SSE2 and AVX2 versions check 16 respectively 32 bytes at once.
+ * Which one is used is decided at runtime based on what the CPU supports;
+ * other platforms use the portable scalar version.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stddef.h>
+#include "ctrlscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define CTRLSCAN_X86
+#	include <immintrin.h>
+#endif
+
+
+static int
+ctrlScanScalar(const unsigned char *const buf, const int len, const int bHigh)
+{
+	const unsigned char hi = bHigh ? 0x7f : 0xff;
+	int i;
+	for(i = 0 ; i < len ; ++i) {
+		if(buf[i] < 0x20 || buf[i] > hi)
+			break;
+	}
+	return i;
+}
+
+
+#ifdef CTRLSCAN_X86
+/* There is no unsigned byte compare in SSE2/AVX2, but max(x, 0x1f) == 0x1f
+ * holds exactly for x <= 0x1f. Bytes above 0x7f have their sign bit set,
+ * which movemask picks up directly.
+ */
+static int __attribute__((target("sse2")))
+ctrlScanSSE2(const unsigned char *const buf, const int len, const int bHigh)
+{
+	const __m128i lim = _mm_set1_epi8(0x1f);
+	__m128i chunk;
+	unsigned mask;
+	int i;
+
+	for(i = 0 ; i + 16 <= len ; i += 16) {
+		chunk = _mm_loadu_si128((const __m128i*) (buf + i));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chunk, lim), lim));
+		if(bHigh)
+			mask |= _mm_movemask_epi8(chunk);
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + ctrlScanScalar(buf + i, len - i, bHigh);
+}
+
+static int __attribute__((target("avx2")))
+ctrlScanAVX2(const unsigned char *const buf, const int len, const int bHigh)
+{
+	const __m256i lim = _mm256_set1_epi8(0x1f);
+	__m256i chunk;
+	unsigned mask;
+	int i;
+
+	for(i = 0 ; i + 32 <= len ; i += 32) {
+		chunk = _mm256_loadu_si256((const __m256i*) (buf + i));
+		mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(chunk, lim), lim));
+		if(bHigh)
+			mask |= (unsigned) _mm256_movemask_epi8(chunk);
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	/* do the remaining 16 byte step here, too: calling into the SSE2
+	 * version would mix VEX and legacy encoded instructions.
+	 */
+	if(i + 16 <= len) {
+		const __m128i lim16 = _mm_set1_epi8(0x1f);
+		const __m128i chunk16 = _mm_loadu_si128((const __m128i*) (buf + i));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chunk16, lim16), lim16));
+		if(bHigh)
+			mask |= _mm_movemask_epi8(chunk16);
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+		i += 16;
+	}
+	return i + ctrlScanScalar(buf + i, len - i, bHigh);
+}
+#endif /* #ifdef CTRLSCAN_X86 */
+
+
+/* all implementations usable on this machine, best one first */
+static struct ctrlScanImpl_s impls[4];
+static ctrlScanFunc_t bestScan = NULL;
+
+static void
+ctrlScanSelect(void)
+{
+	int n = 0;
+#ifdef CTRLSCAN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		impls[n].name = "avx2";
+		impls[n++].scan = ctrlScanAVX2;
+	}
+	if(__builtin_cpu_supports("sse2")) {
+		impls[n].name = "sse2";
+		impls[n++].scan = ctrlScanSSE2;
+	}
+#endif
+	impls[n].name = "scalar";
+	impls[n++].scan = ctrlScanScalar;
+	impls[n].name = NULL;
+	impls[n].scan = NULL;
+	/* note: if multiple threads get here at the same time, they all store
+	 * the same value, so no locking is required.
+	 */
+	bestScan = impls[0].scan;
+}
+
+
+/* return the offset of the first control (or 8-bit) character in buf or
+ * len if there is none */
+int
+ctrlScan(const unsigned char *const buf, const int len, const int bHigh)
+{
+	if(bestScan == NULL)
+		ctrlScanSelect();
+	return bestScan(buf, len, bHigh);
+}
+
+
+/* return all available implementations, terminated by a NULL name. This
+ * is meant for benchmarking and testing.
+ */
+const struct ctrlScanImpl_s *
+ctrlScanGetImpls(void)
+{
+	if(bestScan == NULL)
+		ctrlScanSelect();
+	return impls;
+}
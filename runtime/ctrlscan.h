@@ -0,0 +1,37 @@
+/* header for ctrlscan.c
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_CTRLSCAN_H
+#define INCLUDED_CTRLSCAN_H
+
+/* a control character scanner returns the offset of the first byte in buf
+ * that is below 0x20 or, if bHigh is set, above 0x7f. If there is no such
+ * byte, len is returned.
+ */
+typedef int (*ctrlScanFunc_t)(const unsigned char *buf, int len, int bHigh);
+
+struct ctrlScanImpl_s {
+	const char *name;
+	ctrlScanFunc_t scan;
+};
+
+/* prototypes */
+int ctrlScan(const unsigned char *buf, int len, int bHigh);
+const struct ctrlScanImpl_s *ctrlScanGetImpls(void);
+
+#endif /* #ifndef INCLUDED_CTRLSCAN_H */
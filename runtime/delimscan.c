@@ -0,0 +1,137 @@
+/* delimscan.c
+ * Locates frame delimiters in received data. This is used by the plain tcp
+ * inputs for octet-stuffed (LF-delimited) framing, where looking at each
+ * byte individually is the dominating cost. On x86, SSE2 and AVX2 versions
+ * check 16 respectively 32 bytes at once. Which one is used is decided at
+ * runtime based on what the CPU supports; other platforms use the portable
+ * scalar version.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stddef.h>
+#include "delimscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define DELIMSCAN_X86
+#	include <immintrin.h>
+#endif
+
+
+static int
+delimScanScalar(const char *const buf, const int len, const int delim2)
+{
+	int i;
+	for(i = 0 ; i < len ; ++i) {
+		if(buf[i] == '\n' || buf[i] == (char) delim2)
+			break;
+	}
+	return i;
+}
+
+
+#ifdef DELIMSCAN_X86
+static int __attribute__((target("sse2")))
+delimScanSSE2(const char *const buf, const int len, const int delim2)
+{
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i d2 = _mm_set1_epi8((char) delim2);
+	__m128i chunk;
+	unsigned mask;
+	int i;
+
+	for(i = 0 ; i + 16 <= len ; i += 16) {
+		chunk = _mm_loadu_si128((const __m128i*) (buf + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, lf),
+						      _mm_cmpeq_epi8(chunk, d2)));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + delimScanScalar(buf + i, len - i, delim2);
+}
+
+static int __attribute__((target("avx2")))
+delimScanAVX2(const char *const buf, const int len, const int delim2)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i d2 = _mm256_set1_epi8((char) delim2);
+	__m256i chunk;
+	unsigned mask;
+	int i;
+
+	for(i = 0 ; i + 32 <= len ; i += 32) {
+		chunk = _mm256_loadu_si256((const __m256i*) (buf + i));
+		mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, lf),
+								    _mm256_cmpeq_epi8(chunk, d2)));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + delimScanSSE2(buf + i, len - i, delim2);
+}
+#endif /* #ifdef DELIMSCAN_X86 */
+
+
+/* all implementations usable on this machine, best one first */
+static struct delimScanImpl_s impls[4];
+static delimScanFunc_t bestScan = NULL;
+
+static void
+delimScanSelect(void)
+{
+	int n = 0;
+#ifdef DELIMSCAN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		impls[n].name = "avx2";
+		impls[n++].scan = delimScanAVX2;
+	}
+	if(__builtin_cpu_supports("sse2")) {
+		impls[n].name = "sse2";
+		impls[n++].scan = delimScanSSE2;
+	}
+#endif
+	impls[n].name = "scalar";
+	impls[n++].scan = delimScanScalar;
+	impls[n].name = NULL;
+	impls[n].scan = NULL;
+	/* note: if multiple threads get here at the same time, they all store
+	 * the same value, so no locking is required.
+	 */
+	bestScan = impls[0].scan;
+}
+
+
+/* return the offset of the first delimiter in buf or len if there is none */
+int
+delimScan(const char *const buf, const int len, const int delim2)
+{
+	if(bestScan == NULL)
+		delimScanSelect();
+	return bestScan(buf, len, delim2);
+}
+
+
+/* return all available implementations, terminated by a NULL name. This
+ * is meant for benchmarking and testing.
+ */
+const struct delimScanImpl_s *
+delimScanGetImpls(void)
+{
+	if(bestScan == NULL)
+		delimScanSelect();
+	return impls;
+}
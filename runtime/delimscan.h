@@ -0,0 +1,37 @@
+/* header for delimscan.c
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_DELIMSCAN_H
+#define INCLUDED_DELIMSCAN_H
+
+/* a delimiter scanner returns the offset of the first '\n' or delim2
+ * byte in buf, or len if there is none. delim2 must be a byte value;
+ * callers without an additional delimiter pass '\n'.
+ */
+typedef int (*delimScanFunc_t)(const char *buf, int len, int delim2);
+
+struct delimScanImpl_s {
+	const char *name;
+	delimScanFunc_t scan;
+};
+
+/* prototypes */
+int delimScan(const char *buf, int len, int delim2);
+const struct delimScanImpl_s *delimScanGetImpls(void);
+
+#endif /* #ifndef INCLUDED_DELIMSCAN_H */
@@ -7,6 +7,16 @@
  * In any case, even the initial implementaton is far faster than what we had
  * before. -- rgerhards, 2011-06-06
  *
+ * The cache is split into shards, each with its own mutex, hash table
+ * and LRU list, so that lookups for different senders do not contend on
+ * a single lock. Entries expire after a configurable TTL (shorter for
+ * failed lookups). Expired entries are still used, but are queued for
+ * refresh by a pool of background resolver threads, so only the very first
+ * lookup of an address blocks on DNS. The main queue may also ask the pool
+ * to resolve all new addresses of a batch in parallel (prefetch). The cache
+ * size is bounded; if a shard is full, its least recently used entry is
+ * evicted.
+ *
  * Copyright 2011-2014 by Rainer Gerhards and Adiscon GmbH.
  *
  * This file is part of the rsyslog runtime library.
@@ -34,6 +44,9 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/time.h>
+#include <errno.h>
 
 #include "syslogd-types.h"
 #include "glbl.h"
@@ -41,10 +54,16 @@
 #include "obj.h"
 #include "unicode-helper.h"
 #include "net.h"
-#include "hashtable.h"
 #include "prop.h"
+#include "statsobj.h"
+#include "srUtils.h"
 #include "dnscache.h"
 
+#define DNSCACHE_NSHARDS	16	/* must be a power of 2 */
+#define DNSCACHE_INIT_BUCKETS	64	/* initial hash buckets per shard, power of 2 */
+#define DNSCACHE_STATS_FLUSH	256	/* add shard stats to global counters every n lookups */
+#define DNSCACHE_MAX_REFRESH	1024	/* max refresh requests waiting for the resolver threads */
+
 /* module data structures */
 struct dnscache_entry_s {
 	struct sockaddr_storage addr;
@@ -52,14 +71,64 @@ struct dnscache_entry_s {
 	prop_t *fqdnLowerCase;
 	prop_t *localName; /* only local name, without domain part (if configured so) */
 	prop_t *ip;
-	struct dnscache_entry_s *next;
-	unsigned nUsed;
+	struct dnscache_entry_s *next;	/* hash chain */
+	struct dnscache_entry_s *lruPrev, *lruNext;
+	unsigned hash;
+	time_t expires;		/* entry needs refresh after this time, 0 = never */
+	sbool bNegative;	/* name could not be resolved, IP is used as name */
+	sbool bRefreshQueued;	/* resolver thread has been asked to refresh us */
 };
 typedef struct dnscache_entry_s dnscache_entry_t;
-struct dnscache_s {
-	pthread_rwlock_t rwlock;
-	struct hashtable *ht;
+
+typedef struct dnscache_shard_s {
+	pthread_mutex_t mut;
+	dnscache_entry_t **buckets;
+	unsigned nBuckets;
 	unsigned nEntries;
+	dnscache_entry_t *lruHead;	/* most recently used */
+	dnscache_entry_t *lruTail;	/* eviction candidate */
+	/* stats not yet added to the global counters (guarded by mut) */
+	unsigned nHits;
+	unsigned nMisses;
+	unsigned nEvictions;
+	unsigned nExpired;
+	unsigned nPending;
+} __attribute__((aligned(64))) dnscache_shard_t;
+
+/* a caller waiting for prefetch requests. It is reference-counted, because
+ * the caller may give up (timeout) while requests are still being resolved.
+ * Guarded by mutRefresh.
+ */
+typedef struct dnscache_waiter_s {
+	pthread_cond_t cond;
+	int nPending;	/* requests not yet done */
+	int nRefs;	/* caller + pending requests */
+} dnscache_waiter_t;
+
+typedef struct dnscache_refresh_s {
+	struct sockaddr_storage addr;
+	dnscache_waiter_t *pWaiter;	/* NULL for plain refresh requests */
+	struct dnscache_refresh_s *next;
+} dnscache_refresh_t;
+
+struct dnscache_s {
+	dnscache_shard_t shards[DNSCACHE_NSHARDS];
+	/* refresh queue for the background resolver */
+	pthread_mutex_t mutRefresh;
+	pthread_cond_t condRefresh;
+	dnscache_refresh_t *refreshRoot, *refreshLast;
+	unsigned nRefresh;
+	int nResolvers;		/* number of running resolver threads */
+	sbool bResolverStop;
+	pthread_t *tidResolvers;
+	/* stats */
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrHits, mutCtrHits)
+	STATSCOUNTER_DEF(ctrMisses, mutCtrMisses)
+	STATSCOUNTER_DEF(ctrEvictions, mutCtrEvictions)
+	STATSCOUNTER_DEF(ctrExpired, mutCtrExpired)
+	STATSCOUNTER_DEF(ctrResolves, mutCtrResolves)
+	STATSCOUNTER_DEF(ctrResolveTime, mutCtrResolveTime)
 };
 typedef struct dnscache_s dnscache_t;
 
@@ -69,39 +138,65 @@ DEFobjStaticHelpers
 DEFobjCurrIf(glbl)
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(prop)
+DEFobjCurrIf(statsobj)
 static dnscache_t dnsCache;
 static prop_t *staticErrValue;
 
 
-/* Our hash function.
- * TODO: check how well it performs on socket addresses!
+/* Our hash function. Only the address itself is used, the port does not
+ * matter for name resolution (and would blow up the cache for TCP senders).
  */
-unsigned int
-hash_from_key_fn(void *k) 
+static inline unsigned
+hashAddr(const struct sockaddr_storage *const addr)
 {
-    int len;
-    uchar *rkey = (uchar*) k; /* we treat this as opaque bytes */
-    unsigned hashval = 1;
+	const uchar *p;
+	size_t len;
+	unsigned hash = 2166136261u; /* FNV-1a */
 
-    len = SALEN((struct sockaddr*)k);
-    while(len--)
-        hashval = hashval * 33 + *rkey++;
+	if(addr->ss_family == AF_INET) {
+		p = (const uchar*) &((const struct sockaddr_in*) addr)->sin_addr;
+		len = sizeof(struct in_addr);
+	} else if(addr->ss_family == AF_INET6) {
+		p = (const uchar*) &((const struct sockaddr_in6*) addr)->sin6_addr;
+		len = sizeof(struct in6_addr);
+	} else {
+		p = (const uchar*) addr;
+		len = SALEN((struct sockaddr*) addr);
+	}
+	while(len--) {
+		hash ^= *p++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
 
-    return hashval;
+static inline int
+addrEquals(const struct sockaddr_storage *const a1, const struct sockaddr_storage *const a2)
+{
+	if(a1->ss_family != a2->ss_family)
+		return 0;
+	if(a1->ss_family == AF_INET)
+		return !memcmp(&((const struct sockaddr_in*) a1)->sin_addr,
+			       &((const struct sockaddr_in*) a2)->sin_addr, sizeof(struct in_addr));
+	if(a1->ss_family == AF_INET6)
+		return !memcmp(&((const struct sockaddr_in6*) a1)->sin6_addr,
+			       &((const struct sockaddr_in6*) a2)->sin6_addr, sizeof(struct in6_addr))
+			&& ((const struct sockaddr_in6*) a1)->sin6_scope_id
+			   == ((const struct sockaddr_in6*) a2)->sin6_scope_id;
+	return SALEN((struct sockaddr*) a1) == SALEN((struct sockaddr*) a2)
+		&& !memcmp(a1, a2, SALEN((struct sockaddr*) a1));
 }
 
-static int
-key_equals_fn(void *key1, void *key2)
+static inline dnscache_shard_t *
+getShard(const unsigned hash)
 {
-	return (SALEN((struct sockaddr*)key1) == SALEN((struct sockaddr*) key2) 
-		   && !memcmp(key1, key2, SALEN((struct sockaddr*) key1)));
+	/* use the upper bits, the lower ones select the bucket */
+	return &dnsCache.shards[(hash >> 24) & (DNSCACHE_NSHARDS - 1)];
 }
 
-/* destruct a cache entry.
- * Precondition: entry must already be unlinked from list
- */
+/* free the name properties of a cache entry (or entry-to-be) */
 static void
-entryDestruct(dnscache_entry_t *etry)
+entryDestructProps(dnscache_entry_t *etry)
 {
 	if(etry->fqdn != NULL)
 		prop.Destruct(&etry->fqdn);
@@ -111,52 +206,167 @@ entryDestruct(dnscache_entry_t *etry)
 		prop.Destruct(&etry->localName);
 	if(etry->ip != NULL)
 		prop.Destruct(&etry->ip);
+}
+
+/* destruct a cache entry.
+ * Precondition: entry must already be unlinked from list
+ */
+static void
+entryDestruct(dnscache_entry_t *etry)
+{
+	entryDestructProps(etry);
 	free(etry);
 }
 
-/* init function (must be called once) */
-rsRetVal
-dnscacheInit(void)
+
+/* add the stats gathered in a shard to the global counters.
+ * Must be called with the shard mutex locked.
+ */
+static inline void
+shardFlushStats(dnscache_shard_t *const shard)
 {
-	DEFiRet;
-	if((dnsCache.ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
-				(void(*)(void*))entryDestruct)) == NULL) {
-		DBGPRINTF("dnscache: error creating hash table!\n");
-		ABORT_FINALIZE(RS_RET_ERR); // TODO: make this degrade, but run!
-	}
-	dnsCache.nEntries = 0;
-	pthread_rwlock_init(&dnsCache.rwlock, NULL);
-	CHKiRet(objGetObjInterface(&obj)); /* this provides the root pointer for all other queries */
-	CHKiRet(objUse(glbl, CORE_COMPONENT));
-	CHKiRet(objUse(errmsg, CORE_COMPONENT));
-	CHKiRet(objUse(prop, CORE_COMPONENT));
+	STATSCOUNTER_BUMP(dnsCache.ctrHits, dnsCache.mutCtrHits, shard->nHits);
+	STATSCOUNTER_BUMP(dnsCache.ctrMisses, dnsCache.mutCtrMisses, shard->nMisses);
+	STATSCOUNTER_BUMP(dnsCache.ctrEvictions, dnsCache.mutCtrEvictions, shard->nEvictions);
+	STATSCOUNTER_BUMP(dnsCache.ctrExpired, dnsCache.mutCtrExpired, shard->nExpired);
+	shard->nHits = shard->nMisses = shard->nEvictions = shard->nExpired = 0;
+	shard->nPending = 0;
+}
 
-	prop.Construct(&staticErrValue);
-	prop.SetString(staticErrValue, (uchar*)"???", 3);
-	prop.ConstructFinalize(staticErrValue);
-finalize_it:
-	RETiRet;
+/* count a lookup; flushes the shard stats from time to time */
+static inline void
+shardCountLookup(dnscache_shard_t *const shard)
+{
+	if(++shard->nPending >= DNSCACHE_STATS_FLUSH)
+		shardFlushStats(shard);
 }
 
-/* deinit function (must be called once) */
-rsRetVal
-dnscacheDeinit(void)
+/* stats read notifier. As it is called after the counters have been read,
+ * the values are at most one interval (and DNSCACHE_STATS_FLUSH lookups
+ * per shard) late.
+ */
+static void
+dnscacheStatsRead(statsobj_t __attribute__((unused)) *stats, void __attribute__((unused)) *ctx)
 {
-	DEFiRet;
-	prop.Destruct(&staticErrValue);
-	hashtable_destroy(dnsCache.ht, 1); /* 1 => free all values automatically */
-	pthread_rwlock_destroy(&dnsCache.rwlock);
-	objRelease(glbl, CORE_COMPONENT);
-	objRelease(errmsg, CORE_COMPONENT);
-	objRelease(prop, CORE_COMPONENT);
-	RETiRet;
+	int i;
+
+	for(i = 0 ; i < DNSCACHE_NSHARDS ; ++i) {
+		pthread_mutex_lock(&dnsCache.shards[i].mut);
+		shardFlushStats(&dnsCache.shards[i]);
+		pthread_mutex_unlock(&dnsCache.shards[i].mut);
+	}
 }
 
 
+static inline void
+lruUnlink(dnscache_shard_t *const shard, dnscache_entry_t *const etry)
+{
+	if(etry->lruPrev == NULL)
+		shard->lruHead = etry->lruNext;
+	else
+		etry->lruPrev->lruNext = etry->lruNext;
+	if(etry->lruNext == NULL)
+		shard->lruTail = etry->lruPrev;
+	else
+		etry->lruNext->lruPrev = etry->lruPrev;
+}
+
+static inline void
+lruPushHead(dnscache_shard_t *const shard, dnscache_entry_t *const etry)
+{
+	etry->lruPrev = NULL;
+	etry->lruNext = shard->lruHead;
+	if(shard->lruHead == NULL)
+		shard->lruTail = etry;
+	else
+		shard->lruHead->lruPrev = etry;
+	shard->lruHead = etry;
+}
+
 static inline dnscache_entry_t*
-findEntry(struct sockaddr_storage *addr)
+findEntry(dnscache_shard_t *const shard, struct sockaddr_storage *addr, const unsigned hash)
 {
-	return((dnscache_entry_t*) hashtable_search(dnsCache.ht, addr));
+	dnscache_entry_t *etry;
+
+	for(etry = shard->buckets[hash & (shard->nBuckets - 1)] ; etry != NULL ; etry = etry->next) {
+		if(etry->hash == hash && addrEquals(&etry->addr, addr))
+			break;
+	}
+	return etry;
+}
+
+/* remove an entry from its shard. The caller must destruct it. */
+static void
+removeEntry(dnscache_shard_t *const shard, dnscache_entry_t *const etry)
+{
+	dnscache_entry_t **pp;
+
+	for(pp = &shard->buckets[etry->hash & (shard->nBuckets - 1)] ; *pp != etry ; pp = &(*pp)->next)
+		/* just search */;
+	*pp = etry->next;
+	lruUnlink(shard, etry);
+	--shard->nEntries;
+}
+
+/* double the number of hash buckets. If we run out of memory, we just keep
+ * the current (longer) chains.
+ */
+static void
+shardGrow(dnscache_shard_t *const shard)
+{
+	dnscache_entry_t **newBuckets;
+	dnscache_entry_t *etry, *next;
+	const unsigned nNew = shard->nBuckets * 2;
+	unsigned i;
+
+	if((newBuckets = calloc(nNew, sizeof(dnscache_entry_t*))) == NULL)
+		return;
+	for(i = 0 ; i < shard->nBuckets ; ++i) {
+		for(etry = shard->buckets[i] ; etry != NULL ; etry = next) {
+			next = etry->next;
+			etry->next = newBuckets[etry->hash & (nNew - 1)];
+			newBuckets[etry->hash & (nNew - 1)] = etry;
+		}
+	}
+	free(shard->buckets);
+	shard->buckets = newBuckets;
+	shard->nBuckets = nNew;
+}
+
+/* insert a (new) entry into a shard. If the shard is full, the least
+ * recently used entry is evicted and returned via ppEvicted, so that
+ * the caller can destruct it after releasing the lock.
+ */
+static void
+insertEntry(dnscache_shard_t *const shard, dnscache_entry_t *const etry, dnscache_entry_t **ppEvicted)
+{
+	unsigned maxEntries;
+	unsigned idx;
+
+	maxEntries = glblDNSCacheMaxEntries / DNSCACHE_NSHARDS;
+	if(maxEntries == 0)
+		maxEntries = 1;
+	*ppEvicted = NULL;
+	if(shard->nEntries >= maxEntries && shard->lruTail != NULL) {
+		*ppEvicted = shard->lruTail;
+		removeEntry(shard, *ppEvicted);
+		++shard->nEvictions;
+	}
+	if(shard->nEntries >= shard->nBuckets * 2)
+		shardGrow(shard);
+	idx = etry->hash & (shard->nBuckets - 1);
+	etry->next = shard->buckets[idx];
+	shard->buckets[idx] = etry;
+	lruPushHead(shard, etry);
+	++shard->nEntries;
+}
+
+/* compute the expiration time for a freshly resolved entry */
+static inline time_t
+entryExpires(const dnscache_entry_t *const etry)
+{
+	const int ttl = etry->bNegative ? glblDNSCacheNegativeTTL : glblDNSCacheTTL;
+	return (ttl == 0) ? 0 : time(NULL) + ttl;
 }
 
 
@@ -354,6 +564,8 @@ finalize_it:
 		etry->fqdn = etry->ip;
 		prop.AddRef(etry->ip);
 		etry->fqdnLowerCase = etry->ip;
+		/* cache failed lookups only for the (shorter) negative TTL */
+		etry->bNegative = !glbl.GetDisableDNS();
         }
 
 	setLocalHostName(etry);
@@ -362,72 +574,209 @@ finalize_it:
 }
 
 
-static inline rsRetVal
-addEntry(struct sockaddr_storage *addr, dnscache_entry_t **pEtry)
+/* resolve an address into a (not yet cached) entry and update the
+ * resolver stats.
+ */
+static rsRetVal
+resolveEntry(struct sockaddr_storage *addr, dnscache_entry_t *etry)
 {
-	int r;
-	struct sockaddr_storage *keybuf;
-	dnscache_entry_t *etry = NULL;
+	struct timeval tvStart, tvEnd;
+	long long usecs;
 	DEFiRet;
 
-	CHKmalloc(etry = MALLOC(sizeof(dnscache_entry_t)));
-	CHKiRet(resolveAddr(addr, etry));
-	memcpy(&etry->addr, addr, SALEN((struct sockaddr*) addr));
-	etry->nUsed = 0;
-	*pEtry = etry;
+	etry->fqdn = etry->fqdnLowerCase = etry->localName = etry->ip = NULL;
+	etry->bNegative = 0;
+	gettimeofday(&tvStart, NULL);
+	iRet = resolveAddr(addr, etry);
+	gettimeofday(&tvEnd, NULL);
+	usecs = (tvEnd.tv_sec - tvStart.tv_sec) * 1000000LL + (tvEnd.tv_usec - tvStart.tv_usec);
+	STATSCOUNTER_INC(dnsCache.ctrResolves, dnsCache.mutCtrResolves);
+	STATSCOUNTER_BUMP(dnsCache.ctrResolveTime, dnsCache.mutCtrResolveTime, usecs < 0 ? 0 : usecs);
+	if(iRet == RS_RET_OK)
+		etry->expires = entryExpires(etry);
+	RETiRet;
+}
 
-	CHKmalloc(keybuf = malloc(sizeof(struct sockaddr_storage)));
-	memcpy(keybuf, addr, sizeof(struct sockaddr_storage));
 
-	pthread_rwlock_unlock(&dnsCache.rwlock); /* release read lock */
-	pthread_rwlock_wrlock(&dnsCache.rwlock); /* and re-aquire for writing */
-	r = hashtable_insert(dnsCache.ht, keybuf, *pEtry);
-	if(r == 0) {
-		DBGPRINTF("dnscache: inserting element failed\n");
+/* release a waiter reference. Must be called with mutRefresh locked. */
+static inline void
+waiterRelease(dnscache_waiter_t *const pWaiter)
+{
+	if(--pWaiter->nRefs == 0) {
+		pthread_cond_destroy(&pWaiter->cond);
+		free(pWaiter);
 	}
-	pthread_rwlock_unlock(&dnsCache.rwlock);
-	pthread_rwlock_rdlock(&dnsCache.rwlock); /* we need this again */
+}
 
-finalize_it:
-	if(iRet != RS_RET_OK && etry != NULL) {
-		/* Note: sub-fields cannot be populated in this case */
-		free(etry);
+
+/* the background resolvers: refresh expired entries, so that lookups
+ * never need to wait for DNS once an address is cached, and resolve
+ * new addresses for prefetch requests.
+ */
+static void *
+resolverThread(void __attribute__((unused)) *arg)
+{
+	dnscache_refresh_t *req;
+	dnscache_entry_t tmp;
+	dnscache_entry_t *etry;
+	dnscache_entry_t *newEtry;
+	dnscache_entry_t *toDestruct;
+	dnscache_entry_t *evicted;
+	dnscache_shard_t *shard;
+	sigset_t sigSet;
+	unsigned hash;
+	rsRetVal localRet;
+
+	/* signals are handled by the main thread */
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+
+	pthread_mutex_lock(&dnsCache.mutRefresh);
+	while(1) {
+		while(dnsCache.refreshRoot == NULL && !dnsCache.bResolverStop)
+			pthread_cond_wait(&dnsCache.condRefresh, &dnsCache.mutRefresh);
+		if(dnsCache.bResolverStop)
+			break;
+		req = dnsCache.refreshRoot;
+		dnsCache.refreshRoot = req->next;
+		if(dnsCache.refreshRoot == NULL)
+			dnsCache.refreshLast = NULL;
+		--dnsCache.nRefresh;
+		pthread_mutex_unlock(&dnsCache.mutRefresh);
+
+		localRet = resolveEntry(&req->addr, &tmp);
+		hash = hashAddr(&req->addr);
+		shard = getShard(hash);
+		newEtry = NULL;
+		if(localRet == RS_RET_OK && req->pWaiter != NULL)
+			newEtry = malloc(sizeof(dnscache_entry_t));
+		toDestruct = evicted = NULL;
+		pthread_mutex_lock(&shard->mut);
+		etry = findEntry(shard, &req->addr, hash);
+		if(etry != NULL) {
+			if(localRet == RS_RET_OK) {
+				/* swap in the new names, the old ones are freed
+				 * below (users hold their own references)
+				 */
+				prop_t *p;
+				p = etry->fqdn; etry->fqdn = tmp.fqdn; tmp.fqdn = p;
+				p = etry->fqdnLowerCase; etry->fqdnLowerCase = tmp.fqdnLowerCase; tmp.fqdnLowerCase = p;
+				p = etry->localName; etry->localName = tmp.localName; tmp.localName = p;
+				p = etry->ip; etry->ip = tmp.ip; tmp.ip = p;
+				etry->bNegative = tmp.bNegative;
+				etry->expires = tmp.expires;
+				etry->bRefreshQueued = 0;
+			} else {
+				/* e.g. a malicious PTR record now: drop the entry, the next
+				 * lookup re-resolves and handles the error as configured.
+				 */
+				removeEntry(shard, etry);
+				toDestruct = etry;
+			}
+		} else if(newEtry != NULL) {
+			/* prefetch of a new address */
+			*newEtry = tmp;
+			memcpy(&newEtry->addr, &req->addr, SALEN((struct sockaddr*) &req->addr));
+			newEtry->hash = hash;
+			newEtry->bRefreshQueued = 0;
+			insertEntry(shard, newEtry, &evicted);
+			tmp.fqdn = tmp.fqdnLowerCase = tmp.localName = tmp.ip = NULL;
+			newEtry = NULL;
+		}
+		pthread_mutex_unlock(&shard->mut);
+		if(toDestruct != NULL)
+			entryDestruct(toDestruct);
+		if(evicted != NULL)
+			entryDestruct(evicted);
+		free(newEtry);
+		entryDestructProps(&tmp);
+
+		pthread_mutex_lock(&dnsCache.mutRefresh);
+		if(req->pWaiter != NULL) {
+			if(--req->pWaiter->nPending == 0)
+				pthread_cond_signal(&req->pWaiter->cond);
+			waiterRelease(req->pWaiter);
+		}
+		free(req);
 	}
-	RETiRet;
+	pthread_mutex_unlock(&dnsCache.mutRefresh);
+	return NULL;
 }
 
 
-/* validate if an entry is still valid and, if not, re-query it.
- * In the initial implementation, this is a dummy!
- * TODO: implement!
+/* make sure the resolver threads are running. They are started on first
+ * use, because we must not create them before rsyslogd forks.
+ * Must be called with mutRefresh locked. Returns 1 if at least one resolver
+ * is available.
  */
-static inline rsRetVal
-validateEntry(dnscache_entry_t __attribute__((unused)) *etry, struct sockaddr_storage __attribute__((unused)) *addr)
+static int
+startResolvers(void)
 {
-	return RS_RET_OK;
+	int nThreads;
+
+	if(dnsCache.nResolvers > 0 || dnsCache.bResolverStop)
+		goto done;
+	nThreads = glblDNSCacheResolverThreads;
+	if((dnsCache.tidResolvers = calloc(nThreads, sizeof(pthread_t))) == NULL)
+		goto done;
+	while(dnsCache.nResolvers < nThreads) {
+		if(pthread_create(&dnsCache.tidResolvers[dnsCache.nResolvers], NULL,
+		                  resolverThread, NULL) != 0) {
+			DBGPRINTF("dnscache: could only start %d of %d resolver threads\n",
+				  dnsCache.nResolvers, nThreads);
+			break;
+		}
+		++dnsCache.nResolvers;
+	}
+done:
+	return dnsCache.nResolvers > 0;
 }
 
 
-/* This is the main function: it looks up an entry and returns it's name
- * and IP address. If the entry is not yet inside the cache, it is added.
- * If the entry can not be resolved, an error is reported back. If fqdn
- * or fqdnLowerCase are NULL, they are not set.
+/* append a request to the resolver queue. Must be called with mutRefresh locked. */
+static inline void
+enqueueRequest(dnscache_refresh_t *const req)
+{
+	req->next = NULL;
+	if(dnsCache.refreshLast == NULL)
+		dnsCache.refreshRoot = req;
+	else
+		dnsCache.refreshLast->next = req;
+	dnsCache.refreshLast = req;
+	++dnsCache.nRefresh;
+	pthread_cond_signal(&dnsCache.condRefresh);
+}
+
+
+/* ask the resolver threads to refresh an address.
+ * Returns 1 if the request was queued, 0 otherwise.
  */
-rsRetVal
-dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase,
-	       prop_t **localName, prop_t **ip)
+static int
+queueRefresh(struct sockaddr_storage *addr)
 {
-	dnscache_entry_t *etry;
-	DEFiRet;
+	dnscache_refresh_t *req;
+	int bQueued = 0;
 
-	pthread_rwlock_rdlock(&dnsCache.rwlock); /* TODO: optimize this! */
-	etry = findEntry(addr);
-	dbgprintf("dnscache: entry %p found\n", etry);
-	if(etry == NULL) {
-		CHKiRet(addEntry(addr, &etry));
-	} else {
-		CHKiRet(validateEntry(etry, addr));
-	}
+	pthread_mutex_lock(&dnsCache.mutRefresh);
+	if(dnsCache.nRefresh >= DNSCACHE_MAX_REFRESH || !startResolvers())
+		goto done;
+	if((req = malloc(sizeof(dnscache_refresh_t))) == NULL)
+		goto done;
+	memcpy(&req->addr, addr, sizeof(struct sockaddr_storage));
+	req->pWaiter = NULL;
+	enqueueRequest(req);
+	bQueued = 1;
+done:
+	pthread_mutex_unlock(&dnsCache.mutRefresh);
+	return bQueued;
+}
+
+
+/* hand out the names of an entry to the caller (who gets own references) */
+static inline void
+entryGetProps(dnscache_entry_t *etry, prop_t **fqdn, prop_t **fqdnLowerCase,
+	       prop_t **localName, prop_t **ip)
+{
 	prop.AddRef(etry->ip);
 	*ip = etry->ip;
 	if(fqdn != NULL) {
@@ -442,9 +791,88 @@ dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerC
 		prop.AddRef(etry->localName);
 		*localName = etry->localName;
 	}
+}
+
+
+/* look up a cached entry, account for the lookup, mark the entry as
+ * recently used and queue a refresh if it is expired.
+ * Must be called with the shard mutex locked. Returns NULL if not cached.
+ */
+static dnscache_entry_t *
+lookupEntry(dnscache_shard_t *const shard, struct sockaddr_storage *addr, const unsigned hash)
+{
+	dnscache_entry_t *etry;
+
+	etry = findEntry(shard, addr, hash);
+	if(etry == NULL) {
+		++shard->nMisses;
+	} else {
+		++shard->nHits;
+		if(etry != shard->lruHead) {
+			lruUnlink(shard, etry);
+			lruPushHead(shard, etry);
+		}
+		if(etry->expires != 0 && !etry->bRefreshQueued && time(NULL) >= etry->expires) {
+			++shard->nExpired;
+			etry->bRefreshQueued = queueRefresh(addr);
+		}
+	}
+	shardCountLookup(shard);
+	return etry;
+}
+
+
+/* This is the main function: it looks up an entry and returns it's name
+ * and IP address. If the entry is not yet inside the cache, it is added.
+ * If the entry can not be resolved, an error is reported back. If fqdn
+ * or fqdnLowerCase are NULL, they are not set.
+ * Only a cache miss resolves synchronously (and without holding any lock);
+ * expired entries are returned as they are and refreshed in the background.
+ */
+rsRetVal
+dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase,
+	       prop_t **localName, prop_t **ip)
+{
+	dnscache_entry_t *etry;
+	dnscache_entry_t *newEtry = NULL;
+	dnscache_entry_t *evicted = NULL;
+	dnscache_shard_t *shard;
+	unsigned hash;
+	DEFiRet;
+
+	hash = hashAddr(addr);
+	shard = getShard(hash);
+	pthread_mutex_lock(&shard->mut);
+	etry = lookupEntry(shard, addr, hash);
+	if(etry != NULL) {
+		entryGetProps(etry, fqdn, fqdnLowerCase, localName, ip);
+		pthread_mutex_unlock(&shard->mut);
+		FINALIZE;
+	}
+	pthread_mutex_unlock(&shard->mut);
+
+	/* not cached, resolve without holding the lock */
+	CHKmalloc(newEtry = MALLOC(sizeof(dnscache_entry_t)));
+	CHKiRet(resolveEntry(addr, newEtry));
+	memcpy(&newEtry->addr, addr, SALEN((struct sockaddr*) addr));
+	newEtry->hash = hash;
+	newEtry->bRefreshQueued = 0;
+
+	pthread_mutex_lock(&shard->mut);
+	etry = findEntry(shard, addr, hash);
+	if(etry == NULL) { /* else someone else was faster, and we use theirs */
+		insertEntry(shard, newEtry, &evicted);
+		etry = newEtry;
+		newEtry = NULL;
+	}
+	entryGetProps(etry, fqdn, fqdnLowerCase, localName, ip);
+	pthread_mutex_unlock(&shard->mut);
+	if(evicted != NULL)
+		entryDestruct(evicted);
 
 finalize_it:
-	pthread_rwlock_unlock(&dnsCache.rwlock);
+	if(newEtry != NULL)
+		entryDestruct(newEtry);
 	if(iRet != RS_RET_OK && iRet != RS_RET_ADDRESS_UNKNOWN) {
 		DBGPRINTF("dnscacheLookup failed with iRet %d\n", iRet);
 		prop.AddRef(staticErrValue);
@@ -464,3 +892,230 @@ finalize_it:
 	}
 	RETiRet;
 }
+
+
+/* Like dnscacheLookup(), but never waits for DNS: if the address is not
+ * cached, the IP address is returned as name (and nothing is cached).
+ * This is used after a prefetch timed out.
+ */
+rsRetVal
+dnscacheLookupNoWait(struct sockaddr_storage *addr, prop_t **localName, prop_t **ip)
+{
+	dnscache_entry_t *etry;
+	dnscache_shard_t *shard;
+	unsigned hash;
+	char szIP[80]; /* large enough for IPv6 */
+	int error;
+	DEFiRet;
+
+	hash = hashAddr(addr);
+	shard = getShard(hash);
+	pthread_mutex_lock(&shard->mut);
+	etry = lookupEntry(shard, addr, hash);
+	if(etry != NULL)
+		entryGetProps(etry, NULL, NULL, localName, ip);
+	pthread_mutex_unlock(&shard->mut);
+	if(etry != NULL)
+		FINALIZE;
+
+	error = mygetnameinfo((struct sockaddr *)addr, SALEN((struct sockaddr *)addr),
+			      szIP, sizeof(szIP), NULL, 0, NI_NUMERICHOST);
+	if(error) {
+		DBGPRINTF("dnscacheLookupNoWait: malformed from address %s\n", gai_strerror(error));
+		ABORT_FINALIZE(RS_RET_INVALID_SOURCE);
+	}
+	CHKiRet(prop.CreateStringProp(ip, (uchar*)szIP, strlen(szIP)));
+	prop.AddRef(*ip);
+	*localName = *ip;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Resolve a set of addresses in parallel by the resolver threads and wait
+ * until all of them are cached, but at most timeoutMs milliseconds. Addresses
+ * which are already cached are skipped. Lookups which time out are continued
+ * in the background.
+ * Returns an error if the addresses can not be resolved asynchronously
+ * (including when the resolver queue is full, DNSCACHE_MAX_REFRESH), in
+ * which case the caller should use dnscacheLookup().
+ */
+rsRetVal
+dnscachePrefetch(struct sockaddr_storage **addrs, const int nAddrs, const int timeoutMs)
+{
+	dnscache_waiter_t *pWaiter = NULL;
+	dnscache_refresh_t *reqRoot = NULL;
+	dnscache_refresh_t *req;
+	dnscache_shard_t *shard;
+	struct timespec tsTimeout;
+	unsigned hash;
+	int bCached;
+	int i, j;
+	DEFiRet;
+
+	/* collect what is not yet cached (without counting it as lookup) */
+	for(i = 0 ; i < nAddrs ; ++i) {
+		for(j = 0 ; j < i ; ++j) {
+			if(addrEquals(addrs[i], addrs[j]))
+				break;
+		}
+		if(j < i)
+			continue; /* duplicate */
+		hash = hashAddr(addrs[i]);
+		shard = getShard(hash);
+		pthread_mutex_lock(&shard->mut);
+		bCached = findEntry(shard, addrs[i], hash) != NULL;
+		pthread_mutex_unlock(&shard->mut);
+		if(bCached)
+			continue;
+		CHKmalloc(req = malloc(sizeof(dnscache_refresh_t)));
+		memcpy(&req->addr, addrs[i], sizeof(struct sockaddr_storage));
+		req->next = reqRoot;
+		reqRoot = req;
+	}
+	if(reqRoot == NULL)
+		FINALIZE;
+
+	CHKmalloc(pWaiter = calloc(1, sizeof(dnscache_waiter_t)));
+	pthread_cond_init(&pWaiter->cond, NULL);
+	pWaiter->nRefs = 1;
+
+	pthread_mutex_lock(&dnsCache.mutRefresh);
+	if(!startResolvers()) {
+		pthread_mutex_unlock(&dnsCache.mutRefresh);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	while(reqRoot != NULL && dnsCache.nRefresh < DNSCACHE_MAX_REFRESH) {
+		req = reqRoot;
+		reqRoot = req->next;
+		req->pWaiter = pWaiter;
+		++pWaiter->nPending;
+		++pWaiter->nRefs;
+		enqueueRequest(req);
+	}
+	timeoutComp(&tsTimeout, timeoutMs);
+	while(pWaiter->nPending > 0) {
+		if(pthread_cond_timedwait(&pWaiter->cond, &dnsCache.mutRefresh, &tsTimeout) == ETIMEDOUT) {
+			DBGPRINTF("dnscachePrefetch: %d lookups timed out, continuing in background\n",
+				  pWaiter->nPending);
+			break;
+		}
+	}
+	waiterRelease(pWaiter);
+	pWaiter = NULL;
+	pthread_mutex_unlock(&dnsCache.mutRefresh);
+	if(reqRoot != NULL) {
+		/* resolver queue full, the rest is for the caller's synchronous lookup */
+		DBGPRINTF("dnscachePrefetch: resolver queue full, not all addresses prefetched\n");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
+finalize_it:
+	if(pWaiter != NULL) {
+		pthread_cond_destroy(&pWaiter->cond);
+		free(pWaiter);
+	}
+	while(reqRoot != NULL) {
+		req = reqRoot;
+		reqRoot = req->next;
+		free(req);
+	}
+	RETiRet;
+}
+
+
+/* init function (must be called once) */
+rsRetVal
+dnscacheInit(void)
+{
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < DNSCACHE_NSHARDS ; ++i) {
+		pthread_mutex_init(&dnsCache.shards[i].mut, NULL);
+		CHKmalloc(dnsCache.shards[i].buckets = calloc(DNSCACHE_INIT_BUCKETS, sizeof(dnscache_entry_t*)));
+		dnsCache.shards[i].nBuckets = DNSCACHE_INIT_BUCKETS;
+	}
+	pthread_mutex_init(&dnsCache.mutRefresh, NULL);
+	pthread_cond_init(&dnsCache.condRefresh, NULL);
+	CHKiRet(objGetObjInterface(&obj)); /* this provides the root pointer for all other queries */
+	CHKiRet(objUse(glbl, CORE_COMPONENT));
+	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(prop, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+
+	prop.Construct(&staticErrValue);
+	prop.SetString(staticErrValue, (uchar*)"???", 3);
+	prop.ConstructFinalize(staticErrValue);
+
+	CHKiRet(statsobj.Construct(&dnsCache.stats));
+	CHKiRet(statsobj.SetName(dnsCache.stats, UCHAR_CONSTANT("dnscache")));
+	CHKiRet(statsobj.SetOrigin(dnsCache.stats, UCHAR_CONSTANT("core.dnscache")));
+	STATSCOUNTER_INIT(dnsCache.ctrHits, dnsCache.mutCtrHits);
+	CHKiRet(statsobj.AddCounter(dnsCache.stats, UCHAR_CONSTANT("hits"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &dnsCache.ctrHits));
+	STATSCOUNTER_INIT(dnsCache.ctrMisses, dnsCache.mutCtrMisses);
+	CHKiRet(statsobj.AddCounter(dnsCache.stats, UCHAR_CONSTANT("misses"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &dnsCache.ctrMisses));
+	STATSCOUNTER_INIT(dnsCache.ctrEvictions, dnsCache.mutCtrEvictions);
+	CHKiRet(statsobj.AddCounter(dnsCache.stats, UCHAR_CONSTANT("evictions"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &dnsCache.ctrEvictions));
+	STATSCOUNTER_INIT(dnsCache.ctrExpired, dnsCache.mutCtrExpired);
+	CHKiRet(statsobj.AddCounter(dnsCache.stats, UCHAR_CONSTANT("expired"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &dnsCache.ctrExpired));
+	STATSCOUNTER_INIT(dnsCache.ctrResolves, dnsCache.mutCtrResolves);
+	CHKiRet(statsobj.AddCounter(dnsCache.stats, UCHAR_CONSTANT("resolver.calls"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &dnsCache.ctrResolves));
+	STATSCOUNTER_INIT(dnsCache.ctrResolveTime, dnsCache.mutCtrResolveTime);
+	CHKiRet(statsobj.AddCounter(dnsCache.stats, UCHAR_CONSTANT("resolver.time.us"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &dnsCache.ctrResolveTime));
+	CHKiRet(statsobj.SetReadNotifier(dnsCache.stats, dnscacheStatsRead, NULL));
+	CHKiRet(statsobj.ConstructFinalize(dnsCache.stats));
+finalize_it:
+	RETiRet;
+}
+
+/* deinit function (must be called once) */
+rsRetVal
+dnscacheDeinit(void)
+{
+	dnscache_refresh_t *req;
+	dnscache_entry_t *etry, *next;
+	int i;
+	DEFiRet;
+
+	pthread_mutex_lock(&dnsCache.mutRefresh);
+	dnsCache.bResolverStop = 1;
+	pthread_cond_broadcast(&dnsCache.condRefresh);
+	pthread_mutex_unlock(&dnsCache.mutRefresh);
+	for(i = 0 ; i < dnsCache.nResolvers ; ++i)
+		pthread_join(dnsCache.tidResolvers[i], NULL);
+	free(dnsCache.tidResolvers);
+	while(dnsCache.refreshRoot != NULL) {
+		req = dnsCache.refreshRoot;
+		dnsCache.refreshRoot = req->next;
+		if(req->pWaiter != NULL)
+			waiterRelease(req->pWaiter);
+		free(req);
+	}
+	pthread_cond_destroy(&dnsCache.condRefresh);
+	pthread_mutex_destroy(&dnsCache.mutRefresh);
+
+	for(i = 0 ; i < DNSCACHE_NSHARDS ; ++i) {
+		for(etry = dnsCache.shards[i].lruHead ; etry != NULL ; etry = next) {
+			next = etry->lruNext;
+			entryDestruct(etry);
+		}
+		free(dnsCache.shards[i].buckets);
+		pthread_mutex_destroy(&dnsCache.shards[i].mut);
+	}
+	if(dnsCache.stats != NULL)
+		statsobj.Destruct(&dnsCache.stats);
+	prop.Destruct(&staticErrValue);
+	objRelease(glbl, CORE_COMPONENT);
+	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(prop, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
+	RETiRet;
+}
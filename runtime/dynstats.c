@@ -27,6 +27,7 @@
 #include "errmsg.h"
 #include "rsconf.h"
 #include "unicode-helper.h"
+#include "shardctr.h"
 
 /* definitions for objects we access */
 DEFobjStaticHelpers
@@ -44,7 +45,7 @@ DEFobjCurrIf(statsobj)
 
 #define DYNSTATS_MAX_BUCKET_NS_METRIC_LENGTH 100
 #define DYNSTATS_METRIC_NAME_SEPARATOR '.'
-#define DYNSTATS_HASHTABLE_SIZE_OVERPROVISIONING 1.25
+#define DYNSTATS_SLOTS_PER_METRIC 2 /* keeps linear probing short */
 
 static struct cnfparamdescr modpdescr[] = {
 	{ DYNSTATS_PARAM_NAME, eCmdHdlrString, CNFPARAM_REQUIRED },
@@ -69,46 +70,90 @@ finalize_it:
 	RETiRet;
 }
 
+static rsRetVal dynstats_findOrAddCtr(dynstats_bucket_t *b, dynstats_gen_t *gen, const uchar *metric,
+	dynstats_ctr_t **ppCtr);
+
 static inline void
 dynstats_destroyCtr(dynstats_bucket_t *b, dynstats_ctr_t *ctr, uint8_t destructStatsCtr) {
-	if (destructStatsCtr) {
+	if (destructStatsCtr && ctr->pCtr != NULL) {
 		statsobj.DestructCounter(b->stats, ctr->pCtr);
 	}
 	free(ctr->metric);
 	free(ctr);
 }
 
-static inline void /* assumes exclusive access to bucket */
-dynstats_destroyCounters(dynstats_bucket_t *b) {
-	dynstats_ctr_t *ctr;
+static rsRetVal
+dynstats_initGen(dynstats_bucket_t *b, dynstats_gen_t *gen) {
+	DEFiRet;
 
-    hashtable_destroy(b->table, 0);
-	statsobj.DestructAllCounters(b->stats);
-	while(1) {
-        ctr = b->ctrs;
-		if (ctr == NULL) {
-			break;
-		} else {
-            b->ctrs = ctr->next;
-			dynstats_destroyCtr(b, ctr, 0);
+	gen->nSlots = 2;
+	while (gen->nSlots < DYNSTATS_SLOTS_PER_METRIC * b->maxCardinality) {
+		gen->nSlots *= 2;
+	}
+	CHKmalloc(gen->slots = calloc(gen->nSlots, sizeof(dynstats_ctr_t*)));
+	gen->metricCount = 0;
+finalize_it:
+	RETiRet;
+}
+
+/* Discard all metrics of a generation that is no longer used. If carryTo
+ * is given, counts that were not yet reported are added to the same
+ * metric there, so that increments done while the purge was in progress
+ * are not lost. Each counter is unregistered before its value is read:
+ * DestructCounter() waits for a stats reader that is emitting (and maybe
+ * resetting) it, so afterwards the value holds exactly what was never
+ * reported and no increment is counted twice.
+ */
+static void
+dynstats_destroyGen(dynstats_bucket_t *b, dynstats_gen_t *gen, dynstats_gen_t *carryTo) {
+	dynstats_ctr_t *ctr, *newCtr;
+	uint32_t i;
+	unsigned nPurged = 0;
+
+	if (gen->slots == NULL) {
+		return;
+	}
+	for (i = 0 ; i < gen->nSlots ; ++i) {
+		if ((ctr = gen->slots[i]) == NULL) {
+			continue;
+		}
+		if (ctr->pCtr != NULL) {
+			statsobj.DestructCounter(b->stats, ctr->pCtr);
+			ctr->pCtr = NULL;
 		}
+		if (carryTo != NULL && ctr->ctr != 0) {
+			if (dynstats_findOrAddCtr(b, carryTo, ctr->metric, &newCtr) == RS_RET_OK) {
+				STATSCOUNTER_BUMP(newCtr->ctr, newCtr->mutCtr, ctr->ctr);
+			} else {
+				STATSCOUNTER_INC(b->ctrOpsOverflow, b->mutCtrOpsOverflow);
+			}
+		}
+		dynstats_destroyCtr(b, ctr, 0);
+		++nPurged;
 	}
-	STATSCOUNTER_BUMP(b->ctrMetricsPurged, b->mutCtrMetricsPurged, b->metricCount);
+	free(gen->slots);
+	gen->slots = NULL;
+	STATSCOUNTER_BUMP(b->ctrMetricsPurged, b->mutCtrMetricsPurged, nPurged);
 }
 
 void
 dynstats_destroyBucket(dynstats_bucket_t* b) {
 	dynstats_buckets_t *bkts;
+	int i;
 
 	bkts = &loadConf->dynstats_buckets;
 
-	pthread_rwlock_wrlock(&b->lock);
-	dynstats_destroyCounters(b);
+	pthread_mutex_lock(&b->mutPurge);
+	for (i = 0 ; i < 2 ; ++i) {
+		dynstats_destroyGen(b, &b->gens[i], NULL);
+		DESTROY_ATOMIC_HELPER_MUT(b->gens[i].mutMetricCount);
+		DESTROY_ATOMIC_HELPER_MUT(b->gens[i].mutSlots);
+	}
 	statsobj.Destruct(&b->stats);
 	free(b->name);
-	pthread_rwlock_unlock(&b->lock);
-	pthread_rwlock_destroy(&b->lock);
-	pthread_mutex_destroy(&b->mutMetricCount);
+	pthread_mutex_unlock(&b->mutPurge);
+	pthread_mutex_destroy(&b->mutPurge);
+	shardEpochDestruct(&b->writers);
 	statsobj.DestructCounter(bkts->global_stats, b->pOpsOverflowCtr);
 	statsobj.DestructCounter(bkts->global_stats, b->pNewMetricAddCtr);
 	statsobj.DestructCounter(bkts->global_stats, b->pNoMetricCtr);
@@ -194,29 +239,35 @@ finalize_it:
 	RETiRet;
 }
 
-static void
-no_op_free(void __attribute__((unused)) *ignore)  {}
-
+/* Switch writers to a fresh generation. With do_purge, the metrics of the
+ * previous one are discarded once its last writer is gone. Writers are
+ * never blocked by this.
+ */
 static rsRetVal
 dynstats_resetBucket(dynstats_bucket_t *b, uint8_t do_purge) {
-	size_t htab_sz;
+	dynstats_gen_t *oldGen, *newGen;
+	int iOld;
 	DEFiRet;
-	htab_sz = (size_t) (DYNSTATS_HASHTABLE_SIZE_OVERPROVISIONING * b->maxCardinality + 1);
-	pthread_rwlock_wrlock(&b->lock);
-	if (do_purge) {
-		dynstats_destroyCounters(b);
-	}
-	ATOMIC_STORE_0_TO_INT(&b->metricCount, &b->mutMetricCount);
-	STATSCOUNTER_INC(b->ctrPurgeTriggered, b->mutCtrPurgeTriggered);
-    b->ctrs = NULL;
-	if ((b->table = create_hashtable(htab_sz, hash_from_string, key_equals_string, no_op_free)) == NULL) {
+
+	pthread_mutex_lock(&b->mutPurge);
+	iOld = shardEpochCurrent(&b->writers);
+	oldGen = &b->gens[iOld];
+	newGen = &b->gens[1 - iOld];
+	if (dynstats_initGen(b, newGen) != RS_RET_OK) {
 		errmsg.LogError(errno, RS_RET_INTERNAL_ERROR, "error trying to initialize hash-table for dyn-stats bucket named: %s", b->name);
 		ABORT_FINALIZE(RS_RET_INTERNAL_ERROR);
 	}
-			
+	shardEpochSwitch(&b->writers);
+	if (do_purge) {
+		/* writers only do a lookup and an increment, so this is short */
+		shardEpochWaitReaders(&b->writers, iOld);
+		dynstats_destroyGen(b, oldGen, b->resettable ? newGen : NULL);
+	}
+	STATSCOUNTER_INC(b->ctrPurgeTriggered, b->mutCtrPurgeTriggered);
+
 	timeoutComp(&b->metricCleanupTimeout, b->unusedMetricLife);
 finalize_it:
-	pthread_rwlock_unlock(&b->lock);
+	pthread_mutex_unlock(&b->mutPurge);
 	if (iRet != RS_RET_OK) {
 		statsobj.Destruct(&b->stats);
 	}
@@ -226,9 +277,9 @@ finalize_it:
 static inline void
 dynstats_resetIfExpired(dynstats_bucket_t *b) {
 	long timeout;
-	pthread_rwlock_rdlock(&b->lock);
+	pthread_mutex_lock(&b->mutPurge);
 	timeout = timeoutVal(&b->metricCleanupTimeout);
-	pthread_rwlock_unlock(&b->lock);
+	pthread_mutex_unlock(&b->mutPurge);
 	if (timeout == 0) {
 		errmsg.LogMsg(0, RS_RET_TIMED_OUT, LOG_INFO, "dynstats: bucket '%s' is being reset", b->name);
 		dynstats_resetBucket(b, 1);
@@ -264,11 +315,11 @@ static rsRetVal
 dynstats_newBucket(const uchar* name, uint8_t resettable, uint32_t maxCardinality, uint32_t unusedMetricLife) {
 	dynstats_bucket_t *b;
 	dynstats_buckets_t *bkts;
-	uint8_t lock_initialized, metric_count_mutex_initialized;
-	pthread_rwlockattr_t bucket_lock_attr;
+	uint8_t lock_initialized;
+	int i;
 	DEFiRet;
 
-	lock_initialized = metric_count_mutex_initialized = 0;
+	lock_initialized = 0;
 	b = NULL;
 	
 	bkts = &loadConf->dynstats_buckets;
@@ -280,15 +331,13 @@ dynstats_newBucket(const uchar* name, uint8_t resettable, uint32_t maxCardinalit
 		b->unusedMetricLife = 1000 * unusedMetricLife; 
 		CHKmalloc(b->name = ustrdup(name));
 
-		pthread_rwlockattr_init(&bucket_lock_attr);
-#ifdef HAVE_PTHREAD_RWLOCKATTR_SETKIND_NP
-		pthread_rwlockattr_setkind_np(&bucket_lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
-#endif
-
-		pthread_rwlock_init(&b->lock, &bucket_lock_attr);
+		pthread_mutex_init(&b->mutPurge, NULL);
+		shardEpochInit(&b->writers);
+		for (i = 0 ; i < 2 ; ++i) {
+			INIT_ATOMIC_HELPER_MUT(b->gens[i].mutMetricCount);
+			INIT_ATOMIC_HELPER_MUT(b->gens[i].mutSlots);
+		}
 		lock_initialized = 1;
-		pthread_mutex_init(&b->mutMetricCount, NULL);
-		metric_count_mutex_initialized = 1;
 
 		CHKiRet(dynstats_initNewBucketStats(b));
 
@@ -310,11 +359,13 @@ dynstats_newBucket(const uchar* name, uint8_t resettable, uint32_t maxCardinalit
 	}
 finalize_it:
 	if (iRet != RS_RET_OK) {
-		if (metric_count_mutex_initialized) {
-			pthread_mutex_destroy(&b->mutMetricCount);
-		}
 		if (lock_initialized) {
-			pthread_rwlock_destroy(&b->lock);
+			pthread_mutex_destroy(&b->mutPurge);
+			shardEpochDestruct(&b->writers);
+			for (i = 0 ; i < 2 ; ++i) {
+				DESTROY_ATOMIC_HELPER_MUT(b->gens[i].mutMetricCount);
+				DESTROY_ATOMIC_HELPER_MUT(b->gens[i].mutSlots);
+			}
 		}
 		if (b != NULL) {
 			free(b->name);
@@ -432,91 +483,109 @@ dynstats_findBucket(const uchar* name) {
 	return b;
 }
 
+/* allocate a new counter, if the generation still has room for it */
 static rsRetVal
-dynstats_createCtr(dynstats_bucket_t *b, const uchar* metric, dynstats_ctr_t **ctr) {
+dynstats_createCtr(dynstats_bucket_t *b, dynstats_gen_t *gen, const uchar* metric, dynstats_ctr_t **ctr) {
+	int reserved = 0;
 	DEFiRet;
-	
+
+	*ctr = NULL;
+	if (ATOMIC_INC_AND_FETCH_unsigned(&gen->metricCount, &gen->mutMetricCount) >= b->maxCardinality) {
+		ATOMIC_DEC(&gen->metricCount, &gen->mutMetricCount);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	reserved = 1;
 	CHKmalloc(*ctr = calloc(1, sizeof(dynstats_ctr_t)));
 	CHKmalloc((*ctr)->metric = ustrdup(metric));
 	STATSCOUNTER_INIT((*ctr)->ctr, (*ctr)->mutCtr);
-	CHKiRet(statsobj.AddManagedCounter(b->stats, metric, ctrType_IntCtr,
-									   b->resettable ? CTR_FLAG_MUST_RESET : CTR_FLAG_NONE,
-									   &(*ctr)->ctr, &(*ctr)->pCtr));
 finalize_it:
-	if (iRet != RS_RET_OK) {
-        if ((*ctr) != NULL) {
-            free((*ctr)->metric);
-            free(*ctr);
-            *ctr = NULL;
-        }
+	if (iRet != RS_RET_OK && reserved) {
+		ATOMIC_DEC(&gen->metricCount, &gen->mutMetricCount);
+		free(*ctr);
+		*ctr = NULL;
 	}
 	RETiRet;
 }
 
-static rsRetVal
-dynstats_addNewCtr(dynstats_bucket_t *b, const uchar* metric, uint8_t doInitialIncrement) {
-	dynstats_ctr_t *ctr;
-	dynstats_ctr_t *found_ctr;
-	int created;
-	uchar *copy_of_key = NULL;
-	DEFiRet;
-
-	created = 0;
-	ctr = NULL;
+/* undo dynstats_createCtr() for a counter that lost the race for its slot */
+static inline void
+dynstats_dropNewCtr(dynstats_gen_t *gen, dynstats_ctr_t *ctr) {
+	ATOMIC_DEC(&gen->metricCount, &gen->mutMetricCount);
+	dynstats_destroyCtr(NULL, ctr, 0);
+}
 
-	if (ATOMIC_FETCH_32BIT(&b->metricCount, &b->mutMetricCount) >= b->maxCardinality) {
-		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+static inline int
+dynstats_casSlot(dynstats_gen_t *gen, const uint32_t idx, dynstats_ctr_t *ctr) {
+#ifdef HAVE_ATOMIC_BUILTINS
+	return __sync_bool_compare_and_swap(&gen->slots[idx], NULL, ctr);
+#else
+	int done;
+	pthread_mutex_lock(&gen->mutSlots);
+	done = (gen->slots[idx] == NULL);
+	if (done) {
+		gen->slots[idx] = ctr;
 	}
-	
-	CHKiRet(dynstats_createCtr(b, metric, &ctr));
+	pthread_mutex_unlock(&gen->mutSlots);
+	return done;
+#endif
+}
 
-	pthread_rwlock_wrlock(&b->lock);
-    found_ctr = (dynstats_ctr_t*) hashtable_search(b->table, ctr->metric);
-	if (found_ctr != NULL) {
-		if (doInitialIncrement) {
-			STATSCOUNTER_INC(found_ctr->ctr, found_ctr->mutCtr);
-		}
-	} else {
-        copy_of_key = ustrdup(ctr->metric);
-        if (copy_of_key != NULL) {
-            created = hashtable_insert(b->table, copy_of_key, ctr);
-        }
-		if (created) {
-            if (b->ctrs == NULL) {
-                b->ctrs = ctr;
-            } else {
-                ctr->next = b->ctrs;
-                b->ctrs = ctr;
-            }
-			if (doInitialIncrement) {
-				STATSCOUNTER_INC(ctr->ctr, ctr->mutCtr);
+/* Find the counter for metric in gen, adding it if it does not yet exist.
+ * Slots are only ever filled (never cleared) while gen is current, so
+ * lookups need no lock and an insert is a single CAS on an empty slot.
+ * If two threads add the same metric concurrently, the CAS loser finds
+ * the winner's counter in that very slot and uses it.
+ */
+static rsRetVal
+dynstats_findOrAddCtr(dynstats_bucket_t *b, dynstats_gen_t *gen, const uchar *metric,
+	dynstats_ctr_t **ppCtr) {
+	dynstats_ctr_t *ctr, *newCtr = NULL;
+	const uint32_t mask = gen->nSlots - 1;
+	uint32_t idx, n;
+	DEFiRet;
+
+	idx = hash_from_string((void*) metric) & mask;
+	for (n = 0 ; n < gen->nSlots ; ++n, idx = (idx + 1) & mask) {
+		ctr = gen->slots[idx];
+		if (ctr == NULL) {
+			if (newCtr == NULL) {
+				CHKiRet(dynstats_createCtr(b, gen, metric, &newCtr));
 			}
+			if (dynstats_casSlot(gen, idx, newCtr)) {
+				if (statsobj.AddManagedCounter(b->stats, metric, ctrType_IntCtr,
+						b->resettable ? CTR_FLAG_MUST_RESET : CTR_FLAG_NONE,
+						&newCtr->ctr, &newCtr->pCtr) != RS_RET_OK) {
+					DBGPRINTF("dynstats: could not add counter for metric '%s' of "
+						  "bucket '%s' to stats, it will count but not be reported\n",
+						  metric, b->name);
+				}
+				STATSCOUNTER_INC(b->ctrNewMetricAdd, b->mutCtrNewMetricAdd);
+				*ppCtr = newCtr;
+				newCtr = NULL;
+				FINALIZE;
+			}
+			ctr = gen->slots[idx];
+		}
+		if (!ustrcmp(ctr->metric, metric)) {
+			*ppCtr = ctr;
+			FINALIZE;
 		}
 	}
-	pthread_rwlock_unlock(&b->lock);
+	/* not reached: there are more slots than metrics allowed */
+	ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 
-	if (found_ctr != NULL) {
-		//ignore
-	} else if (created) {
-		ATOMIC_INC(&b->metricCount, &b->mutMetricCount);
-		STATSCOUNTER_INC(b->ctrNewMetricAdd, b->mutCtrNewMetricAdd);
-	} else {
-        if (copy_of_key != NULL) {
-            free(copy_of_key);
-        }
-		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
-	}
-	
 finalize_it:
-	if ((! created) && (ctr != NULL)) {
-		dynstats_destroyCtr(b, ctr, 1);
+	if (newCtr != NULL) {
+		dynstats_dropNewCtr(gen, newCtr);
 	}
 	RETiRet;
 }
 
 rsRetVal
 dynstats_inc(dynstats_bucket_t *b, uchar* metric) {
+	dynstats_gen_t *gen;
 	dynstats_ctr_t *ctr;
+	int i;
 	DEFiRet;
 
 	if (! GatherStats) {
@@ -528,28 +597,19 @@ dynstats_inc(dynstats_bucket_t *b, uchar* metric) {
 		FINALIZE;
 	}
 
-	if (pthread_rwlock_tryrdlock(&b->lock) == 0) {
-        ctr = (dynstats_ctr_t *) hashtable_search(b->table, metric);
-		if (ctr != NULL) {
-			STATSCOUNTER_INC(ctr->ctr, ctr->mutCtr);
-		}
-		pthread_rwlock_unlock(&b->lock);
-	} else {
-		ABORT_FINALIZE(RS_RET_NOENTRY);
+	/* writers announce themselves in the generation they work on, so
+	 * that a purge knows when it may discard the previous one */
+	i = shardEpochEnter(&b->writers);
+	gen = &b->gens[i];
+	iRet = dynstats_findOrAddCtr(b, gen, metric, &ctr);
+	if (iRet == RS_RET_OK) {
+		STATSCOUNTER_INC(ctr->ctr, ctr->mutCtr);
 	}
+	shardEpochLeave(&b->writers, i);
 
-	if (ctr == NULL) {
-		CHKiRet(dynstats_addNewCtr(b, metric, 1));
-	}
 finalize_it:
 	if (iRet != RS_RET_OK) {
-		if (iRet == RS_RET_NOENTRY) {
-			/* NOTE: this is not tested (because it requires very strong orchestration to gurantee contended lock for testing) */
-			STATSCOUNTER_INC(b->ctrOpsIgnored, b->mutCtrOpsIgnored);
-		} else {
-			STATSCOUNTER_INC(b->ctrOpsOverflow, b->mutCtrOpsOverflow);
-		}
+		STATSCOUNTER_INC(b->ctrOpsOverflow, b->mutCtrOpsOverflow);
 	}
 	RETiRet;
 }
-
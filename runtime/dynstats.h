@@ -20,19 +20,28 @@
 
 #include "hashtable.h"
 
-typedef struct hashtable htable;
-
 struct dynstats_ctr_s {
 	STATSCOUNTER_DEF(ctr, mutCtr);
 	ctr_t *pCtr;
 	uchar *metric;
-	struct dynstats_ctr_s *next; /* linked list ptr */
+};
+
+/* The metrics of a bucket live in one of two generations. Writers insert
+ * into the current generation's table without locking; a purge makes the
+ * other generation current and discards the old one as soon as no writer
+ * uses it any longer. So writers are never blocked (or their updates
+ * dropped) by a purge.
+ */
+struct dynstats_gen_s {
+	dynstats_ctr_t **slots;	/* open addressing, filled via CAS */
+	uint32_t nSlots;	/* power of 2, > maxCardinality */
+	unsigned metricCount;
+	DEF_ATOMIC_HELPER_MUT(mutMetricCount)
+	DEF_ATOMIC_HELPER_MUT(mutSlots)
 };
 
 struct dynstats_bucket_s {
-	htable *table;
 	uchar *name;
-	pthread_rwlock_t lock;
 	statsobj_t *stats;
 	STATSCOUNTER_DEF(ctrOpsOverflow, mutCtrOpsOverflow);
 	ctr_t *pOpsOverflowCtr;
@@ -42,15 +51,17 @@ struct dynstats_bucket_s {
 	ctr_t *pNoMetricCtr;
 	STATSCOUNTER_DEF(ctrMetricsPurged, mutCtrMetricsPurged);
 	ctr_t *pMetricsPurgedCtr;
+	/* ops_ignored is kept for compatibility of the stats output only,
+	 * increments are no longer dropped under contention */
 	STATSCOUNTER_DEF(ctrOpsIgnored, mutCtrOpsIgnored);
 	ctr_t *pOpsIgnoredCtr;
 	STATSCOUNTER_DEF(ctrPurgeTriggered, mutCtrPurgeTriggered);
 	ctr_t *pPurgeTriggeredCtr;
 	struct dynstats_bucket_s *next; /* linked list ptr */
-	struct dynstats_ctr_s *ctrs;
+	struct dynstats_gen_s gens[2];
+	shardepoch_t writers;		/* epoch = index of the generation writers use */
+	pthread_mutex_t mutPurge;	/* serializes purges */
 	uint32_t maxCardinality;
-	uint32_t metricCount;
-	pthread_mutex_t mutMetricCount;
 	uint32_t unusedMetricLife;
 	uint32_t lastResetTs;
 	struct timespec metricCleanupTimeout;
@@ -77,6 +77,15 @@ int bProcessInternalMessages = 1;	/* Should rsyslog itself process internal mess
 					 * 1 - yes
 					 * 0 - send them to libstdlog (e.g. to push to journal)
 					 */
+int glblScriptBytecode = 1;	/* compile script expressions into bytecode? */
+int glblTemplateCompile = 1;	/* compile templates into flat operation lists? */
+int glblMsgPool = 1;		/* keep destructed msg objects for re-use? */
+int glblDNSCacheTTL = 86400;	/* seconds until a dns cache entry is refreshed, 0 = never */
+int glblDNSCacheNegativeTTL = 300; /* same for failed lookups */
+int glblDNSCacheMaxEntries = 100000; /* max number of dns cache entries */
+int glblDNSCacheResolverThreads = 4; /* background resolver threads */
+int glblDNSPrefetch = 0;	/* resolve main queue batches in parallel before processing? */
+int glblDNSPrefetchTimeout = 1000; /* ms to wait for prefetch, then use IP as name */
 static uchar *pszWorkDir = NULL;
 #ifdef HAVE_LIBLOGGING_STDLOG
 static uchar *stdlog_chanspec = NULL;
@@ -167,7 +176,16 @@ static struct cnfparamdescr cnfparamdescr[] = {
 	{ "net.aclresolvehostname", eCmdHdlrBinary, 0 },
 	{ "net.enabledns", eCmdHdlrBinary, 0 },
 	{ "net.permitACLwarning", eCmdHdlrBinary, 0 },
-	{ "processinternalmessages", eCmdHdlrBinary, 0 }
+	{ "processinternalmessages", eCmdHdlrBinary, 0 },
+	{ "script.bytecode", eCmdHdlrBinary, 0 },
+	{ "template.compile", eCmdHdlrBinary, 0 },
+	{ "msg.pool", eCmdHdlrBinary, 0 },
+	{ "dnscache.ttl", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.negativettl", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.maxentries", eCmdHdlrPositiveInt, 0 },
+	{ "dnscache.resolver.threads", eCmdHdlrPositiveInt, 0 },
+	{ "dnscache.prefetch", eCmdHdlrBinary, 0 },
+	{ "dnscache.prefetch.timeout", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk paramblk =
 	{ CNFPARAMBLK_VERSION,
@@ -1148,6 +1166,24 @@ glblDoneLoadCnf(void)
 		        setDisableDNS(!((int) cnfparamvals[i].val.d.n));
 		} else if(!strcmp(paramblk.descr[i].name, "net.permitwarning")) {
 		        setOption_DisallowWarning(!((int) cnfparamvals[i].val.d.n));
+		} else if(!strcmp(paramblk.descr[i].name, "script.bytecode")) {
+		        glblScriptBytecode = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "template.compile")) {
+		        glblTemplateCompile = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "msg.pool")) {
+		        glblMsgPool = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.ttl")) {
+		        glblDNSCacheTTL = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.negativettl")) {
+		        glblDNSCacheNegativeTTL = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.maxentries")) {
+		        glblDNSCacheMaxEntries = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.resolver.threads")) {
+		        glblDNSCacheResolverThreads = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.prefetch")) {
+		        glblDNSPrefetch = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.prefetch.timeout")) {
+		        glblDNSPrefetchTimeout = (int) cnfparamvals[i].val.d.n;
 		} else {
 			dbgprintf("glblDoneLoadCnf: program error, non-handled "
 			  "param '%s'\n", paramblk.descr[i].name);
@@ -41,6 +41,15 @@
 
 extern pid_t glbl_ourpid;
 extern int bProcessInternalMessages;
+extern int glblScriptBytecode;
+extern int glblTemplateCompile;
+extern int glblMsgPool;
+extern int glblDNSCacheTTL;
+extern int glblDNSCacheNegativeTTL;
+extern int glblDNSCacheMaxEntries;
+extern int glblDNSCacheResolverThreads;
+extern int glblDNSPrefetch;
+extern int glblDNSPrefetchTimeout;
 #ifdef HAVE_LIBLOGGING_STDLOG
 extern stdlog_channel_t stdlog_hdl;
 #endif
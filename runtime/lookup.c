@@ -26,6 +26,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <json.h>
 #include <assert.h>
 
@@ -33,6 +34,7 @@
 #include "srUtils.h"
 #include "errmsg.h"
 #include "lookup.h"
+#include "lookupimg.h"
 #include "msg.h"
 #include "rsconf.h"
 #include "dirty.h"
@@ -47,6 +49,7 @@ DEFobjCurrIf(glbl)
 
 /* forward definitions */
 static rsRetVal lookupReadFile(lookup_t *pThis, const uchar* name, const uchar* filename);
+static rsRetVal lookupLoad(lookup_ref_t *pRef, lookup_t *pThis);
 static void lookupDestruct(lookup_t *pThis);
 
 /* static data */
@@ -54,7 +57,8 @@ static void lookupDestruct(lookup_t *pThis);
 static struct cnfparamdescr modpdescr[] = {
 	{ "name", eCmdHdlrString, CNFPARAM_REQUIRED },
 	{ "file", eCmdHdlrString, CNFPARAM_REQUIRED },
-	{ "reloadOnHUP", eCmdHdlrBinary, 0 }
+	{ "reloadOnHUP", eCmdHdlrBinary, 0 },
+	{ "format", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -85,7 +89,7 @@ lookupNew(lookup_ref_t **ppThis)
 
 	CHKmalloc(pThis = calloc(1, sizeof(lookup_ref_t)));
 	CHKmalloc(t = calloc(1, sizeof(lookup_t)));
-	pthread_rwlock_init(&pThis->rwlock, NULL);
+	shardEpochInit(&pThis->readers);
 	pthread_mutex_init(&pThis->reloader_mut, NULL);
 	pthread_cond_init(&pThis->run_reloader, NULL);
 	pthread_attr_init(&pThis->reloader_thd_attr);
@@ -139,7 +143,7 @@ lookupRefDestruct(lookup_ref_t *pThis)
 	pthread_cond_destroy(&pThis->run_reloader);
 	pthread_attr_destroy(&pThis->reloader_thd_attr);
 
-	pthread_rwlock_destroy(&pThis->rwlock);
+	shardEpochDestruct(&pThis->readers);
 	lookupDestruct(pThis->self);
 	free(pThis->name);
 	free(pThis->filename);
@@ -154,6 +158,7 @@ destructTable_str(lookup_t *pThis) {
 		free(entries[i].key);
 	}
 	free(entries);
+	free(pThis->table.str->slots);
 	free(pThis->table.str);
 }
 
@@ -176,7 +181,10 @@ lookupDestruct(lookup_t *pThis) {
 
 	if (pThis == NULL) return;
 	
-	if (pThis->type == STRING_LOOKUP_TABLE) {
+	if (pThis->img_addr != NULL) {
+		munmap(pThis->img_addr, pThis->img_len);
+		free(pThis->table.img);
+	} else if (pThis->type == STRING_LOOKUP_TABLE) {
 		destructTable_str(pThis);
 	} else if (pThis->type == ARRAY_LOOKUP_TABLE) {
 		destructTable_arr(pThis);
@@ -212,12 +220,6 @@ lookupDestroyCnf() {
 }
 
 /* comparison function for qsort() */
-static int
-qs_arrcmp_strtab(const void *s1, const void *s2)
-{
-	return ustrcmp(((lookup_string_tab_entry_t*)s1)->key, ((lookup_string_tab_entry_t*)s2)->key);
-}
-
 static int
 qs_arrcmp_ustrs(const void *s1, const void *s2)
 {
@@ -227,24 +229,20 @@ qs_arrcmp_ustrs(const void *s1, const void *s2)
 static int
 qs_arrcmp_uint32_index_val(const void *s1, const void *s2)
 {
-	return ((uint32_index_val_t*)s1)->index - ((uint32_index_val_t*)s2)->index;
+	const uint32_t k1 = ((uint32_index_val_t*)s1)->index;
+	const uint32_t k2 = ((uint32_index_val_t*)s2)->index;
+	return (k1 > k2) - (k1 < k2);
 }
 
 static int
 qs_arrcmp_sprsArrtab(const void *s1, const void *s2)
 {
-	return ((lookup_sparseArray_tab_entry_t*)s1)->key - ((lookup_sparseArray_tab_entry_t*)s2)->key;
-}
-
-/* comparison function for bsearch() and string array compare
- * this is for the string lookup table type
- */
-static int
-bs_arrcmp_strtab(const void *s1, const void *s2)
-{
-	return strcmp((char*)s1, (char*)((lookup_string_tab_entry_t*)s2)->key);
+	const uint32_t k1 = ((lookup_sparseArray_tab_entry_t*)s1)->key;
+	const uint32_t k2 = ((lookup_sparseArray_tab_entry_t*)s2)->key;
+	return (k1 > k2) - (k1 < k2);
 }
 
+/* comparison function for bsearch() and string array compare */
 static int
 bs_arrcmp_str(const void *s1, const void *s2)
 {
@@ -254,45 +252,49 @@ bs_arrcmp_str(const void *s1, const void *s2)
 static int
 bs_arrcmp_sprsArrtab(const void *s1, const void *s2)
 {
-	return *(uint32_t*)s1 - ((lookup_sparseArray_tab_entry_t*)s2)->key;
+	const uint32_t k1 = *(uint32_t*)s1;
+	const uint32_t k2 = ((lookup_sparseArray_tab_entry_t*)s2)->key;
+	return (k1 > k2) - (k1 < k2);
 }
 
-static inline const char*
+static inline const uchar*
 defaultVal(lookup_t *pThis) {
-	return (pThis->nomatch == NULL) ? "" : (const char*) pThis->nomatch;
+	return (pThis->nomatch == NULL) ? (const uchar*) "" : pThis->nomatch;
 }
 
 /* lookup_fn for different types of tables */
-static es_str_t*
+static const uchar*
 lookupKey_stub(lookup_t *pThis, lookup_key_t __attribute__((unused)) key) {
-	return es_newStrFromCStr((char*) pThis->nomatch, ustrlen(pThis->nomatch));
+	return pThis->nomatch;
 }
 
-static es_str_t*
+static const uchar*
 lookupKey_str(lookup_t *pThis, lookup_key_t key) {
-	lookup_string_tab_entry_t *entry;
-	const char *r;
-	entry = bsearch(key.k_str, pThis->table.str->entries, pThis->nmemb, sizeof(lookup_string_tab_entry_t), bs_arrcmp_strtab);
-	if(entry == NULL) {
-		r = defaultVal(pThis);
-	} else {
-		r = (const char*)entry->interned_val_ref;
+	const lookup_string_tab_t *const tab = pThis->table.str;
+	const uint32_t hash = lkpimgHashStr(key.k_str);
+	uint32_t i;
+
+	if(tab->slots == NULL) {
+		return defaultVal(pThis);
 	}
-	return es_newStrFromCStr(r, strlen(r));
+	for(i = hash & tab->slot_mask ; tab->slots[i].idx != 0 ; i = (i + 1) & tab->slot_mask) {
+		if(tab->slots[i].hash == hash
+		   && ustrcmp(key.k_str, tab->entries[tab->slots[i].idx - 1].key) == 0) {
+			return tab->entries[tab->slots[i].idx - 1].interned_val_ref;
+		}
+	}
+	return defaultVal(pThis);
 }
 
-static es_str_t*
+static const uchar*
 lookupKey_arr(lookup_t *pThis, lookup_key_t key) {
-	const char *r;
 	uint32_t uint_key = key.k_uint;
 	uint32_t idx = uint_key - pThis->table.arr->first_key;
 
 	if (idx >= pThis->nmemb) {
-		r = defaultVal(pThis);
-	} else {
-		r = (char*) pThis->table.arr->interned_val_refs[uint_key - pThis->table.arr->first_key];
+		return defaultVal(pThis);
 	}
-	return es_newStrFromCStr(r, strlen(r));
+	return pThis->table.arr->interned_val_refs[idx];
 }
 
 typedef int (comp_fn_t)(const void *s1, const void *s2);
@@ -329,17 +331,63 @@ bsearch_lte(const void *key, const void *base, size_t nmemb, size_t size, comp_f
 	return (void *) (((const char *) base) + ( idx * size));
 }
 
-static es_str_t*
+static const uchar*
 lookupKey_sprsArr(lookup_t *pThis, lookup_key_t key) {
 	lookup_sparseArray_tab_entry_t *entry;
-	const char *r;
 	entry = bsearch_lte(&key.k_uint, pThis->table.sprsArr->entries, pThis->nmemb, sizeof(lookup_sparseArray_tab_entry_t), bs_arrcmp_sprsArrtab);
 	if(entry == NULL) {
-		r = defaultVal(pThis);
-	} else {
-		r = (const char*)entry->interned_val_ref;
+		return defaultVal(pThis);
+	}
+	return entry->interned_val_ref;
+}
+
+/* lookup_fn for tables loaded from binary images. They work like the
+ * ones above, but on the structures inside the image.
+ */
+static const uchar*
+lookupKey_img_str(lookup_t *pThis, lookup_key_t key) {
+	const lookup_img_tab_t *const tab = pThis->table.img;
+	const lkpimg_slot_t *const slots = (const lkpimg_slot_t*) tab->slots;
+	const lkpimg_strEntry_t *const entries = (const lkpimg_strEntry_t*) tab->entries;
+	const uint32_t hash = lkpimgHashStr(key.k_str);
+	uint32_t i;
+
+	for(i = hash & tab->slot_mask ; slots[i].idx != 0 ; i = (i + 1) & tab->slot_mask) {
+		if(slots[i].hash == hash
+		   && ustrcmp(key.k_str, tab->strs + entries[slots[i].idx - 1].key) == 0) {
+			return tab->strs + entries[slots[i].idx - 1].val;
+		}
+	}
+	return defaultVal(pThis);
+}
+
+static const uchar*
+lookupKey_img_arr(lookup_t *pThis, lookup_key_t key) {
+	const lookup_img_tab_t *const tab = pThis->table.img;
+	uint32_t idx = key.k_uint - tab->first_key;
+
+	if (idx >= pThis->nmemb) {
+		return defaultVal(pThis);
+	}
+	return tab->strs + ((const uint32_t*) tab->entries)[idx];
+}
+
+static int
+bs_arrcmp_img_sprsArrtab(const void *s1, const void *s2)
+{
+	const uint32_t k1 = *(const uint32_t*)s1;
+	const uint32_t k2 = ((const lkpimg_uintEntry_t*)s2)->key;
+	return (k1 > k2) - (k1 < k2);
+}
+
+static const uchar*
+lookupKey_img_sprsArr(lookup_t *pThis, lookup_key_t key) {
+	const lkpimg_uintEntry_t *entry;
+	entry = bsearch_lte(&key.k_uint, pThis->table.img->entries, pThis->nmemb, sizeof(lkpimg_uintEntry_t), bs_arrcmp_img_sprsArrtab);
+	if(entry == NULL) {
+		return defaultVal(pThis);
 	}
-	return es_newStrFromCStr(r, strlen(r));
+	return pThis->table.img->strs + entry->val;
 }
 
 /* builders for different table-types */
@@ -348,6 +396,39 @@ lookupKey_sprsArr(lookup_t *pThis, lookup_key_t key) {
 	errmsg.LogError(0, RS_RET_INVALID_VALUE, "'%s' lookup table named: '%s' has record(s) without 'index' field", type, name); \
 	ABORT_FINALIZE(RS_RET_INVALID_VALUE);
 
+/* build the hash index of a string table. There are at least twice as
+ * many slots as entries, so that probe sequences stay short. If a key
+ * occurs more than once, the first occurrence wins.
+ */
+static rsRetVal
+build_StringTableIndex(lookup_t *pThis) {
+	lookup_string_tab_t *const tab = pThis->table.str;
+	uint32_t nslots;
+	uint32_t hash;
+	uint32_t i, j;
+	DEFiRet;
+
+	for(nslots = 16 ; nslots < 2 * pThis->nmemb ; nslots *= 2)
+		/* just compute */;
+	CHKmalloc(tab->slots = calloc(nslots, sizeof(lookup_string_tab_slot_t)));
+	tab->slot_mask = nslots - 1;
+	for(i = 0 ; i < pThis->nmemb ; ++i) {
+		hash = lkpimgHashStr(tab->entries[i].key);
+		for(j = hash & tab->slot_mask ; tab->slots[j].idx != 0 ; j = (j + 1) & tab->slot_mask) {
+			if(tab->slots[j].hash == hash
+			   && ustrcmp(tab->entries[i].key, tab->entries[tab->slots[j].idx - 1].key) == 0)
+				break;
+		}
+		if(tab->slots[j].idx == 0) {
+			tab->slots[j].hash = hash;
+			tab->slots[j].idx = i + 1;
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
 static inline rsRetVal
 build_StringTable(lookup_t *pThis, struct json_object *jtab, const uchar* name) {
 	uint32_t i;
@@ -373,7 +454,7 @@ build_StringTable(lookup_t *pThis, struct json_object *jtab, const uchar* name)
 			assert(canonicalValueRef != NULL);
 			pThis->table.str->entries[i].interned_val_ref = canonicalValueRef;
 		}
-		qsort(pThis->table.str->entries, pThis->nmemb, sizeof(lookup_string_tab_entry_t), qs_arrcmp_strtab);
+		CHKiRet(build_StringTableIndex(pThis));
 	}
 		
 	pThis->lookup = lookupKey_str;
@@ -616,6 +697,17 @@ lookupFindTable(uchar *name)
 }
 
 
+/* called after a new table was installed: switch the epoch and wait for
+ * all readers of the previous one, which may still use the old table, to
+ * leave. Readers only do a lookup while inside, so this is short.
+ */
+static void
+lookupWaitReaders(lookup_ref_t *pThis)
+{
+	shardEpochWaitReaders(&pThis->readers, shardEpochSwitch(&pThis->readers));
+}
+
+
 /* this reloads a lookup table. This is done while the engine is running,
  * as such the function must ensure proper locking and proper order of
  * operations (so that nothing can interfere). If the table cannot be loaded,
@@ -633,14 +725,16 @@ lookupReloadOrStub(lookup_ref_t *pThis, const uchar* stub_val) {
 	DBGPRINTF("reload requested for lookup table '%s'\n", pThis->name);
 	CHKmalloc(newlu = calloc(1, sizeof(lookup_t)));
 	if (stub_val == NULL) {
-		CHKiRet(lookupReadFile(newlu, pThis->name, pThis->filename));
+		CHKiRet(lookupLoad(pThis, newlu));
 	} else {
 		CHKiRet(lookupBuildStubbedTable(newlu, stub_val));
 	}
-	/* all went well, copy over data members */
-	pthread_rwlock_wrlock(&pThis->rwlock);
+	/* all went well, publish the new table. Readers go on without being
+	 * blocked; the old table is destructed below, when none of them can
+	 * use it anymore.
+	 */
 	pThis->self = newlu;
-	pthread_rwlock_unlock(&pThis->rwlock);
+	lookupWaitReaders(pThis);
 finalize_it:
 	if (iRet != RS_RET_OK) {
 		if (stub_val == NULL) {
@@ -671,11 +765,10 @@ lookupDoStub(lookup_ref_t *pThis, const uchar* stub_val)
 {
 	int already_stubbed = 0;
 	DEFiRet;
-	pthread_rwlock_rdlock(&pThis->rwlock);
+	/* we are the reloader, so self cannot change under us */
 	if (pThis->self->type == STUBBED_LOOKUP_TABLE &&
 		ustrcmp(pThis->self->nomatch, stub_val) == 0)
 		already_stubbed = 1;
-	pthread_rwlock_unlock(&pThis->rwlock);
 	if (! already_stubbed) {
 		errmsg.LogError(0, RS_RET_OK, "stubbing lookup table '%s' with value '%s'",
 						pThis->name, stub_val);
@@ -794,21 +887,24 @@ lookupPendingReloadCount()
 }
 
 
-/* returns either a pointer to the value (read only!) or NULL
- * if either the key could not be found or an error occured.
- * Note that an estr_t object is returned. The caller is 
- * responsible for freeing it.
+/* enter a table as a reader and return the current table. Its values
+ * (as returned by its lookup function) may be used until
+ * lookupLeaveReader() is called with the epoch stored in *pEpoch.
+ * Readers never block: a reload installs the new table, switches the
+ * epoch and then waits for the readers of the previous epoch to leave
+ * before the old table is destructed.
  */
-es_str_t *
-lookupKey(lookup_ref_t *pThis, lookup_key_t key)
+lookup_t *
+lookupEnterReader(lookup_ref_t *pThis, int *pEpoch)
 {
-	es_str_t *estr;
-	lookup_t *t;
-	pthread_rwlock_rdlock(&pThis->rwlock);
-	t = pThis->self;
-	estr = t->lookup(t, key);
-	pthread_rwlock_unlock(&pThis->rwlock);
-	return estr;
+	*pEpoch = shardEpochEnter(&pThis->readers);
+	return pThis->self;
+}
+
+void
+lookupLeaveReader(lookup_ref_t *pThis, int epoch)
+{
+	shardEpochLeave(&pThis->readers, epoch);
 }
 
 
@@ -884,6 +980,109 @@ finalize_it:
 }
 
 
+/* load a table from a binary image created by rslookuputil. The image is
+ * mapped and, once validated, used as is, so this takes no time worth
+ * mentioning even for very large tables, and the pages are shared with
+ * the page cache. Images must be replaced by renaming a new file over the
+ * old one (rslookuputil does so), never by rewriting them in place:
+ * changing a file that is mapped would corrupt the table in use.
+ */
+static rsRetVal
+lookupReadImage(lookup_t *pThis, const uchar *name, const uchar *filename)
+{
+	const lkpimg_hdr_t *hdr;
+	const char *errMsg;
+	int eno;
+	char errStr[1024];
+	int fd = -1;
+	struct stat sb;
+	void *addr = MAP_FAILED;
+	DEFiRet;
+
+	if((fd = open((const char*) filename, O_RDONLY|O_CLOEXEC)) == -1) {
+		eno = errno;
+		errmsg.LogError(0, RS_RET_FILE_NOT_FOUND,
+			"lookup table file '%s' could not be opened: %s",
+			filename, rs_strerror_r(eno, errStr, sizeof(errStr)));
+		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+	}
+	if(fstat(fd, &sb) == -1) {
+		eno = errno;
+		errmsg.LogError(0, RS_RET_FILE_NOT_FOUND,
+			"lookup table file '%s' stat failed: %s",
+			filename, rs_strerror_r(eno, errStr, sizeof(errStr)));
+		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+	}
+	if(sb.st_size < (off_t) sizeof(lkpimg_hdr_t)) {
+		errmsg.LogError(0, RS_RET_LOOKUP_IMG_INVALID,
+			"lookup table '%s': file '%s' is not a lookup table image",
+			name, filename);
+		ABORT_FINALIZE(RS_RET_LOOKUP_IMG_INVALID);
+	}
+	addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(addr == MAP_FAILED) {
+		eno = errno;
+		errmsg.LogError(0, RS_RET_READ_ERR,
+			"lookup table file '%s' could not be mapped: %s",
+			filename, rs_strerror_r(eno, errStr, sizeof(errStr)));
+		ABORT_FINALIZE(RS_RET_READ_ERR);
+	}
+	if(lkpimgValidate(addr, sb.st_size, &errMsg) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_LOOKUP_IMG_INVALID,
+			"lookup table '%s': image '%s' is invalid: %s",
+			name, filename, errMsg);
+		ABORT_FINALIZE(RS_RET_LOOKUP_IMG_INVALID);
+	}
+
+	/* from now on, the mapping belongs to the table */
+	pThis->img_addr = addr;
+	pThis->img_len = sb.st_size;
+	addr = MAP_FAILED;
+
+	hdr = (const lkpimg_hdr_t*) pThis->img_addr;
+	CHKmalloc(pThis->table.img = calloc(1, sizeof(lookup_img_tab_t)));
+	pThis->table.img->strs = (const uchar*) hdr + hdr->off_strs;
+	pThis->table.img->entries = (const char*) hdr + hdr->off_entries;
+	pThis->table.img->slots = (const char*) hdr + hdr->off_slots;
+	pThis->table.img->slot_mask = hdr->slot_mask;
+	pThis->table.img->first_key = hdr->first_key;
+	if(hdr->nomatch != LKPIMG_NO_VALUE) {
+		CHKmalloc(pThis->nomatch = ustrdup(pThis->table.img->strs + hdr->nomatch));
+	}
+	pThis->nmemb = hdr->nmemb;
+	if(hdr->type == LKPIMG_TYPE_STRING) {
+		pThis->type = STRING_LOOKUP_TABLE;
+		pThis->key_type = LOOKUP_KEY_TYPE_STRING;
+		pThis->lookup = lookupKey_img_str;
+	} else if(hdr->type == LKPIMG_TYPE_ARRAY) {
+		pThis->type = ARRAY_LOOKUP_TABLE;
+		pThis->key_type = LOOKUP_KEY_TYPE_UINT;
+		pThis->lookup = lookupKey_img_arr;
+	} else {
+		pThis->type = SPARSE_ARRAY_LOOKUP_TABLE;
+		pThis->key_type = LOOKUP_KEY_TYPE_UINT;
+		pThis->lookup = lookupKey_img_sprsArr;
+	}
+
+finalize_it:
+	if(addr != MAP_FAILED)
+		munmap(addr, sb.st_size);
+	if(fd != -1)
+		close(fd);
+	RETiRet;
+}
+
+
+/* load the table file of pRef into pThis, in the configured format */
+static rsRetVal
+lookupLoad(lookup_ref_t *pRef, lookup_t *pThis)
+{
+	if(pRef->is_binary)
+		return lookupReadImage(pThis, pRef->name, pRef->filename);
+	return lookupReadFile(pThis, pRef->name, pRef->filename);
+}
+
+
 rsRetVal
 lookupTableDefProcessCnf(struct cnfobj *o)
 {
@@ -915,6 +1114,18 @@ lookupTableDefProcessCnf(struct cnfobj *o)
 			CHKmalloc(lu->name = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL));
 		} else if(!strcmp(modpblk.descr[i].name, "reloadOnHUP")) {
 			lu->reload_on_hup = (pvals[i].val.d.n != 0);
+		} else if(!strcmp(modpblk.descr[i].name, "format")) {
+			if(!es_strconstcmp(pvals[i].val.d.estr, "binary")) {
+				lu->is_binary = 1;
+			} else if(!es_strconstcmp(pvals[i].val.d.estr, "json")) {
+				lu->is_binary = 0;
+			} else {
+				char *cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_INVALID_VALUE, "lookup_table: invalid format "
+					"'%s', must be 'json' or 'binary'", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+			}
 		} else {
 			dbgprintf("lookup_table: program error, non-handled "
 			  "param '%s'\n", modpblk.descr[i].name);
@@ -928,7 +1139,7 @@ lookupTableDefProcessCnf(struct cnfobj *o)
 	reloader_thd_name[thd_name_len - 1] = '\0';
 	pthread_setname_np(lu->reloader, reloader_thd_name);
 #endif
-	CHKiRet(lookupReadFile(lu->self, lu->name, lu->filename));
+	CHKiRet(lookupLoad(lu, lu->self));
 	DBGPRINTF("lookup table '%s' loaded from file '%s'\n", lu->name, lu->filename);
 
 finalize_it:
@@ -21,6 +21,7 @@
 #ifndef INCLUDED_LOOKUP_H
 #define INCLUDED_LOOKUP_H
 #include <libestr.h>
+#include "shardctr.h"
 
 #define STRING_LOOKUP_TABLE 1
 #define ARRAY_LOOKUP_TABLE 2
@@ -55,19 +56,44 @@ struct lookup_string_tab_entry_s {
 	uchar *interned_val_ref;
 };
 
+/* a slot of the hash index of a string table. idx is the index of the
+ * entry plus one, so that 0 marks an empty slot.
+ */
+struct lookup_string_tab_slot_s {
+	uint32_t hash;
+	uint32_t idx;
+};
+
 struct lookup_string_tab_s {
 	lookup_string_tab_entry_t *entries;
+	lookup_string_tab_slot_t *slots;	/* open addressing, linear probing */
+	uint32_t slot_mask;			/* number of slots - 1 */
+};
+
+/* a table loaded from a binary image (see lookupimg.h). All pointers
+ * point into the mapped image.
+ */
+struct lookup_img_tab_s {
+	const uchar *strs;	/* string pool */
+	const void *entries;
+	const void *slots;	/* string tables only */
+	uint32_t slot_mask;
+	uint32_t first_key;	/* array tables only */
 };
 
 struct lookup_ref_s {
-	pthread_rwlock_t rwlock;	/* protect us in case of dynamic reloads */
+	/* readers do not lock: self is replaced on reload and the old table
+	 * is destructed only after all readers which may still use it have
+	 * left, see lookupEnterReader() */
+	shardepoch_t readers;
 	uchar *name;
 	uchar *filename;
+	uint8_t is_binary;	/* file is a binary image, not JSON */
 	lookup_t *self;
 	lookup_ref_t *next;
 	/* reload specific attributes */
 	pthread_mutex_t reloader_mut; /* signaling + access to reload-flow variables*/
-	/* rwlock(above) may be acquired inside critical-section reloader_mut guards */
+	/* self is only ever replaced by the reloader, inside reloader_mut */
 	pthread_cond_t run_reloader;
 	pthread_t reloader;
 	pthread_attr_t reloader_thd_attr;
@@ -77,7 +103,10 @@ struct lookup_ref_s {
 	uint8_t reload_on_hup;
 };
 
-typedef es_str_t* (lookup_fn_t)(lookup_t*, lookup_key_t);
+/* returns the interned value for key, or the nomatch value. The value
+ * belongs to the table and is valid until the reader leaves.
+ */
+typedef const uchar* (lookup_fn_t)(lookup_t*, lookup_key_t);
 
 /* a single lookup table */
 struct lookup_s {
@@ -88,7 +117,10 @@ struct lookup_s {
 		lookup_string_tab_t *str;
 		lookup_array_tab_t *arr;
 		lookup_sparseArray_tab_t *sprsArr;
+		lookup_img_tab_t *img;
 	} table;
+	void *img_addr;		/* mapped binary image, NULL if loaded from JSON */
+	size_t img_len;
 	uint32_t interned_val_count;
 	uchar **interned_vals;
 	uchar *nomatch;
@@ -104,7 +136,8 @@ union lookup_key_u {
 void lookupInitCnf(lookup_tables_t *lu_tabs);
 rsRetVal lookupTableDefProcessCnf(struct cnfobj *o);
 lookup_ref_t *lookupFindTable(uchar *name);
-es_str_t * lookupKey(lookup_ref_t *pThis, lookup_key_t key);
+lookup_t *lookupEnterReader(lookup_ref_t *pThis, int *pEpoch);
+void lookupLeaveReader(lookup_ref_t *pThis, int epoch);
 void lookupDestroyCnf();
 void lookupClassExit(void);
 void lookupDoHUP();
@@ -0,0 +1,480 @@
+/* lookupimg.c
+ * Binary lookup table images. An image is a lookup table precompiled by
+ * rslookuputil, which rsyslogd maps into memory and uses without any
+ * parsing. This file contains both the code to build images and the
+ * code to validate them before use. It must not depend on the rest of
+ * the runtime, as it is also linked into rslookuputil.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "rsyslog.h"
+#include "lookupimg.h"
+
+/* one record of the table to be built */
+typedef struct lkpimgRec_s {
+	const char *skey;	/* string tables */
+	uint32_t ukey;		/* (sparse) array tables */
+	uint32_t idx;		/* position in input, keeps sorting stable */
+	const char *val;
+	uint32_t valOff;
+} lkpimgRec_t;
+
+struct lkpimgBuilder_s {
+	int type;
+	const char *nomatch;
+	lkpimgRec_t *recs;
+	uint32_t nRecs;
+	uint32_t maxRecs;
+};
+
+#define ALIGN8(x) (((x) + 7) & ~((uint64_t) 7))
+
+
+/* checksum over len bytes (a multiple of 8) at buf. This is not meant
+ * to protect against deliberate modification, only against truncated,
+ * partially written or otherwise damaged images.
+ */
+static uint64_t
+lkpimgChecksum(const void *const buf, const uint64_t len)
+{
+	const uint64_t *const w = (const uint64_t*) buf;
+	uint64_t sum = 14695981039346656037ull;
+	uint64_t i;
+
+	for(i = 0 ; i < len / 8 ; ++i) {
+		sum = (sum ^ w[i]) * 1099511628211ull;
+	}
+	return sum;
+}
+
+
+rsRetVal
+lkpimgBuilderConstruct(lkpimgBuilder_t **ppThis, const int type)
+{
+	lkpimgBuilder_t *pThis;
+	DEFiRet;
+
+	if(type != LKPIMG_TYPE_STRING && type != LKPIMG_TYPE_ARRAY && type != LKPIMG_TYPE_SPARSE_ARRAY)
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	CHKmalloc(pThis = calloc(1, sizeof(lkpimgBuilder_t)));
+	pThis->type = type;
+	*ppThis = pThis;
+finalize_it:
+	RETiRet;
+}
+
+
+void
+lkpimgBuilderDestruct(lkpimgBuilder_t *pThis)
+{
+	if(pThis == NULL)
+		return;
+	free(pThis->recs);
+	free(pThis);
+}
+
+
+void
+lkpimgBuilderSetNomatch(lkpimgBuilder_t *pThis, const char *val)
+{
+	pThis->nomatch = val;
+}
+
+
+static rsRetVal
+lkpimgBuilderAddRec(lkpimgBuilder_t *pThis, const char *skey, const uint32_t ukey, const char *val)
+{
+	lkpimgRec_t *newRecs;
+	uint32_t newMax;
+	DEFiRet;
+
+	if(pThis->nRecs == pThis->maxRecs) {
+		if(pThis->maxRecs >= UINT32_MAX / 2)
+			ABORT_FINALIZE(RS_RET_FILE_TOO_LARGE);
+		newMax = (pThis->maxRecs == 0) ? 1024 : 2 * pThis->maxRecs;
+		CHKmalloc(newRecs = realloc(pThis->recs, newMax * sizeof(lkpimgRec_t)));
+		pThis->recs = newRecs;
+		pThis->maxRecs = newMax;
+	}
+	pThis->recs[pThis->nRecs].skey = skey;
+	pThis->recs[pThis->nRecs].ukey = ukey;
+	pThis->recs[pThis->nRecs].idx = pThis->nRecs;
+	pThis->recs[pThis->nRecs].val = val;
+	++pThis->nRecs;
+finalize_it:
+	RETiRet;
+}
+
+
+rsRetVal
+lkpimgBuilderAddStr(lkpimgBuilder_t *pThis, const char *key, const char *val)
+{
+	return lkpimgBuilderAddRec(pThis, key, 0, val);
+}
+
+
+rsRetVal
+lkpimgBuilderAddUint(lkpimgBuilder_t *pThis, const uint32_t key, const char *val)
+{
+	return lkpimgBuilderAddRec(pThis, NULL, key, val);
+}
+
+
+/* comparison functions for qsort() */
+static int
+qs_cmpRecPtrVal(const void *p1, const void *p2)
+{
+	return strcmp((*(lkpimgRec_t**)p1)->val, (*(lkpimgRec_t**)p2)->val);
+}
+
+static int
+qs_cmpRecUkey(const void *p1, const void *p2)
+{
+	const lkpimgRec_t *const r1 = (const lkpimgRec_t*) p1;
+	const lkpimgRec_t *const r2 = (const lkpimgRec_t*) p2;
+	if(r1->ukey != r2->ukey)
+		return (r1->ukey < r2->ukey) ? -1 : 1;
+	return (r1->idx < r2->idx) ? -1 : (r1->idx > r2->idx);
+}
+
+
+/* append a string to the pool and return its offset */
+static inline uint32_t
+poolAdd(char *const pool, uint64_t *const pLen, const char *const str)
+{
+	const uint64_t off = *pLen;
+	const size_t len = strlen(str) + 1;
+	memcpy(pool + off, str, len);
+	*pLen += len;
+	return (uint32_t) off;
+}
+
+
+/* build the image in memory. On error, a message is stored in errMsg. */
+static rsRetVal
+lkpimgBuild(lkpimgBuilder_t *pThis, char **ppImg, uint64_t *pLen, char *errMsg, const size_t lenErrMsg)
+{
+	lkpimg_hdr_t *hdr;
+	lkpimgRec_t **byVal = NULL;
+	lkpimg_strEntry_t *strEntries;
+	lkpimg_uintEntry_t *uintEntries;
+	uint32_t *arrEntries;
+	lkpimg_slot_t *slots;
+	char *img = NULL;
+	char *pool;
+	uint64_t lenStrs, lenPool;
+	uint64_t lenEntries;
+	uint64_t nslots = 0;
+	uint64_t size;
+	uint32_t hash;
+	uint32_t i, j;
+	const uint32_t n = pThis->nRecs;
+	DEFiRet;
+
+	/* values are stored only once, so find the distinct ones first */
+	if(n > 0)
+		CHKmalloc(byVal = malloc(n * sizeof(lkpimgRec_t*)));
+	for(i = 0 ; i < n ; ++i)
+		byVal[i] = pThis->recs + i;
+	qsort(byVal, n, sizeof(lkpimgRec_t*), qs_cmpRecPtrVal);
+	lenStrs = (pThis->nomatch == NULL) ? 0 : strlen(pThis->nomatch) + 1;
+	for(i = 0 ; i < n ; ++i) {
+		if(i == 0 || strcmp(byVal[i]->val, byVal[i-1]->val) != 0)
+			lenStrs += strlen(byVal[i]->val) + 1;
+		if(pThis->type == LKPIMG_TYPE_STRING)
+			lenStrs += strlen(pThis->recs[i].skey) + 1;
+	}
+	if(lenStrs >= UINT32_MAX) {
+		snprintf(errMsg, lenErrMsg, "keys and values take %llu bytes, images "
+			"support at most 4GB", (unsigned long long) lenStrs);
+		ABORT_FINALIZE(RS_RET_FILE_TOO_LARGE);
+	}
+
+	if(pThis->type == LKPIMG_TYPE_STRING) {
+		lenEntries = (uint64_t) n * sizeof(lkpimg_strEntry_t);
+		for(nslots = 16 ; nslots < 2 * (uint64_t) n ; nslots *= 2)
+			/* just compute */;
+	} else if(pThis->type == LKPIMG_TYPE_ARRAY) {
+		lenEntries = ALIGN8((uint64_t) n * sizeof(uint32_t));
+	} else {
+		lenEntries = (uint64_t) n * sizeof(lkpimg_uintEntry_t);
+	}
+	size = sizeof(lkpimg_hdr_t) + lenEntries + nslots * sizeof(lkpimg_slot_t) + ALIGN8(lenStrs);
+	if(size != (size_t) size) {
+		snprintf(errMsg, lenErrMsg, "image too large for this platform");
+		ABORT_FINALIZE(RS_RET_FILE_TOO_LARGE);
+	}
+	CHKmalloc(img = calloc(1, size));
+	hdr = (lkpimg_hdr_t*) img;
+	memcpy(hdr->magic, LKPIMG_MAGIC, sizeof(hdr->magic));
+	hdr->version = LKPIMG_VERSION;
+	hdr->endian_mark = LKPIMG_ENDIAN_MARK;
+	hdr->type = pThis->type;
+	hdr->nmemb = n;
+	hdr->size = size;
+	hdr->off_entries = sizeof(lkpimg_hdr_t);
+	hdr->off_slots = hdr->off_entries + lenEntries;
+	hdr->off_strs = hdr->off_slots + nslots * sizeof(lkpimg_slot_t);
+	hdr->len_strs = ALIGN8(lenStrs);
+	hdr->slot_mask = (nslots == 0) ? 0 : (uint32_t) (nslots - 1);
+
+	pool = img + hdr->off_strs;
+	lenPool = 0;
+	hdr->nomatch = (pThis->nomatch == NULL) ? LKPIMG_NO_VALUE : poolAdd(pool, &lenPool, pThis->nomatch);
+	for(i = 0 ; i < n ; ++i) {
+		if(i == 0 || strcmp(byVal[i]->val, byVal[i-1]->val) != 0)
+			byVal[i]->valOff = poolAdd(pool, &lenPool, byVal[i]->val);
+		else
+			byVal[i]->valOff = byVal[i-1]->valOff;
+	}
+
+	if(pThis->type == LKPIMG_TYPE_STRING) {
+		/* if a key occurs more than once, the first occurrence wins, just
+		 * like with tables loaded from JSON */
+		strEntries = (lkpimg_strEntry_t*) (img + hdr->off_entries);
+		slots = (lkpimg_slot_t*) (img + hdr->off_slots);
+		for(i = 0 ; i < n ; ++i) {
+			strEntries[i].key = poolAdd(pool, &lenPool, pThis->recs[i].skey);
+			strEntries[i].val = pThis->recs[i].valOff;
+			hash = lkpimgHashStr((const unsigned char*) pThis->recs[i].skey);
+			for(j = hash & hdr->slot_mask ; slots[j].idx != 0 ; j = (j + 1) & hdr->slot_mask) {
+				if(slots[j].hash == hash
+				   && strcmp(pThis->recs[i].skey, pThis->recs[slots[j].idx - 1].skey) == 0)
+					break;
+			}
+			if(slots[j].idx == 0) {
+				slots[j].hash = hash;
+				slots[j].idx = i + 1;
+			}
+		}
+	} else {
+		qsort(pThis->recs, n, sizeof(lkpimgRec_t), qs_cmpRecUkey);
+		if(pThis->type == LKPIMG_TYPE_ARRAY) {
+			arrEntries = (uint32_t*) (img + hdr->off_entries);
+			hdr->first_key = (n == 0) ? 0 : pThis->recs[0].ukey;
+			for(i = 0 ; i < n ; ++i) {
+				if(i > 0 && pThis->recs[i].ukey != pThis->recs[i-1].ukey + 1) {
+					snprintf(errMsg, lenErrMsg, "'array' table has non-contiguous "
+						"members between index '%u' and '%u'",
+						pThis->recs[i-1].ukey, pThis->recs[i].ukey);
+					ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+				}
+				arrEntries[i] = pThis->recs[i].valOff;
+			}
+		} else {
+			uintEntries = (lkpimg_uintEntry_t*) (img + hdr->off_entries);
+			for(i = 0 ; i < n ; ++i) {
+				uintEntries[i].key = pThis->recs[i].ukey;
+				uintEntries[i].val = pThis->recs[i].valOff;
+			}
+		}
+	}
+
+	hdr->sum_data = lkpimgChecksum(img + sizeof(lkpimg_hdr_t), size - sizeof(lkpimg_hdr_t));
+	hdr->sum_hdr = lkpimgChecksum(hdr, offsetof(lkpimg_hdr_t, sum_hdr));
+	*ppImg = img;
+	*pLen = size;
+	img = NULL;
+
+finalize_it:
+	free(byVal);
+	free(img);
+	RETiRet;
+}
+
+
+/* write the image to file fn. The image is written to a temporary file
+ * first, which is then renamed to fn. So a running rsyslogd, which may
+ * have mapped the previous image, is never affected, and a reload either
+ * sees the old or the complete new image.
+ */
+rsRetVal
+lkpimgBuilderWrite(lkpimgBuilder_t *pThis, const char *fn, char *errMsg, const size_t lenErrMsg)
+{
+	char *img = NULL;
+	uint64_t len = 0;
+	uint64_t written;
+	ssize_t r;
+	char *tmpfn = NULL;
+	size_t lenTmpfn;
+	int fd = -1;
+	mode_t mask;
+	DEFiRet;
+
+	*errMsg = '\0';
+	CHKiRet(lkpimgBuild(pThis, &img, &len, errMsg, lenErrMsg));
+
+	lenTmpfn = strlen(fn) + sizeof(".tmpXXXXXX");
+	CHKmalloc(tmpfn = malloc(lenTmpfn));
+	snprintf(tmpfn, lenTmpfn, "%s.tmpXXXXXX", fn);
+	if((fd = mkstemp(tmpfn)) == -1) {
+		snprintf(errMsg, lenErrMsg, "cannot create '%s': %s", tmpfn, strerror(errno));
+		free(tmpfn);
+		tmpfn = NULL;
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	/* mkstemp() creates the file with mode 0600, but the image should be
+	 * created like any other file */
+	mask = umask(0);
+	umask(mask);
+	if(fchmod(fd, 0666 & ~mask) != 0) {
+		snprintf(errMsg, lenErrMsg, "cannot set permissions of '%s': %s", tmpfn, strerror(errno));
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	for(written = 0 ; written < len ; written += r) {
+		r = write(fd, img + written, len - written);
+		if(r == -1 && errno == EINTR) {
+			r = 0;
+		} else if(r <= 0) {
+			snprintf(errMsg, lenErrMsg, "error writing '%s': %s", tmpfn,
+				(r == 0) ? "nothing written" : strerror(errno));
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+	}
+	if(fsync(fd) != 0 || close(fd) != 0) {
+		fd = -1;
+		snprintf(errMsg, lenErrMsg, "error writing '%s': %s", tmpfn, strerror(errno));
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	fd = -1;
+	if(rename(tmpfn, fn) != 0) {
+		snprintf(errMsg, lenErrMsg, "cannot rename '%s' to '%s': %s", tmpfn, fn, strerror(errno));
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+
+finalize_it:
+	if(fd != -1)
+		close(fd);
+	if(iRet != RS_RET_OK && tmpfn != NULL)
+		unlink(tmpfn);
+	free(tmpfn);
+	free(img);
+	RETiRet;
+}
+
+
+#define INVALID(msg) { *errMsg = (msg); ABORT_FINALIZE(RS_RET_LOOKUP_IMG_INVALID); }
+
+/* check that len bytes at img are a complete and consistent image, so
+ * that lookups in it never access memory outside of it. This looks at
+ * every entry, but that is just one pass over the image, which is
+ * cheap compared to building a table from JSON.
+ */
+rsRetVal
+lkpimgValidate(const void *const img, const size_t len, const char **errMsg)
+{
+	const lkpimg_hdr_t *const hdr = (const lkpimg_hdr_t*) img;
+	const char *base = (const char*) img;
+	const lkpimg_strEntry_t *strEntries;
+	const lkpimg_uintEntry_t *uintEntries;
+	const uint32_t *arrEntries;
+	const lkpimg_slot_t *slots;
+	uint64_t lenEntries, nslots, i;
+	uint64_t nempty;
+	DEFiRet;
+
+	if(len < sizeof(lkpimg_hdr_t) || memcmp(hdr->magic, LKPIMG_MAGIC, sizeof(hdr->magic)))
+		INVALID("not a lookup table image");
+	if(hdr->endian_mark != LKPIMG_ENDIAN_MARK)
+		INVALID("image was created on a machine with different byte order");
+	if(hdr->version != LKPIMG_VERSION)
+		INVALID("unsupported image version");
+	if(hdr->sum_hdr != lkpimgChecksum(hdr, offsetof(lkpimg_hdr_t, sum_hdr)))
+		INVALID("header checksum mismatch");
+	if(hdr->size != len)
+		INVALID("image is truncated or has trailing data");
+
+	switch(hdr->type) {
+	case LKPIMG_TYPE_STRING:
+		lenEntries = (uint64_t) hdr->nmemb * sizeof(lkpimg_strEntry_t);
+		nslots = (uint64_t) hdr->slot_mask + 1;
+		if((nslots & hdr->slot_mask) != 0 || nslots < 2 * (uint64_t) hdr->nmemb)
+			INVALID("invalid number of hash slots");
+		break;
+	case LKPIMG_TYPE_ARRAY:
+		lenEntries = ALIGN8((uint64_t) hdr->nmemb * sizeof(uint32_t));
+		nslots = 0;
+		if(hdr->nmemb > 0 && (uint64_t) hdr->first_key + hdr->nmemb - 1 > UINT32_MAX)
+			INVALID("array keys out of range");
+		break;
+	case LKPIMG_TYPE_SPARSE_ARRAY:
+		lenEntries = (uint64_t) hdr->nmemb * sizeof(lkpimg_uintEntry_t);
+		nslots = 0;
+		break;
+	default:
+		INVALID("unknown table type");
+	}
+	if(hdr->off_entries != sizeof(lkpimg_hdr_t)
+	   || hdr->off_slots != hdr->off_entries + lenEntries
+	   || hdr->off_strs != hdr->off_slots + nslots * sizeof(lkpimg_slot_t)
+	   || hdr->len_strs % 8 != 0 || hdr->len_strs > len
+	   || hdr->off_strs + hdr->len_strs != hdr->size)
+		INVALID("inconsistent section layout");
+	if(hdr->sum_data != lkpimgChecksum(base + sizeof(lkpimg_hdr_t), len - sizeof(lkpimg_hdr_t)))
+		INVALID("data checksum mismatch");
+
+	/* the pool ends with a '\0', so any offset into it is a valid string */
+	if(hdr->len_strs > UINT32_MAX
+	   || (hdr->len_strs > 0 && base[hdr->off_strs + hdr->len_strs - 1] != '\0'))
+		INVALID("invalid string pool");
+	if(hdr->nomatch != LKPIMG_NO_VALUE && hdr->nomatch >= hdr->len_strs)
+		INVALID("invalid nomatch value");
+	if(hdr->type == LKPIMG_TYPE_STRING) {
+		strEntries = (const lkpimg_strEntry_t*) (base + hdr->off_entries);
+		for(i = 0 ; i < hdr->nmemb ; ++i) {
+			if(strEntries[i].key >= hdr->len_strs || strEntries[i].val >= hdr->len_strs)
+				INVALID("invalid string reference");
+		}
+		slots = (const lkpimg_slot_t*) (base + hdr->off_slots);
+		nempty = 0;
+		for(i = 0 ; i < nslots ; ++i) {
+			if(slots[i].idx == 0)
+				++nempty;
+			else if(slots[i].idx > hdr->nmemb)
+				INVALID("invalid hash slot");
+		}
+		/* lookups stop at the first empty slot */
+		if(nempty == 0)
+			INVALID("hash index is full");
+	} else if(hdr->type == LKPIMG_TYPE_ARRAY) {
+		arrEntries = (const uint32_t*) (base + hdr->off_entries);
+		for(i = 0 ; i < hdr->nmemb ; ++i) {
+			if(arrEntries[i] >= hdr->len_strs)
+				INVALID("invalid string reference");
+		}
+	} else {
+		uintEntries = (const lkpimg_uintEntry_t*) (base + hdr->off_entries);
+		for(i = 0 ; i < hdr->nmemb ; ++i) {
+			if(uintEntries[i].val >= hdr->len_strs)
+				INVALID("invalid string reference");
+			if(i > 0 && uintEntries[i].key < uintEntries[i-1].key)
+				INVALID("sparseArray keys are not sorted");
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
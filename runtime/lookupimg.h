@@ -0,0 +1,113 @@
+/* header for lookupimg.c
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_LOOKUPIMG_H
+#define INCLUDED_LOOKUPIMG_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* A binary lookup table image is a precompiled lookup table, which
+ * rsyslogd maps into memory and uses as is. It is created by rslookuputil
+ * from the JSON table definition.
+ *
+ * The image starts with a header, followed by the sections it points to.
+ * All numbers are in host byte order (an image from a host with different
+ * byte order is rejected), all sections start at multiples of 8 bytes and
+ * all string references are offsets into the string pool, which holds
+ * '\0'-terminated strings. Values are stored only once.
+ * The entries depend on the table type:
+ * - string: lkpimg_strEntry_t, plus a hash index of lkpimg_slot_t (open
+ *   addressing, linear probing, lkpimgHashStr()). idx in a slot is the
+ *   index of the entry plus one, 0 marks an empty slot.
+ * - array: one uint32_t value offset per key, starting at first_key
+ * - sparseArray: lkpimg_uintEntry_t, sorted by key
+ *
+ * sum_data is a checksum over everything after the header, sum_hdr one
+ * over the header up to (but not including) sum_hdr itself.
+ */
+#define LKPIMG_MAGIC "RSLKPIMG"
+#define LKPIMG_VERSION 1
+#define LKPIMG_ENDIAN_MARK 0x01020304u
+#define LKPIMG_NO_VALUE 0xffffffffu
+
+#define LKPIMG_TYPE_STRING 1
+#define LKPIMG_TYPE_ARRAY 2
+#define LKPIMG_TYPE_SPARSE_ARRAY 3
+
+typedef struct lkpimg_hdr_s {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian_mark;
+	uint32_t type;
+	uint32_t nmemb;
+	uint32_t nomatch;	/* offset of nomatch value or LKPIMG_NO_VALUE */
+	uint32_t first_key;	/* array tables only */
+	uint32_t slot_mask;	/* string tables: number of slots - 1 */
+	uint32_t pad;
+	uint64_t size;		/* size of the whole image */
+	uint64_t off_entries;
+	uint64_t off_slots;	/* string tables only */
+	uint64_t off_strs;
+	uint64_t len_strs;
+	uint64_t sum_data;
+	uint64_t sum_hdr;
+} lkpimg_hdr_t;
+
+typedef struct lkpimg_strEntry_s {
+	uint32_t key;
+	uint32_t val;
+} lkpimg_strEntry_t;
+
+typedef struct lkpimg_uintEntry_s {
+	uint32_t key;
+	uint32_t val;
+} lkpimg_uintEntry_t;
+
+typedef struct lkpimg_slot_s {
+	uint32_t hash;
+	uint32_t idx;
+} lkpimg_slot_t;
+
+/* hash function for string keys (FNV-1a). The in-memory string tables
+ * use it, too.
+ */
+static inline uint32_t
+lkpimgHashStr(const unsigned char *k)
+{
+	uint32_t hash = 2166136261u;
+	for( ; *k ; ++k) {
+		hash = (hash ^ *k) * 16777619u;
+	}
+	return hash;
+}
+
+/* the builder collects the table content and writes the image. Keys and
+ * values are not copied, they must stay valid until the image is written.
+ */
+typedef struct lkpimgBuilder_s lkpimgBuilder_t;
+
+/* prototypes */
+rsRetVal lkpimgBuilderConstruct(lkpimgBuilder_t **ppThis, const int type);
+void lkpimgBuilderDestruct(lkpimgBuilder_t *pThis);
+void lkpimgBuilderSetNomatch(lkpimgBuilder_t *pThis, const char *val);
+rsRetVal lkpimgBuilderAddStr(lkpimgBuilder_t *pThis, const char *key, const char *val);
+rsRetVal lkpimgBuilderAddUint(lkpimgBuilder_t *pThis, const uint32_t key, const char *val);
+rsRetVal lkpimgBuilderWrite(lkpimgBuilder_t *pThis, const char *fn, char *errMsg, const size_t lenErrMsg);
+rsRetVal lkpimgValidate(const void *img, const size_t len, const char **errMsg);
+
+#endif /* #ifndef INCLUDED_LOOKUPIMG_H */
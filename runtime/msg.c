@@ -64,6 +64,8 @@
 #include "var.h"
 #include "rsconf.h"
 #include "parserif.h"
+#include "stream.h"
+#include "statsobj.h"
 #include <errno.h>
 
 /* TODO: move the global variable root to the config object - had no time to to it
@@ -80,6 +82,8 @@ DEFobjCurrIf(regexp)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(net)
 DEFobjCurrIf(var)
+DEFobjCurrIf(strm)
+DEFobjCurrIf(statsobj)
 
 static char *one_digit[10] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9" };
 
@@ -421,6 +425,151 @@ MsgUnlock(msg_t *pThis)
 }
 
 
+/* Copy-on-write support for the JSON trees ($! and $.). MsgDup() does not
+ * deep-copy the trees but lets the original and the duplicate reference the
+ * same tree via a share descriptor. The descriptor owns the json-c reference
+ * to the tree and counts the messages using it. Its mutex serializes all
+ * access to the shared tree, as the messages sharing it may be processed by
+ * different threads (and json-c is not thread-safe, not even on reads, as it
+ * caches string representations inside the objects).
+ * Before a message modifies a shared tree, it obtains a private deep copy
+ * (or takes ownership, if it is the last user). Readers never modify a
+ * shared tree, so they do not create missing path elements.
+ * The share descriptor pointer inside the msg is protected by the msg lock,
+ * so the lock order is always msg lock, then share lock.
+ */
+struct msgJSONShr_s {
+	pthread_mutex_t mut;
+	int nUsers;		/* number of messages referencing the tree */
+};
+
+static inline void
+jsonShrLock(struct msgJSONShr_s *const pShr)
+{
+	if(pShr != NULL)
+		pthread_mutex_lock(&pShr->mut);
+}
+static inline void
+jsonShrUnlock(struct msgJSONShr_s *const pShr)
+{
+	if(pShr != NULL)
+		pthread_mutex_unlock(&pShr->mut);
+}
+
+/* let a newly duplicated message use the JSON tree of the original one.
+ * Must be called with the original message locked. If no share descriptor
+ * can be created, we fall back to a deep copy.
+ */
+static void
+msgJSONShare(struct json_object *const jroot, struct msgJSONShr_s **const ppShrOld,
+	struct json_object **const pjrootNew, struct msgJSONShr_s **const ppShrNew)
+{
+	struct msgJSONShr_s *pShr;
+
+	if(jroot == NULL)
+		return;
+	if((pShr = *ppShrOld) == NULL) {
+		if((pShr = malloc(sizeof(struct msgJSONShr_s))) == NULL) {
+			*pjrootNew = jsonDeepCopy(jroot);
+			return;
+		}
+		pthread_mutex_init(&pShr->mut, NULL);
+		pShr->nUsers = 1;
+		*ppShrOld = pShr;
+	}
+	pthread_mutex_lock(&pShr->mut);
+	++pShr->nUsers;
+	pthread_mutex_unlock(&pShr->mut);
+	*pjrootNew = jroot;
+	*ppShrNew = pShr;
+}
+
+/* make sure the message has a private copy of the JSON tree, so that it
+ * can be modified. Must be called with the message locked.
+ */
+static rsRetVal
+msgJSONUnshare(struct json_object **const pjroot, struct msgJSONShr_s **const ppShr)
+{
+	struct msgJSONShr_s *const pShr = *ppShr;
+	struct json_object *copy;
+	DEFiRet;
+
+	if(pShr == NULL)
+		FINALIZE;
+
+	pthread_mutex_lock(&pShr->mut);
+	if(pShr->nUsers == 1) {
+		/* all others are gone, so the tree is already ours */
+		pthread_mutex_unlock(&pShr->mut);
+		pthread_mutex_destroy(&pShr->mut);
+		free(pShr);
+	} else {
+		copy = jsonDeepCopy(*pjroot);
+		if(copy == NULL) {
+			pthread_mutex_unlock(&pShr->mut);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		--pShr->nUsers;
+		pthread_mutex_unlock(&pShr->mut);
+		*pjroot = copy;
+	}
+	*ppShr = NULL;
+
+finalize_it:
+	RETiRet;
+}
+
+/* drop the message's reference to its JSON tree, shared or not */
+static void
+msgJSONRelease(struct json_object **const pjroot, struct msgJSONShr_s **const ppShr)
+{
+	struct msgJSONShr_s *const pShr = *ppShr;
+	int nUsers;
+
+	if(pShr == NULL) {
+		if(*pjroot != NULL)
+			json_object_put(*pjroot);
+	} else {
+		pthread_mutex_lock(&pShr->mut);
+		nUsers = --pShr->nUsers;
+		pthread_mutex_unlock(&pShr->mut);
+		if(nUsers == 0) {
+			json_object_put(*pjroot);
+			pthread_mutex_destroy(&pShr->mut);
+			free(pShr);
+		}
+		*ppShr = NULL;
+	}
+	*pjroot = NULL;
+}
+
+/* obtain the string representation of a message's JSON tree, e.g. for
+ * serialization. For a shared tree, json-c's string buffer is shared,
+ * too, so we must hand out a private copy in that case.
+ */
+static uchar *
+msgJSONGetString(msg_t *const pM, struct json_object *const *const pjroot,
+	struct msgJSONShr_s *const *const ppShr, int *const pbMustBeFreed)
+{
+	uchar *psz = NULL;
+
+	*pbMustBeFreed = 0;
+	MsgLock(pM);
+	if(*pjroot != NULL) {
+		if(*ppShr == NULL) {
+			psz = (uchar*) json_object_get_string(*pjroot);
+		} else {
+			jsonShrLock(*ppShr);
+			psz = (uchar*) strdup(json_object_get_string(*pjroot));
+			jsonShrUnlock(*ppShr);
+			*pbMustBeFreed = 1;
+		}
+	}
+	MsgUnlock(pM);
+	return psz;
+}
+
+
 /* set RcvFromIP name in msg object WITHOUT calling AddRef.
  * rgerhards, 2013-01-22
  */
@@ -763,6 +912,392 @@ uchar *propIDToName(propid_t propID)
 }
 
 
+/* ----- msg object pool -----
+ * Allocating and freeing msg objects via malloc() is quite expensive at high
+ * message rates, especially because objects are usually created on input
+ * threads and destroyed on worker threads, which makes the malloc subsystem
+ * move memory between its thread arenas. So we keep destructed objects in a
+ * pool and hand them out again. Each thread has a small private cache, which
+ * is used without any locking. Only if it runs empty or too full, objects are
+ * moved in batches from/to the global pool (under the pool mutex). So a worker
+ * thread destroying messages returns them in batches, from where the input
+ * threads pick them up again.
+ * The global pool is limited in size; if it is full, objects are freed. The
+ * statistics counters are also kept per thread and only added to the global
+ * values from time to time, so they may lag a bit behind.
+ * The pool can be turned off via global(msg.pool="off"). Then objects are
+ * malloc()ed and free()d directly; objects which are already pooled at that
+ * time stay there until their thread terminates or rsyslog exits.
+ */
+#define MSGPOOL_CACHE_MAX	256	/* max objects in a thread's private cache */
+#define MSGPOOL_BATCH		64	/* objects moved between cache and pool at once */
+#define MSGPOOL_MAX		16384	/* max objects in the global pool */
+#define MSGPOOL_STATS_UPD	1024	/* update global stats every n cache operations */
+
+typedef struct msgPoolEntry_s {
+	struct msgPoolEntry_s *pNext;
+} msgPoolEntry_t;
+
+typedef struct msgPoolCache_s {
+	msgPoolEntry_t *pRoot;	/* free objects */
+	int nFree;
+	int nHits;	/* stats since last update of global counters */
+	int nMisses;
+	int nResident;	/* objects allocated (+) or freed (-) since last update */
+} msgPoolCache_t;
+
+static struct {
+	pthread_mutex_t mut;
+	msgPoolEntry_t *pRoot;
+	int nFree;
+	sbool bActive;	/* pool ready to use? (not before init nor after exit) */
+	pthread_key_t keyCache;
+	statsobj_t *stats;
+	intctr_t ctrHits;	/* all counters guarded by mut */
+	intctr_t ctrMisses;
+	intctr_t ctrResident;	/* bytes allocated for msg objects (in use or pooled) */
+} msgPool;
+
+
+/* update global stats from the thread cache. Must be called with the pool
+ * mutex locked.
+ */
+static inline void
+msgPoolUpdStats(msgPoolCache_t *const pCache)
+{
+	msgPool.ctrHits += pCache->nHits;
+	msgPool.ctrMisses += pCache->nMisses;
+	msgPool.ctrResident += (intctr_t) pCache->nResident * sizeof(msg_t);
+	pCache->nHits = pCache->nMisses = pCache->nResident = 0;
+}
+
+
+/* move objects above nKeep from the thread cache to the global pool (or
+ * free them, if the global pool is full).
+ */
+static void
+msgPoolReturn(msgPoolCache_t *const pCache, const int nKeep)
+{
+	msgPoolEntry_t *pEntry;
+
+	pthread_mutex_lock(&msgPool.mut);
+	while(pCache->nFree > nKeep) {
+		pEntry = pCache->pRoot;
+		pCache->pRoot = pEntry->pNext;
+		--pCache->nFree;
+		if(msgPool.bActive && msgPool.nFree < MSGPOOL_MAX) {
+			pEntry->pNext = msgPool.pRoot;
+			msgPool.pRoot = pEntry;
+			++msgPool.nFree;
+		} else {
+			free(pEntry);
+			--pCache->nResident;
+		}
+	}
+	msgPoolUpdStats(pCache);
+	pthread_mutex_unlock(&msgPool.mut);
+}
+
+
+/* refill the (empty) thread cache from the global pool */
+static void
+msgPoolRefill(msgPoolCache_t *const pCache)
+{
+	msgPoolEntry_t *pEntry;
+
+	pthread_mutex_lock(&msgPool.mut);
+	while(pCache->nFree < MSGPOOL_BATCH && msgPool.pRoot != NULL) {
+		pEntry = msgPool.pRoot;
+		msgPool.pRoot = pEntry->pNext;
+		--msgPool.nFree;
+		pEntry->pNext = pCache->pRoot;
+		pCache->pRoot = pEntry;
+		++pCache->nFree;
+	}
+	msgPoolUpdStats(pCache);
+	pthread_mutex_unlock(&msgPool.mut);
+}
+
+
+/* destructor for the thread cache, called on thread termination */
+static void
+msgPoolCacheDestruct(void *const p)
+{
+	msgPoolCache_t *const pCache = (msgPoolCache_t*) p;
+	msgPoolReturn(pCache, 0);
+	free(pCache);
+}
+
+
+static inline msgPoolCache_t *
+msgPoolGetCache(void)
+{
+	msgPoolCache_t *pCache;
+
+	if(!msgPool.bActive || !glblMsgPool)
+		return NULL;
+	pCache = (msgPoolCache_t*) pthread_getspecific(msgPool.keyCache);
+	if(pCache == NULL) {
+		if((pCache = calloc(1, sizeof(msgPoolCache_t))) == NULL)
+			return NULL;
+		pthread_setspecific(msgPool.keyCache, pCache);
+	}
+	return pCache;
+}
+
+
+static inline msg_t *
+msgPoolAlloc(void)
+{
+	msgPoolCache_t *const pCache = msgPoolGetCache();
+	msgPoolEntry_t *pEntry;
+	msg_t *pM;
+
+	if(pCache == NULL)
+		return MALLOC(sizeof(msg_t));
+
+	if(pCache->pRoot == NULL && msgPool.nFree > 0) /* unlocked check is OK, just a hint */
+		msgPoolRefill(pCache);
+	if(pCache->pRoot != NULL) {
+		pEntry = pCache->pRoot;
+		pCache->pRoot = pEntry->pNext;
+		--pCache->nFree;
+		++pCache->nHits;
+		pM = (msg_t*) pEntry;
+	} else {
+		if((pM = MALLOC(sizeof(msg_t))) == NULL)
+			return NULL;
+		++pCache->nMisses;
+		++pCache->nResident;
+	}
+	if(pCache->nHits + pCache->nMisses >= MSGPOOL_STATS_UPD) {
+		pthread_mutex_lock(&msgPool.mut);
+		msgPoolUpdStats(pCache);
+		pthread_mutex_unlock(&msgPool.mut);
+	}
+	return pM;
+}
+
+
+static inline void
+msgPoolFree(msg_t *const pM)
+{
+	msgPoolCache_t *const pCache = msgPoolGetCache();
+	msgPoolEntry_t *const pEntry = (msgPoolEntry_t*) pM;
+
+	if(pCache == NULL) {
+		free(pM);
+		return;
+	}
+	pEntry->pNext = pCache->pRoot;
+	pCache->pRoot = pEntry;
+	if(++pCache->nFree >= MSGPOOL_CACHE_MAX)
+		msgPoolReturn(pCache, MSGPOOL_CACHE_MAX - MSGPOOL_BATCH);
+}
+
+
+static rsRetVal
+msgPoolInit(void)
+{
+	DEFiRet;
+
+	pthread_mutex_init(&msgPool.mut, NULL);
+	if(pthread_key_create(&msgPool.keyCache, msgPoolCacheDestruct) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
+
+	CHKiRet(statsobj.Construct(&msgPool.stats));
+	CHKiRet(statsobj.SetName(msgPool.stats, UCHAR_CONSTANT("msgpool")));
+	CHKiRet(statsobj.SetOrigin(msgPool.stats, UCHAR_CONSTANT("core.msg")));
+	CHKiRet(statsobj.AddCounter(msgPool.stats, UCHAR_CONSTANT("hits"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &msgPool.ctrHits));
+	CHKiRet(statsobj.AddCounter(msgPool.stats, UCHAR_CONSTANT("misses"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &msgPool.ctrMisses));
+	CHKiRet(statsobj.AddCounter(msgPool.stats, UCHAR_CONSTANT("resident.bytes"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &msgPool.ctrResident));
+	CHKiRet(statsobj.ConstructFinalize(msgPool.stats));
+	msgPool.bActive = 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* free all pooled objects. Objects destructed afterwards (there should be
+ * none) are freed immediately.
+ */
+static void
+msgPoolExit(void)
+{
+	msgPoolCache_t *pCache;
+	msgPoolEntry_t *pEntry;
+
+	if((pCache = pthread_getspecific(msgPool.keyCache)) != NULL) {
+		pthread_setspecific(msgPool.keyCache, NULL);
+		msgPoolCacheDestruct(pCache);
+	}
+	pthread_mutex_lock(&msgPool.mut);
+	msgPool.bActive = 0;
+	while(msgPool.pRoot != NULL) {
+		pEntry = msgPool.pRoot;
+		msgPool.pRoot = pEntry->pNext;
+		free(pEntry);
+	}
+	msgPool.nFree = 0;
+	pthread_mutex_unlock(&msgPool.mut);
+	if(msgPool.stats != NULL)
+		statsobj.Destruct(&msgPool.stats);
+}
+/* ----- end msg object pool ----- */
+
+
+/* ----- receive slab pool -----
+ * Slabs are receive buffers that are shared by the raw messages of several
+ * msg objects (see msg.h). Each pool is owned by a single input thread,
+ * which takes slabs from it. Slabs are returned by whatever thread drops
+ * the last reference, so the free list is guarded by a mutex. That mutex
+ * is taken at most once per slab use, not per message.
+ * The pool must outlive all messages that still reference its slabs. As
+ * these may sit in a queue for a long time, msgRawPoolDestruct() just marks
+ * the pool as dead; it is actually freed when the last slab comes back.
+ */
+struct msgRawPool_s {
+	pthread_mutex_t mut;
+	msgRawSlab_t *pFree;	/* free slabs */
+	int nSlabs;		/* slabs owned by this pool (free or in use) */
+	sbool bDead;		/* pool destructed, free slabs when returned */
+};
+
+
+static void
+msgRawSlabFree(msgRawSlab_t *const pSlab)
+{
+	free(pSlab->buf);
+	free(pSlab);
+}
+
+
+/* construct a pool with nSlabs slabs of lenSlab bytes each */
+rsRetVal
+msgRawPoolConstruct(msgRawPool_t **const ppPool, const int nSlabs, const size_t lenSlab)
+{
+	msgRawPool_t *pPool;
+	msgRawSlab_t *pSlab;
+	int i;
+	DEFiRet;
+
+	*ppPool = NULL;
+	CHKmalloc(pPool = calloc(1, sizeof(msgRawPool_t)));
+	pthread_mutex_init(&pPool->mut, NULL);
+	*ppPool = pPool; /* from here on, msgRawPoolDestruct() cleans up */
+	for(i = 0 ; i < nSlabs ; ++i) {
+		CHKmalloc(pSlab = calloc(1, sizeof(msgRawSlab_t)));
+		if((pSlab->buf = MALLOC(lenSlab)) == NULL) {
+			free(pSlab);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		pSlab->pPool = pPool;
+		pSlab->pNext = pPool->pFree;
+		pPool->pFree = pSlab;
+		++pPool->nSlabs;
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK && *ppPool != NULL)
+		msgRawPoolDestruct(ppPool);
+	RETiRet;
+}
+
+
+/* destruct a pool. Slabs still referenced by messages are freed
+ * when they are released, the last one also frees the pool itself.
+ */
+void
+msgRawPoolDestruct(msgRawPool_t **const ppPool)
+{
+	msgRawPool_t *const pPool = *ppPool;
+	msgRawSlab_t *pSlab;
+	int bFreePool;
+
+	pthread_mutex_lock(&pPool->mut);
+	pPool->bDead = 1;
+	while(pPool->pFree != NULL) {
+		pSlab = pPool->pFree;
+		pPool->pFree = pSlab->pNext;
+		msgRawSlabFree(pSlab);
+		--pPool->nSlabs;
+	}
+	bFreePool = (pPool->nSlabs == 0);
+	pthread_mutex_unlock(&pPool->mut);
+	if(bFreePool) {
+		pthread_mutex_destroy(&pPool->mut);
+		free(pPool);
+	} else {
+		DBGPRINTF("msgRawPoolDestruct: %d slabs still in use, pool freed "
+			  "when they are released\n", pPool->nSlabs);
+	}
+	*ppPool = NULL;
+}
+
+
+/* take a slab from the pool. The caller holds the only reference to it.
+ * Returns NULL if all slabs are in use; the caller must then fall back
+ * to copying the data.
+ */
+msgRawSlab_t *
+msgRawPoolGet(msgRawPool_t *const pPool)
+{
+	msgRawSlab_t *pSlab;
+
+	pthread_mutex_lock(&pPool->mut);
+	pSlab = pPool->pFree;
+	if(pSlab != NULL)
+		pPool->pFree = pSlab->pNext;
+	pthread_mutex_unlock(&pPool->mut);
+	if(pSlab != NULL)
+		pSlab->nRefs = 1;
+	return pSlab;
+}
+
+
+/* drop a reference to a slab, returning it to its pool if it was the last one */
+void
+msgRawSlabRelease(msgRawSlab_t *const pSlab)
+{
+	msgRawPool_t *const pPool = pSlab->pPool;
+	int bFreePool = 0;
+
+	if(ATOMIC_DEC_AND_FETCH(&pSlab->nRefs, &pPool->mut) > 0)
+		return;
+	pthread_mutex_lock(&pPool->mut);
+	if(pPool->bDead) {
+		msgRawSlabFree(pSlab);
+		bFreePool = (--pPool->nSlabs == 0);
+	} else {
+		pSlab->pNext = pPool->pFree;
+		pPool->pFree = pSlab;
+	}
+	pthread_mutex_unlock(&pPool->mut);
+	if(bFreePool) {
+		pthread_mutex_destroy(&pPool->mut);
+		free(pPool);
+	}
+}
+
+
+/* free the raw message buffer, if we own one */
+static inline void
+msgFreeRawMsg(msg_t *const pThis)
+{
+	if(pThis->pRawSlab != NULL) {
+		msgRawSlabRelease(pThis->pRawSlab);
+		pThis->pRawSlab = NULL;
+	} else if(pThis->pszRawMsg != pThis->szRawMsg) {
+		free(pThis->pszRawMsg);
+	}
+}
+/* ----- end receive slab pool ----- */
+
+
 /* This is common code for all Constructors. It is defined in an
  * inline'able function so that we can save a function call in the
  * actual constructors (otherwise, the msgConstruct would need
@@ -788,7 +1323,7 @@ static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
 	msg_t *pM;
 
 	assert(ppThis != NULL);
-	CHKmalloc(pM = MALLOC(sizeof(msg_t)));
+	CHKmalloc(pM = msgPoolAlloc());
 	objConstructSetObjInfo(pM); /* intialize object helper entities */
 
 	/* initialize members in ORDER they appear in structure (think "cache line"!) */
@@ -807,6 +1342,7 @@ static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
 	pM->iLenTAG = 0;
 	pM->iLenHOSTNAME = 0;
 	pM->pszRawMsg = NULL;
+	pM->pRawSlab = NULL;
 	pM->pszHOSTNAME = NULL;
 	pM->pszRcvdAt3164 = NULL;
 	pM->pszRcvdAt3339 = NULL;
@@ -826,6 +1362,8 @@ static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
 	pM->pRuleset = NULL;
 	pM->json = NULL;
 	pM->localvars = NULL;
+	pM->jsonShr = NULL;
+	pM->localvarsShr = NULL;
 	pM->dfltTZ[0] = '\0';
 	memset(&pM->tRcvdAt, 0, sizeof(pM->tRcvdAt));
 	memset(&pM->tTIMESTAMP, 0, sizeof(pM->tTIMESTAMP));
@@ -940,8 +1478,7 @@ CODESTARTobjDestruct(msg)
 	if(currRefCount == 0)
 	{
 		/* DEV Debugging Only! dbgprintf("msgDestruct\t0x%lx, RefCount now 0, doing DESTROY\n", (unsigned long)pThis); */
-		if(pThis->pszRawMsg != pThis->szRawMsg)
-			free(pThis->pszRawMsg);
+		msgFreeRawMsg(pThis);
 		freeTAG(pThis);
 		freeHOSTNAME(pThis);
 		if(pThis->pInputName != NULL)
@@ -969,10 +1506,8 @@ CODESTARTobjDestruct(msg)
 			rsCStrDestruct(&pThis->pCSPROCID);
 		if(pThis->pCSMSGID != NULL)
 			rsCStrDestruct(&pThis->pCSMSGID);
-		if(pThis->json != NULL)
-			json_object_put(pThis->json);
-		if(pThis->localvars != NULL)
-			json_object_put(pThis->localvars);
+		msgJSONRelease(&pThis->json, &pThis->jsonShr);
+		msgJSONRelease(&pThis->localvars, &pThis->localvarsShr);
 		if(pThis->pszUUID != NULL)
 			free(pThis->pszUUID);
 #	ifndef HAVE_ATOMIC_BUILTINS
@@ -999,6 +1534,10 @@ CODESTARTobjDestruct(msg)
 			}
 		}
 #		endif
+		/* we keep the memory for re-use, so we must not let the framework free it */
+		obj.DestructObjSelf((obj_t*) pThis);
+		msgPoolFree(pThis);
+		pThis = NULL;
 	} else {
 #	ifndef HAVE_ATOMIC_BUILTINS
 		MsgUnlock(pThis);
@@ -1039,6 +1578,8 @@ ENDobjDestruct(msg)
  * can never run into a situation where the message object is being
  * modified while its content is copied - it's forbidden by definition.
  * rgerhards, 2007-07-10
+ * The JSON trees are an exception: they may be modified at any time, so
+ * we need the lock to set up sharing them (see msgJSONShare()).
  */
 msg_t* MsgDup(msg_t* pOld)
 {
@@ -1099,7 +1640,8 @@ msg_t* MsgDup(msg_t* pOld)
 		}
 	}
 	if(pOld->iLenRawMsg < CONF_RAWMSG_BUFSIZE) {
-		memcpy(pNew->szRawMsg, pOld->szRawMsg, pOld->iLenRawMsg + 1);
+		/* note: a shrunk raw msg may still live in a slab or heap buffer */
+		memcpy(pNew->szRawMsg, pOld->pszRawMsg, pOld->iLenRawMsg + 1);
 		pNew->pszRawMsg = pNew->szRawMsg;
 	} else {
 		tmpCOPYSZ(RawMsg);
@@ -1125,10 +1667,13 @@ msg_t* MsgDup(msg_t* pOld)
 	tmpCOPYCSTR(PROCID);
 	tmpCOPYCSTR(MSGID);
 
-	if(pOld->json != NULL)
-		pNew->json = jsonDeepCopy(pOld->json);
-	if(pOld->localvars != NULL)
-		pNew->localvars = jsonDeepCopy(pOld->localvars);
+	/* the JSON trees are not copied but shared until one of the
+	 * messages modifies them (copy-on-write).
+	 */
+	MsgLock(pOld);
+	msgJSONShare(pOld->json, &pOld->jsonShr, &pNew->json, &pNew->jsonShr);
+	msgJSONShare(pOld->localvars, &pOld->localvarsShr, &pNew->localvars, &pNew->localvarsShr);
+	MsgUnlock(pOld);
 
 	/* we do not copy all other cache properties, as we do not even know
 	 * if they are needed once again. So we let them re-create if needed.
@@ -1157,6 +1702,8 @@ static rsRetVal MsgSerialize(msg_t *pThis, strm_t *pStrm)
 {
 	uchar *psz;
 	int len;
+	int bFreePsz;
+	rsRetVal localRet;
 	DEFiRet;
 
 	assert(pThis != NULL);
@@ -1185,13 +1732,19 @@ static rsRetVal MsgSerialize(msg_t *pThis, strm_t *pStrm)
 	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszRcvFromIP"), PROPTYPE_PSZ, (void*) psz));
 	psz = pThis->pszStrucData; 
 	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszStrucData"), PROPTYPE_PSZ, (void*) psz));
-	if(pThis->json != NULL) {
-		psz = (uchar*) json_object_get_string(pThis->json);
-		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("json"), PROPTYPE_PSZ, (void*) psz));
+	psz = msgJSONGetString(pThis, &pThis->json, &pThis->jsonShr, &bFreePsz);
+	if(psz != NULL) {
+		localRet = obj.SerializeProp(pStrm, UCHAR_CONSTANT("json"), PROPTYPE_PSZ, (void*) psz);
+		if(bFreePsz)
+			free(psz);
+		CHKiRet(localRet);
 	}
-	if(pThis->localvars != NULL) {
-		psz = (uchar*) json_object_get_string(pThis->localvars);
-		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("localvars"), PROPTYPE_PSZ, (void*) psz));
+	psz = msgJSONGetString(pThis, &pThis->localvars, &pThis->localvarsShr, &bFreePsz);
+	if(psz != NULL) {
+		localRet = obj.SerializeProp(pStrm, UCHAR_CONSTANT("localvars"), PROPTYPE_PSZ, (void*) psz);
+		if(bFreePsz)
+			free(psz);
+		CHKiRet(localRet);
 	}
 
 	objSerializePTR(pStrm, pCSAPPNAME, CSTR);
@@ -1388,6 +1941,330 @@ finalize_it:
 #undef isProp
 
 
+/* ----- binary (de)serializer for disk queues -----
+ * The generic text format used by MsgSerialize() is robust, but quite
+ * slow to parse, as each property must be read char by char and looked up
+ * by its name. This is a problem when a large disk queue needs to be
+ * drained. So disk queues may also use the binary format below, which can be
+ * read with two stream operations and decoded without any lookups.
+ * A record looks like this (integers in network byte order):
+ *   u8 cookie (MSG_BINREC_COOKIE), u8 version, u16 reserved (0),
+ *   u32 length of payload, payload, u8 trailer (MSG_BINREC_TRAILER)
+ * The payload starts with the fixed-size (scalar) properties, followed by
+ * the MSG_BINREC_NSTRS string properties in fixed order. Each string is
+ * written as u32 length (MSG_BINREC_NOSTR if not present), the string itself
+ * and a terminating NUL, so that we can use it directly from the read buffer.
+ * The cookie is never a valid first character of a text record, so the
+ * reader can detect which format is used for each record. This permits
+ * to read old queue files and to change the format on an existing queue.
+ */
+#define MSG_BINREC_HDRLEN	8
+#define MSG_BINREC_TIMELEN	17
+#define MSG_BINREC_FIXEDLEN	(3 * 2 + 4 + 8 + 2 * MSG_BINREC_TIMELEN + 4)
+#define MSG_BINREC_NSTRS	14
+#define MSG_BINREC_NOSTR	0xffffffffu
+#define MSG_BINREC_MAXLEN	(256 * 1024 * 1024) /* sanity check for corrupted files */
+
+static inline uchar *
+binPutU16(uchar *p, const uint16_t v)
+{
+	p[0] = (v >> 8) & 0xff;
+	p[1] = v & 0xff;
+	return p + 2;
+}
+static inline uchar *
+binPutU32(uchar *p, const uint32_t v)
+{
+	p[0] = (v >> 24) & 0xff;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+	return p + 4;
+}
+static inline uchar *
+binPutU64(uchar *p, const uint64_t v)
+{
+	p = binPutU32(p, (uint32_t) (v >> 32));
+	return binPutU32(p, (uint32_t) v);
+}
+static inline uchar *
+binPutTime(uchar *p, const struct syslogTime *const t)
+{
+	*p++ = t->timeType;
+	*p++ = t->month;
+	*p++ = t->day;
+	*p++ = t->hour;
+	*p++ = t->minute;
+	*p++ = t->second;
+	*p++ = t->secfracPrecision;
+	*p++ = t->OffsetMinute;
+	*p++ = t->OffsetHour;
+	*p++ = t->OffsetMode;
+	*p++ = t->inUTC;
+	p = binPutU16(p, (uint16_t) t->year);
+	return binPutU32(p, (uint32_t) t->secfrac);
+}
+static inline uchar *
+binPutStr(uchar *p, const uchar *const psz, const uint32_t len)
+{
+	if(psz == NULL)
+		return binPutU32(p, MSG_BINREC_NOSTR);
+	p = binPutU32(p, len);
+	memcpy(p, psz, len);
+	p[len] = '\0';
+	return p + len + 1;
+}
+
+static inline uint16_t
+binGetU16(const uchar *const p)
+{
+	return (uint16_t) ((p[0] << 8) | p[1]);
+}
+static inline uint32_t
+binGetU32(const uchar *const p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+static inline uint64_t
+binGetU64(const uchar *const p)
+{
+	return ((uint64_t) binGetU32(p) << 32) | binGetU32(p + 4);
+}
+static inline const uchar *
+binGetTime(const uchar *p, struct syslogTime *const t)
+{
+	t->timeType = *p++;
+	t->month = *p++;
+	t->day = *p++;
+	t->hour = *p++;
+	t->minute = *p++;
+	t->second = *p++;
+	t->secfracPrecision = *p++;
+	t->OffsetMinute = *p++;
+	t->OffsetHour = *p++;
+	t->OffsetMode = *p++;
+	t->inUTC = *p++;
+	t->year = (short) binGetU16(p);
+	t->secfrac = (int) binGetU32(p + 2);
+	return p + 6;
+}
+
+
+/* serialize a message object in binary format (see above). The same
+ * properties as in MsgSerialize() are persisted.
+ */
+rsRetVal
+MsgSerializeBinary(msg_t *const pThis, strm_t *const pStrm)
+{
+	uchar *strs[MSG_BINREC_NSTRS];
+	uint32_t lens[MSG_BINREC_NSTRS];
+	uchar stackBuf[4096];
+	uchar *buf = stackBuf;
+	uchar *p;
+	size_t lenRec;
+	int len;
+	int bFreeJSON;
+	int bFreeLocalVars;
+	int i;
+	DEFiRet;
+
+	assert(pThis != NULL);
+	assert(pStrm != NULL);
+
+	/* collect the string properties first, so that we know the record size */
+	if(pThis->iLenTAG > 0) {
+		strs[0] = (pThis->iLenTAG < CONF_TAG_BUFSIZE) ? pThis->TAG.szBuf : pThis->TAG.pszTAG;
+		lens[0] = pThis->iLenTAG;
+	} else {
+		strs[0] = NULL;
+	}
+	strs[1] = pThis->pszRawMsg;
+	lens[1] = pThis->iLenRawMsg;
+	strs[2] = pThis->pszHOSTNAME;
+	lens[2] = pThis->iLenHOSTNAME;
+	getInputName(pThis, &strs[3], &len);
+	lens[3] = len;
+	strs[4] = getRcvFrom(pThis);
+	strs[5] = getRcvFromIP(pThis);
+	strs[6] = pThis->pszStrucData;
+	lens[6] = pThis->lenStrucData;
+	strs[7] = msgJSONGetString(pThis, &pThis->json, &pThis->jsonShr, &bFreeJSON);
+	strs[8] = msgJSONGetString(pThis, &pThis->localvars, &pThis->localvarsShr, &bFreeLocalVars);
+	strs[9] = (pThis->pCSAPPNAME == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSAPPNAME);
+	strs[10] = (pThis->pCSPROCID == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSPROCID);
+	strs[11] = (pThis->pCSMSGID == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSMSGID);
+	strs[12] = pThis->pszUUID;
+	strs[13] = (pThis->pRuleset == NULL) ? NULL : rulesetGetName(pThis->pRuleset);
+	for(i = 4 ; i < MSG_BINREC_NSTRS ; ++i) {
+		if(i != 6 && strs[i] != NULL)
+			lens[i] = ustrlen(strs[i]);
+	}
+
+	lenRec = MSG_BINREC_HDRLEN + MSG_BINREC_FIXEDLEN + 1;
+	for(i = 0 ; i < MSG_BINREC_NSTRS ; ++i) {
+		lenRec += 4;
+		if(strs[i] != NULL)
+			lenRec += lens[i] + 1;
+	}
+	if(lenRec > sizeof(stackBuf))
+		CHKmalloc(buf = malloc(lenRec));
+
+	p = buf;
+	*p++ = MSG_BINREC_COOKIE;
+	*p++ = MSG_BINREC_VERSION;
+	p = binPutU16(p, 0);
+	p = binPutU32(p, (uint32_t) (lenRec - MSG_BINREC_HDRLEN - 1));
+	p = binPutU16(p, (uint16_t) pThis->iProtocolVersion);
+	p = binPutU16(p, pThis->iSeverity);
+	p = binPutU16(p, pThis->iFacility);
+	p = binPutU32(p, (uint32_t) pThis->msgFlags);
+	p = binPutU64(p, (uint64_t) pThis->ttGenTime);
+	p = binPutTime(p, &pThis->tRcvdAt);
+	p = binPutTime(p, &pThis->tTIMESTAMP);
+	p = binPutU32(p, (uint32_t) pThis->offMSG);
+	for(i = 0 ; i < MSG_BINREC_NSTRS ; ++i)
+		p = binPutStr(p, strs[i], lens[i]);
+	*p++ = MSG_BINREC_TRAILER;
+	assert((size_t) (p - buf) == lenRec);
+
+	CHKiRet(strm.RecordBegin(pStrm));
+	CHKiRet(strm.Write(pStrm, buf, lenRec));
+	CHKiRet(strm.RecordEnd(pStrm));
+
+finalize_it:
+	if(buf != stackBuf)
+		free(buf);
+	if(bFreeJSON)
+		free(strs[7]);
+	if(bFreeLocalVars)
+		free(strs[8]);
+	RETiRet;
+}
+
+
+/* deserialize a binary message record. The stream must be positioned at
+ * the record cookie. If the record is invalid, it is skipped as a whole
+ * (as far as its header permits), so that the next one can be read.
+ */
+rsRetVal
+MsgDeserializeBinary(msg_t *const pMsg, strm_t *const pStrm)
+{
+	uchar hdr[MSG_BINREC_HDRLEN];
+	uchar stackBuf[4096];
+	uchar *buf = stackBuf;
+	const uchar *p;
+	const uchar *pEnd;
+	uchar *strs[MSG_BINREC_NSTRS];
+	uint32_t lens[MSG_BINREC_NSTRS];
+	uint32_t lenPayload;
+	struct json_tokener *tokener;
+	prop_t *myProp;
+	prop_t *propRcvFrom = NULL;
+	prop_t *propRcvFromIP = NULL;
+	int i;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pStrm, strm);
+
+	CHKiRet(strm.ReadBytes(pStrm, hdr, sizeof(hdr)));
+	if(hdr[0] != MSG_BINREC_COOKIE)
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER);
+	lenPayload = binGetU32(hdr + 4);
+	if(lenPayload > MSG_BINREC_MAXLEN)
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER);
+	if(lenPayload + 1 > sizeof(stackBuf))
+		CHKmalloc(buf = malloc(lenPayload + 1));
+	CHKiRet(strm.ReadBytes(pStrm, buf, lenPayload + 1));
+	if(buf[lenPayload] != MSG_BINREC_TRAILER)
+		ABORT_FINALIZE(RS_RET_INVALID_TRAILER);
+	if(hdr[1] != MSG_BINREC_VERSION) {
+		DBGPRINTF("binary message record version %d not supported, record skipped\n", hdr[1]);
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER_VERS);
+	}
+	if(lenPayload < MSG_BINREC_FIXEDLEN)
+		ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+
+	/* first pass: check that the strings are well-formed */
+	p = buf + MSG_BINREC_FIXEDLEN;
+	pEnd = buf + lenPayload;
+	for(i = 0 ; i < MSG_BINREC_NSTRS ; ++i) {
+		if(pEnd - p < 4)
+			ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+		lens[i] = binGetU32(p);
+		p += 4;
+		if(lens[i] == MSG_BINREC_NOSTR) {
+			strs[i] = NULL;
+		} else {
+			if((size_t) (pEnd - p) <= lens[i] || p[lens[i]] != '\0')
+				ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+			strs[i] = (uchar*) p;
+			p += lens[i] + 1;
+		}
+	}
+
+	/* now fill the message object */
+	p = buf;
+	setProtocolVersion(pMsg, (short) binGetU16(p));
+	pMsg->iSeverity = binGetU16(p + 2);
+	pMsg->iFacility = binGetU16(p + 4);
+	pMsg->msgFlags = (int) binGetU32(p + 6);
+	pMsg->ttGenTime = (time_t) binGetU64(p + 10);
+	p = binGetTime(p + 18, &pMsg->tRcvdAt);
+	p = binGetTime(p, &pMsg->tTIMESTAMP);
+
+	if(strs[0] != NULL)
+		MsgSetTAG(pMsg, strs[0], lens[0]);
+	if(strs[1] != NULL)
+		MsgSetRawMsg(pMsg, (char*) strs[1], lens[1]);
+	if(strs[2] != NULL)
+		MsgSetHOSTNAME(pMsg, strs[2], lens[2]);
+	if(strs[3] != NULL) {
+		CHKiRet(prop.Construct(&myProp));
+		CHKiRet(prop.SetString(myProp, strs[3], lens[3]));
+		CHKiRet(prop.ConstructFinalize(myProp));
+		MsgSetInputName(pMsg, myProp);
+		prop.Destruct(&myProp);
+	}
+	if(strs[4] != NULL) {
+		MsgSetRcvFromStr(pMsg, strs[4], lens[4], &propRcvFrom);
+		prop.Destruct(&propRcvFrom);
+	}
+	if(strs[5] != NULL) {
+		MsgSetRcvFromIPStr(pMsg, strs[5], lens[5], &propRcvFromIP);
+		prop.Destruct(&propRcvFromIP);
+	}
+	if(strs[6] != NULL)
+		MsgSetStructuredData(pMsg, (char*) strs[6]);
+	if(strs[7] != NULL) {
+		tokener = json_tokener_new();
+		pMsg->json = json_tokener_parse_ex(tokener, (char*) strs[7], lens[7]);
+		json_tokener_free(tokener);
+	}
+	if(strs[8] != NULL) {
+		tokener = json_tokener_new();
+		pMsg->localvars = json_tokener_parse_ex(tokener, (char*) strs[8], lens[8]);
+		json_tokener_free(tokener);
+	}
+	if(strs[9] != NULL)
+		MsgSetAPPNAME(pMsg, (char*) strs[9]);
+	if(strs[10] != NULL)
+		MsgSetPROCID(pMsg, (char*) strs[10]);
+	if(strs[11] != NULL)
+		MsgSetMSGID(pMsg, (char*) strs[11]);
+	if(strs[12] != NULL)
+		pMsg->pszUUID = ustrdup(strs[12]);
+	if(strs[13] != NULL)
+		rulesetGetRuleset(runConf, &(pMsg->pRuleset), strs[13]);
+	/* offMSG must be set after the raw message */
+	MsgSetMSGoffs(pMsg, (short) binGetU32(p));
+
+finalize_it:
+	if(buf != stackBuf)
+		free(buf);
+	RETiRet;
+}
+
+
 /* Increment reference count - see description of the "msg"
  * structure for details. As a convenience to developers,
  * this method returns the msg pointer that is passed to it.
@@ -2337,10 +3214,17 @@ msgGetJSONMESG(msg_t *__restrict__ const pMsg)
 	json_object_object_add(json, "uuid", jval);
 #endif
 
+	/* the $! tree may be shared with other messages, so we must hold
+	 * the share lock as long as we reference it.
+	 */
+	MsgLock(pMsg);
+	jsonShrLock(pMsg->jsonShr);
 	json_object_object_add(json, "$!", json_object_get(pMsg->json));
 
 	pRes = (uchar*) strdup(json_object_get_string(json));
 	json_object_put(json);
+	jsonShrUnlock(pMsg->jsonShr);
+	MsgUnlock(pMsg);
 	return pRes;
 }
 
@@ -2797,7 +3681,17 @@ rsRetVal MsgReplaceMSG(msg_t *pThis, const uchar* pszMSG, int lenMSG)
 	assert(pszMSG != NULL);
 
 	lenNew = pThis->iLenRawMsg + lenMSG - pThis->iLenMSG;
-	if(lenMSG > pThis->iLenMSG && lenNew >= CONF_RAWMSG_BUFSIZE) {
+	if(pThis->pRawSlab != NULL && lenNew > pThis->iLenRawMsg) {
+		/* slab slices cannot grow, so we need to move out of the slab */
+		if(lenNew < CONF_RAWMSG_BUFSIZE) {
+			bufNew = pThis->szRawMsg;
+		} else {
+			CHKmalloc(bufNew = MALLOC(lenNew + 1));
+		}
+		memcpy(bufNew, pThis->pszRawMsg, pThis->offMSG);
+		msgFreeRawMsg(pThis);
+		pThis->pszRawMsg = bufNew;
+	} else if(lenMSG > pThis->iLenMSG && lenNew >= CONF_RAWMSG_BUFSIZE) {
 		/*  we have lost our "bet" and need to alloc a new buffer ;) */
 		CHKmalloc(bufNew = MALLOC(lenNew + 1));
 		memcpy(bufNew, pThis->pszRawMsg, pThis->offMSG);
@@ -2824,8 +3718,11 @@ finalize_it:
 void MsgSetRawMsg(msg_t *pThis, const char* pszRawMsg, size_t lenMsg)
 {
 	int deltaSize;
+	msgRawSlab_t *const pOldSlab = pThis->pRawSlab;
 	assert(pThis != NULL);
-	if(pThis->pszRawMsg != pThis->szRawMsg)
+	/* a slab is released only after copying, the new data may live in it */
+	pThis->pRawSlab = NULL;
+	if(pOldSlab == NULL && pThis->pszRawMsg != pThis->szRawMsg)
 		free(pThis->pszRawMsg);
 
 	deltaSize = lenMsg - pThis->iLenRawMsg;
@@ -2841,6 +3738,8 @@ void MsgSetRawMsg(msg_t *pThis, const char* pszRawMsg, size_t lenMsg)
 
 	memcpy(pThis->pszRawMsg, pszRawMsg, pThis->iLenRawMsg);
 	pThis->pszRawMsg[pThis->iLenRawMsg] = '\0'; /* this also works with truncation! */
+	if(pOldSlab != NULL)
+		msgRawSlabRelease(pOldSlab);
 	/* correct other information */
 	if(pThis->iLenRawMsg > pThis->offMSG)
 		pThis->iLenMSG += deltaSize;
@@ -2849,6 +3748,83 @@ void MsgSetRawMsg(msg_t *pThis, const char* pszRawMsg, size_t lenMsg)
 }
 
 
+/* Make sure the raw message buffer is owned by the message and can hold
+ * newLen bytes plus the '\0', keeping its first lenKeep bytes. This is
+ * for in-place modifications that grow the message, which saves building
+ * it in a separate buffer and copying it back via MsgSetRawMsg(). The new
+ * length must be set with MsgSetRawMsgLen() when done.
+ */
+rsRetVal
+MsgReserveRawMsg(msg_t *const pThis, const size_t lenKeep, const size_t newLen)
+{
+	uchar *pNew;
+	DEFiRet;
+
+	if(pThis->pRawSlab == NULL && pThis->pszRawMsg != pThis->szRawMsg) {
+		CHKmalloc(pNew = realloc(pThis->pszRawMsg, newLen + 1));
+		pThis->pszRawMsg = pNew;
+	} else if(pThis->pRawSlab != NULL || newLen >= CONF_RAWMSG_BUFSIZE) {
+		if(newLen < CONF_RAWMSG_BUFSIZE) {
+			pNew = pThis->szRawMsg;
+		} else {
+			CHKmalloc(pNew = MALLOC(newLen + 1));
+		}
+		memcpy(pNew, pThis->pszRawMsg, lenKeep);
+		msgFreeRawMsg(pThis);
+		pThis->pszRawMsg = pNew;
+	}
+	/* else the fixed buffer is large enough */
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* set the length of a raw message that was modified in place */
+void
+MsgSetRawMsgLen(msg_t *const pThis, const size_t lenMsg)
+{
+	const int deltaSize = lenMsg - pThis->iLenRawMsg;
+
+	pThis->iLenRawMsg = lenMsg;
+	pThis->pszRawMsg[lenMsg] = '\0';
+	if(pThis->iLenRawMsg > pThis->offMSG)
+		pThis->iLenMSG += deltaSize;
+	else
+		pThis->iLenMSG = 0;
+}
+
+
+/* set raw message from a slice of a receive slab, without copying it.
+ * The message takes a reference to the slab. The byte at
+ * pszRawMsg[lenMsg] must belong to the slice, as it is overwritten by
+ * the '\0' terminator. Small messages are still copied into the msg
+ * object, so that they do not keep a (large) slab in use.
+ */
+void MsgSetRawMsgFromSlab(msg_t *const pThis, msgRawSlab_t *const pSlab, uchar *const pszRawMsg,
+	const size_t lenMsg)
+{
+	int deltaSize;
+	assert(pThis != NULL);
+
+	if(lenMsg < CONF_RAWMSG_BUFSIZE) {
+		MsgSetRawMsg(pThis, (char*) pszRawMsg, lenMsg);
+		return;
+	}
+	ATOMIC_INC(&pSlab->nRefs, &pSlab->pPool->mut);
+	msgFreeRawMsg(pThis);
+	pThis->pRawSlab = pSlab;
+	deltaSize = lenMsg - pThis->iLenRawMsg;
+	pThis->iLenRawMsg = lenMsg;
+	pThis->pszRawMsg = pszRawMsg;
+	pThis->pszRawMsg[lenMsg] = '\0';
+	if(pThis->iLenRawMsg > pThis->offMSG)
+		pThis->iLenMSG += deltaSize;
+	else
+		pThis->iLenMSG = 0;
+}
+
+
 /* set raw message in message object. Size of message is not provided. This
  * function should only be used when it is unavoidable (and over time we should
  * try to remove it altogether).
@@ -2953,6 +3929,7 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 	struct json_object *jroot;
 	struct json_object *parent;
 	struct json_object *field;
+	struct msgJSONShr_s *pShr = NULL;
 	DEFiRet;
 
 	if(*pbMustBeFreed)
@@ -2960,11 +3937,13 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 	*pRes = NULL;
 
 	if(pProp->id == PROP_CEE) {
-		jroot = pMsg->json;
 		MsgLock(pMsg);
+		jroot = pMsg->json;
+		pShr = pMsg->jsonShr;
 	} else if(pProp->id == PROP_LOCAL_VAR) {
-		jroot = pMsg->localvars;
 		MsgLock(pMsg);
+		jroot = pMsg->localvars;
+		pShr = pMsg->localvarsShr;
 	} else if(pProp->id == PROP_GLOBAL_VAR) {
 		jroot = global_var_root;
 		pthread_mutex_lock(&glblVars_lock);
@@ -2973,6 +3952,7 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 			  pProp->id);
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
+	jsonShrLock(pShr);
 
 	if(jroot == NULL) FINALIZE;
 
@@ -2980,8 +3960,10 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 		field = jroot;
 	} else {
 		leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-		CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 1));
-		if(jsonVarExtract(parent, (char*)leaf, &field) == FALSE)
+		/* a shared tree must not be modified, so we cannot create
+		 * missing containers; then the value simply does not exist. */
+		if(jsonPathFindParent(jroot, pProp->name, leaf, &parent, pShr == NULL) != RS_RET_OK
+		   || jsonVarExtract(parent, (char*)leaf, &field) == FALSE)
 			field = NULL;
 	}
 	if(field != NULL) {
@@ -2991,6 +3973,7 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 	}
 
 finalize_it:
+	jsonShrUnlock(pShr);
 	if(pProp->id == PROP_GLOBAL_VAR)
 		pthread_mutex_unlock(&glblVars_lock);
 	else
@@ -3022,16 +4005,19 @@ msgGetJSONPropJSONorString(msg_t * const pMsg, msgPropDescr_t *pProp, struct jso
 	struct json_object *jroot;
 	uchar *leaf;
 	struct json_object *parent;
+	struct msgJSONShr_s *pShr = NULL;
 	DEFiRet;
 
 	*pjson = NULL, *pcstr = NULL;
 
 	if(pProp->id == PROP_CEE) {
-		jroot = pMsg->json;
 		MsgLock(pMsg);
+		jroot = pMsg->json;
+		pShr = pMsg->jsonShr;
 	} else if(pProp->id == PROP_LOCAL_VAR) {
-		jroot = pMsg->localvars;
 		MsgLock(pMsg);
+		jroot = pMsg->localvars;
+		pShr = pMsg->localvarsShr;
 	} else if(pProp->id == PROP_GLOBAL_VAR) {
 		jroot = global_var_root;
 		pthread_mutex_lock(&glblVars_lock);
@@ -3040,13 +4026,14 @@ msgGetJSONPropJSONorString(msg_t * const pMsg, msgPropDescr_t *pProp, struct jso
 			  pProp->id);
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
+	jsonShrLock(pShr);
 
 	if(!strcmp((char*)pProp->name, "!")) {
 		*pjson = jroot;
 		FINALIZE;
 	}
 	leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-	CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 1));
+	CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, pShr == NULL));
 	if(jsonVarExtract(parent, (char*)leaf, pjson) == FALSE) {
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
@@ -3064,6 +4051,7 @@ finalize_it:
 	/* we need a deep copy, as another thread may modify the object */
 	if(*pjson != NULL)
 		*pjson = jsonDeepCopy(*pjson);
+	jsonShrUnlock(pShr);
 	if(pProp->id == PROP_GLOBAL_VAR)
 		pthread_mutex_unlock(&glblVars_lock);
 	else
@@ -3080,16 +4068,19 @@ msgGetJSONPropJSON(msg_t * const pMsg, msgPropDescr_t *pProp, struct json_object
 	struct json_object *jroot;
 	uchar *leaf;
 	struct json_object *parent;
+	struct msgJSONShr_s *pShr = NULL;
 	DEFiRet;
 
 	*pjson = NULL;
 
 	if(pProp->id == PROP_CEE) {
-		jroot = pMsg->json;
 		MsgLock(pMsg);
+		jroot = pMsg->json;
+		pShr = pMsg->jsonShr;
 	} else if(pProp->id == PROP_LOCAL_VAR) {
-		jroot = pMsg->localvars;
 		MsgLock(pMsg);
+		jroot = pMsg->localvars;
+		pShr = pMsg->localvarsShr;
 	} else if(pProp->id == PROP_GLOBAL_VAR) {
 		jroot = global_var_root;
 		pthread_mutex_lock(&glblVars_lock);
@@ -3098,13 +4089,14 @@ msgGetJSONPropJSON(msg_t * const pMsg, msgPropDescr_t *pProp, struct json_object
 			  pProp->id);
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
+	jsonShrLock(pShr);
 
 	if(!strcmp((char*)pProp->name, "!")) {
 		*pjson = jroot;
 		FINALIZE;
 	}
 	leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-	CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 1));
+	CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, pShr == NULL));
 	if(jsonVarExtract(parent, (char*)leaf, pjson) == FALSE) {
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
@@ -3113,6 +4105,7 @@ finalize_it:
 	/* we need a deep copy, as another thread may modify the object */
 	if(*pjson != NULL)
 		*pjson = jsonDeepCopy(*pjson);
+	jsonShrUnlock(pShr);
 	if(pProp->id == PROP_GLOBAL_VAR)
 		pthread_mutex_unlock(&glblVars_lock);
 	else
@@ -3300,6 +4293,244 @@ finalize_it:
 }
 
 
+/* Direct accessors for properties which need no further processing.
+ * They are used by compiled templates (see tplCompile()) instead of
+ * MsgGetProp(). Each one returns the same value MsgGetProp() returns for
+ * the property without a template entry, but the value is always owned
+ * by the message (or static) and must not be freed. arg is the date
+ * format for timestamps and unused otherwise.
+ */
+static uchar *
+accMSG(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	*pLen = getMSGLen(pMsg);
+	return getMSG(pMsg);
+}
+
+static uchar *
+accTIMESTAMP(msg_t *const pMsg, const int arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getTimeReported(pMsg, (enum tplFormatTypes) arg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accHOSTNAME(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	*pLen = getHOSTNAMELen(pMsg);
+	return (uchar*) getHOSTNAME(pMsg);
+}
+
+static uchar *
+accSYSLOGTAG(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *pRes;
+	getTAG(pMsg, &pRes, pLen);
+	return pRes;
+}
+
+static uchar *
+accRAWMSG(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *pRes;
+	getRawMsg(pMsg, &pRes, pLen);
+	return pRes;
+}
+
+static uchar *
+accRAWMSG_AFTER_PRI(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *pRes;
+	getRawMsgAfterPRI(pMsg, &pRes, pLen);
+	return pRes;
+}
+
+static uchar *
+accINPUTNAME(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *pRes;
+	getInputName(pMsg, &pRes, pLen);
+	return pRes;
+}
+
+static uchar *
+accFROMHOST(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = getRcvFrom(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accFROMHOST_IP(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = getRcvFromIP(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accPRI(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getPRI(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accSYSLOGFACILITY(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getFacility(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accSYSLOGFACILITY_TEXT(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getFacilityStr(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accSYSLOGSEVERITY(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getSeverity(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accSYSLOGSEVERITY_TEXT(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getSeverityStr(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accTIMEGENERATED(msg_t *const pMsg, const int arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getTimeGenerated(pMsg, (enum tplFormatTypes) arg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accPROGRAMNAME(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = getProgramName(pMsg, LOCK_MUTEX);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accPROTOCOL_VERSION(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getProtocolVersionString(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accSTRUCTURED_DATA(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *pRes;
+	MsgGetStructuredData(pMsg, &pRes, pLen);
+	return pRes;
+}
+
+static uchar *
+accAPP_NAME(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getAPPNAME(pMsg, LOCK_MUTEX);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accPROCID(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getPROCID(pMsg, LOCK_MUTEX);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accMSGID(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getMSGID(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+#ifdef USE_LIBUUID
+static uchar *
+accUUID(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *pRes;
+	getUUID(pMsg, &pRes, pLen);
+	return pRes;
+}
+#endif
+
+static uchar *
+accPARSESUCCESS(msg_t *const pMsg, const int __attribute__((unused)) arg, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getParseSuccess(pMsg);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+accSYS_MYHOSTNAME(msg_t __attribute__((unused)) *const pMsg, const int __attribute__((unused)) arg,
+	rs_size_t *const pLen)
+{
+	uchar *const pRes = glbl.GetLocalHostName();
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+/* return the direct accessor for a property or NULL if there is none
+ * (the property must then be obtained via MsgGetProp()).
+ */
+msgPropAccessor_t
+MsgGetPropAccessor(const propid_t id)
+{
+	switch(id) {
+	case PROP_MSG:			return accMSG;
+	case PROP_TIMESTAMP:		return accTIMESTAMP;
+	case PROP_HOSTNAME:		return accHOSTNAME;
+	case PROP_SYSLOGTAG:		return accSYSLOGTAG;
+	case PROP_RAWMSG:		return accRAWMSG;
+	case PROP_RAWMSG_AFTER_PRI:	return accRAWMSG_AFTER_PRI;
+	case PROP_INPUTNAME:		return accINPUTNAME;
+	case PROP_FROMHOST:		return accFROMHOST;
+	case PROP_FROMHOST_IP:		return accFROMHOST_IP;
+	case PROP_PRI:			return accPRI;
+	case PROP_SYSLOGFACILITY:	return accSYSLOGFACILITY;
+	case PROP_SYSLOGFACILITY_TEXT:	return accSYSLOGFACILITY_TEXT;
+	case PROP_SYSLOGSEVERITY:	return accSYSLOGSEVERITY;
+	case PROP_SYSLOGSEVERITY_TEXT:	return accSYSLOGSEVERITY_TEXT;
+	case PROP_TIMEGENERATED:	return accTIMEGENERATED;
+	case PROP_PROGRAMNAME:		return accPROGRAMNAME;
+	case PROP_PROTOCOL_VERSION:	return accPROTOCOL_VERSION;
+	case PROP_STRUCTURED_DATA:	return accSTRUCTURED_DATA;
+	case PROP_APP_NAME:		return accAPP_NAME;
+	case PROP_PROCID:		return accPROCID;
+	case PROP_MSGID:		return accMSGID;
+#ifdef USE_LIBUUID
+	case PROP_UUID:			return accUUID;
+#endif
+	case PROP_PARSESUCCESS:		return accPARSESUCCESS;
+	case PROP_SYS_MYHOSTNAME:	return accSYS_MYHOSTNAME;
+	default:			return NULL;
+	}
+}
+
+
 /* This function returns a string-representation of the 
  * requested message property. This is a generic function used
  * to abstract properties so that these can be easier
@@ -3622,12 +4853,14 @@ uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restri
 				} else if(pProp->id == PROP_CEE_ALL_JSON_PLAIN) {
 					jflag = JSON_C_TO_STRING_PLAIN;
 				}
+				jsonShrLock(pMsg->jsonShr);
 				jstr = json_object_to_json_string_ext(pMsg->json, jflag);
+				pRes = (jstr == NULL) ? NULL : (uchar*)strdup(jstr);
+				jsonShrUnlock(pMsg->jsonShr);
 				MsgUnlock(pMsg);
 				if(jstr == NULL) {
 					RET_OUT_OF_MEMORY;
 				}
-				pRes = (uchar*)strdup(jstr);
 				if(pRes == NULL) {
 					RET_OUT_OF_MEMORY;
 				}
@@ -4608,7 +5841,7 @@ jsonPathFindParent(struct json_object *jroot, uchar *name, uchar *leaf, struct j
 	namestart = name;
 	*parent = jroot;
 	while(name < leaf-1) {
-		jsonPathFindNext(*parent, namestart, &name, leaf, parent, bCreate);
+		CHKiRet(jsonPathFindNext(*parent, namestart, &name, leaf, parent, bCreate));
 	}
 	if(*parent == NULL)
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
@@ -4673,14 +5906,17 @@ msgAddJSON(msg_t * const pM, uchar *name, struct json_object *json, int force_re
 	struct json_object *parent, *leafnode;
 	struct json_object *given = NULL;
 	uchar *leaf;
+	rsRetVal localRet = RS_RET_OK;
 	DEFiRet;
 
 	if(name[0] == '!') {
 		pjroot = &pM->json;
 		MsgLock(pM);
+		localRet = msgJSONUnshare(pjroot, &pM->jsonShr);
 	} else if(name[0] == '.') {
 		pjroot = &pM->localvars;
 		MsgLock(pM);
+		localRet = msgJSONUnshare(pjroot, &pM->localvarsShr);
 	} else if (name[0] == '/') { /* globl var */
 		pjroot = &global_var_root;
 		if (sharedReference) {
@@ -4693,6 +5929,10 @@ msgAddJSON(msg_t * const pM, uchar *name, struct json_object *json, int force_re
 		DBGPRINTF("Passed name %s is unknown kind of variable (It is not CEE, Local or Global variable).", name);
 		ABORT_FINALIZE(RS_RET_INVLD_SETOP);
 	}
+	if(localRet != RS_RET_OK) {
+		json_object_put(json);
+		ABORT_FINALIZE(localRet);
+	}
 
 	if(name[1] == '\0') { /* full tree? */
 		if(*pjroot == NULL)
@@ -4756,14 +5996,17 @@ msgDelJSON(msg_t * const pM, uchar *name)
 {
 	struct json_object **jroot;
 	struct json_object *parent, *leafnode;
+	struct msgJSONShr_s **ppShr = NULL;
 	uchar *leaf;
 	DEFiRet;
 
 	if(name[0] == '!') {
 		jroot = &pM->json;
+		ppShr = &pM->jsonShr;
 		MsgLock(pM);
 	} else if(name[0] == '.') {
 		jroot = &pM->localvars;
+		ppShr = &pM->localvarsShr;
 		MsgLock(pM);
 	} else if (name[0] == '/') { /* globl var */
 		jroot = &global_var_root;
@@ -4785,9 +6028,15 @@ msgDelJSON(msg_t * const pM, uchar *name)
 		 * we trust rsyslog.conf to be written by the admin.
 		 */
 		DBGPRINTF("unsetting JSON root object\n");
-		json_object_put(*jroot);
-		*jroot = NULL;
+		if(ppShr == NULL) {
+			json_object_put(*jroot);
+			*jroot = NULL;
+		} else {
+			msgJSONRelease(jroot, ppShr);
+		}
 	} else {
+		if(ppShr != NULL)
+			CHKiRet(msgJSONUnshare(jroot, ppShr));
 		leaf = jsonPathGetLeaf(name, ustrlen(name));
 		CHKiRet(jsonPathFindParent(*jroot, name, leaf, &parent, 1));
 		if(jsonVarExtract(parent, (char*)leaf, &leafnode) == FALSE)
@@ -4993,6 +6242,8 @@ BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
 	CHKiRet(objUse(var, CORE_COMPONENT));
+	CHKiRet(objUse(strm, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	/* set our own handlers */
 	OBJSetMethodHandler(objMethod_SERIALIZE, MsgSerialize);
@@ -5000,6 +6251,14 @@ BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
 #	if HAVE_MALLOC_TRIM
 	INIT_ATOMIC_HELPER_MUT(mutTrimCtr);
 #	endif
+	CHKiRet(msgPoolInit());
 ENDObjClassInit(msg)
+
+
+BEGINObjClassExit(msg, OBJ_IS_CORE_MODULE)
+CODESTARTObjClassExit(msg)
+	msgPoolExit();
+	objRelease(statsobj, CORE_COMPONENT);
+ENDObjClassExit(msg)
 /* vim:set ai:
  */
@@ -37,6 +37,21 @@
 #include "template.h"
 #include "atomic.h"
 
+/* Receive buffers ("slabs") for zero-copy inputs. An input receives into
+ * a slab and hands slices of it over to the messages it creates, which
+ * then reference the slab instead of holding a copy of the raw data. A
+ * slab is reference counted: the input holds one reference while it works
+ * on the slab and each message holds another. When the last reference is
+ * dropped, the slab goes back to the pool it was taken from.
+ */
+typedef struct msgRawPool_s msgRawPool_t;
+typedef struct msgRawSlab_s {
+	msgRawPool_t *pPool;		/* owning pool */
+	struct msgRawSlab_s *pNext;	/* free list link (while in pool) */
+	int nRefs;			/* reference counter */
+	uchar *buf;			/* the actual receive buffer */
+} msgRawSlab_t;
+
 /* rgerhards 2004-11-08: The following structure represents a
  * syslog message. 
  *
@@ -77,6 +92,7 @@ struct msg {
 	int	iLenPROGNAME;	/* Length of PROGNAME (-1 = not yet set) */
 	uchar	*pszRawMsg;	/* message as it was received on the wire. This is important in case we
 				 * need to preserve cryptographic verifiers.  */
+	msgRawSlab_t *pRawSlab;	/* slab pszRawMsg points into, NULL if we own the buffer */
 	uchar	*pszHOSTNAME;	/* HOSTNAME from syslog message */
 	char *pszRcvdAt3164;	/* time as RFC3164 formatted string (always 15 charcters) */
 	char *pszRcvdAt3339;	/* time as RFC3164 formatted string (32 charcters at most) */
@@ -110,6 +126,8 @@ struct msg {
 	struct syslogTime tTIMESTAMP;/* (parsed) value of the timestamp */
 	struct json_object *json;
 	struct json_object *localvars;
+	struct msgJSONShr_s *jsonShr;	/* non-NULL while json is shared with other msgs (copy-on-write) */
+	struct msgJSONShr_s *localvarsShr; /* same for localvars */
 	/* some fixed-size buffers to save malloc()/free() for frequently used fields (from the default templates) */
 	uchar szRawMsg[CONF_RAWMSG_BUFSIZE];	/* most messages are small, and these are stored here (without malloc/free!) */
 	uchar szHOSTNAME[CONF_HOSTNAME_BUFSIZE];
@@ -149,11 +167,17 @@ struct msg {
 #define MSG_LEGACY_PROTOCOL 0
 #define MSG_RFC5424_PROTOCOL 1
 
+/* binary serialization format (for disk queues), see MsgSerializeBinary() */
+#define MSG_BINREC_COOKIE	0xB1	/* first octet of a binary record, never '<' */
+#define MSG_BINREC_TRAILER	'\n'
+#define MSG_BINREC_VERSION	1
+
 #define MAX_VARIABLE_NAME_LEN 1024
 
 /* function prototypes
  */
 PROTOTYPEObjClassInit(msg);
+PROTOTYPEObjClassExit(msg);
 rsRetVal msgConstruct(msg_t **ppThis);
 rsRetVal msgConstructWithTime(msg_t **ppThis, struct syslogTime *stTime, time_t ttGenTime);
 rsRetVal msgConstructForDeserializer(msg_t **ppThis);
@@ -184,9 +208,18 @@ rsRetVal MsgSetAfterPRIOffs(msg_t *pMsg, short offs);
 void MsgSetMSGoffs(msg_t *pMsg, short offs);
 void MsgSetRawMsgWOSize(msg_t *pMsg, char* pszRawMsg);
 void MsgSetRawMsg(msg_t *pMsg, const char* pszRawMsg, size_t lenMsg);
+void MsgSetRawMsgFromSlab(msg_t *pMsg, msgRawSlab_t *pSlab, uchar *pszRawMsg, size_t lenMsg);
+rsRetVal MsgReserveRawMsg(msg_t *pMsg, size_t lenKeep, size_t newLen);
+void MsgSetRawMsgLen(msg_t *pMsg, size_t lenMsg);
+rsRetVal msgRawPoolConstruct(msgRawPool_t **ppPool, int nSlabs, size_t lenSlab);
+void msgRawPoolDestruct(msgRawPool_t **ppPool);
+msgRawSlab_t *msgRawPoolGet(msgRawPool_t *pPool);
+void msgRawSlabRelease(msgRawSlab_t *pSlab);
 rsRetVal MsgReplaceMSG(msg_t *pThis, const uchar* pszMSG, int lenMSG);
 uchar *MsgGetProp(msg_t *pMsg, struct templateEntry *pTpe, msgPropDescr_t *pProp,
 		  rs_size_t *pPropLen, unsigned short *pbMustBeFreed, struct syslogTime *ttNow);
+typedef uchar *(*msgPropAccessor_t)(msg_t *const pMsg, const int arg, rs_size_t *const pLen);
+msgPropAccessor_t MsgGetPropAccessor(const propid_t id);
 uchar *getRcvFrom(msg_t *pM);
 void getTAG(msg_t *pM, uchar **ppBuf, int *piLen);
 char *getTimeReported(msg_t *pM, enum tplFormatTypes eFmt);
@@ -196,6 +229,8 @@ rsRetVal msgAddJSON(msg_t *pM, uchar *name, struct json_object *json, int force_
 rsRetVal msgAddMetadata(msg_t *msg, uchar *metaname, uchar *metaval);
 rsRetVal MsgGetSeverity(msg_t *pThis, int *piSeverity);
 rsRetVal MsgDeserialize(msg_t *pMsg, strm_t *pStrm);
+rsRetVal MsgSerializeBinary(msg_t *pMsg, strm_t *pStrm);
+rsRetVal MsgDeserializeBinary(msg_t *pMsg, strm_t *pStrm);
 rsRetVal MsgSetPropsViaJSON(msg_t *__restrict__ const pMsg, const uchar *__restrict__ const json);
 const uchar* msgGetJSONMESG(msg_t *__restrict__ const pMsg);
 
@@ -95,6 +95,32 @@ static struct AllowedSenders *pLastAllowedSenders_GSS = NULL;
 int     ACLAddHostnameOnFail = 0; /* add hostname to acl when DNS resolving has failed */
 int     ACLDontResolve = 0;       /* add hostname to acl instead of resolving it to IP(s) */
 
+/* IP-based allowed sender entries are additionally compiled into binary
+ * prefix trees (one for IPv4, one for IPv6), so that checking a sender does
+ * not need to walk the whole list. Hostname wildcards and scoped IPv6
+ * entries can not be put into the trees. They are kept in a (usually
+ * short) array of entries which are still checked one by one.
+ */
+typedef struct aclNode_s {
+	struct aclNode_s *child[2];
+	sbool bMatch;	/* a permitted prefix ends here */
+} aclNode_t;
+
+typedef struct aclTree_s {
+	aclNode_t *root4;
+	aclNode_t *root6;
+	struct AllowedSenders **slow;	/* entries not in the trees */
+	int nSlow;
+	int maxSlow;
+} aclTree_t;
+
+/* read-only after startup, like the lists */
+static aclTree_t aclTree_UDP;
+static aclTree_t aclTree_TCP;
+#ifdef USE_GSSAPI
+static aclTree_t aclTree_GSS;
+#endif
+
 
 /* ------------------------------ begin permitted peers code ------------------------------ */
 
@@ -149,6 +175,36 @@ finalize_it:
 }
 
 
+/* returns the ACL tree for the provided type, NULL if the type is invalid */
+static aclTree_t *
+getAclTree(uchar *pszType)
+{
+	if(!strcmp((char*)pszType, "UDP"))
+		return &aclTree_UDP;
+	else if(!strcmp((char*)pszType, "TCP"))
+		return &aclTree_TCP;
+#ifdef USE_GSSAPI
+	else if(!strcmp((char*)pszType, "GSS"))
+		return &aclTree_GSS;
+#endif
+	return NULL;
+}
+
+/* same as above, but by list root pointer */
+static aclTree_t *
+getAclTreeForRoot(struct AllowedSenders **ppRoot)
+{
+	if(ppRoot == &pAllowedSenders_UDP)
+		return &aclTree_UDP;
+	else if(ppRoot == &pAllowedSenders_TCP)
+		return &aclTree_TCP;
+#ifdef USE_GSSAPI
+	else if(ppRoot == &pAllowedSenders_GSS)
+		return &aclTree_GSS;
+#endif
+	return NULL;
+}
+
 /* add a wildcard entry to this permitted peer. Entries are always
  * added at the tail of the list. pszStr and lenStr identify the wildcard
  * entry to be added. Note that the string is NOT \0 terminated, so
@@ -529,6 +585,122 @@ mygetnameinfo(const struct sockaddr *sa, socklen_t salen,
 }
 
 
+static void
+aclNodeFree(aclNode_t *pNode)
+{
+	if(pNode == NULL)
+		return;
+	aclNodeFree(pNode->child[0]);
+	aclNodeFree(pNode->child[1]);
+	free(pNode);
+}
+
+/* add a prefix of the provided length to a tree. addr is in network byte order. */
+static rsRetVal
+aclTreeInsert(aclNode_t **ppNode, const uchar *addr, const int bits)
+{
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; ; ++i) {
+		if(*ppNode == NULL)
+			CHKmalloc(*ppNode = calloc(1, sizeof(aclNode_t)));
+		if((*ppNode)->bMatch)
+			FINALIZE; /* already covered by a shorter prefix */
+		if(i == bits)
+			break;
+		ppNode = &(*ppNode)->child[(addr[i >> 3] >> (7 - (i & 7))) & 1];
+	}
+	(*ppNode)->bMatch = 1;
+	/* longer prefixes below this one are now redundant */
+	aclNodeFree((*ppNode)->child[0]);
+	aclNodeFree((*ppNode)->child[1]);
+	(*ppNode)->child[0] = (*ppNode)->child[1] = NULL;
+
+finalize_it:
+	RETiRet;
+}
+
+/* returns 1 if any prefix in the tree matches addr (network byte order), 0 otherwise */
+static inline int
+aclTreeMatch(const aclNode_t *pNode, const uchar *addr, const int bits)
+{
+	int i;
+
+	for(i = 0 ; pNode != NULL ; ++i) {
+		if(pNode->bMatch)
+			return 1;
+		if(i == bits)
+			break;
+		pNode = pNode->child[(addr[i >> 3] >> (7 - (i & 7))) & 1];
+	}
+	return 0;
+}
+
+/* add an allowed sender entry to the tree (or the slow path) */
+static rsRetVal
+aclTreeAdd(aclTree_t *pTree, struct AllowedSenders *pEntry)
+{
+	struct AllowedSenders **newSlow;
+	struct sockaddr *pAddr;
+	DEFiRet;
+
+	if(!F_ISSET(pEntry->allowedSender.flags, ADDR_NAME)) {
+		pAddr = pEntry->allowedSender.addr.NetAddr;
+		if(pAddr->sa_family == AF_INET) {
+			CHKiRet(aclTreeInsert(&pTree->root4, (uchar*) &SIN(pAddr)->sin_addr,
+					      pEntry->SignificantBits));
+			FINALIZE;
+		} else if(pAddr->sa_family == AF_INET6 && SIN6(pAddr)->sin6_scope_id == 0) {
+			CHKiRet(aclTreeInsert(&pTree->root6, SIN6(pAddr)->sin6_addr.s6_addr,
+					      pEntry->SignificantBits));
+			FINALIZE;
+		}
+	}
+
+	if(pTree->nSlow == pTree->maxSlow) {
+		CHKmalloc(newSlow = realloc(pTree->slow, (pTree->maxSlow + 16) * sizeof(struct AllowedSenders*)));
+		pTree->slow = newSlow;
+		pTree->maxSlow += 16;
+	}
+	pTree->slow[pTree->nSlow++] = pEntry;
+
+finalize_it:
+	RETiRet;
+}
+
+/* check a sender against the prefix trees. Returns 1 if permitted, 0 if
+ * the slow path entries still need to be checked.
+ */
+static inline int
+aclTreeMatchAddr(aclTree_t *pTree, struct sockaddr *pFrom)
+{
+	switch(pFrom->sa_family) {
+	case AF_INET:
+		return aclTreeMatch(pTree->root4, (uchar*) &SIN(pFrom)->sin_addr, 32);
+	case AF_INET6:
+		/* v4-mapped senders also match IPv4 entries */
+		if(IN6_IS_ADDR_V4MAPPED(&SIN6(pFrom)->sin6_addr)
+		   && aclTreeMatch(pTree->root4, SIN6(pFrom)->sin6_addr.s6_addr + 12, 32))
+			return 1;
+		return aclTreeMatch(pTree->root6, SIN6(pFrom)->sin6_addr.s6_addr, 128);
+	default:
+		return 0;
+	}
+}
+
+static void
+aclTreeClear(aclTree_t *pTree)
+{
+	if(pTree == NULL)
+		return;
+	aclNodeFree(pTree->root4);
+	aclNodeFree(pTree->root6);
+	free(pTree->slow);
+	memset(pTree, 0, sizeof(aclTree_t));
+}
+
+
 /* This function adds an allowed sender entry to the ACL linked list.
  * In any case, a single entry is added. If an error occurs, the
  * function does its error reporting itself. All validity checks
@@ -552,6 +724,11 @@ static rsRetVal AddAllowedSenderEntry(struct AllowedSenders **ppRoot, struct All
 	memcpy(&(pEntry->allowedSender), iAllow, sizeof (struct NetAddr));
 	pEntry->pNext = NULL;
 	pEntry->SignificantBits = iSignificantBits;
+
+	if(aclTreeAdd(getAclTreeForRoot(ppRoot), pEntry) != RS_RET_OK) {
+		free(pEntry);
+		return RS_RET_OUT_OF_MEMORY;
+	}
 	
 	/* enqueue */
 	if(*ppRoot == NULL) {
@@ -593,6 +770,7 @@ clearAllowedSenders(uchar *pszType)
 	 * all kinds of interesting things) -- rgerhards, 2009-01-12
 	 */
 	reinitAllowRoot(pszType);
+	aclTreeClear(getAclTree(pszType));
 }
 
 
@@ -989,8 +1167,10 @@ static int isAllowedSender2(uchar *pszType, struct sockaddr *pFrom, const char *
 {
 	struct AllowedSenders *pAllow;
 	struct AllowedSenders *pAllowRoot = NULL;
+	aclTree_t *pTree;
 	int bNeededDNS = 0;	/* partial check because we could not resolve DNS? */
 	int ret;
+	int i;
 
 	assert(pFrom != NULL);
 	
@@ -1000,13 +1180,18 @@ static int isAllowedSender2(uchar *pszType, struct sockaddr *pFrom, const char *
 	if(pAllowRoot == NULL)
 		return 1; /* checking disabled, everything is valid! */
 	
-	/* now we loop through the list of allowed senders. As soon as
+	/* IP entries are looked up in the prefix trees. If none matches, we
+	 * loop through the remaining allowed senders. As soon as
 	 * we find a match, we return back (indicating allowed). We loop
 	 * until we are out of allowed senders. If so, we fall through the
 	 * loop and the function's terminal return statement will indicate
 	 * that the sender is disallowed.
 	 */
-	for(pAllow = pAllowRoot ; pAllow != NULL ; pAllow = pAllow->pNext) {
+	pTree = getAclTree(pszType);
+	if(aclTreeMatchAddr(pTree, pFrom))
+		return 1;
+	for(i = 0 ; i < pTree->nSlow ; ++i) {
+		pAllow = pTree->slow[i];
 		ret = MaskCmp (&(pAllow->allowedSender), pAllow->SignificantBits, pFrom, pszFromHost, bChkDNS);
 		if(ret == 1)
 			return 1;
@@ -1207,8 +1392,11 @@ void closeUDPListenSockets(int *pSockArr)
  * bIsServer indicates if a server socket should be created
  * 1 - server, 0 - client
  * param rcvbuf indicates desired rcvbuf size; 0 means OS default
+ * bReusePort requests SO_REUSEPORT, so that multiple sockets can be bound to
+ * the same address and port (the kernel distributes packets across them)
  */
-int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbuf, int ipfreebind)
+int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbuf, int ipfreebind,
+	int bReusePort)
 {
         struct addrinfo hints, *res, *r;
         int error, maxs, *s, *socks, on = 1;
@@ -1283,6 +1471,18 @@ int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbu
 			continue;
 		}
 
+#		ifdef SO_REUSEPORT
+		if(bReusePort && setsockopt(*s, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on)) < 0) {
+			errmsg.LogError(errno, NO_ERRCODE, "setsockopt(REUSEPORT)");
+			close(*s);
+			*s = -1;
+			continue;
+		}
+#		else
+		if(bReusePort)
+			DBGPRINTF("create_udp_socket: SO_REUSEPORT not supported on this platform\n");
+#		endif
+
 		/* We need to enable BSD compatibility. Otherwise an attacker
 		 * could flood our log files by sending us tons of ICMP errors.
 		 */
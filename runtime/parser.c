@@ -42,6 +42,7 @@
 #include "unicode-helper.h"
 #include "dirty.h"
 #include "cfsysline.h"
+#include "ctrlscan.h"
 
 /* some defines */
 #define DEFUPRI		(LOG_USER|LOG_NOTICE)
@@ -374,6 +375,89 @@ finalize_it:
 }
 
 
+/* escape settings for SanitizeMsg(), fetched once per message */
+typedef struct sanitizeCnf_s {
+	sbool bSpaceLF;
+	sbool bEscCtl;
+	sbool bEscTab;
+	sbool bEsc8Bit;
+	sbool bCStyle;
+	uchar cEscPrefix;
+} sanitizeCnf_t;
+
+/* write the sanitized form of c to pDst and return its length: 1 if c is
+ * kept as is, up to 4 for an escape sequence, and 0 for control characters
+ * that are dropped because escaping them is turned off.
+ */
+static inline int
+sanitizeChar(const sanitizeCnf_t *const cnf, const uchar c, uchar *const pDst)
+{
+	if(c < 32 && (c != '\t' || cnf->bEscTab)) {
+		/* note: \0 must always be escaped, the rest of the code currently
+		 * can not handle it! -- rgerhards, 2009-08-26
+		 */
+		if(c != '\0' && !cnf->bEscCtl)
+			return 0;
+		/* we are configured to escape control characters. Please note
+		 * that this most probably break non-western character sets like
+		 * Japanese, Korean or Chinese. rgerhards, 2007-07-17
+		 */
+		if(cnf->bCStyle) {
+			pDst[0] = '\\';
+			switch(c) {
+			case '\0':
+				pDst[1] = '0';
+				return 2;
+			case '\a':
+				pDst[1] = 'a';
+				return 2;
+			case '\b':
+				pDst[1] = 'b';
+				return 2;
+			case '\e':
+				pDst[1] = 'e';
+				return 2;
+			case '\f':
+				pDst[1] = 'f';
+				return 2;
+			case '\n':
+				pDst[1] = 'n';
+				return 2;
+			case '\r':
+				pDst[1] = 'r';
+				return 2;
+			case '\t':
+				pDst[1] = 't';
+				return 2;
+			case '\v':
+				pDst[1] = 'v';
+				return 2;
+			default:
+				break;
+			}
+		}
+	} else if(c <= 127 || !cnf->bEsc8Bit) {
+		pDst[0] = c;
+		return 1;
+	}
+	/* In the 8-bit case, we also do the conversion. Note that this most
+	 * probably breaks European languages. -- rgerhards, 2010-01-27
+	 */
+	if(cnf->bCStyle) {
+		pDst[0] = '\\';
+		pDst[1] = 'x';
+		pDst[2] = hexdigit[(c & 0xF0) >> 4];
+		pDst[3] = hexdigit[c & 0xF];
+	} else {
+		pDst[0] = cnf->cEscPrefix;
+		pDst[1] = '0' + ((c & 0300) >> 6);
+		pDst[2] = '0' + ((c & 0070) >> 3);
+		pDst[3] = '0' + ((c & 0007));
+	}
+	return 4;
+}
+
+
 /* sanitize a received message
  * if a message gets to large during sanitization, it is truncated. This is
  * as specified in the upcoming syslog RFC series.
@@ -397,9 +481,14 @@ SanitizeMsg(msg_t *pMsg)
 	size_t lenMsg;
 	size_t iSrc;
 	size_t iDst;
+	size_t iFirst; /* first character that needs sanitation */
 	size_t iMaxLine;
 	size_t maxDest;
-	uchar pc;
+	size_t newLen;
+	int n;
+	sbool bDrops;
+	uchar esc[4];
+	sanitizeCnf_t cnf;
 	sbool bUpdatedLen = RSFALSE;
 	uchar szSanBuf[32*1024]; /* buffer used for sanitizing a string */
 
@@ -432,136 +521,98 @@ SanitizeMsg(msg_t *pMsg)
 		bUpdatedLen = RSTRUE;
 	}
 
+	cnf.bSpaceLF = glbl.GetParserSpaceLFOnReceive();
+	cnf.bEscCtl = glbl.GetParserEscapeControlCharactersOnReceive();
+	cnf.bEscTab = glbl.GetParserEscapeControlCharacterTab();
+	cnf.bEsc8Bit = glbl.GetParserEscape8BitCharactersOnReceive();
+	cnf.bCStyle = glbl.GetParserEscapeControlCharactersCStyle();
+	cnf.cEscPrefix = glbl.GetParserControlCharacterEscapePrefix();
+
 	/* it is much quicker to sweep over the message and see if it actually
 	 * needs sanitation than to do the sanitation in any case. So we first do
 	 * this and terminate when it is not needed - which is expectedly the case
 	 * for the vast majority of messages. -- rgerhards, 2009-06-15
+	 * The sweep is done by ctrlScan(), which checks many bytes at once where
+	 * the CPU supports it, and only stops at candidate characters.
 	 * Note that we do NOT check here if tab characters are to be escaped or
 	 * not. I expect this functionality to be seldomly used and thus I do not
 	 * like to pay the performance penalty. So the penalty is only with those
 	 * that actually use it, because we may call the sanitizer without actual
 	 * need below (but it then still will work perfectly well!). -- rgerhards, 2009-11-27
 	 */
-	int bNeedSanitize = 0;
-	for(iSrc = 0 ; iSrc < lenMsg ; iSrc++) {
-		if(pszMsg[iSrc] < 32) {
-			if(glbl.GetParserSpaceLFOnReceive() && pszMsg[iSrc] == '\n') {
-				pszMsg[iSrc] = ' ';
-			} else if(pszMsg[iSrc] == '\0' || glbl.GetParserEscapeControlCharactersOnReceive()) {
-				bNeedSanitize = 1;
-				if (!glbl.GetParserSpaceLFOnReceive()) {
-					break;
-			    }
-			}
-		} else if(pszMsg[iSrc] > 127 && glbl.GetParserEscape8BitCharactersOnReceive()) {
-			bNeedSanitize = 1;
-			break;
+	iFirst = lenMsg;
+	for(iSrc = 0 ; (iSrc += ctrlScan(pszMsg + iSrc, lenMsg - iSrc, cnf.bEsc8Bit)) < lenMsg ; ++iSrc) {
+		if(pszMsg[iSrc] > 127) {
+			if(iFirst > iSrc)
+				iFirst = iSrc;
+			if(!cnf.bSpaceLF)
+				break;
+		} else if(cnf.bSpaceLF && pszMsg[iSrc] == '\n') {
+			pszMsg[iSrc] = ' ';
+		} else if(pszMsg[iSrc] == '\0' || cnf.bEscCtl) {
+			if(iFirst > iSrc)
+				iFirst = iSrc;
+			if(!cnf.bSpaceLF)
+				break;
 		}
 	}
 
-	if(!bNeedSanitize) {
+	if(iFirst == lenMsg) {
 		if(bUpdatedLen == RSTRUE)
 			MsgSetRawMsgSize(pMsg, lenMsg);
 		FINALIZE;
 	}
 
-	/* now copy over the message and sanitize it. Note that up to iSrc-1 there was
-	 * obviously no need to sanitize, so we can go over that quickly...
-	 */
+	/* compute the sanitized size. Up to iFirst, nothing changes */
+	newLen = iFirst;
+	bDrops = RSFALSE;
+	for(iSrc = iFirst ; iSrc < lenMsg ; ++iSrc) {
+		n = ctrlScan(pszMsg + iSrc, lenMsg - iSrc, cnf.bEsc8Bit);
+		newLen += n;
+		iSrc += n;
+		if(iSrc == lenMsg)
+			break;
+		n = sanitizeChar(&cnf, pszMsg[iSrc], esc);
+		if(n == 0)
+			bDrops = RSTRUE;
+		newLen += n;
+	}
+
 	iMaxLine = glbl.GetMaxLine();
 	maxDest = lenMsg * 4; /* message can grow at most four-fold */
-
 	if(maxDest > iMaxLine)
 		maxDest = iMaxLine;	/* but not more than the max size! */
+
+	if(!bDrops && newLen + 3 < maxDest) {
+		/* fast path: the message only grows and needs no truncation, so we
+		 * can sanitize in place, working from the end. That way, no byte is
+		 * overwritten before it was read, and each is moved only once.
+		 */
+		CHKiRet(MsgReserveRawMsg(pMsg, lenMsg, newLen));
+		pszMsg = pMsg->pszRawMsg;
+		iDst = newLen;
+		for(iSrc = lenMsg ; iSrc > iFirst ; ) {
+			--iSrc;
+			n = sanitizeChar(&cnf, pszMsg[iSrc], esc);
+			iDst -= n;
+			memcpy(pszMsg + iDst, esc, n);
+		}
+		MsgSetRawMsgLen(pMsg, newLen);
+		FINALIZE;
+	}
+
+	/* now copy over the message and sanitize it. Note that up to iFirst there was
+	 * obviously no need to sanitize, so we can go over that quickly...
+	 */
 	if(maxDest < sizeof(szSanBuf))
 		pDst = szSanBuf;
 	else 
 		CHKmalloc(pDst = MALLOC(iMaxLine + 1));
-	if(iSrc > 0) {
-		iSrc--; /* go back to where everything is OK */
-		memcpy(pDst, pszMsg, iSrc); /* fast copy known good */
-	}
+	iSrc = (iFirst < maxDest) ? iFirst : maxDest; /* stay within pDst */
+	memcpy(pDst, pszMsg, iSrc); /* fast copy known good */
 	iDst = iSrc;
 	while(iSrc < lenMsg && iDst < maxDest - 3) { /* leave some space if last char must be escaped */
-		if((pszMsg[iSrc] < 32) && (pszMsg[iSrc] != '\t' || glbl.GetParserEscapeControlCharacterTab())) {
-			/* note: \0 must always be escaped, the rest of the code currently
-			 * can not handle it! -- rgerhards, 2009-08-26
-			 */
-			if(pszMsg[iSrc] == '\0' || glbl.GetParserEscapeControlCharactersOnReceive()) {
-				/* we are configured to escape control characters. Please note
-				 * that this most probably break non-western character sets like
-				 * Japanese, Korean or Chinese. rgerhards, 2007-07-17
-				 */
-				if (glbl.GetParserEscapeControlCharactersCStyle()) {
-					pDst[iDst++] = '\\';
-
-					switch (pszMsg[iSrc]) {
-					case '\0':
-						pDst[iDst++] = '0';
-						break;
-					case '\a':
-						pDst[iDst++] = 'a';
-						break;
-					case '\b':
-						pDst[iDst++] = 'b';
-						break;
-					case '\e':
-						pDst[iDst++] = 'e';
-						break;
-					case '\f':
-						pDst[iDst++] = 'f';
-						break;
-					case '\n':
-						pDst[iDst++] = 'n';
-						break;
-					case '\r':
-						pDst[iDst++] = 'r';
-						break;
-					case '\t':
-						pDst[iDst++] = 't';
-						break;
-					case '\v':
-						pDst[iDst++] = 'v';
-						break;
-					default:
-						pDst[iDst++] = 'x';
-
-						pc = pszMsg[iSrc];
-						pDst[iDst++] = hexdigit[(pc & 0xF0) >> 4];
-						pDst[iDst++] = hexdigit[pc & 0xF];
-
-						break;
-					}
-
-				} else {
-					pDst[iDst++] = glbl.GetParserControlCharacterEscapePrefix();
-					pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0300) >> 6);
-					pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0070) >> 3);
-					pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0007));
-				}
-			}
-
-		} else if(pszMsg[iSrc] > 127 && glbl.GetParserEscape8BitCharactersOnReceive()) {
-			if (glbl.GetParserEscapeControlCharactersCStyle()) {
-				pDst[iDst++] = '\\';
-				pDst[iDst++] = 'x';
-
-				pc = pszMsg[iSrc];
-				pDst[iDst++] = hexdigit[(pc & 0xF0) >> 4];
-				pDst[iDst++] = hexdigit[pc & 0xF];
-
-			} else {
-				/* In this case, we also do the conversion. Note that this most
-				 * probably breaks European languages. -- rgerhards, 2010-01-27
-				 */
-				pDst[iDst++] = glbl.GetParserControlCharacterEscapePrefix();
-				pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0300) >> 6);
-				pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0070) >> 3);
-				pDst[iDst++] = '0' + ((pszMsg[iSrc] & 0007));
-			}
-		} else {
-			pDst[iDst++] = pszMsg[iSrc];
-		}
+		iDst += sanitizeChar(&cnf, pszMsg[iSrc], pDst + iDst);
 		++iSrc;
 	}
 	pDst[iDst] = '\0';
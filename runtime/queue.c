@@ -45,6 +45,7 @@
 #include <sys/stat.h>	 /* required for HP UX */
 #include <time.h>
 #include <errno.h>
+#include <sched.h>
 
 #include "rsyslog.h"
 #include "queue.h"
@@ -60,10 +61,7 @@
 #include "unicode-helper.h"
 #include "statsobj.h"
 #include "parserif.h"
-
-#ifdef OS_SOLARIS
-#	include <sched.h>
-#endif
+#include "hashtable.h"
 
 /* static data */
 DEFobjStaticHelpers
@@ -88,10 +86,14 @@ static rsRetVal ConsumerDA(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal batchProcessed(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
 static rsRetVal qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
+#ifdef HAVE_ATOMIC_BUILTINS
+static rsRetVal qqueueMultiEnqObjRingBuffer(qqueue_t *pThis, multi_submit_t *pMultiSub);
+#endif
 static rsRetVal qAddDirect(qqueue_t *pThis, msg_t *pMsg);
 static rsRetVal qDestructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qConstructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qDestructDisk(qqueue_t *pThis);
+static rsRetVal ShutdownWorkers(qqueue_t *pThis);
 rsRetVal qqueueSetSpoolDir(qqueue_t *pThis, uchar *pszSpoolDir, int lenSpoolDir);
 
 /* some constants for queuePersist () */
@@ -125,7 +127,13 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "queue.dequeueslowdown", eCmdHdlrInt, 0 },
 	{ "queue.dequeuetimebegin", eCmdHdlrInt, 0 },
 	{ "queue.dequeuetimeend", eCmdHdlrInt, 0 },
-	{ "queue.cry.provider", eCmdHdlrGetWord, 0 }
+	{ "queue.cry.provider", eCmdHdlrGetWord, 0 },
+	{ "queue.shards", eCmdHdlrPositiveInt, 0 },
+	{ "queue.shardkey", eCmdHdlrGetWord, 0 },
+	{ "queue.shardsteal", eCmdHdlrBinary, 0 },
+	{ "queue.diskformat", eCmdHdlrGetWord, 0 },
+	{ "queue.syncbatchsize", eCmdHdlrNonNegInt, 0 },
+	{ "queue.syncinterval", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk pblk =
 	{ CNFPARAMBLK_VERSION,
@@ -249,6 +257,9 @@ getQueueTypeName(queueType_t t)
 	case QUEUETYPE_DIRECT: 
 		r = "Direct";
 		break;
+	case QUEUETYPE_RINGBUFFER:
+		r = "RingBuffer";
+		break;
 	default:
 		r = "invalid/unknown queue mode";
 		break;
@@ -273,6 +284,8 @@ qqueueDbgPrint(qqueue_t *pThis)
 	dbgoprint((obj_t*) pThis, "queue.discardseverity: %d\n", pThis->iDiscardSeverity);
 	dbgoprint((obj_t*) pThis, "queue.checkpointinterval: %d\n", pThis->iPersistUpdCnt);
 	dbgoprint((obj_t*) pThis, "queue.syncqueuefiles: %d\n", pThis->bSyncQueueFiles);
+	dbgoprint((obj_t*) pThis, "queue.syncbatchsize: %d\n", pThis->iSyncBatchSize);
+	dbgoprint((obj_t*) pThis, "queue.syncinterval: %d\n", pThis->iSyncInterval);
 	dbgoprint((obj_t*) pThis, "queue.type: %d [%s]\n", pThis->qType, getQueueTypeName(pThis->qType));
 	dbgoprint((obj_t*) pThis, "queue.workerthreads: %d\n", pThis->iNumWorkerThreads);
 	dbgoprint((obj_t*) pThis, "queue.timeoutshutdown: %d\n", pThis->toQShutdown);
@@ -285,6 +298,11 @@ qqueueDbgPrint(qqueue_t *pThis)
 	dbgoprint((obj_t*) pThis, "queue.dequeueslowdown: %d\n", pThis->iDeqSlowdown);
 	dbgoprint((obj_t*) pThis, "queue.dequeuetimebegin: %d\n", pThis->iDeqtWinFromHr);
 	dbgoprint((obj_t*) pThis, "queue.dequeuetimeend: %d\n", pThis->iDeqtWinToHr);
+	dbgoprint((obj_t*) pThis, "queue.diskformat: %s\n", pThis->bDiskFmtBinary ? "binary" : "text");
+	dbgoprint((obj_t*) pThis, "queue.shards: %d\n", pThis->nShards);
+	dbgoprint((obj_t*) pThis, "queue.shardkey: '%s'\n",
+		(pThis->pszShardKey == NULL) ? "[NONE]" : (char*)pThis->pszShardKey);
+	dbgoprint((obj_t*) pThis, "queue.shardsteal: %d\n", pThis->bShardSteal);
 }
 
 
@@ -428,6 +446,9 @@ StartDA(qqueue_t *pThis)
 	CHKiRet(qqueueSetSpoolDir(pThis->pqDA, pThis->pszSpoolDir, pThis->lenSpoolDir));
 	CHKiRet(qqueueSetiPersistUpdCnt(pThis->pqDA, pThis->iPersistUpdCnt));
 	CHKiRet(qqueueSetbSyncQueueFiles(pThis->pqDA, pThis->bSyncQueueFiles));
+	CHKiRet(qqueueSetbDiskFmtBinary(pThis->pqDA, pThis->bDiskFmtBinary));
+	CHKiRet(qqueueSetiSyncBatchSize(pThis->pqDA, pThis->iSyncBatchSize));
+	CHKiRet(qqueueSetiSyncInterval(pThis->pqDA, pThis->iSyncInterval));
 	CHKiRet(qqueueSettoActShutdown(pThis->pqDA, pThis->toActShutdown));
 	CHKiRet(qqueueSettoEnq(pThis->pqDA, pThis->toEnq));
 	CHKiRet(qqueueSetiDeqtWinFromHr(pThis->pqDA, pThis->iDeqtWinFromHr));
@@ -688,6 +709,268 @@ static rsRetVal qDelLinkedList(qqueue_t *pThis)
 }
 
 
+/* -------------------- ring buffer -------------------- */
+
+/* The ring buffer is a bounded multi-producer/multi-consumer ring. Each slot
+ * carries a sequence number which tells producers and consumers if they may
+ * use it (see qRingSlot_t). Positions are reserved via CAS, so multiple
+ * threads can work on the ring concurrently without holding the queue mutex.
+ * Consumers are still called with the queue mutex locked (the worker pool
+ * framework needs it), which also serializes them. Producers use a lock-free
+ * fast path as long as the queue is below all of its watermarks (see
+ * qqueueEnqRingBufferLockFree()). They publish their messages before they
+ * increase iQueueSize, so consumers never see a queue size that includes
+ * messages which are not yet in the ring. However, the slot at the dequeue
+ * position may still be reserved by a producer that has not yet published
+ * it, while later slots already are. Consumers never wait for such a slot
+ * (they hold the queue mutex), see qDeqRingBuffer().
+ * Note that a slot is released as soon as its message has been dequeued. The
+ * to-delete logic works on iQueueSize, which is at least the number of
+ * occupied slots minus the slots reserved by lock-free producers. The ring
+ * has room for twice the maximum queue size, and ringReserveEnq() never
+ * reserves more slots than are free.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define RING_LOAD(x) (*(volatile unsigned long*) &(x))
+
+/* wait until a ring slot reaches the expected sequence number. This is only
+ * used by producers, for a slot whose previous lap has already been claimed
+ * by a consumer which is about to release it, so the wait is usually very
+ * short. We yield the CPU in case the other thread has been descheduled.
+ */
+static inline void
+ringWaitSlot(qRingSlot_t *const pSlot, const unsigned long seq)
+{
+	int i = 0;
+	while(RING_LOAD(pSlot->seq) != seq) {
+		if(++i == 64) {
+			sched_yield();
+			i = 0;
+		}
+	}
+}
+
+/* reserve nElem consecutive positions for enqueueing. Returns 0 if the ring does
+ * not have enough free slots, otherwise 1 and the first position in *pPos.
+ */
+static inline int
+ringReserveEnq(qqueue_t *const pThis, const int nElem, unsigned long *const pPos)
+{
+	unsigned long pos;
+	unsigned long deq;
+	int nRetries = 0;
+	int r = 1;
+
+	pos = RING_LOAD(pThis->tVars.ring.enqPos);
+	while(1) {
+		deq = RING_LOAD(pThis->tVars.ring.deqPos);
+		if((long) (pos + nElem - deq) > (long) (pThis->tVars.ring.mask + 1)) {
+			r = 0; /* ring full */
+			break;
+		}
+		if(ATOMIC_CAS(&pThis->tVars.ring.enqPos, pos, pos + nElem, NULL))
+			break;
+		++nRetries;
+		pos = RING_LOAD(pThis->tVars.ring.enqPos);
+	}
+
+	if(nRetries > 0) {
+		STATSCOUNTER_BUMP(pThis->ctrRingCASRetries, pThis->mutCtrRingCASRetries, nRetries);
+	}
+	*pPos = pos;
+	return r;
+}
+
+/* store messages into previously reserved positions and make them visible
+ * to the consumers.
+ */
+static inline void
+ringPublish(qqueue_t *const pThis, const unsigned long pos, msg_t **const ppMsg, const int nElem)
+{
+	qRingSlot_t *pSlot;
+	int i;
+
+	for(i = 0 ; i < nElem ; ++i) {
+		pSlot = &pThis->tVars.ring.pSlots[(pos + i) & pThis->tVars.ring.mask];
+		ringWaitSlot(pSlot, pos + i);
+		pSlot->pMsg = ppMsg[i];
+		__sync_synchronize();
+		pSlot->seq = pos + i + 1;
+	}
+}
+
+
+static rsRetVal qConstructRingBuffer(qqueue_t *pThis)
+{
+	unsigned long nSlots;
+	unsigned long i;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	if(pThis->iMaxQueueSize == 0)
+		ABORT_FINALIZE(RS_RET_QSIZE_ZERO);
+
+	/* leave room for lock-free producers which slightly overshoot the
+	 * queue size (see qqueueEnqRingBufferLockFree()) */
+	for(nSlots = 1 ; nSlots < 2 * (unsigned long) pThis->iMaxQueueSize ; nSlots <<= 1)
+		/*JUST SEARCH*/;
+
+	CHKmalloc(pThis->tVars.ring.pSlots = MALLOC(sizeof(qRingSlot_t) * nSlots));
+	for(i = 0 ; i < nSlots ; ++i) {
+		pThis->tVars.ring.pSlots[i].seq = i;
+		pThis->tVars.ring.pSlots[i].pMsg = NULL;
+	}
+	pThis->tVars.ring.mask = nSlots - 1;
+	pThis->tVars.ring.enqPos = 0;
+	pThis->tVars.ring.deqPos = 0;
+
+	qqueueChkIsDA(pThis);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qDestructRingBuffer(qqueue_t *pThis)
+{
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	queueDrain(pThis); /* discard any remaining queue entries */
+	free(pThis->tVars.ring.pSlots);
+
+	RETiRet;
+}
+
+
+/* this is the regular (mutex-protected) add entry point. As iQueueSize is
+ * below iMaxQueueSize when we are called, there always is a free slot.
+ */
+static rsRetVal qAddRingBuffer(qqueue_t *pThis, msg_t* pMsg)
+{
+	unsigned long pos;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	if(!ringReserveEnq(pThis, 1, &pos)) {
+		DBGOPRINT((obj_t*) pThis, "ring buffer full although queue size is %d - program error?\n",
+			  pThis->iQueueSize);
+		ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+	}
+	ringPublish(pThis, pos, &pMsg, 1);
+	STATSCOUNTER_INC(pThis->ctrRingEnqLocked, pThis->mutCtrRingEnqLocked);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* dequeue the next message. Consumers are serialized by the queue mutex.
+ * Returns RS_RET_NO_MORE_DATA without dequeueing anything if a producer has
+ * reserved, but not yet published the next slot. We must not wait for it
+ * here, as the caller holds the queue mutex.
+ */
+static rsRetVal qDeqRingBuffer(qqueue_t *pThis, msg_t **ppMsg)
+{
+	qRingSlot_t *pSlot;
+	unsigned long pos;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	pos = RING_LOAD(pThis->tVars.ring.deqPos);
+	pSlot = &pThis->tVars.ring.pSlots[pos & pThis->tVars.ring.mask];
+	if(RING_LOAD(pSlot->seq) != pos + 1) {
+		*ppMsg = NULL;
+		ABORT_FINALIZE(RS_RET_NO_MORE_DATA);
+	}
+	__sync_synchronize();
+	*ppMsg = pSlot->pMsg;
+	pSlot->pMsg = NULL;
+	__sync_synchronize();
+	pSlot->seq = pos + pThis->tVars.ring.mask + 1; /* free for next lap */
+	pThis->tVars.ring.deqPos = pos + 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* slots are already released on dequeue, so there is nothing left to do */
+static rsRetVal qDelRingBuffer(qqueue_t __attribute__((unused)) *pThis)
+{
+	return RS_RET_OK;
+}
+
+
+/* Try to enqueue a set of messages without acquiring the queue mutex. This
+ * is only possible if none of the queue's special conditions can be hit,
+ * that is we are below the discard, flow control and DA high water marks.
+ * The messages are stored in the ring first and only then added to
+ * iQueueSize, so consumers never look for messages which are not yet there.
+ * As the size check is done without a lock, concurrent producers may all
+ * pass it and thus overshoot the mark by the size of their batches. This
+ * is harmless, as the ring has room for twice the maximum queue size and
+ * ringReserveEnq() checks the free slots anyhow. Returns RS_RET_OK if the
+ * messages have been enqueued and RS_RET_QUEUE_FULL if the caller must use
+ * the regular (locked) enqueue path instead. Nothing has been changed in
+ * the latter case.
+ * The queue mutex is only acquired if workers need to be advised, most
+ * importantly if the queue was empty before (workers may be sleeping).
+ * Note that we need the full memory barrier that comes with the atomic add
+ * of iQueueSize: a worker going idle first updates nLogDeq and then checks
+ * the queue size, whereas we first update the queue size and then check
+ * nLogDeq. So either the worker sees our messages or we see it is idle.
+ */
+static rsRetVal
+qqueueEnqRingBufferLockFree(qqueue_t *pThis, msg_t **ppMsg, const int nElem)
+{
+	unsigned long pos;
+	int iQueueSizeOld;
+	int iLogSizeOld;
+	int bNeedAdvise;
+	int iCancelStateSave;
+	DEFiRet;
+
+	if((int) ATOMIC_FETCH_32BIT(&pThis->iQueueSize, &pThis->mutQueueSize) + nElem
+	   > pThis->iRingLockFreeMrk)
+		ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+	if(!ringReserveEnq(pThis, nElem, &pos))
+		ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+	ringPublish(pThis, pos, ppMsg, nElem);
+
+	/* only now the messages become visible to the consumers */
+	iQueueSizeOld = ATOMIC_ADD(pThis->iQueueSize, nElem);
+	iLogSizeOld = iQueueSizeOld - (int) ATOMIC_FETCH_32BIT(&pThis->nLogDeq, &pThis->mutLogDeq);
+
+	STATSCOUNTER_SHARDED_BUMP(pThis->ctrEnqueued, nElem);
+	STATSCOUNTER_BUMP(pThis->ctrRingEnqLockFree, pThis->mutCtrRingEnqLockFree, nElem);
+	STATSCOUNTER_SETMAX_NOMUT(pThis->ctrMaxqsize, iQueueSizeOld + nElem);
+#	ifdef ENABLE_IMDIAG
+		ATOMIC_ADD(iOverallQueueSize, nElem);
+#	endif
+
+	bNeedAdvise = (iLogSizeOld <= 0);
+	if(!bNeedAdvise && pThis->iNumWorkerThreads > 1 && pThis->iMinMsgsPerWrkr > 0) {
+		/* we may have crossed the point where one more worker is needed */
+		bNeedAdvise = (iLogSizeOld / pThis->iMinMsgsPerWrkr)
+				!= ((iLogSizeOld + nElem) / pThis->iMinMsgsPerWrkr);
+	}
+	if(bNeedAdvise) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+		d_pthread_mutex_lock(pThis->mut);
+		qqueueAdviseMaxWorkers(pThis);
+		d_pthread_mutex_unlock(pThis->mut);
+		pthread_setcancelstate(iCancelStateSave, NULL);
+	}
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
+
 /* -------------------- disk  -------------------- */
 
 
@@ -898,6 +1181,9 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pWrite, pThis->iMaxFileSize));
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDeq, pThis->iMaxFileSize));
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDel, pThis->iMaxFileSize));
+	CHKiRet(strm.SetiSyncCount(pThis->tVars.disk.pWrite, pThis->iSyncBatchSize));
+	CHKiRet(strm.SetiSyncInterval(pThis->tVars.disk.pWrite, pThis->iSyncInterval));
+	CHKiRet(strm.SetpUsrSyncCntr(pThis->tVars.disk.pWrite, &pThis->ctrSyncs));
 
 finalize_it:
 	RETiRet;
@@ -929,7 +1215,11 @@ static rsRetVal qAddDisk(qqueue_t *pThis, msg_t* pMsg)
 	ASSERT(pThis != NULL);
 
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, &nWriteCount));
-	CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	if(pThis->bDiskFmtBinary) {
+		CHKiRet(MsgSerializeBinary(pMsg, pThis->tVars.disk.pWrite));
+	} else {
+		CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	}
 	CHKiRet(strm.Flush(pThis->tVars.disk.pWrite));
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, NULL)); /* no more counting for now... */
 
@@ -949,11 +1239,30 @@ finalize_it:
 }
 
 
+/* dequeue from disk. Each record may be in text or binary format, no matter
+ * which format we currently write. So we check the first octet of the
+ * record to find out which deserializer to use.
+ */
 static rsRetVal qDeqDisk(qqueue_t *pThis, msg_t **ppMsg)
 {
+	uchar c;
 	DEFiRet;
-	iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3, pThis->tVars.disk.pReadDeq, NULL,
-		NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+
+	CHKiRet(strm.ReadChar(pThis->tVars.disk.pReadDeq, &c));
+	CHKiRet(strm.UnreadChar(pThis->tVars.disk.pReadDeq, c));
+	if(c == MSG_BINREC_COOKIE) {
+		CHKiRet(msgConstructForDeserializer(ppMsg));
+		iRet = MsgDeserializeBinary(*ppMsg, pThis->tVars.disk.pReadDeq);
+		if(iRet != RS_RET_OK) {
+			DBGOPRINT((obj_t*) pThis, "error %d reading binary queue record\n", iRet);
+			msgDestruct(ppMsg);
+		}
+	} else {
+		iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3, pThis->tVars.disk.pReadDeq, NULL,
+			NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+	}
+
+finalize_it:
 	RETiRet;
 }
 
@@ -1068,14 +1377,262 @@ qqueueDeq(qqueue_t *pThis, msg_t **ppMsg)
 	 * losing the whole process because it loops... -- rgerhards, 2008-01-03
 	 */
 	iRet = pThis->qDeq(pThis, ppMsg);
+	if(iRet == RS_RET_NO_MORE_DATA)
+		FINALIZE; /* ring buffer: next message not yet published, nothing dequeued */
 	ATOMIC_INC(&pThis->nLogDeq, &pThis->mutLogDeq);
 
 //	DBGOPRINT((obj_t*) pThis, "entry deleted, size now log %d, phys %d entries\n",
 //		  getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis));
 
+finalize_it:
+	RETiRet;
+}
+
+
+/* --------------- code for sharded queues -------------------- */
+
+/* A sharded queue splits its store into nShards independent sub-queues
+ * (shards). Each of them is a regular queue object with its own mutex and
+ * worker pool, so producers and consumers of different shards do not
+ * contend. The queue object the user configured (the front queue) does not
+ * have a store or worker pool by itself, it just routes messages to the shards.
+ * Messages are either routed based on the producing thread (so every input
+ * thread usually feeds its own shard) or based on the hash of a message
+ * property (so e.g. per-host ordering is preserved).
+ * Workers of a shard that runs empty steal work from the other shards. As
+ * we must not hold two queue mutexes at the same time (deadlock!), stealing
+ * is only tried on shards whose mutex is currently free.
+ */
+
+/* thread-specific shard index, used if no shard key is set. Threads are
+ * assigned to shards in round-robin fashion on first use.
+ */
+static pthread_key_t keyShardIdx;
+static unsigned nextShardIdx = 0;
+DEF_ATOMIC_HELPER_MUT(mutNextShardIdx)
+
+static inline qqueue_t *
+shardSelect(qqueue_t *const pThis, msg_t *const pMsg)
+{
+	uchar *pszVal;
+	rs_size_t lenVal;
+	unsigned short bMustBeFreed = 0;
+	uintptr_t idx;
+
+	if(pThis->pShardKey == NULL) {
+		idx = (uintptr_t) pthread_getspecific(keyShardIdx);
+		if(idx == 0) {
+			idx = ATOMIC_INC_AND_FETCH_unsigned(&nextShardIdx, &mutNextShardIdx) + 1;
+			pthread_setspecific(keyShardIdx, (void*) idx);
+		}
+		--idx; /* 0 is reserved for "not yet set" */
+	} else {
+		pszVal = MsgGetProp(pMsg, NULL, pThis->pShardKey, &lenVal, &bMustBeFreed, NULL);
+		idx = hash_from_string(pszVal);
+		if(bMustBeFreed)
+			free(pszVal);
+	}
+	return pThis->pShards[idx % pThis->nShards];
+}
+
+
+/* create and start the shards. Parameters are inherited from the front
+ * queue, sizes and marks are split between the shards. Must be called after
+ * the front queue's parameters have been checked and defaulted.
+ */
+static rsRetVal
+StartShards(qqueue_t *pThis)
+{
+	qqueue_t *pShard;
+	uchar pszShardName[128];
+	int nWrkr;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pThis->pShards = calloc(pThis->nShards, sizeof(qqueue_t*)));
+	nWrkr = pThis->iNumWorkerThreads / pThis->nShards;
+	if(nWrkr < 1)
+		nWrkr = 1;
+
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		CHKiRet(qqueueConstruct(&pThis->pShards[i], pThis->qType, nWrkr,
+			pThis->iMaxQueueSize / pThis->nShards, pThis->pConsumer));
+		pShard = pThis->pShards[i];
+		snprintf((char*) pszShardName, sizeof(pszShardName), "%s[shard %d]",
+			 obj.GetName((obj_t*) pThis), i);
+		obj.SetName((obj_t*) pShard, pszShardName);
+
+		/* as the created queue is the same object class, we take the
+		 * liberty to access its properties directly.
+		 */
+		pShard->pShardParent = pThis;
+		pShard->iShardIdx = i;
+		pShard->bShardSteal = pThis->bShardSteal;
+		pShard->bEnqOnly = pThis->bEnqOnly;
+		pShard->pAction = pThis->pAction;
+		pShard->iDeqBatchSize = pThis->iDeqBatchSize;
+		pShard->iHighWtrMrk = pThis->iHighWtrMrk / pThis->nShards;
+		pShard->iLowWtrMrk = pThis->iLowWtrMrk / pThis->nShards;
+		pShard->iFullDlyMrk = pThis->iFullDlyMrk / pThis->nShards;
+		pShard->iLightDlyMrk = pThis->iLightDlyMrk / pThis->nShards;
+		pShard->iDiscardMrk = pThis->iDiscardMrk / pThis->nShards;
+		pShard->iDiscardSeverity = pThis->iDiscardSeverity;
+		pShard->iMinMsgsPerWrkr = pThis->iMinMsgsPerWrkr / pThis->nShards;
+		pShard->toQShutdown = pThis->toQShutdown;
+		pShard->toActShutdown = pThis->toActShutdown;
+		pShard->toWrkShutdown = pThis->toWrkShutdown;
+		pShard->toEnq = pThis->toEnq;
+		pShard->iDeqSlowdown = pThis->iDeqSlowdown;
+		pShard->iDeqtWinFromHr = pThis->iDeqtWinFromHr;
+		pShard->iDeqtWinToHr = pThis->iDeqtWinToHr;
+		pShard->bSaveOnShutdown = pThis->bSaveOnShutdown;
+		CHKiRet(qqueueStart(pShard));
+	}
+
+	DBGOPRINT((obj_t*) pThis, "%d shards started, %d worker(s) each\n", pThis->nShards, nWrkr);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+qDestructSharded(qqueue_t *pThis)
+{
+	int i;
+
+	if(pThis->pShards != NULL) {
+		/* all shard workers must be gone before the first shard is
+		 * destructed, as they may try to steal from any other shard.
+		 */
+		for(i = 0 ; i < pThis->nShards ; ++i) {
+			if(pThis->pShards[i] != NULL && pThis->pShards[i]->bQueueStarted
+			   && !pThis->bEnqOnly)
+				ShutdownWorkers(pThis->pShards[i]);
+		}
+		for(i = 0 ; i < pThis->nShards ; ++i) {
+			if(pThis->pShards[i] != NULL)
+				qqueueDestruct(&pThis->pShards[i]);
+		}
+		free(pThis->pShards);
+		pThis->pShards = NULL;
+	}
+	return RS_RET_OK;
+}
+
+
+/* try to steal work from other shards. Called by a worker of shard pThis
+ * when it found its own shard empty, with pThis' mutex locked. We move up to
+ * half of the victim's waiting messages (limited by the batch size) into our
+ * own store, where they are then dequeued as usual. Moving the elements
+ * keeps the to-delete logic of both shards intact. Returns the number of
+ * messages stolen.
+ */
+static int
+shardSteal(qqueue_t *pThis)
+{
+	qqueue_t *pFront = pThis->pShardParent;
+	qqueue_t *pVictim;
+	msg_t *pMsg;
+	int nSteal;
+	int nStolen = 0;
+	int i, k;
+
+	for(k = 1 ; k < pFront->nShards && nStolen == 0 ; ++k) {
+		pVictim = pFront->pShards[(pThis->iShardIdx + k) % pFront->nShards];
+		/* unlocked pre-check to avoid needless mutex operations */
+		if(getLogicalQueueSize(pVictim) < 2)
+			continue;
+		if(pthread_mutex_trylock(pVictim->mut) != 0)
+			continue; /* busy, do not wait for it */
+		nSteal = getLogicalQueueSize(pVictim) / 2;
+		if(nSteal > pThis->iDeqBatchSize)
+			nSteal = pThis->iDeqBatchSize;
+		if(nSteal > pThis->iMaxQueueSize - getPhysicalQueueSize(pThis))
+			nSteal = pThis->iMaxQueueSize - getPhysicalQueueSize(pThis);
+		for(i = 0 ; i < nSteal ; ++i) {
+			if(pVictim->qDeq(pVictim, &pMsg) != RS_RET_OK)
+				break;
+			pVictim->qDel(pVictim);
+			ATOMIC_DEC(&pVictim->iQueueSize, &pVictim->mutQueueSize);
+#			ifdef ENABLE_IMDIAG
+#				ifdef HAVE_ATOMIC_BUILTINS
+					ATOMIC_DEC(&iOverallQueueSize, &NULL);
+#				else
+					--iOverallQueueSize; /* racy, but we can't wait for a mutex! */
+#				endif
+#			endif
+			if(qqueueAdd(pThis, pMsg) != RS_RET_OK) {
+				DBGOPRINT((obj_t*) pThis, "error adding stolen message, discarded\n");
+				msgDestruct(&pMsg);
+			}
+			++nStolen;
+		}
+		if(nStolen > 0) {
+			/* the victim has space again, wake up blocked producers */
+			pthread_cond_signal(&pVictim->notFull);
+			pthread_cond_broadcast(&pVictim->belowLightDlyWtrMrk);
+		}
+		d_pthread_mutex_unlock(pVictim->mut);
+	}
+
+	if(nStolen > 0) {
+		DBGOPRINT((obj_t*) pThis, "stole %d messages from other shard\n", nStolen);
+		STATSCOUNTER_BUMP(pThis->ctrShardStolen, pThis->mutCtrShardStolen, nStolen);
+	}
+	return nStolen;
+}
+
+
+/* front queue enqueue for sharded queues. Messages are passed on in runs of
+ * consecutive messages which go to the same shard, so that batching is
+ * preserved and no extra memory is needed.
+ */
+static rsRetVal
+qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	multi_submit_t subBatch;
+	qqueue_t *pShard;
+	qqueue_t *pShardNext;
+	int iStart;
+	int i;
+	rsRetVal localRet;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+	assert(pMultiSub != NULL);
+
+	if(pMultiSub->nElem == 0)
+		FINALIZE;
+
+	if(pThis->pShardKey == NULL) {
+		/* all messages of a producer go to the same shard */
+		pShard = shardSelect(pThis, pMultiSub->ppMsgs[0]);
+		iRet = pShard->MultiEnq(pShard, pMultiSub);
+		FINALIZE;
+	}
+
+	iStart = 0;
+	pShard = shardSelect(pThis, pMultiSub->ppMsgs[0]);
+	for(i = 1 ; i <= pMultiSub->nElem ; ++i) {
+		pShardNext = (i == pMultiSub->nElem) ? NULL : shardSelect(pThis, pMultiSub->ppMsgs[i]);
+		if(pShardNext != pShard) {
+			subBatch.maxElem = subBatch.nElem = i - iStart;
+			subBatch.ppMsgs = pMultiSub->ppMsgs + iStart;
+			localRet = pShard->MultiEnq(pShard, &subBatch);
+			if(localRet != RS_RET_OK)
+				iRet = localRet; /* report, but continue with the rest */
+			iStart = i;
+			pShard = pShardNext;
+		}
+	}
+
+finalize_it:
 	RETiRet;
 }
 
+/* --------------- end code for sharded queues -------------------- */
+
 
 /* Try to shut down regular and DA queue workers, within the queue timeout 
  * period. That means processing continues as usual. This is the expected
@@ -1354,6 +1911,7 @@ rsRetVal qqueueConstruct(qqueue_t **ppThis, queueType_t qType, int iWorkerThread
 
 	pThis->pszFilePrefix = NULL;
 	pThis->qType = qType;
+	pThis->bShardSteal = 1;
 
 
 	INIT_ATOMIC_HELPER_MUT(pThis->mutQueueSize);
@@ -1497,6 +2055,10 @@ DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem)
 			/* awake possibly waiting enq process */
 			pthread_cond_signal(&pThis->notFull); /* we hold the mutex while we are in here! */
 		}
+		/* with group commit, the consumer side also drives the commit
+		 * interval, so that it is honored if no new messages arrive.
+		 */
+		strm.Commit(pThis->tVars.disk.pWrite, 0);
 	} else { /* memory queue */
 		for(i = 0 ; i < nElem ; ++i) {
 			pThis->qDel(pThis);
@@ -1651,14 +2213,30 @@ DequeueConsumableElements(qqueue_t *pThis, wti_t *pWti, int *piRemainingQueueSiz
 					rd_fd, rd_offs);
 			*pSkippedMsgs = iQueueSize;
 #			ifdef ENABLE_IMDIAG
-			iOverallQueueSize -= iQueueSize;
+#				ifdef HAVE_ATOMIC_BUILTINS
+					ATOMIC_SUB(&iOverallQueueSize, iQueueSize, &NULL);
+#				else
+					iOverallQueueSize -= iQueueSize; /* racy, but we can't wait for a mutex! */
+#				endif
 #			endif
-			pThis->iQueueSize -= iQueueSize;
+			ATOMIC_SUB(&pThis->iQueueSize, iQueueSize, &pThis->mutQueueSize);
 			iQueueSize = 0;
 			break;
 		}
 
 		localRet = qqueueDeq(pThis, &pMsg);
+		if(localRet == RS_RET_NO_MORE_DATA) {
+			/* ring buffer: the next slot is reserved by a producer, but not
+			 * yet published. Process what we have or, if we have nothing,
+			 * give the producer a chance to finish without holding the mutex.
+			 */
+			if(nDequeued > 0)
+				break;
+			d_pthread_mutex_unlock(pThis->mut);
+			sched_yield();
+			d_pthread_mutex_lock(pThis->mut);
+			continue;
+		}
 		if(localRet == RS_RET_FILE_NOT_FOUND) {
 			DBGPRINTF("fatal error on disk queue '%s': file '%s' "
 				"not found, queue size said to be %d",
@@ -1914,6 +2492,15 @@ ConsumerReg(qqueue_t *pThis, wti_t *pWti)
 	ISOBJ_TYPE_assert(pWti, wti);
 
 	iRet = DequeueForConsumer(pThis, pWti, &skippedMsgs);
+	if(iRet == RS_RET_IDLE && pThis->pShardParent != NULL && pThis->bShardSteal
+	   && !pThis->bShutdownImmediate && shardSteal(pThis) > 0) {
+		iRet = DequeueForConsumer(pThis, pWti, &skippedMsgs);
+	}
+	if(iRet == RS_RET_IDLE && pThis->qType == QUEUETYPE_DISK && pThis->tVars.disk.pWrite != NULL) {
+		/* we may have been woken up because the group commit interval
+		 * expired (see GetIdleTimeout()) */
+		strm.Commit(pThis->tVars.disk.pWrite, 0);
+	}
 	if(iRet == RS_RET_FILE_NOT_FOUND) {
 		/* This is a fatal condition and means the queue is almost unusable */
 		d_pthread_mutex_unlock(pThis->mut);
@@ -2112,6 +2699,31 @@ if(pThis->pqParent != NULL) // TODO: check why we actually do this!
 }
 
 
+/* return how long an idle worker may sleep. With group commit, the disk
+ * queue write stream may contain unsynced data. If no new messages arrive,
+ * nothing would trigger its sync, so the worker must wake up when the sync
+ * interval expires (see ConsumerReg()). Called with the queue mutex locked.
+ */
+static rsRetVal
+GetIdleTimeout(qqueue_t *pThis, long *pVal)
+{
+	strm_t *pWrite;
+	DEFiRet;
+	assert(pVal != NULL);
+	*pVal = 0;
+	if(pThis->qType != QUEUETYPE_DISK || pThis->iSyncInterval == 0)
+		FINALIZE;
+	pWrite = pThis->tVars.disk.pWrite;
+	if(pWrite == NULL || !pWrite->bSync || pWrite->nUnsynced == 0)
+		FINALIZE;
+	*pVal = timeoutVal(&pWrite->tNextSync);
+	if(*pVal == 0)
+		*pVal = 1; /* already due, but 0 would mean "no limit" */
+finalize_it:
+	RETiRet;
+}
+
+
 /* start up the queue - it must have been constructed and parameters defined
  * before.
  */
@@ -2185,10 +2797,32 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			pThis->MultiEnq = qqueueMultiEnqObjDirect;
 			pThis->qDel = NULL;
 			break;
+		case QUEUETYPE_RINGBUFFER:
+#			ifdef HAVE_ATOMIC_BUILTINS
+			pThis->qConstruct = qConstructRingBuffer;
+			pThis->qDestruct = qDestructRingBuffer;
+			pThis->qAdd = qAddRingBuffer;
+			pThis->qDeq = qDeqRingBuffer;
+			pThis->qDel = qDelRingBuffer;
+			pThis->MultiEnq = qqueueMultiEnqObjRingBuffer;
+#			else
+			errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED, "queue \"%s\": ringbuffer queue type "
+					"requires atomic instructions, which are not available on this "
+					"platform - using FixedArray instead", obj.GetName((obj_t*) pThis));
+			pThis->qType = QUEUETYPE_FIXED_ARRAY;
+			pThis->qConstruct = qConstructFixedArray;
+			pThis->qDestruct = qDestructFixedArray;
+			pThis->qAdd = qAddFixedArray;
+			pThis->qDeq = qDeqFixedArray;
+			pThis->qDel = qDelFixedArray;
+			pThis->MultiEnq = qqueueMultiEnqObjNonDirect;
+#			endif
+			break;
 	}
 
 	if(pThis->iMaxQueueSize < 100
-	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY)) {
+	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY
+	       || pThis->qType == QUEUETYPE_RINGBUFFER)) {
 		errmsg.LogMsg(0, RS_RET_OK_WARN, LOG_WARNING, "Note: queue.size=\"%d\" is very "
 			"low and can lead to unpredictable results. See also "
 			"http://www.rsyslog.com/lower-bound-for-queue-sizes/",
@@ -2290,6 +2924,17 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 		pThis->iDeqBatchSize = pThis->iMaxQueueSize;
 	}
 
+	/* the lock-free enqueue path of the ring buffer must stay below all marks
+	 * which require special processing (see qqueueEnqRingBufferLockFree()).
+	 */
+	pThis->iRingLockFreeMrk = pThis->iMaxQueueSize - 1;
+	if(pThis->iLightDlyMrk < pThis->iRingLockFreeMrk)
+		pThis->iRingLockFreeMrk = pThis->iLightDlyMrk;
+	if(pThis->iFullDlyMrk < pThis->iRingLockFreeMrk)
+		pThis->iRingLockFreeMrk = pThis->iFullDlyMrk;
+	if(pThis->iDiscardMrk < pThis->iRingLockFreeMrk)
+		pThis->iRingLockFreeMrk = pThis->iDiscardMrk;
+
 	/* finalize some initializations that could not yet be done because it is
 	 * influenced by properties which might have been set after queueConstruct ()
 	 */
@@ -2307,6 +2952,15 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	pthread_cond_init (&pThis->belowFullDlyWtrMrk, NULL);
 	pthread_cond_init (&pThis->belowLightDlyWtrMrk, NULL);
 
+	if(pThis->nShards > 1) {
+		/* we are just the front queue, the shards do the real work */
+		pThis->qDestruct = qDestructSharded;
+		pThis->MultiEnq = qqueueMultiEnqObjSharded;
+		pThis->bQueueStarted = 1;
+		CHKiRet(StartShards(pThis));
+		FINALIZE;
+	}
+
 	/* call type-specific constructor */
 	CHKiRet(pThis->qConstruct(pThis)); /* this also sets bIsDA */
 
@@ -2318,6 +2972,9 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 		wrk = pThis->iHighWtrMrk - (pThis->iHighWtrMrk / 100) * 50; /* 50% of high water mark */
 		if(wrk < pThis->iFullDlyMrk)
 			pThis->iFullDlyMrk = wrk;
+		/* DA mode is activated by qqueueAdviseMaxWorkers(), which needs the mutex */
+		if(pThis->iHighWtrMrk - 1 < pThis->iRingLockFreeMrk)
+			pThis->iRingLockFreeMrk = pThis->iHighWtrMrk - 1;
 	}
 
 	DBGOPRINT((obj_t*) pThis, "params: type %d, enq-only %d, disk assisted %d, spoolDir '%s', maxFileSz %lld, "
@@ -2345,6 +3002,7 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(wtpSetpfGetDeqBatchSize	(pThis->pWtpReg, (rsRetVal (*)(void *pUsr, int*)) GetDeqBatchSize));
 	CHKiRet(wtpSetpfDoWork		(pThis->pWtpReg, (rsRetVal (*)(void *pUsr, void *pWti)) ConsumerReg));
 	CHKiRet(wtpSetpfObjProcessed	(pThis->pWtpReg, (rsRetVal (*)(void *pUsr, wti_t *pWti)) batchProcessed));
+	CHKiRet(wtpSetpfGetIdleTimeout	(pThis->pWtpReg, (rsRetVal (*)(void *pUsr, long*)) GetIdleTimeout));
 	CHKiRet(wtpSetpmutUsr		(pThis->pWtpReg, pThis->mut));
 	CHKiRet(wtpSetiNumWorkerThreads	(pThis->pWtpReg, pThis->iNumWorkerThreads));
 	CHKiRet(wtpSettoWrkShutdown	(pThis->pWtpReg, pThis->toWrkShutdown));
@@ -2372,9 +3030,9 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("size"),
 		ctrType_Int, CTR_FLAG_NONE, &pThis->iQueueSize));
 
-	STATSCOUNTER_INIT(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
+	STATSCOUNTER_SHARDED_INIT(pThis->ctrEnqueued);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("enqueued"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrEnqueued));
+		ctrType_ShardedCtr, CTR_FLAG_RESETTABLE, &pThis->ctrEnqueued));
 
 	STATSCOUNTER_INIT(pThis->ctrFull, pThis->mutCtrFull);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("full"),
@@ -2387,10 +3045,35 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.nf"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrNFDscrd));
 
+	if(pThis->qType == QUEUETYPE_RINGBUFFER) {
+		STATSCOUNTER_INIT(pThis->ctrRingEnqLockFree, pThis->mutCtrRingEnqLockFree);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("ring.enqueued.lockfree"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrRingEnqLockFree));
+		STATSCOUNTER_INIT(pThis->ctrRingEnqLocked, pThis->mutCtrRingEnqLocked);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("ring.enqueued.locked"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrRingEnqLocked));
+		STATSCOUNTER_INIT(pThis->ctrRingCASRetries, pThis->mutCtrRingCASRetries);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("ring.cas.retries"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrRingCASRetries));
+	}
+
+	if(pThis->pShardParent != NULL) {
+		STATSCOUNTER_INIT(pThis->ctrShardStolen, pThis->mutCtrShardStolen);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("stolen"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrShardStolen));
+	}
+
 	pThis->ctrMaxqsize = 0; /* no mutex needed, thus no init call */
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("maxqsize"),
 		ctrType_Int, CTR_FLAG_NONE, &pThis->ctrMaxqsize));
 
+	if(pThis->qType == QUEUETYPE_DISK && pThis->bSyncQueueFiles
+	   && (pThis->iSyncBatchSize > 1 || pThis->iSyncInterval > 0)) {
+		/* updated by the write stream, which is guarded by the queue mutex */
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("syncs"),
+			ctrType_IntCtr, CTR_FLAG_NONE, &pThis->ctrSyncs));
+	}
+
 	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
 
 finalize_it:
@@ -2460,9 +3143,13 @@ static rsRetVal qqueuePersist(qqueue_t *pThis, int bIsCheckpoint)
 	objSerializeSCALAR(psQIF, tVars.disk.sizeOnDisk, INT64);
 	CHKiRet(obj.EndSerialize(psQIF));
 
-	/* now persist the stream info */
-	if(pThis->tVars.disk.pWrite != NULL)
+	/* now persist the stream info. With group commit, there may be unsynced
+	 * data, which must be synced before we write its offset to the .qi file.
+	 */
+	if(pThis->tVars.disk.pWrite != NULL) {
+		CHKiRet(strm.Commit(pThis->tVars.disk.pWrite, 1));
 		CHKiRet(strm.Serialize(pThis->tVars.disk.pWrite, psQIF));
+	}
 	if(pThis->tVars.disk.pReadDel != NULL)
 		CHKiRet(strm.Serialize(pThis->tVars.disk.pReadDel, psQIF));
 	
@@ -2628,6 +3315,11 @@ CODESTARTobjDestruct(qqueue)
 
 	free(pThis->pszFilePrefix);
 	free(pThis->pszSpoolDir);
+	if(pThis->pShardKey != NULL) {
+		msgPropDescrDestruct(pThis->pShardKey);
+		free(pThis->pShardKey);
+	}
+	free(pThis->pszShardKey);
 	if(pThis->useCryprov) {
 		pThis->cryprov.Destruct(&pThis->cryprovData);
 		obj.ReleaseObj(__FILE__, pThis->cryprovNameFull+2, pThis->cryprovNameFull,
@@ -2717,7 +3409,7 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 	int err;
 	struct timespec t;
 
-	STATSCOUNTER_INC(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
+	STATSCOUNTER_SHARDED_INC(pThis->ctrEnqueued);
 	/* first check if we need to discard this message (which will cause CHKiRet() to exit)
 	 */
 	CHKiRet(qqueueChkDiscardMsg(pThis, pThis->iQueueSize, pMsg));
@@ -2887,6 +3579,29 @@ qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 finalize_it:
 	RETiRet;
 }
+
+#ifdef HAVE_ATOMIC_BUILTINS
+/* ring buffer mode: try to enqueue the whole batch lock-free first and
+ * fall back to the regular code if that is not possible.
+ */
+static rsRetVal
+qqueueMultiEnqObjRingBuffer(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+	assert(pMultiSub != NULL);
+
+	if(pMultiSub->nElem == 0)
+		FINALIZE;
+	if(qqueueEnqRingBufferLockFree(pThis, pMultiSub->ppMsgs, pMultiSub->nElem) != RS_RET_OK) {
+		iRet = qqueueMultiEnqObjNonDirect(pThis, pMultiSub);
+	}
+
+finalize_it:
+	RETiRet;
+}
+#endif
 /* ------------------------------ END multi-enqueue functions ------------------------------ */
 
 
@@ -2898,13 +3613,26 @@ qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 {
 	DEFiRet;
 	int iCancelStateSave;
+	int bLocked = 0;
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
-	const int isNonDirectQ = pThis->qType != QUEUETYPE_DIRECT;
+	if(pThis->nShards > 1) {
+		qqueue_t *const pShard = shardSelect(pThis, pMsg);
+		iRet = qqueueEnqMsg(pShard, flowCtlType, pMsg);
+		FINALIZE;
+	}
 
-	if(isNonDirectQ) {
+#	ifdef HAVE_ATOMIC_BUILTINS
+	if(pThis->qType == QUEUETYPE_RINGBUFFER
+	   && qqueueEnqRingBufferLockFree(pThis, &pMsg, 1) == RS_RET_OK) {
+		FINALIZE; /* done without the mutex */
+	}
+#	endif
+
+	if(pThis->qType != QUEUETYPE_DIRECT) {
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
 		d_pthread_mutex_lock(pThis->mut);
+		bLocked = 1;
 	}
 
 	CHKiRet(doEnqSingleObj(pThis, flowCtlType, pMsg));
@@ -2912,7 +3640,7 @@ qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 	qqueueChkPersist(pThis, 1);
 
 finalize_it:
-	if(isNonDirectQ) {
+	if(bLocked) {
 		/* make sure at least one worker is running. */
 		qqueueAdviseMaxWorkers(pThis);
 		/* and release the mutex */
@@ -2996,6 +3724,7 @@ rsRetVal
 qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 {
 	int i;
+	int bShardStealSet = 0;
 	struct cnfparamvals *pvals;
 
 	pvals = nvlstGetParams(lst, &pblk, NULL);
@@ -3067,6 +3796,28 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->iDeqtWinFromHr = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.dequeuetimeend")) {
 			pThis->iDeqtWinToHr = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.shards")) {
+			pThis->nShards = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.shardkey")) {
+			pThis->pszShardKey = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(pblk.descr[i].name, "queue.shardsteal")) {
+			pThis->bShardSteal = pvals[i].val.d.n;
+			bShardStealSet = 1;
+		} else if(!strcmp(pblk.descr[i].name, "queue.syncbatchsize")) {
+			pThis->iSyncBatchSize = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.syncinterval")) {
+			pThis->iSyncInterval = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.diskformat")) {
+			if(!es_strconstcmp(pvals[i].val.d.estr, "binary")) {
+				pThis->bDiskFmtBinary = 1;
+			} else if(!es_strconstcmp(pvals[i].val.d.estr, "text")) {
+				pThis->bDiskFmtBinary = 0;
+			} else {
+				char *const cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				parser_errmsg("invalid queue.diskformat '%s', must be \"text\" "
+					"or \"binary\" - using text", cstr);
+				free(cstr);
+			}
 		} else {
 			DBGPRINTF("queue: program error, non-handled "
 			  "param '%s'\n", pblk.descr[i].name);
@@ -3081,6 +3832,42 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 		}
 	}
 
+	if(pThis->nShards > 1) {
+		if(pThis->qType == QUEUETYPE_DISK || pThis->qType == QUEUETYPE_DIRECT
+		   || pThis->pszFilePrefix != NULL) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s': queue.shards "
+					"can only be used with pure in-memory queues (not direct, "
+					"disk or disk-assisted) - ignored", obj.GetName((obj_t*) pThis));
+			pThis->nShards = 0;
+		}
+	}
+
+	if(pThis->pszShardKey != NULL) {
+		if((pThis->pShardKey = calloc(1, sizeof(msgPropDescr_t))) == NULL
+		   || msgPropDescrFill(pThis->pShardKey, pThis->pszShardKey,
+				       ustrlen(pThis->pszShardKey)) != RS_RET_OK) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s': invalid "
+					"queue.shardkey '%s' - sharding by producer thread instead",
+					obj.GetName((obj_t*) pThis), pThis->pszShardKey);
+			free(pThis->pShardKey);
+			pThis->pShardKey = NULL;
+		}
+	}
+
+	/* a stealing worker processes part of a shard's backlog in parallel to
+	 * the shard's own worker, which breaks the per-key ordering that is the
+	 * point of queue.shardkey. So stealing is off for keyed shards.
+	 */
+	if(pThis->pShardKey != NULL && pThis->bShardSteal) {
+		if(bShardStealSet) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "warning on queue '%s': "
+					"queue.shardsteal can not be used together with "
+					"queue.shardkey, as it would break per-key ordering - "
+					"shardsteal turned off", obj.GetName((obj_t*) pThis));
+		}
+		pThis->bShardSteal = 0;
+	}
+
 	if(pThis->pszFilePrefix == NULL && pThis->cryprovName != NULL) {
 		errmsg.LogError(0, RS_RET_QUEUE_CRY_DISK_ONLY, "error on queue '%s', crypto provider can "
 				"only be set for disk or disk assisted queue - ignored",
@@ -3100,6 +3887,9 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 
 /* some simple object access methods */
 DEFpropSetMeth(qqueue, bSyncQueueFiles, int)
+DEFpropSetMeth(qqueue, bDiskFmtBinary, int)
+DEFpropSetMeth(qqueue, iSyncBatchSize, int)
+DEFpropSetMeth(qqueue, iSyncInterval, int)
 DEFpropSetMeth(qqueue, iPersistUpdCnt, int)
 DEFpropSetMeth(qqueue, iDeqtWinFromHr, int)
 DEFpropSetMeth(qqueue, iDeqtWinToHr, int)
@@ -3170,6 +3960,11 @@ BEGINObjClassInit(qqueue, 1, OBJ_IS_CORE_MODULE)
 
 	/* now set our own handlers */
 	OBJSetMethodHandler(objMethod_SETPROPERTY, qqueueSetProperty);
+
+	INIT_ATOMIC_HELPER_MUT(mutNextShardIdx);
+	if(pthread_key_create(&keyShardIdx, NULL) != 0) {
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
 ENDObjClassInit(qqueue)
 
 /* vi:set ai:
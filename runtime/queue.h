@@ -46,7 +46,8 @@ typedef enum {
 	QUEUETYPE_FIXED_ARRAY = 0,/* a simple queue made out of a fixed (initially malloced) array fast but memoryhog */
 	QUEUETYPE_LINKEDLIST = 1, /* linked list used as buffer, lower fixed memory overhead but slower */
 	QUEUETYPE_DISK = 2, 	  /* disk files used as buffer */
-	QUEUETYPE_DIRECT = 3 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_DIRECT = 3, 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_RINGBUFFER = 4  /* bounded lock-free ring, producers usually do not need the queue mutex */
 } queueType_t;
 
 /* list member definition for linked list types of queues: */
@@ -55,6 +56,21 @@ typedef struct qLinkedList_S {
 	msg_t *pMsg;
 } qLinkedList_t;
 
+/* slot of the ring buffer queue type. The sequence number tells whether the
+ * slot is free for the producer at position seq (seq == pos), holds data for
+ * the consumer at that position (seq == pos + 1) or is still in use by a
+ * previous lap of the ring. This is the classical bounded MPMC ring design.
+ */
+typedef struct qRingSlot_s {
+	unsigned long seq;
+	msg_t *pMsg;
+} qRingSlot_t;
+
+/* used to keep the ring buffer enqueue and dequeue positions on different
+ * cache lines, so that producers and consumers do not invalidate each other.
+ */
+#define QUEUE_CACHELINE_SIZE 64
+
 
 /* the queue object */
 struct queue_s {
@@ -76,12 +92,16 @@ struct queue_s {
 	int	iUpdsSincePersist;/* nbr of queue updates since the last persist call */
 	int	iPersistUpdCnt;	/* persits queue info after this nbr of updates - 0 -> persist only on shutdown */
 	sbool	bSyncQueueFiles;/* if working with files, sync them after each write? */
+	int	iSyncBatchSize;	/* group commit: sync queue files only every n messages... */
+	int	iSyncInterval;	/* ... or every n ms (both 0: sync after each write) */
+	sbool	bDiskFmtBinary;	/* write disk queue records in binary (instead of text) format? */
 	int	iHighWtrMrk;	/* high water mark for disk-assisted memory queues */
 	int	iLowWtrMrk;	/* low water mark for disk-assisted memory queues */
 	int	iDiscardMrk;	/* if the queue is above this mark, low-severity messages are discarded */
 	int	iFullDlyMrk;	/* if the queue is above this mark, FULL_DELAYable message are put on hold */
 	int	iLightDlyMrk;	/* if the queue is above this mark, LIGHT_DELAYable message are put on hold */
 	int	iDiscardSeverity;/* messages of this severity above are discarded on too-full queue */
+	int	iRingLockFreeMrk;/* ring buffer: max queue size for lock-free enqueue (below all other marks) */
 	sbool	bNeedDelQIF;	/* does the QIF file need to be deleted when queue becomes empty? */
 	int	toQShutdown;	/* timeout for regular queue shutdown in ms */
 	int	toActShutdown;	/* timeout for long-running action shutdown in ms */
@@ -146,6 +166,16 @@ struct queue_s {
 	struct queue_s *pqDA;	/* queue for disk-assisted modes */
 	struct queue_s *pqParent;/* pointer to the parent (if this is a child queue) */
 	int	bDAEnqOnly;	/* EnqOnly setting for DA queue */
+	/* sharding: the queue store is split into nShards sub-queues (shards), each
+	 * with its own mutex and worker pool. The front queue just routes messages.
+	 */
+	int	nShards;	/* number of shards, 0 or 1 means not sharded */
+	struct queue_s **pShards;/* the shards (front queue only) */
+	struct queue_s *pShardParent;/* front queue, if this queue is a shard */
+	int	iShardIdx;	/* index of this shard inside the front queue */
+	sbool	bShardSteal;	/* may idle workers steal work from other shards? */
+	uchar	*pszShardKey;	/* name of property to select shard, NULL - by producer thread */
+	msgPropDescr_t *pShardKey; /* descriptor of property to select shard */
 	/* now follow queueing mode specific data elements */
 	//union {			/* different data elements based on queue type (qType) */
 	struct {			/* different data elements based on queue type (qType) */
@@ -167,6 +197,15 @@ struct queue_s {
 			strm_t *pReadDeq; /* current file for dequeueing */
 			strm_t *pReadDel; /* current file for deleting */
 		} disk;
+		struct {
+			qRingSlot_t *pSlots;	/* the ring itself, number of slots is a power of 2 */
+			unsigned long mask;	/* number of slots - 1 */
+			char pad0[QUEUE_CACHELINE_SIZE];
+			unsigned long enqPos;	/* next position to be reserved by a producer */
+			char pad1[QUEUE_CACHELINE_SIZE];
+			unsigned long deqPos;	/* next position to be consumed */
+			char pad2[QUEUE_CACHELINE_SIZE];
+		} ring;
 	} tVars;
 	sbool	useCryprov;	/* quicker than checkig ptr (1 vs 8 bytes!) */
 	uchar *cryprovName; /* crypto provider to use */
@@ -177,11 +216,16 @@ struct queue_s {
 	DEF_ATOMIC_HELPER_MUT(mutLogDeq)
 	/* for statistics subsystem */
 	statsobj_t *statsobj;
-	STATSCOUNTER_DEF(ctrEnqueued, mutCtrEnqueued)
+	STATSCOUNTER_SHARDED_DEF(ctrEnqueued)
 	STATSCOUNTER_DEF(ctrFull, mutCtrFull)
 	STATSCOUNTER_DEF(ctrFDscrd, mutCtrFDscrd)
 	STATSCOUNTER_DEF(ctrNFDscrd, mutCtrNFDscrd)
+	STATSCOUNTER_DEF(ctrRingEnqLockFree, mutCtrRingEnqLockFree)
+	STATSCOUNTER_DEF(ctrRingEnqLocked, mutCtrRingEnqLocked)
+	STATSCOUNTER_DEF(ctrRingCASRetries, mutCtrRingCASRetries)
+	STATSCOUNTER_DEF(ctrShardStolen, mutCtrShardStolen)
 	int ctrMaxqsize; /* NOT guarded by a mutex */
+	uint64 ctrSyncs; /* group commits of the disk queue write stream, guarded by queue mutex */
 };
 
 
@@ -209,6 +253,9 @@ void qqueueDbgPrint(qqueue_t *pThis);
 PROTOTYPEObjClassInit(qqueue);
 PROTOTYPEpropSetMeth(qqueue, iPersistUpdCnt, int);
 PROTOTYPEpropSetMeth(qqueue, bSyncQueueFiles, int);
+PROTOTYPEpropSetMeth(qqueue, bDiskFmtBinary, int);
+PROTOTYPEpropSetMeth(qqueue, iSyncBatchSize, int);
+PROTOTYPEpropSetMeth(qqueue, iSyncInterval, int);
 PROTOTYPEpropSetMeth(qqueue, iDeqtWinFromHr, int);
 PROTOTYPEpropSetMeth(qqueue, iDeqtWinToHr, int);
 PROTOTYPEpropSetMeth(qqueue, toQShutdown, long);
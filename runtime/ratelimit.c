@@ -1,6 +1,7 @@
 /* ratelimit.c
  * support for rate-limiting sources, including "last message
- * repeated n times" processing.
+ * repeated n times" processing. Also contains a keyed token bucket
+ * limiter, which limits each key (e.g. sender) individually.
  *
  * Copyright 2012 Rainer Gerhards and Adiscon GmbH.
  *
@@ -24,6 +25,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "rsyslog.h"
 #include "errmsg.h"
@@ -34,6 +40,8 @@
 #include "msg.h"
 #include "rsconf.h"
 #include "dirty.h"
+#include "statsobj.h"
+#include "dynstats.h"
 
 /* definitions for objects we access */
 DEFobjStaticHelpers
@@ -41,9 +49,66 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(glbl)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(parser)
+DEFobjCurrIf(statsobj)
 
 /* static data */
 
+#define KEYRL_NSHARDS		16	/* must be a power of 2 */
+#define KEYRL_DFLT_MAXKEYS	100000
+#define KEYRL_STATS_FLUSH	256	/* add shard stats to global counters every n checks */
+
+/* A key's bucket. Tokens are kept in 1/1000 units, so that slow refill
+ * rates do not get lost by integer arithmetic.
+ */
+typedef struct keyrlEntry_s {
+	struct keyrlEntry_s *next;
+	unsigned hash;
+	int64 tokens;
+	int64 lastMs;		/* time of last refill */
+	unsigned lenKey;
+	uchar key[1];		/* actually lenKey+1 bytes, NUL-terminated */
+} keyrlEntry_t;
+
+typedef struct keyrlShard_s {
+	pthread_mutex_t mut;
+	keyrlEntry_t **buckets;
+	unsigned nBuckets;
+	unsigned nEntries;
+	int64 lastSweepMs;
+	time_t ttLastDropMsg;	/* last "begin to drop" message emitted */
+	/* stats not yet added to the global counters (guarded by mut) */
+	unsigned nAllowed;
+	unsigned nDropped;
+	unsigned nExpired;
+	unsigned nOverflow;
+	unsigned nPending;
+} __attribute__((aligned(64))) keyrlShard_t;
+
+struct keyratelimit_s {
+	char *name;
+	unsigned interval;	/**< seconds in which burst tokens are refilled */
+	unsigned burst;		/**< bucket size */
+	unsigned maxKeys;
+	msgPropDescr_t keyProp;	/**< message property used as key by keyratelimitCheckMsg() */
+	uchar *dropStatsName;
+	dynstats_bucket_t *pDropStats;	/**< optional per-key drop counters */
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrAllowed, mutCtrAllowed)
+	STATSCOUNTER_DEF(ctrDropped, mutCtrDropped)
+	STATSCOUNTER_DEF(ctrExpired, mutCtrExpired)
+	STATSCOUNTER_DEF(ctrOverflow, mutCtrOverflow)
+	intctr_t ctrKeys;
+	unsigned nRefs;		/**< call sites sharing this limiter, see keyratelimitGetShared() */
+	sbool bShared;		/**< limiter is on the shared list */
+	keyratelimit_t *nextShared;
+	keyrlShard_t shards[KEYRL_NSHARDS];
+};
+
+/* limiters shared by name (rainerscript ratelimit()). The list is only
+ * modified during config load and shutdown, which are single-threaded.
+ */
+static keyratelimit_t *sharedKeyRl = NULL;
+
 /* generate a "repeated n times" message */
 static inline msg_t *
 ratelimitGenRepMsg(ratelimit_t *ratelimit)
@@ -220,6 +285,12 @@ ratelimitMsg(ratelimit_t *ratelimit, msg_t *pMsg, msg_t **ppRepMsg)
 			ABORT_FINALIZE(RS_RET_DISCARDMSG);
 		}
 	}
+	if(ratelimit->pKeyed != NULL && (pMsg->iSeverity >= ratelimit->severity)) {
+		if(keyratelimitCheckMsg(ratelimit->pKeyed, pMsg) == 0) {
+			msgDestruct(&pMsg);
+			ABORT_FINALIZE(RS_RET_DISCARDMSG);
+		}
+	}
 	if(ratelimit->bReduceRepeatMsgs) {
 		CHKiRet(doLastMessageRepeatedNTimes(ratelimit, pMsg, ppRepMsg));
 	}
@@ -235,7 +306,7 @@ finalize_it:
 int
 ratelimitChecked(ratelimit_t *ratelimit)
 {
-	return ratelimit->interval || ratelimit->bReduceRepeatMsgs;
+	return ratelimit->interval || ratelimit->bReduceRepeatMsgs || ratelimit->pKeyed != NULL;
 }
 
 
@@ -369,6 +440,407 @@ ratelimitDestruct(ratelimit_t *ratelimit)
 	free(ratelimit);
 }
 
+
+/* ------------------------------ keyed token bucket limiter ------------------------------ */
+
+static inline int64
+keyrlNowMs(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static inline unsigned
+keyrlHash(const uchar *key, unsigned lenKey)
+{
+	unsigned hash = 2166136261u; /* FNV-1a */
+	while(lenKey--) {
+		hash ^= *key++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* add the stats gathered in a shard to the global counters.
+ * Must be called with the shard mutex locked.
+ */
+static inline void
+keyrlFlushStats(keyratelimit_t *const pThis, keyrlShard_t *const shard)
+{
+	STATSCOUNTER_BUMP(pThis->ctrAllowed, pThis->mutCtrAllowed, shard->nAllowed);
+	STATSCOUNTER_BUMP(pThis->ctrDropped, pThis->mutCtrDropped, shard->nDropped);
+	STATSCOUNTER_BUMP(pThis->ctrExpired, pThis->mutCtrExpired, shard->nExpired);
+	STATSCOUNTER_BUMP(pThis->ctrOverflow, pThis->mutCtrOverflow, shard->nOverflow);
+	shard->nAllowed = shard->nDropped = shard->nExpired = shard->nOverflow = 0;
+	shard->nPending = 0;
+}
+
+static void
+keyrlStatsRead(statsobj_t __attribute__((unused)) *stats, void *ctx)
+{
+	keyratelimit_t *const pThis = (keyratelimit_t*) ctx;
+	intctr_t nKeys = 0;
+	int i;
+
+	for(i = 0 ; i < KEYRL_NSHARDS ; ++i) {
+		pthread_mutex_lock(&pThis->shards[i].mut);
+		keyrlFlushStats(pThis, &pThis->shards[i]);
+		nKeys += pThis->shards[i].nEntries;
+		pthread_mutex_unlock(&pThis->shards[i].mut);
+	}
+	pThis->ctrKeys = nKeys;
+}
+
+/* remove all idle keys from a shard. A key is idle if its bucket has been
+ * completely refilled, so forgetting it does not change any result.
+ * Must be called with the shard mutex locked.
+ */
+static void
+keyrlSweep(keyratelimit_t *const pThis, keyrlShard_t *const shard, const int64 nowMs)
+{
+	keyrlEntry_t **pp;
+	keyrlEntry_t *etry;
+	const int64 idleMs = (int64) pThis->interval * 1000;
+	unsigned i;
+
+	for(i = 0 ; i < shard->nBuckets ; ++i) {
+		pp = &shard->buckets[i];
+		while(*pp != NULL) {
+			etry = *pp;
+			if(nowMs - etry->lastMs >= idleMs) {
+				*pp = etry->next;
+				free(etry);
+				--shard->nEntries;
+				++shard->nExpired;
+			} else {
+				pp = &etry->next;
+			}
+		}
+	}
+	shard->lastSweepMs = nowMs;
+}
+
+/* check if a message for the given key is within the rate limit.
+ * key must be NUL-terminated, lenKey is its length without the NUL.
+ * Returns 1 if the message may be processed, 0 if it must be dropped.
+ * This function is thread-safe.
+ */
+int
+keyratelimitCheck(keyratelimit_t *const pThis, const uchar *const key, const unsigned lenKey)
+{
+	keyrlShard_t *shard;
+	keyrlEntry_t *etry;
+	const unsigned hash = keyrlHash(key, lenKey);
+	const int64 nowMs = keyrlNowMs();
+	const int64 maxTokens = (int64) pThis->burst * 1000;
+	const unsigned maxPerShard = (pThis->maxKeys + KEYRL_NSHARDS - 1) / KEYRL_NSHARDS;
+	int64 elapsed;
+	time_t ttNow;
+	int bAllowed = 1;
+	int bLogDrop = 0;
+	uchar msgbuf[1024];
+
+	shard = &pThis->shards[(hash >> 24) & (KEYRL_NSHARDS - 1)];
+	pthread_mutex_lock(&shard->mut);
+	for(etry = shard->buckets[hash & (shard->nBuckets - 1)] ; etry != NULL ; etry = etry->next) {
+		if(etry->hash == hash && etry->lenKey == lenKey && !memcmp(etry->key, key, lenKey))
+			break;
+	}
+	if(etry == NULL) {
+		/* new key; first make room by dropping idle ones, but not
+		 * more often than once per interval (the sweep is O(n))
+		 */
+		if(nowMs - shard->lastSweepMs >= (int64) pThis->interval * 1000)
+			keyrlSweep(pThis, shard, nowMs);
+		if(shard->nEntries >= maxPerShard
+		   || (etry = malloc(sizeof(keyrlEntry_t) + lenKey)) == NULL) {
+			/* we can not track more keys: let the message pass, which
+			 * is the same as what happened before keyed limits existed.
+			 */
+			++shard->nOverflow;
+			++shard->nAllowed;
+			goto done;
+		}
+		etry->hash = hash;
+		etry->tokens = maxTokens;
+		etry->lastMs = nowMs;
+		etry->lenKey = lenKey;
+		memcpy(etry->key, key, lenKey);
+		etry->key[lenKey] = '\0';
+		etry->next = shard->buckets[hash & (shard->nBuckets - 1)];
+		shard->buckets[hash & (shard->nBuckets - 1)] = etry;
+		++shard->nEntries;
+	} else {
+		elapsed = nowMs - etry->lastMs;
+		if(elapsed > 0) {
+			/* cap elapsed time, a full interval refills the bucket anyhow */
+			if(elapsed > (int64) pThis->interval * 1000)
+				elapsed = (int64) pThis->interval * 1000;
+			etry->tokens += elapsed * pThis->burst / pThis->interval;
+			if(etry->tokens > maxTokens)
+				etry->tokens = maxTokens;
+			etry->lastMs = nowMs;
+		}
+	}
+
+	if(etry->tokens >= 1000) {
+		etry->tokens -= 1000;
+		++shard->nAllowed;
+	} else {
+		bAllowed = 0;
+		++shard->nDropped;
+		ttNow = (time_t) (nowMs / 1000);
+		if(ttNow >= shard->ttLastDropMsg + (time_t) pThis->interval) {
+			shard->ttLastDropMsg = ttNow;
+			bLogDrop = 1;
+		}
+	}
+done:
+	if(++shard->nPending >= KEYRL_STATS_FLUSH)
+		keyrlFlushStats(pThis, shard);
+	pthread_mutex_unlock(&shard->mut);
+
+	if(!bAllowed) {
+		if(bLogDrop) {
+			snprintf((char*)msgbuf, sizeof(msgbuf),
+			         "%s: begin to drop messages of key '%s' due to rate-limiting",
+				 pThis->name, key);
+			logmsgInternal(RS_RET_RATE_LIMITED, LOG_SYSLOG|LOG_INFO, msgbuf, 0);
+		}
+		if(pThis->pDropStats != NULL)
+			dynstats_inc(pThis->pDropStats, (uchar*) key);
+	}
+	return bAllowed;
+}
+
+
+/* check a message against the limit, with the configured property
+ * (default: fromhost-ip) as key. If the sender address has not yet been
+ * resolved (e.g. imudp), the numeric address is used without triggering
+ * a DNS lookup.
+ */
+int
+keyratelimitCheckMsg(keyratelimit_t *const pThis, msg_t *const pMsg)
+{
+	uchar addrbuf[INET6_ADDRSTRLEN];
+	uchar *key;
+	rs_size_t lenKey;
+	unsigned short bMustBeFreed = 0;
+	struct sockaddr *pAddr;
+	int bAllowed;
+
+	if(pThis->keyProp.id == PROP_FROMHOST_IP && (pMsg->msgFlags & NEEDS_DNSRESOL)) {
+		pAddr = (struct sockaddr*) pMsg->rcvFrom.pfrominet;
+		key = addrbuf;
+		if(pAddr == NULL
+		   || inet_ntop(pAddr->sa_family, (pAddr->sa_family == AF_INET6) ?
+				(void*) &((struct sockaddr_in6*)pAddr)->sin6_addr :
+				(void*) &((struct sockaddr_in*)pAddr)->sin_addr,
+				(char*) addrbuf, sizeof(addrbuf)) == NULL)
+			addrbuf[0] = '\0';
+		lenKey = ustrlen(addrbuf);
+	} else {
+		key = MsgGetProp(pMsg, NULL, &pThis->keyProp, &lenKey, &bMustBeFreed, NULL);
+	}
+	bAllowed = keyratelimitCheck(pThis, key, lenKey);
+	if(bMustBeFreed)
+		free(key);
+	return bAllowed;
+}
+
+
+/* create a new keyed limiter. At most burst messages per key are
+ * permitted in a row; the bucket is refilled with burst tokens per
+ * interval seconds.
+ */
+rsRetVal
+keyratelimitNew(keyratelimit_t **ppThis, const char *name, unsigned interval, unsigned burst)
+{
+	keyratelimit_t *pThis = NULL;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pThis = calloc(1, sizeof(keyratelimit_t)));
+	CHKmalloc(pThis->name = strdup(name));
+	pThis->interval = (interval == 0) ? 1 : interval;
+	pThis->burst = (burst == 0) ? 1 : burst;
+	pThis->maxKeys = KEYRL_DFLT_MAXKEYS;
+	pThis->keyProp.id = PROP_FROMHOST_IP;
+	pThis->nRefs = 1;
+	for(i = 0 ; i < KEYRL_NSHARDS ; ++i)
+		pthread_mutex_init(&pThis->shards[i].mut, NULL);
+	*ppThis = pThis;
+finalize_it:
+	if(iRet != RS_RET_OK && pThis != NULL) {
+		free(pThis->name);
+		free(pThis);
+	}
+	RETiRet;
+}
+
+/* set the message property to use as key. Must be called before
+ * keyratelimitConstructFinalize().
+ */
+rsRetVal
+keyratelimitSetKeyProp(keyratelimit_t *pThis, uchar *propName)
+{
+	DEFiRet;
+	msgPropDescrDestruct(&pThis->keyProp);
+	CHKiRet(msgPropDescrFill(&pThis->keyProp, propName, ustrlen(propName)));
+finalize_it:
+	RETiRet;
+}
+
+void
+keyratelimitSetMaxKeys(keyratelimit_t *pThis, unsigned maxKeys)
+{
+	pThis->maxKeys = (maxKeys == 0) ? 1 : maxKeys;
+}
+
+/* count drops per key in the named dyn-stats bucket */
+rsRetVal
+keyratelimitSetDropStats(keyratelimit_t *pThis, uchar *bucketName)
+{
+	DEFiRet;
+	free(pThis->dropStatsName);
+	CHKmalloc(pThis->dropStatsName = ustrdup(bucketName));
+finalize_it:
+	RETiRet;
+}
+
+rsRetVal
+keyratelimitConstructFinalize(keyratelimit_t *pThis)
+{
+	unsigned nBuckets;
+	int i;
+	DEFiRet;
+
+	if(pThis->dropStatsName != NULL) {
+		if((pThis->pDropStats = dynstats_findBucket(pThis->dropStatsName)) == NULL) {
+			errmsg.LogError(0, RS_RET_NOT_FOUND, "%s: dyn-stats bucket '%s' for rate-limit "
+				"drops not found, per-key drop counters disabled",
+				pThis->name, pThis->dropStatsName);
+		}
+	}
+
+	/* size the tables so that a full shard has short chains */
+	for(nBuckets = 16 ; nBuckets < pThis->maxKeys / KEYRL_NSHARDS && nBuckets < 65536 ; nBuckets *= 2)
+		/* just compute */;
+	for(i = 0 ; i < KEYRL_NSHARDS ; ++i) {
+		CHKmalloc(pThis->shards[i].buckets = calloc(nBuckets, sizeof(keyrlEntry_t*)));
+		pThis->shards[i].nBuckets = nBuckets;
+	}
+
+	CHKiRet(statsobj.Construct(&pThis->stats));
+	CHKiRet(statsobj.SetName(pThis->stats, (uchar*)pThis->name));
+	CHKiRet(statsobj.SetOrigin(pThis->stats, UCHAR_CONSTANT("ratelimit")));
+	STATSCOUNTER_INIT(pThis->ctrAllowed, pThis->mutCtrAllowed);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("allowed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrAllowed));
+	STATSCOUNTER_INIT(pThis->ctrDropped, pThis->mutCtrDropped);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("dropped"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrDropped));
+	STATSCOUNTER_INIT(pThis->ctrExpired, pThis->mutCtrExpired);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("keys.expired"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrExpired));
+	STATSCOUNTER_INIT(pThis->ctrOverflow, pThis->mutCtrOverflow);
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("keys.overflow"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrOverflow));
+	CHKiRet(statsobj.AddCounter(pThis->stats, UCHAR_CONSTANT("keys"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &pThis->ctrKeys));
+	CHKiRet(statsobj.SetReadNotifier(pThis->stats, keyrlStatsRead, pThis));
+	CHKiRet(statsobj.ConstructFinalize(pThis->stats));
+finalize_it:
+	RETiRet;
+}
+
+/* obtain the limiter registered under name, creating it on first use.
+ * All callers asking for the same name share one set of buckets, so
+ * the configured rate applies in total and not per caller. Asking for
+ * an existing name with a different interval or burst is an error.
+ * Each successful call must be paired with keyratelimitDestruct().
+ */
+rsRetVal
+keyratelimitGetShared(keyratelimit_t **ppThis, const char *name, unsigned interval, unsigned burst)
+{
+	keyratelimit_t *pThis;
+	DEFiRet;
+
+	for(pThis = sharedKeyRl ; pThis != NULL ; pThis = pThis->nextShared) {
+		if(!strcmp(pThis->name, name))
+			break;
+	}
+	if(pThis != NULL) {
+		if(pThis->interval != interval || pThis->burst != burst)
+			ABORT_FINALIZE(RS_RET_DUP_PARAM);
+		++pThis->nRefs;
+		*ppThis = pThis;
+		FINALIZE;
+	}
+
+	CHKiRet(keyratelimitNew(&pThis, name, interval, burst));
+	if((iRet = keyratelimitConstructFinalize(pThis)) != RS_RET_OK) {
+		keyratelimitDestruct(pThis);
+		FINALIZE;
+	}
+	pThis->bShared = 1;
+	pThis->nextShared = sharedKeyRl;
+	sharedKeyRl = pThis;
+	*ppThis = pThis;
+finalize_it:
+	RETiRet;
+}
+
+void
+keyratelimitDestruct(keyratelimit_t *pThis)
+{
+	keyratelimit_t **pp;
+	keyrlEntry_t *etry, *next;
+	unsigned j;
+	int i;
+
+	if(pThis == NULL)
+		return;
+	if(--pThis->nRefs > 0)
+		return;
+	if(pThis->bShared) {
+		for(pp = &sharedKeyRl ; *pp != NULL ; pp = &(*pp)->nextShared) {
+			if(*pp == pThis) {
+				*pp = pThis->nextShared;
+				break;
+			}
+		}
+	}
+	if(pThis->stats != NULL)
+		statsobj.Destruct(&pThis->stats);
+	for(i = 0 ; i < KEYRL_NSHARDS ; ++i) {
+		if(pThis->shards[i].buckets != NULL) {
+			for(j = 0 ; j < pThis->shards[i].nBuckets ; ++j) {
+				for(etry = pThis->shards[i].buckets[j] ; etry != NULL ; etry = next) {
+					next = etry->next;
+					free(etry);
+				}
+			}
+			free(pThis->shards[i].buckets);
+		}
+		pthread_mutex_destroy(&pThis->shards[i].mut);
+	}
+	msgPropDescrDestruct(&pThis->keyProp);
+	free(pThis->dropStatsName);
+	free(pThis->name);
+	free(pThis);
+}
+
+/* additionally limit the messages of a ratelimiter per key. The keyed
+ * limiter is not owned by the ratelimiter and may be shared.
+ */
+void
+ratelimitSetKeyed(ratelimit_t *ratelimit, keyratelimit_t *pKeyed)
+{
+	ratelimit->pKeyed = pKeyed;
+}
+
 void
 ratelimitModExit(void)
 {
@@ -376,6 +848,7 @@ ratelimitModExit(void)
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(parser, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 }
 
 rsRetVal
@@ -387,6 +860,7 @@ ratelimitModInit(void)
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(parser, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 finalize_it:
 	RETiRet;
 }
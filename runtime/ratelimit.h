@@ -37,6 +37,7 @@ struct ratelimit_s {
 	sbool bThreadSafe;	/**< do we need to operate in Thread-Safe mode? */
 	sbool bNoTimeCache;	/**< if we shall not used cached reception time */
 	pthread_mutex_t mut;	/**< mutex if thread-safe operation desired */
+	keyratelimit_t *pKeyed;	/**< optional per-key limiter (not owned) */
 };
 
 /* prototypes */
@@ -50,6 +51,18 @@ rsRetVal ratelimitAddMsg(ratelimit_t *ratelimit, multi_submit_t *pMultiSub, msg_
 void ratelimitDestruct(ratelimit_t *pThis);
 int ratelimitChecked(ratelimit_t *ratelimit);
 rsRetVal ratelimitModInit(void);
+void ratelimitSetKeyed(ratelimit_t *ratelimit, keyratelimit_t *pKeyed);
+
+/* keyed (e.g. per sender) token bucket rate limiter */
+rsRetVal keyratelimitNew(keyratelimit_t **ppThis, const char *name, unsigned interval, unsigned burst);
+rsRetVal keyratelimitSetKeyProp(keyratelimit_t *pThis, uchar *propName);
+void keyratelimitSetMaxKeys(keyratelimit_t *pThis, unsigned maxKeys);
+rsRetVal keyratelimitSetDropStats(keyratelimit_t *pThis, uchar *bucketName);
+rsRetVal keyratelimitConstructFinalize(keyratelimit_t *pThis);
+rsRetVal keyratelimitGetShared(keyratelimit_t **ppThis, const char *name, unsigned interval, unsigned burst);
+int keyratelimitCheck(keyratelimit_t *pThis, const uchar *key, unsigned lenKey);
+int keyratelimitCheckMsg(keyratelimit_t *pThis, msg_t *pMsg);
+void keyratelimitDestruct(keyratelimit_t *pThis);
 void ratelimitModExit(void);
 
 #endif /* #ifndef INCLUDED_RATELIMIT_H */
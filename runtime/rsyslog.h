@@ -50,6 +50,7 @@
 #define CONF_HOSTNAME_BUFSIZE		32
 #define CONF_PROP_BUFSIZE		16	/* should be close to sizeof(ptr) or lighly above it */
 #define CONF_IPARAMS_BUFSIZE		16	/* initial size of iparams array in wti (is automatically extended) */
+#define CONF_TPLCACHE_MAXENTRIES	8	/* max number of templates a worker keeps rendered for the current message */
 #define	CONF_MIN_SIZE_FOR_COMPRESS	60 	/* config param: minimum message size to try compression. The smaller
 						 * the message, the less likely is any compression gain. We check for
 						 * gain before we submit the message. But to do so we still need to
@@ -448,6 +449,7 @@ enum rsRetVal_				/** return value. All methods return this if not specified oth
 	RS_RET_SENDER_APPEARED = -2430,/**< info: new sender appeared */
 	RS_RET_FILE_ALREADY_IN_TABLE = -2431,/**< in imfile: table already contains to be added file */
 	RS_RET_ERR_DROP_PRIV = -2432,/**< error droping privileges */
+	RS_RET_LOOKUP_IMG_INVALID = -2433,/**< binary lookup table image is invalid or corrupt */
 
 	/* RainerScript error messages (range 1000.. 1999) */
 	RS_RET_SYSVAR_NOT_FOUND = 1001, /**< system variable could not be found (maybe misspelled) */
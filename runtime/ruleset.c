@@ -213,21 +213,26 @@ finalize_it:
 }
 
 static rsRetVal
-execSet(struct cnfstmt *stmt, msg_t *pMsg)
+execSet(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 {
 	struct var result;
 	DEFiRet;
-	cnfexprEval(stmt->d.s_set.expr, &result, pMsg);
+	if(stmt->d.s_set.prog != NULL)
+		cnfvmEval(stmt->d.s_set.prog, &result, pMsg);
+	else
+		cnfexprEval(stmt->d.s_set.expr, &result, pMsg);
 	msgSetJSONFromVar(pMsg, stmt->d.s_set.varname, &result, stmt->d.s_set.force_reset);
+	wtiTplCacheInvalidate(pWti);
 	varDelete(&result);
 	RETiRet;
 }
 
 static rsRetVal
-execUnset(struct cnfstmt *stmt, msg_t *pMsg)
+execUnset(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 {
 	DEFiRet;
 	msgDelJSON(pMsg, stmt->d.s_unset.varname);
+	wtiTplCacheInvalidate(pWti);
 	RETiRet;
 }
 
@@ -257,7 +262,10 @@ execIf(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 {
 	sbool bRet;
 	DEFiRet;
-	bRet = cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
+	if(stmt->d.s_if.prog != NULL)
+		bRet = cnfvmEvalBool(stmt->d.s_if.prog, pMsg);
+	else
+		bRet = cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
 	DBGPRINTF("if condition result is %d\n", bRet);
 	if(bRet) {
 		if(stmt->d.s_if.t_then != NULL)
@@ -276,6 +284,7 @@ invokeForeachBodyWith(struct cnfstmt *stmt, json_object *o, msg_t *pMsg, wti_t *
 	v.datatype = 'J';
 	v.d.json = o;
 	DEFiRet;
+	wtiTplCacheInvalidate(pWti);
 	CHKiRet(msgSetJSONFromVar(pMsg, (uchar*)stmt->d.s_foreach.iter->var, &v, 1));
 	CHKiRet(scriptExec(stmt->d.s_foreach.body, pMsg, pWti));
 finalize_it:
@@ -352,6 +361,7 @@ execForeach(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 		DBGPRINTF("foreach loop skipped, as object to iterate upon is not an array\n");
 		FINALIZE;
 	}
+	wtiTplCacheInvalidate(pWti);
 	CHKiRet(msgDelJSON(pMsg, (uchar*)stmt->d.s_foreach.iter->var));
 
 finalize_it:
@@ -403,8 +413,11 @@ evalPROPFILT(struct cnfstmt *stmt, msg_t *pMsg)
 	/* Now do the compares (short list currently ;)) */
 	switch(stmt->d.s_propfilt.operation ) {
 	case FIOP_CONTAINS:
-		if(rsCStrLocateInSzStr(stmt->d.s_propfilt.pCSCompValue, (uchar*) pszPropVal) != -1)
+		if(stmt->d.s_propfilt.acm != NULL) {
+			bRet = cnfacmMatch(stmt->d.s_propfilt.acm, pszPropVal, propLen, 0);
+		} else if(rsCStrLocateInSzStr(stmt->d.s_propfilt.pCSCompValue, (uchar*) pszPropVal) != -1) {
 			bRet = 1;
+		}
 		break;
 	case FIOP_ISEMPTY:
 		if(propLen == 0)
@@ -539,10 +552,10 @@ scriptExec(struct cnfstmt *root, msg_t *pMsg, wti_t *pWti)
 			CHKiRet(execAct(stmt, pMsg, pWti));
 			break;
 		case S_SET:
-			CHKiRet(execSet(stmt, pMsg));
+			CHKiRet(execSet(stmt, pMsg, pWti));
 			break;
 		case S_UNSET:
-			CHKiRet(execUnset(stmt, pMsg));
+			CHKiRet(execUnset(stmt, pMsg, pWti));
 			break;
 		case S_CALL:
 			CHKiRet(execCall(stmt, pMsg, pWti));
@@ -866,6 +879,32 @@ rulesetOptimizeAll(rsconf_t *conf)
 }
 
 
+/* helper for rulesetCompileAll(), compiles a single ruleset */
+DEFFUNC_llExecFunc(doRulesetCompileAll)
+{
+	ruleset_t *const pRuleset = (ruleset_t*) pData;
+	cnfstmtCompile(pRuleset->root);
+	if(Debug) {
+		dbgprintf("ruleset '%s' after compilation:\n", pRuleset->pszName);
+		rulesetDebugPrint(pRuleset);
+	}
+	return RS_RET_OK;
+}
+/* compile the script expressions of all rulesets into bytecode. This must
+ * be called after rulesetOptimizeAll(). Expressions that can not be compiled
+ * are still interpreted.
+ */
+rsRetVal
+rulesetCompileAll(rsconf_t *conf)
+{
+	DEFiRet;
+	dbgprintf("begin ruleset compilation phase\n");
+	llExecFunc(&(conf->rulesets.llRulesets), doRulesetCompileAll, NULL);
+	dbgprintf("ruleset compilation phase finished.\n");
+	RETiRet;
+}
+
+
 /* Create a ruleset-specific "main" queue for this ruleset. If one is already
  * defined, an error message is emitted but nothing else is done.
  * Note: we use the main message queue parameters for queue creation and access
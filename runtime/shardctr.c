@@ -0,0 +1,135 @@
+/* shardctr.c
+ * Statistics counters that are split into per-thread slots. A plain
+ * counter that is incremented by all worker threads for every message
+ * keeps its cache line moving between CPUs, which limits scaling long
+ * before the atomic operation itself gets expensive. Sharded counters
+ * avoid that at the price of summing up all slots when read, which only
+ * happens when stats are emitted.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "shardctr.h"
+
+pthread_key_t shardCtrKeySlot;
+static pthread_once_t onceKeySlot = PTHREAD_ONCE_INIT;
+static unsigned nextSlot = 0;
+DEF_ATOMIC_HELPER_MUT(mutNextSlot)
+
+static void
+createKeySlot(void)
+{
+	INIT_ATOMIC_HELPER_MUT(mutNextSlot);
+	pthread_key_create(&shardCtrKeySlot, NULL);
+}
+
+
+/* initialize a counter. This must be called before the first update,
+ * as it also makes sure the thread slot key exists.
+ */
+void
+shardCtrInit(shardctr_t *const pCtr)
+{
+	pthread_once(&onceKeySlot, createKeySlot);
+	memset(pCtr, 0, sizeof(shardctr_t));
+	INIT_ATOMIC_HELPER_MUT64(pCtr->mut);
+}
+
+
+/* assign the calling thread its slot; returns slot index + 1, as 0
+ * means "not yet assigned" in the thread-specific data.
+ */
+uintptr_t
+shardCtrSlotAssign(void)
+{
+	uintptr_t idx;
+
+	idx = ATOMIC_INC_AND_FETCH_unsigned(&nextSlot, &mutNextSlot) + 1;
+	pthread_setspecific(shardCtrKeySlot, (void*) idx);
+	return idx;
+}
+
+
+/* Sum of all slots. Concurrent updates may or may not be included, just
+ * as with a plain counter read while others modify it.
+ */
+uint64
+shardCtrGet(shardctr_t *const pCtr)
+{
+	uint64 sum = 0;
+	int i;
+
+	for(i = 0 ; i < SHARDCTR_NSLOTS ; ++i)
+		sum += pCtr->slot[i].val;
+	return sum;
+}
+
+
+void
+shardCtrReset(shardctr_t *const pCtr)
+{
+	int i;
+
+	for(i = 0 ; i < SHARDCTR_NSLOTS ; ++i)
+		pCtr->slot[i].val = 0;
+}
+
+
+void
+shardEpochInit(shardepoch_t *const pEp)
+{
+	shardCtrInit(&pEp->readers[0]);
+	shardCtrInit(&pEp->readers[1]);
+	pEp->epoch = 0;
+	INIT_ATOMIC_HELPER_MUT(pEp->mut);
+}
+
+
+void
+shardEpochDestruct(shardepoch_t *const pEp)
+{
+	DESTROY_ATOMIC_HELPER_MUT(pEp->mut);
+}
+
+
+/* switch new readers to the other epoch and return the previous one.
+ * Writers must be serialized by the caller.
+ */
+int
+shardEpochSwitch(shardepoch_t *const pEp)
+{
+	const int iOld = pEp->epoch;
+
+	ATOMIC_CAS(&pEp->epoch, iOld, 1 - iOld, &pEp->mut);
+	return iOld;
+}
+
+
+/* wait until all readers of a previous epoch have left. Readers are
+ * expected to stay inside only briefly, so we just poll.
+ */
+void
+shardEpochWaitReaders(shardepoch_t *const pEp, const int epoch)
+{
+	const struct timespec ts = { 0, 100000 };
+
+	while(shardCtrGet(&pEp->readers[epoch]) != 0)
+		nanosleep(&ts, NULL);
+}
@@ -0,0 +1,120 @@
+/* header for shardctr.c
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_SHARDCTR_H
+#define INCLUDED_SHARDCTR_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "atomic.h"
+
+#define SHARDCTR_NSLOTS 64	/* must be a power of 2 */
+#define SHARDCTR_CACHELINE_SIZE 64
+
+/* A sharded counter has one cache line per slot and each thread only
+ * writes to its own slot. The leading pad keeps slot 0 off the cache
+ * line of whatever precedes the counter, so the struct can be embedded
+ * in other objects without any alignment requirements.
+ */
+typedef struct shardctr_s {
+	char pad0[SHARDCTR_CACHELINE_SIZE];
+	struct {
+		uint64 val;
+		char pad[SHARDCTR_CACHELINE_SIZE - sizeof(uint64)];
+	} slot[SHARDCTR_NSLOTS];
+	DEF_ATOMIC_HELPER_MUT64(mut)
+} shardctr_t;
+
+/* the key is accessed directly for speed, much like GatherStats */
+extern pthread_key_t shardCtrKeySlot;
+
+void shardCtrInit(shardctr_t *pCtr);
+uintptr_t shardCtrSlotAssign(void);
+uint64 shardCtrGet(shardctr_t *pCtr);
+void shardCtrReset(shardctr_t *pCtr);
+
+/* Slots are handed out round-robin on a thread's first update, so with
+ * more than SHARDCTR_NSLOTS threads some share a slot. That's why the
+ * update is still atomic -- but on a cache line that is not contended
+ * in the usual case.
+ */
+static inline void
+shardCtrAdd(shardctr_t *const pCtr, const uint64 delta)
+{
+	uintptr_t idx = (uintptr_t) pthread_getspecific(shardCtrKeySlot);
+	if(idx == 0)
+		idx = shardCtrSlotAssign();
+	ATOMIC_ADD_uint64(&pCtr->slot[(idx - 1) & (SHARDCTR_NSLOTS - 1)].val, &pCtr->mut, delta);
+}
+
+/* Reader tracking for objects that are replaced while in use, without
+ * blocking readers: readers enter the current epoch, and the writer
+ * installs the replacement, switches the epoch and then waits until the
+ * previous epoch has no readers left before it frees the old object.
+ * Each epoch counts its readers in a sharded counter, so entering and
+ * leaving do not contend between CPUs.
+ */
+typedef struct shardepoch_s {
+	shardctr_t readers[2];	/* number of readers per epoch */
+	int epoch;		/* epoch new readers enter */
+	DEF_ATOMIC_HELPER_MUT(mut)
+} shardepoch_t;
+
+void shardEpochInit(shardepoch_t *pEp);
+void shardEpochDestruct(shardepoch_t *pEp);
+int shardEpochSwitch(shardepoch_t *pEp);
+void shardEpochWaitReaders(shardepoch_t *pEp, int epoch);
+
+/* enter the current epoch as reader and return it; it must be passed
+ * to shardEpochLeave(). Data published by the writer before switching
+ * to this epoch may be read after this returns.
+ */
+static inline int
+shardEpochEnter(shardepoch_t *const pEp)
+{
+	int i;
+
+	while(1) {
+		i = pEp->epoch;
+		shardCtrAdd(&pEp->readers[i], 1);
+		/* the add is a full barrier: if the epoch is still unchanged, a
+		 * writer switching away from it is guaranteed to see us in
+		 * shardEpochWaitReaders(), and everything read from here on is
+		 * read after the add */
+		if(pEp->epoch == i)
+			return i;
+		shardCtrAdd(&pEp->readers[i], (uint64) -1);
+	}
+}
+
+static inline void
+shardEpochLeave(shardepoch_t *const pEp, const int epoch)
+{
+	shardCtrAdd(&pEp->readers[epoch], (uint64) -1);
+}
+
+/* the epoch new readers currently enter (for writers, which are
+ * serialized by the caller)
+ */
+static inline int
+shardEpochCurrent(shardepoch_t *const pEp)
+{
+	return pEp->epoch;
+}
+
+#endif /* #ifndef INCLUDED_SHARDCTR_H */
@@ -209,6 +209,9 @@ addManagedCounter(statsobj_t *pThis, const uchar *ctrName, statsCtrType_t ctrTyp
 	case ctrType_Int:
 		ctr->val.pInt = (int*) pCtr;
 		break;
+	case ctrType_ShardedCtr:
+		ctr->val.pShardCtr = (shardctr_t*) pCtr;
+		break;
 	}
 	addCtrToList(pThis, ctr);
 	*entryRef = ctr;
@@ -270,6 +273,9 @@ resetResettableCtr(ctr_t *pCtr, int8_t bResetCtrs)
 		case ctrType_Int:
 			*(pCtr->val.pInt) = 0;
 			break;
+		case ctrType_ShardedCtr:
+			shardCtrReset(pCtr->val.pShardCtr);
+			break;
 		}
 	}
 }
@@ -318,6 +324,8 @@ accumulatedValue(ctr_t *pCtr) {
 		return *(pCtr->val.pIntCtr);
 	case ctrType_Int:
 		return *(pCtr->val.pInt);
+	case ctrType_ShardedCtr:
+		return shardCtrGet(pCtr->val.pShardCtr);
 	}
 	return -1;
 }
@@ -423,6 +431,9 @@ getStatsLine(statsobj_t *pThis, cstr_t **ppcstr, int8_t bResetCtrs)
 		case ctrType_Int:
 			rsCStrAppendInt(pcstr, *(pCtr->val.pInt));
 			break;
+		case ctrType_ShardedCtr:
+			rsCStrAppendInt(pcstr, shardCtrGet(pCtr->val.pShardCtr));
+			break;
 		}
 		cstrAppendChar(pcstr, ' ');
 		resetResettableCtr(pCtr, bResetCtrs);
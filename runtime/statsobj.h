@@ -22,6 +22,7 @@
 #define INCLUDED_STATSOBJ_H
 
 #include "atomic.h"
+#include "shardctr.h"
 
 /* The following data item is somewhat dirty, in that it does not follow
  * our usual object calling conventions. However, much like with "Debug", we
@@ -40,7 +41,8 @@ typedef uint64 intctr_t;
 /* counter types */
 typedef enum statsCtrType_e {
 	ctrType_IntCtr,
-	ctrType_Int
+	ctrType_Int,
+	ctrType_ShardedCtr	/* shardctr_t, see STATSCOUNTER_SHARDED_* */
 } statsCtrType_t;
 
 /* stats line format types */
@@ -63,6 +65,7 @@ typedef struct ctr_s {
 	union {
 		intctr_t *pIntCtr;
 		int *pInt;
+		shardctr_t *pShardCtr;
 	} val;
 	int8_t flags;
 	struct ctr_s *next, *prev;
@@ -181,6 +184,27 @@ void checkGoneAwaySenders(time_t);
 	if(GatherStats) \
 		ATOMIC_DEC_uint64(&ctr, mut);
 
+/* Sharded counters are regular counters for hot paths that are updated
+ * by many threads concurrently (e.g. per-message counters of queues and
+ * actions). Every thread writes to its own cache line, so there is no
+ * false sharing; the cost is a larger counter (SHARDCTR_NSLOTS cache
+ * lines) and summing on read. They need no mutex name, and are registered
+ * via AddCounter() with type ctrType_ShardedCtr.
+ */
+#define STATSCOUNTER_SHARDED_DEF(ctr) \
+	shardctr_t ctr;
+
+#define STATSCOUNTER_SHARDED_INIT(ctr) \
+	shardCtrInit(&(ctr));
+
+#define STATSCOUNTER_SHARDED_INC(ctr) \
+	if(GatherStats) \
+		shardCtrAdd(&(ctr), 1);
+
+#define STATSCOUNTER_SHARDED_BUMP(ctr, delta) \
+	if(GatherStats) \
+		shardCtrAdd(&(ctr), delta);
+
 /* the next macro works only if the variable is already guarded
  * by mutex (or the users risks a wrong result). It is assumed 
  * that there are not concurrent operations that modify the counter.
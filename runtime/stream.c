@@ -83,6 +83,7 @@ static rsRetVal doZipWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush
 static rsRetVal doZipFinish(strm_t *pThis);
 static rsRetVal strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf);
 static rsRetVal strmSeekCurrOffs(strm_t *pThis);
+static rsRetVal strmDoCommit(strm_t *pThis);
 
 
 /* methods */
@@ -406,6 +407,10 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 		if(pThis->bAsyncWrite) {
 			strmWaitAsyncWriterDone(pThis);
 		}
+		/* with group commit, some writes may not yet be synced */
+		if(pThis->bSync && pThis->nUnsynced > 0) {
+			strmDoCommit(pThis);
+		}
 	}
 
 	/* if we have a signature provider, we must make sure that the crypto
@@ -679,6 +684,48 @@ static rsRetVal strmUnreadChar(strm_t *pThis, uchar c)
 	return RS_RET_OK;
 }
 
+/* read a block of lenBuf octets into pBuf. This works like calling
+ * strmReadChar() lenBuf times, but copies directly out of the stream buffer.
+ * It is meant for binary records, where we know the size in advance.
+ * Returns RS_RET_EOF if the stream ends before lenBuf octets could be read.
+ */
+static rsRetVal
+strmReadBytes(strm_t *pThis, uchar *pBuf, size_t lenBuf)
+{
+	int padBytes;
+	size_t iAvail;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	ASSERT(pBuf != NULL);
+
+	if(lenBuf > 0 && pThis->iUngetC != -1) {
+		*pBuf++ = pThis->iUngetC;
+		++pThis->iCurrOffs;
+		pThis->iUngetC = -1;
+		--lenBuf;
+	}
+
+	while(lenBuf > 0) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			padBytes = 0;
+			CHKiRet(strmReadBuf(pThis, &padBytes));
+			pThis->iCurrOffs += padBytes;
+		}
+		iAvail = pThis->iBufPtrMax - pThis->iBufPtr;
+		if(iAvail > lenBuf)
+			iAvail = lenBuf;
+		memcpy(pBuf, pThis->pIOBuf + pThis->iBufPtr, iAvail);
+		pThis->iBufPtr += iAvail;
+		pThis->iCurrOffs += iAvail;
+		pBuf += iAvail;
+		lenBuf -= iAvail;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
 /* read a 'paragraph' from a strm file.
  * A paragraph may be terminated by a LF, by a LFLF, or by LF<not whitespace> depending on the option set.
  * The termination LF characters are read, but are
@@ -1377,6 +1424,58 @@ finalize_it:
 }
 #undef SYNCCALL
 
+
+/* group commit support: if iSyncCount or iSyncInterval is set, a bSync
+ * stream is not synced after each write. Instead, we sync when the given
+ * number of writes is pending or when the interval has expired. The owner
+ * may also request a sync at a point of its choosing via strmCommit().
+ * This reduces the number of (very expensive) sync calls considerably while
+ * still limiting the amount of data that can be lost on a system crash.
+ */
+static inline int
+strmIsGroupCommit(strm_t *pThis)
+{
+	return pThis->iSyncCount > 1 || pThis->iSyncInterval > 0;
+}
+
+static rsRetVal
+strmDoCommit(strm_t *pThis)
+{
+	DEFiRet;
+	if(pThis->nUnsynced > 0 && pThis->fd != -1) {
+		CHKiRet(syncFile(pThis));
+		if(pThis->pUsrSyncCntr != NULL)
+			++*pThis->pUsrSyncCntr;
+	}
+	pThis->nUnsynced = 0;
+	if(pThis->iSyncInterval > 0)
+		timeoutComp(&pThis->tNextSync, pThis->iSyncInterval);
+finalize_it:
+	RETiRet;
+}
+
+/* commit (sync) pending writes. If bForce is not set, this is only
+ * done if the group commit count or interval has been reached.
+ */
+static rsRetVal
+strmCommit(strm_t *pThis, int bForce)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, strm);
+
+	if(!pThis->bSync || pThis->nUnsynced == 0)
+		FINALIZE;
+	if(bForce
+	   || (pThis->iSyncCount > 0 && pThis->nUnsynced >= pThis->iSyncCount)
+	   || (pThis->iSyncInterval > 0 && timeoutVal(&pThis->tNextSync) == 0)) {
+		DBGOPRINT((obj_t*) pThis, "group commit of %d writes\n", pThis->nUnsynced);
+		CHKiRet(strmDoCommit(pThis));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
 /* physically write to the output file. the provided data is ready for
  * writing (e.g. zipped if we are requested to do that).
  * Note that if the write() API fails, we do not reset any pointers, but return
@@ -1409,7 +1508,13 @@ strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf)
 		*pThis->pUsrWCntr += iWritten;
 
 	if(pThis->bSync) {
-		CHKiRet(syncFile(pThis));
+		if(strmIsGroupCommit(pThis)) {
+			if(pThis->nUnsynced++ == 0 && pThis->iSyncInterval > 0)
+				timeoutComp(&pThis->tNextSync, pThis->iSyncInterval);
+			CHKiRet(strmCommit(pThis, 0));
+		} else {
+			CHKiRet(syncFile(pThis));
+		}
 	}
 
 	if(pThis->sType == STREAMTYPE_FILE_CIRCULAR) {
@@ -1807,6 +1912,9 @@ DEFpropSetMeth(strm, sType, strmType_t)
 DEFpropSetMeth(strm, iZipLevel, int)
 DEFpropSetMeth(strm, bVeryReliableZip, int)
 DEFpropSetMeth(strm, bSync, int)
+DEFpropSetMeth(strm, iSyncCount, int)
+DEFpropSetMeth(strm, iSyncInterval, int)
+DEFpropSetMeth(strm, pUsrSyncCntr, uint64*)
 DEFpropSetMeth(strm, bReopenOnTruncate, int)
 DEFpropSetMeth(strm, sIOBufSize, size_t)
 DEFpropSetMeth(strm, iSizeLimit, off_t)
@@ -2143,6 +2251,11 @@ CODESTARTobjQueryInterface(strm)
 	pIf->Destruct = strmDestruct;
 	pIf->ReadChar = strmReadChar;
 	pIf->UnreadChar = strmUnreadChar;
+	pIf->ReadBytes = strmReadBytes;
+	pIf->SetiSyncCount = strmSetiSyncCount;
+	pIf->SetiSyncInterval = strmSetiSyncInterval;
+	pIf->Commit = strmCommit;
+	pIf->SetpUsrSyncCntr = strmSetpUsrSyncCntr;
 	pIf->ReadLine = strmReadLine;
 	pIf->SeekCurrOffs = strmSeekCurrOffs;
 	pIf->Write = strmWrite;
@@ -111,6 +111,11 @@ typedef struct strm_s {
 	/* dynamic properties, valid only during file open, not to be persistet */
 	sbool bDisabled; /* should file no longer be written to? (currently set only if omfile file size limit fails) */
 	sbool bSync;	/* sync this file after every write? */
+	int iSyncCount;	/* group commit: if bSync, sync only every n writes (0 - every write) */
+	int iSyncInterval; /* group commit: ... or if this many ms have passed since the last sync */
+	int nUnsynced;	/* group commit: number of writes not yet synced */
+	struct timespec tNextSync; /* group commit: when the interval expires */
+	uint64 *pUsrSyncCntr; /* NULL or a user-provided counter that receives the nbr of group commits */
 	sbool bReopenOnTruncate;
 	size_t sIOBufSize;/* size of IO buffer */
 	uchar *pszDir; /* Directory */
@@ -202,11 +207,22 @@ BEGINinterface(strm) /* name must also be changed in ENDinterface macro! */
 	/* v9 added  2013-04-04 */
 	INTERFACEpropSetMeth(strm, cryprov, cryprov_if_t*);
 	INTERFACEpropSetMeth(strm, cryprovData, void*);
+	/* v13 added  2016-05-10 */
+	rsRetVal (*ReadBytes)(strm_t *pThis, uchar *pBuf, size_t lenBuf);
+	/* v14 added  2016-05-12 */
+	INTERFACEpropSetMeth(strm, iSyncCount, int);
+	INTERFACEpropSetMeth(strm, iSyncInterval, int);
+	rsRetVal (*Commit)(strm_t *pThis, int bForce);
+	/* v15 added  2016-05-20 */
+	INTERFACEpropSetMeth(strm, pUsrSyncCntr, uint64*);
 ENDinterface(strm)
-#define strmCURR_IF_VERSION 12 /* increment whenever you change the interface structure! */
+#define strmCURR_IF_VERSION 15 /* increment whenever you change the interface structure! */
 /* V10, 2013-09-10: added new parameter bEscapeLF, changed mode to uint8_t (rgerhards) */
 /* V11, 2015-12-03: added new parameter bReopenOnTruncate */
 /* V12, 2015-12-11: added new parameter trimLineOverBytes, changed mode to uint32_t */
+/* V13, 2016-05-10: added ReadBytes (for binary disk queue records) */
+/* V14, 2016-05-12: added group commit (iSyncCount, iSyncInterval, Commit) */
+/* V15, 2016-05-20: added pUsrSyncCntr (group commit statistics) */
 
 static inline int
 strmGetCurrFileNum(strm_t *pStrm) {
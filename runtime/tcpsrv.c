@@ -174,6 +174,8 @@ addNewLstnPort(tcpsrv_t *pThis, uchar *pszPort, int bSuppOctetFram, uchar *pszAd
 	CHKiRet(ratelimitNew(&pEntry->ratelimiter, "tcperver", NULL));
 	ratelimitSetLinuxLike(pEntry->ratelimiter, pThis->ratelimitInterval, pThis->ratelimitBurst);
 	ratelimitSetThreadSafe(pEntry->ratelimiter);
+	if(pThis->pKeyRatelimit != NULL)
+		ratelimitSetKeyed(pEntry->ratelimiter, pThis->pKeyRatelimit);
 	STATSCOUNTER_INIT(pEntry->ctrSubmit, pEntry->mutCtrSubmit);
 	CHKiRet(statsobj.AddCounter(pEntry->stats, UCHAR_CONSTANT("submitted"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pEntry->ctrSubmit)));
@@ -1225,6 +1227,18 @@ SetLinuxLikeRatelimiters(tcpsrv_t *pThis, int ratelimitInterval, int ratelimitBu
 }
 
 
+/* Set the per-key ratelimiter for listeners added from now on. The
+ * caller keeps ownership and must keep it alive while we run.
+ */
+static rsRetVal
+SetKeyedRatelimiter(tcpsrv_t *pThis, keyratelimit_t *pKeyed)
+{
+	DEFiRet;
+	pThis->pKeyRatelimit = pKeyed;
+	RETiRet;
+}
+
+
 /* Set the ruleset (ptr) to use */
 static rsRetVal
 SetRuleset(tcpsrv_t *pThis, ruleset_t *pRuleset)
@@ -1393,6 +1407,7 @@ CODESTARTobjQueryInterface(tcpsrv)
 	pIf->SetOnMsgReceive = SetOnMsgReceive;
 	pIf->SetRuleset = SetRuleset;
 	pIf->SetLinuxLikeRatelimiters = SetLinuxLikeRatelimiters;
+	pIf->SetKeyedRatelimiter = SetKeyedRatelimiter;
 	pIf->SetNotificationOnRemoteClose = SetNotificationOnRemoteClose;
 
 finalize_it:
@@ -99,11 +99,14 @@ typedef struct outchannels_s outchannels_t;
 typedef struct modConfData_s modConfData_t;
 typedef struct instanceConf_s instanceConf_t;
 typedef struct ratelimit_s ratelimit_t;
+typedef struct keyratelimit_s keyratelimit_t;
 typedef struct lookup_string_tab_entry_s lookup_string_tab_entry_t;
 typedef struct lookup_string_tab_s lookup_string_tab_t;
+typedef struct lookup_string_tab_slot_s lookup_string_tab_slot_t;
 typedef struct lookup_array_tab_s lookup_array_tab_t;
 typedef struct lookup_sparseArray_tab_s lookup_sparseArray_tab_t;
 typedef struct lookup_sparseArray_tab_entry_s lookup_sparseArray_tab_entry_t;
+typedef struct lookup_img_tab_s lookup_img_tab_t;
 typedef struct lookup_tables_s lookup_tables_t;
 typedef union lookup_key_u lookup_key_t;
 
@@ -121,6 +124,7 @@ typedef struct actWrkrIParams actWrkrIParams_t;
 typedef struct dynstats_bucket_s dynstats_bucket_t;
 typedef struct dynstats_buckets_s dynstats_buckets_t;
 typedef struct dynstats_ctr_s dynstats_ctr_t;
+typedef struct dynstats_gen_s dynstats_gen_t;
 
 /* under Solaris (actually only SPARC), we need to redefine some types
  * to be void, so that we get void* pointers. Otherwise, we will see
@@ -171,10 +171,14 @@ wtiCancelThrd(wti_t *pThis)
 
 /* Destructor */
 BEGINobjDestruct(wti) /* be sure to specify the object type also in END and CODESTART macros! */
+	int i;
 CODESTARTobjDestruct(wti)
 	/* actual destruction */
 	batchFree(&pThis->batch);
 	free(pThis->actWrkrInfo);
+	free(pThis->dirtyActions);
+	for(i = 0 ; i < CONF_TPLCACHE_MAXENTRIES ; ++i)
+		free(pThis->tplCache.entries[i].str.param);
 	pthread_cond_destroy(&pThis->pcondBusy);
 	DESTROY_ATOMIC_HELPER_MUT(pThis->mutIsRunning);
 	free(pThis->pszDbgHdr);
@@ -208,6 +212,7 @@ wtiConstructFinalize(wti_t *pThis)
 
 	/* must use calloc as we need zero-init */
 	CHKmalloc(pThis->actWrkrInfo = calloc(iActionNbr, sizeof(actWrkrInfo_t)));
+	CHKmalloc(pThis->dirtyActions = calloc(iActionNbr, sizeof(action_t*)));
 
 	if(pThis->pWtp == NULL) {
 		dbgprintf("wtiConstructFinalize: pWtp not set, this may be intentional\n");
@@ -257,11 +262,22 @@ static inline void
 doIdleProcessing(wti_t *pThis, wtp_t *pWtp, int *pbInactivityTOOccured)
 {
 	struct timespec t;
+	long toIdle = 0;
 
 	BEGINfunc
 	DBGPRINTF("%s: worker IDLE, waiting for work.\n", wtiGetDbgHdr(pThis));
 
-	if(pThis->bAlwaysRunning) {
+	if(pWtp->pfGetIdleTimeout != NULL)
+		pWtp->pfGetIdleTimeout(pWtp->pUsr, &toIdle);
+
+	if(toIdle > 0 && (pThis->bAlwaysRunning || toIdle < pWtp->toWrkShutdown)) {
+		/* the user has something to do even if no new work arrives (e.g. a
+		 * disk queue group commit), so we must wake up in time for that.
+		 * This is not an inactivity timeout.
+		 */
+		timeoutComp(&t, toIdle);
+		d_pthread_cond_timedwait(&pThis->pcondBusy, pWtp->pmutUsr, &t);
+	} else if(pThis->bAlwaysRunning) {
 		/* never shut down any started worker */
 		d_pthread_cond_wait(&pThis->pcondBusy, pWtp->pmutUsr);
 	} else {
@@ -45,6 +45,7 @@ typedef struct actWrkrInfo {
 	struct {
 		unsigned actState : 3;
 		unsigned bJustResumed : 1;
+		unsigned bDirty : 1;	/* action is in the worker's dirtyActions list */
 	} flags;
 	union {
 		struct {
@@ -71,6 +72,19 @@ struct wti_s {
 	uchar *pszDbgHdr;	/* header string for debug messages */
 	actWrkrInfo_t *actWrkrInfo; /* *array* of action wrkr infos for all actions
 				      (sized for max nbr of actions in config!) */
+	action_t **dirtyActions; /* transactional actions with messages pending since the
+				    last commit of all actions (sized for max nbr of actions in
+				    config, as each one is contained at most once) */
+	int nDirtyActions;
+	struct {
+		msg_t *pMsg;	/* message the entries were rendered from, NULL if none */
+		int nEntries;
+		struct {
+			struct template *pTpl;
+			actWrkrIParams_t str;
+		} entries[CONF_TPLCACHE_MAXENTRIES];
+	} tplCache;	/* templates rendered for the current message, shared by the
+			   direct actions run by this worker (buffers are reused) */
 	pthread_cond_t pcondBusy; /* condition to wake up the worker, protected by pmutUsr in wtp */
 	DEF_ATOMIC_HELPER_MUT(mutIsRunning)
 	struct {
@@ -187,6 +201,12 @@ wtiNewIParam(wti_t *const pWti, action_t *const pAction, actWrkrIParams_t **pipa
 		wrkrInfo->p.tx.maxIParams = newMax;
 	}
 	*piparams = wrkrInfo->p.tx.iparams + wrkrInfo->p.tx.currIParam * pAction->iNumTpls;
+	if(wrkrInfo->p.tx.currIParam == 0 && !wrkrInfo->flags.bDirty) {
+		/* first message of a new transaction, so this action needs to be
+		 * committed at the end of the batch */
+		wrkrInfo->flags.bDirty = 1;
+		pWti->dirtyActions[pWti->nDirtyActions++] = pAction;
+	}
 	++wrkrInfo->p.tx.currIParam;
 
 finalize_it:
@@ -199,9 +219,19 @@ wtiInitIParam(actWrkrIParams_t *piparams)
 	memset(piparams, 0, sizeof(actWrkrIParams_t));
 }
 
+/* drop all templates rendered for the current message. This must be
+ * called whenever the message may have been modified.
+ */
+static inline void
+wtiTplCacheInvalidate(wti_t * const pWti)
+{
+	pWti->tplCache.pMsg = NULL;
+}
+
 static inline void
 wtiResetExecState(wti_t * const pWti, batch_t * const pBatch)
 {
+	wtiTplCacheInvalidate(pWti);
 	pWti->execState.bPrevWasSuspended = 0;
 	pWti->execState.bDoAutoCommit = (batchNumMsgs(pBatch) == 1);
 }
@@ -61,6 +61,7 @@ struct wtp_s {
 	rsRetVal (*pfObjProcessed)(void *pUsr, wti_t *pWti); /* indicate user object is processed */
 	rsRetVal (*pfRateLimiter)(void *pUsr);
 	rsRetVal (*pfDoWork)(void *pUsr, void *pWti);
+	rsRetVal (*pfGetIdleTimeout)(void *pUsr, long*); /* max ms an idle worker may sleep (0 - no limit) */
 	/* end user objects */
 	uchar *pszDbgHdr;	/* header string for debug messages */
 	DEF_ATOMIC_HELPER_MUT(mutCurNumWrkThrd)
@@ -88,6 +89,7 @@ PROTOTYPEpropSetMethFP(wtp, pfRateLimiter, rsRetVal(*pVal)(void*));
 PROTOTYPEpropSetMethFP(wtp, pfGetDeqBatchSize, rsRetVal(*pVal)(void*, int*));
 PROTOTYPEpropSetMethFP(wtp, pfDoWork, rsRetVal(*pVal)(void*, void*));
 PROTOTYPEpropSetMethFP(wtp, pfObjProcessed, rsRetVal(*pVal)(void*, wti_t*));
+PROTOTYPEpropSetMethFP(wtp, pfGetIdleTimeout, rsRetVal(*pVal)(void*, long*));
 PROTOTYPEpropSetMeth(wtp, toWrkShutdown, long);
 PROTOTYPEpropSetMeth(wtp, wtpState, wtpState_t);
 PROTOTYPEpropSetMeth(wtp, iMaxWorkerThreads, int);
@@ -137,6 +137,235 @@ finalize_it:
 }
 
 
+/* Escape kernels for compiled templates. Each one consists of a function
+ * to compute the exact length of the escaped value and one to copy the
+ * escaped value into a buffer that is large enough, returning the end of
+ * the copied data. The template level escapes (option.sql etc.) do the
+ * same as doEscape(), the JSON kernel the same as format="json".
+ */
+struct tplEscKernel_s {
+	size_t (*getLen)(const uchar *src, const rs_size_t len);
+	uchar *(*copy)(uchar *dst, const uchar *src, const rs_size_t len);
+};
+
+static size_t
+escLenSQL(const uchar *const src, const rs_size_t len)
+{
+	size_t lenEsc = len;
+	rs_size_t i;
+	for(i = 0 ; i < len ; ++i)
+		if(src[i] == '\'' || src[i] == '\\')
+			++lenEsc;
+	return lenEsc;
+}
+
+static uchar *
+escCopySQL(uchar *dst, const uchar *const src, const rs_size_t len)
+{
+	rs_size_t i;
+	for(i = 0 ; i < len ; ++i) {
+		if(src[i] == '\'' || src[i] == '\\')
+			*dst++ = '\\';
+		*dst++ = src[i];
+	}
+	return dst;
+}
+
+static size_t
+escLenStdSQL(const uchar *const src, const rs_size_t len)
+{
+	size_t lenEsc = len;
+	rs_size_t i;
+	for(i = 0 ; i < len ; ++i)
+		if(src[i] == '\'')
+			++lenEsc;
+	return lenEsc;
+}
+
+static uchar *
+escCopyStdSQL(uchar *dst, const uchar *const src, const rs_size_t len)
+{
+	rs_size_t i;
+	for(i = 0 ; i < len ; ++i) {
+		if(src[i] == '\'')
+			*dst++ = '\'';
+		*dst++ = src[i];
+	}
+	return dst;
+}
+
+static size_t
+escLenQuote(const uchar *const src, const rs_size_t len)
+{
+	size_t lenEsc = len;
+	rs_size_t i;
+	for(i = 0 ; i < len ; ++i)
+		if(src[i] == '"')
+			++lenEsc;
+	return lenEsc;
+}
+
+static uchar *
+escCopyQuote(uchar *dst, const uchar *const src, const rs_size_t len)
+{
+	rs_size_t i;
+	for(i = 0 ; i < len ; ++i) {
+		if(src[i] == '"')
+			*dst++ = '\\';
+		*dst++ = src[i];
+	}
+	return dst;
+}
+
+/* length of a character after JSON escaping (1 if it needs no escaping) */
+static inline int
+jsonEscCharLen(const uchar c)
+{
+	if(   (c >= 0x23 && c <= 0x2e)
+	   || (c >= 0x30 && c <= 0x5b)
+	   || c >= 0x5d
+	   || c == 0x20 || c == 0x21)
+		return 1;
+	switch(c) {
+	case '\0':
+		return 6;
+	case '"':
+	case '/':
+	case '\\':
+	case '\010':
+	case '\014':
+	case '\n':
+	case '\r':
+	case '\t':
+		return 2;
+	default:
+		return 6;
+	}
+}
+
+static size_t
+escLenJSON(const uchar *const src, const rs_size_t len)
+{
+	size_t lenEsc = 0;
+	rs_size_t i;
+	for(i = 0 ; i < len ; ++i)
+		lenEsc += jsonEscCharLen(src[i]);
+	return lenEsc;
+}
+
+static uchar *
+escCopyJSON(uchar *dst, const uchar *const src, const rs_size_t len)
+{
+	static const char hexdigit[16] = "0123456789ABCDEF";
+	uchar c;
+	rs_size_t i;
+	for(i = 0 ; i < len ; ++i) {
+		c = src[i];
+		if(jsonEscCharLen(c) == 1) {
+			*dst++ = c;
+			continue;
+		}
+		*dst++ = '\\';
+		switch(c) {
+		case '"':	*dst++ = '"'; break;
+		case '/':	*dst++ = '/'; break;
+		case '\\':	*dst++ = '\\'; break;
+		case '\010':	*dst++ = 'b'; break;
+		case '\014':	*dst++ = 'f'; break;
+		case '\n':	*dst++ = 'n'; break;
+		case '\r':	*dst++ = 'r'; break;
+		case '\t':	*dst++ = 't'; break;
+		default:
+			*dst++ = 'u';
+			*dst++ = '0';
+			*dst++ = '0';
+			*dst++ = hexdigit[c / 16];
+			*dst++ = hexdigit[c % 16];
+			break;
+		}
+	}
+	return dst;
+}
+
+static const struct tplEscKernel_s escKernelSQL = { escLenSQL, escCopySQL };
+static const struct tplEscKernel_s escKernelStdSQL = { escLenStdSQL, escCopyStdSQL };
+static const struct tplEscKernel_s escKernelQuote = { escLenQuote, escCopyQuote };
+static const struct tplEscKernel_s escKernelJSON = { escLenJSON, escCopyJSON };
+
+
+/* max number of properties in a template that can be compiled */
+#define TPL_MAX_COMPILED_PROPS 64
+
+/* tplToString() for compiled templates. Like the strgens, we first obtain
+ * all property values and compute the total length, so that the buffer
+ * is extended at most once. Then everything is copied over.
+ */
+static rsRetVal
+tplToStringCompiled(struct template *__restrict__ const pTpl,
+	msg_t *__restrict__ const pMsg,
+	actWrkrIParams_t *__restrict__ const iparam,
+	struct syslogTime *const ttNow)
+{
+	struct {
+		uchar *pVal;
+		rs_size_t iLenVal;
+		unsigned short bMustBeFreed;
+	} vals[TPL_MAX_COMPILED_PROPS];
+	const struct tplOp *op;
+	size_t lenTotal;
+	uchar *pDst;
+	int nVals = 0;
+	int i, j;
+	DEFiRet;
+
+	lenTotal = pTpl->lenConstants;
+	for(i = 0 ; i < pTpl->nOps ; ++i) {
+		op = &pTpl->ops[i];
+		if(op->opType == TPLOP_CONSTANT)
+			continue;
+		if(op->opType == TPLOP_PROP) {
+			vals[nVals].pVal = op->d.prop.get(pMsg, op->d.prop.arg, &vals[nVals].iLenVal);
+			vals[nVals].bMustBeFreed = 0;
+		} else {
+			vals[nVals].pVal = MsgGetProp(pMsg, op->d.pTpe, &op->d.pTpe->data.field.msgProp,
+				&vals[nVals].iLenVal, &vals[nVals].bMustBeFreed, ttNow);
+		}
+		lenTotal += (op->esc == NULL) ? (size_t) vals[nVals].iLenVal
+					      : op->esc->getLen(vals[nVals].pVal, vals[nVals].iLenVal);
+		++nVals;
+	}
+
+	if(lenTotal >= iparam->lenBuf) /* we reserve one char for the final \0! */
+		CHKiRet(ExtendBuf(iparam, lenTotal + 1));
+
+	pDst = iparam->param;
+	for(i = 0, j = 0 ; i < pTpl->nOps ; ++i) {
+		op = &pTpl->ops[i];
+		if(op->opType == TPLOP_CONSTANT) {
+			memcpy(pDst, op->d.constant.pConstant, op->d.constant.iLenConstant);
+			pDst += op->d.constant.iLenConstant;
+		} else {
+			if(op->esc == NULL) {
+				memcpy(pDst, vals[j].pVal, vals[j].iLenVal);
+				pDst += vals[j].iLenVal;
+			} else {
+				pDst = op->esc->copy(pDst, vals[j].pVal, vals[j].iLenVal);
+			}
+			++j;
+		}
+	}
+	*pDst = '\0';
+	iparam->lenStr = pDst - iparam->param;
+
+finalize_it:
+	for(j = 0 ; j < nVals ; ++j) {
+		if(vals[j].bMustBeFreed)
+			free(vals[j].pVal);
+	}
+	RETiRet;
+}
+
+
 /* This functions converts a template into a string.
  *
  * The function takes a pointer to a template and a pointer to a msg object
@@ -165,6 +394,11 @@ tplToString(struct template *__restrict__ const pTpl,
 		FINALIZE;
 	}
 
+	if(pTpl->ops != NULL) {
+		CHKiRet(tplToStringCompiled(pTpl, pMsg, iparam, ttNow));
+		FINALIZE;
+	}
+
 	if(pTpl->bHaveSubtree) {
 		/* only a single CEE subtree must be provided */
 		/* note: we could optimize the code below, however, this is
@@ -339,13 +573,14 @@ tplToJSON(struct template *pTpl, msg_t *pMsg, struct json_object **pjson, struct
 	DEFiRet;
 
 	if(pTpl->bHaveSubtree){
-		if(jsonFind(pMsg->json, &pTpl->subtree, pjson) != RS_RET_OK)
+		/* the tree may be shared with other messages (copy-on-write), so
+		 * we must access it under its lock and need a private copy
+		 */
+		if(msgGetJSONPropJSON(pMsg, &pTpl->subtree, pjson) != RS_RET_OK)
 			*pjson = NULL;
 		if(*pjson == NULL) {
 			/* we need to have a root object! */
 			*pjson = json_object_new_object();
-		} else {
-			json_object_get(*pjson); /* inc refcount */
 		}
 		FINALIZE;
 	}
@@ -2088,6 +2323,23 @@ struct template *tplFind(rsconf_t *conf, char *pName, int iLenName)
 	return(pTpl);
 }
 
+static void
+tplFreeOps(struct template *pTpl)
+{
+	int i;
+
+	if(pTpl->ops == NULL)
+		return;
+	for(i = 0 ; i < pTpl->nOps ; ++i) {
+		if(pTpl->ops[i].opType == TPLOP_CONSTANT && pTpl->ops[i].d.constant.bMustBeFreed)
+			free(pTpl->ops[i].d.constant.pConstant);
+	}
+	free(pTpl->ops);
+	pTpl->ops = NULL;
+	pTpl->nOps = 0;
+	pTpl->lenConstants = 0;
+}
+
 /* Destroy the template structure. This is for de-initialization
  * at program end. Everything is deleted.
  * rgerhards 2005-02-22
@@ -2139,6 +2391,7 @@ void tplDeleteAll(rsconf_t *conf)
 		free(pTplDel->pszName);
 		if(pTplDel->bHaveSubtree)
 			msgPropDescrDestruct(&pTplDel->subtree);
+		tplFreeOps(pTplDel);
 		free(pTplDel);
 	}
 	ENDfunc
@@ -2197,6 +2450,7 @@ void tplDeleteNew(rsconf_t *conf)
 		free(pTplDel->pszName);
 		if(pTplDel->bHaveSubtree)
 			msgPropDescrDestruct(&pTplDel->subtree);
+		tplFreeOps(pTplDel);
 		free(pTplDel);
 	}
 	ENDfunc
@@ -2350,6 +2604,236 @@ int tplGetEntryCount(struct template *pTpl)
 	return(pTpl->tpenElements);
 }
 
+/* check if the output of a template depends on the message alone, so
+ * that it can be rendered once per message and then be reused. This is
+ * not the case for properties based on the current time or on global
+ * variables (which other workers may modify at any time).
+ */
+static int
+tplIsDeterministic(struct template *pTpl)
+{
+	struct templateEntry *pTpe;
+
+	if(pTpl->bHaveSubtree)
+		return pTpl->subtree.id != PROP_GLOBAL_VAR;
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType != FIELD)
+			continue;
+		switch(pTpe->data.field.msgProp.id) {
+		case PROP_SYS_NOW:
+		case PROP_SYS_YEAR:
+		case PROP_SYS_MONTH:
+		case PROP_SYS_DAY:
+		case PROP_SYS_HOUR:
+		case PROP_SYS_HHOUR:
+		case PROP_SYS_QHOUR:
+		case PROP_SYS_MINUTE:
+		case PROP_SYS_UPTIME:
+		case PROP_SYS_NOW_UTC:
+		case PROP_SYS_YEAR_UTC:
+		case PROP_SYS_MONTH_UTC:
+		case PROP_SYS_DAY_UTC:
+		case PROP_SYS_HOUR_UTC:
+		case PROP_SYS_HHOUR_UTC:
+		case PROP_SYS_QHOUR_UTC:
+		case PROP_SYS_MINUTE_UTC:
+		case PROP_GLOBAL_VAR:
+			return 0;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
+
+/* register an action parameter that renders this template as string
+ * and whose action has no queue of its own, so it is run by the workers
+ * that execute the ruleset. If a template
+ * has more than one such user, the workers render it only once per
+ * message and share the result (see actionTplToString()).
+ */
+void tplAddCacheUser(struct template *pTpl)
+{
+	if(tplIsDeterministic(pTpl))
+		++pTpl->iCacheUsers;
+}
+
+/* check how a template entry needs to be formatted. Returns 0 if the
+ * property value is used as is, 1 for format="json", 2 for format="jsonf"
+ * and -1 if the entry needs any other processing inside MsgGetProp().
+ */
+static int
+tpeGetSimpleFormat(struct templateEntry *pTpe)
+{
+	if(!pTpe->bComplexProcessing)
+		return 0;
+	if(   pTpe->data.field.has_fields
+	   || pTpe->data.field.iFromPos != 0
+	   || pTpe->data.field.iToPos != 0
+#ifdef FEATURE_REGEXP
+	   || pTpe->data.field.has_regex
+#endif
+	   || pTpe->data.field.eCaseConv != tplCaseConvNo
+	   || pTpe->data.field.options.bDropCC
+	   || pTpe->data.field.options.bSpaceCC
+	   || pTpe->data.field.options.bEscapeCC
+	   || pTpe->data.field.options.bCompressSP
+	   || pTpe->data.field.options.bDropLastLF
+	   || pTpe->data.field.options.bSecPathDrop
+	   || pTpe->data.field.options.bSecPathReplace
+	   || pTpe->data.field.options.bSPIffNo1stSP
+	   || pTpe->data.field.options.bCSV
+	   || pTpe->data.field.options.bJSONr
+	   || pTpe->data.field.options.bJSONfr
+	   || pTpe->data.field.options.bFixedWidth)
+		return -1;
+	if(pTpe->data.field.options.bJSON)
+		return 1;
+	if(pTpe->data.field.options.bJSONf)
+		return 2;
+	return 0;
+}
+
+/* append a constant to the ops array. Adjacent constants are merged
+ * into a single one, which then is owned by the op.
+ */
+static rsRetVal
+tplOpAddConstant(struct template *pTpl, uchar *pConstant, const int iLenConstant)
+{
+	struct tplOp *op;
+	uchar *pNew;
+	DEFiRet;
+
+	if(iLenConstant == 0)
+		FINALIZE;
+	if(pTpl->nOps > 0 && pTpl->ops[pTpl->nOps-1].opType == TPLOP_CONSTANT) {
+		op = &pTpl->ops[pTpl->nOps-1];
+		CHKmalloc(pNew = malloc(op->d.constant.iLenConstant + iLenConstant));
+		memcpy(pNew, op->d.constant.pConstant, op->d.constant.iLenConstant);
+		memcpy(pNew + op->d.constant.iLenConstant, pConstant, iLenConstant);
+		if(op->d.constant.bMustBeFreed)
+			free(op->d.constant.pConstant);
+		op->d.constant.pConstant = pNew;
+		op->d.constant.iLenConstant += iLenConstant;
+		op->d.constant.bMustBeFreed = 1;
+	} else {
+		op = &pTpl->ops[pTpl->nOps++];
+		op->opType = TPLOP_CONSTANT;
+		op->esc = NULL;
+		op->d.constant.pConstant = pConstant;
+		op->d.constant.iLenConstant = iLenConstant;
+		op->d.constant.bMustBeFreed = 0;
+	}
+	pTpl->lenConstants += iLenConstant;
+finalize_it:
+	RETiRet;
+}
+
+/* compile a template into a flat array of operations (see struct tplOp).
+ * Properties which need no processing besides JSON or template level
+ * escaping are obtained via direct accessors instead of MsgGetProp() and
+ * escaped by the matching kernel. Everything else is still handed over
+ * to MsgGetProp(). Templates which cannot be compiled keep ops == NULL
+ * and are processed as before.
+ */
+static rsRetVal
+tplCompile(struct template *pTpl)
+{
+	struct templateEntry *pTpe;
+	const struct tplEscKernel_s *tplEsc;
+	msgPropAccessor_t get;
+	struct tplOp *op;
+	int nFields = 0;
+	int nEntries = 0;
+	int nAccessors = 0;
+	int fmt;
+	DEFiRet;
+
+	if(pTpl->ops != NULL || pTpl->pStrgen != NULL || pTpl->bHaveSubtree)
+		FINALIZE;
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType == FIELD)
+			++nFields;
+		else if(pTpe->eEntryType != CONSTANT)
+			FINALIZE;
+		++nEntries;
+	}
+	if(nFields > TPL_MAX_COMPILED_PROPS) {
+		DBGPRINTF("template '%s' has too many properties, not compiled\n", pTpl->pszName);
+		FINALIZE;
+	}
+
+	switch(pTpl->optFormatEscape) {
+	case SQL_ESCAPE:
+		tplEsc = &escKernelSQL;
+		break;
+	case STDSQL_ESCAPE:
+		tplEsc = &escKernelStdSQL;
+		break;
+	case JSON_ESCAPE:
+		tplEsc = &escKernelQuote;
+		break;
+	default:
+		tplEsc = NULL;
+		break;
+	}
+
+	/* each entry results in at most three ops (jsonf) */
+	CHKmalloc(pTpl->ops = calloc(3 * nEntries + 1, sizeof(struct tplOp)));
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType == CONSTANT) {
+			CHKiRet(tplOpAddConstant(pTpl, pTpe->data.constant.pConstant,
+				pTpe->data.constant.iLenConstant));
+			continue;
+		}
+		fmt = tpeGetSimpleFormat(pTpe);
+		get = MsgGetPropAccessor(pTpe->data.field.msgProp.id);
+		if(pTpe->data.field.options.bDateInUTC
+		   || (fmt == 2 && pTpe->fieldName == NULL)
+		   || (fmt > 0 && tplEsc != NULL))
+			fmt = -1;
+		if(fmt == -1 || get == NULL) {
+			op = &pTpl->ops[pTpl->nOps++];
+			op->opType = TPLOP_ENTRY;
+			op->esc = tplEsc;
+			op->d.pTpe = pTpe;
+			continue;
+		}
+		if(fmt == 2) {
+			CHKiRet(tplOpAddConstant(pTpl, (uchar*) "\"", 1));
+			CHKiRet(tplOpAddConstant(pTpl, pTpe->fieldName, pTpe->lenFieldName));
+			CHKiRet(tplOpAddConstant(pTpl, (uchar*) "\":\"", 3));
+		}
+		op = &pTpl->ops[pTpl->nOps++];
+		op->opType = TPLOP_PROP;
+		op->esc = (fmt == 0) ? tplEsc : &escKernelJSON;
+		op->d.prop.get = get;
+		op->d.prop.arg = pTpe->data.field.eDateFormat;
+		++nAccessors;
+		if(fmt == 2)
+			CHKiRet(tplOpAddConstant(pTpl, (uchar*) "\"", 1));
+	}
+	DBGPRINTF("template '%s' compiled into %d ops, %d of %d properties via direct "
+		"accessors\n", pTpl->pszName, pTpl->nOps, nAccessors, nFields);
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		tplFreeOps(pTpl);
+	RETiRet;
+}
+
+/* compile all templates of a config, called after it has been loaded */
+void tplCompileAll(rsconf_t *conf)
+{
+	struct template *pTpl;
+
+	for(pTpl = conf->templates.root ; pTpl != NULL ; pTpl = pTpl->pNext) {
+		if(tplCompile(pTpl) != RS_RET_OK)
+			DBGPRINTF("error compiling template '%s', using generic code\n",
+				pTpl->pszName);
+	}
+}
+
 rsRetVal templateInit()
 {
 	DEFiRet;
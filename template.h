@@ -55,6 +55,11 @@ struct template {
 	 * than short...
 	 */
 	char optCaseSensitive;  /* case-sensitive variable property references, default False, 0 */
+	int iCacheUsers;	/* number of direct action parameters rendering this template as
+				 * string, if it can be cached at all (see tplAddCacheUser()) */
+	struct tplOp *ops;	/* compiled form of the template, NULL if not compiled */
+	int nOps;		/* number of entries in ops */
+	int lenConstants;	/* combined length of all constant ops */
 };
 
 enum EntryTypes { UNDEFINED = 0, CONSTANT = 1, FIELD = 2 };
@@ -136,6 +141,33 @@ struct templateEntry {
 };
 
 
+/* A compiled template is a flat array of operations, which tplToString()
+ * executes in order (see tplCompile()).
+ */
+enum tplOpTypes {
+	TPLOP_CONSTANT = 0,	/* copy a constant */
+	TPLOP_PROP = 1,		/* copy a property obtained via its direct accessor */
+	TPLOP_ENTRY = 2		/* copy a property obtained via MsgGetProp() */
+};
+
+struct tplOp {
+	enum tplOpTypes opType;
+	const struct tplEscKernel_s *esc; /* escape kernel for property values, NULL if none */
+	union {
+		struct {
+			uchar *pConstant;
+			int iLenConstant;
+			sbool bMustBeFreed; /* constant was generated by the compiler */
+		} constant;
+		struct {
+			msgPropAccessor_t get;
+			int arg;
+		} prop;
+		struct templateEntry *pTpe;
+	} d;
+};
+
+
 /* interfaces */
 BEGINinterface(tpl) /* name must also be changed in ENDinterface macro! */
 ENDinterface(tpl)
@@ -155,6 +187,8 @@ void tplPrintList(rsconf_t *conf);
 void tplLastStaticInit(rsconf_t *conf, struct template *tpl);
 rsRetVal ExtendBuf(actWrkrIParams_t *const iparam, const size_t iMinSize);
 int tplRequiresDateCall(struct template *pTpl);
+void tplAddCacheUser(struct template *pTpl);
+void tplCompileAll(rsconf_t *conf);
 /* note: if a compiler warning for undefined type tells you to look at this
  * code line below, the actual cause is that you currently MUST include template.h
  * BEFORE msg.h, even if your code file does not actually need it.
@@ -0,0 +1,69 @@
+#!/bin/bash
+# Benchmark for the per-batch commit overhead of configs with many actions.
+# Each config has the given number of (transactional) omfile actions, and
+# every message is routed to exactly one of them via a tree of filters,
+# so that routing cost grows only logarithmically. With small batches,
+# most actions do not receive a message in a given batch; processing time
+# should thus hardly depend on the number of actions.
+# This is not part of the regular testbench, as it takes quite a while and
+# the results are only meaningful on an otherwise idle machine. Run it
+# from the tests directory via
+#   srcdir=. ./action-commit-bench.sh [number-of-messages]
+# Note that each action keeps its output file open, so the open files
+# limit is raised as needed.
+# This file is part of the rsyslog project, released under ASL 2.0
+NUMMSGS=${1:-500000}
+NUMACTIONS="10 300 3000"
+echo ===============================================================================
+echo \[action-commit-bench.sh\]: benchmarking commit with many actions, $NUMMSGS messages
+
+now_ms() {
+	echo $(( `date +%s%N` / 1000000 ))
+}
+
+# print filters sending $.n == i to action i, for all i in [$1, $2]
+generate_actions() {
+	awk -v lo=$1 -v hi=$2 '
+	function gen(lo, hi, indent,    mid) {
+		if(lo == hi) {
+			printf("%saction(type=\"omfile\" file=\"./rsyslog.out.%d.log\" template=\"outfmt\")\n", indent, lo)
+			return
+		}
+		mid = int((lo + hi) / 2)
+		printf("%sif $.n <= %d then {\n", indent, mid)
+		gen(lo, mid, indent "\t")
+		printf("%s} else {\n", indent)
+		gen(mid + 1, hi, indent "\t")
+		printf("%s}\n", indent)
+	}
+	BEGIN { gen(lo, hi, "") }'
+}
+
+ulimit -n $(( ${NUMACTIONS##* } + 256 )) || exit 1
+rm -f action-commit-bench.result
+for NACT in $NUMACTIONS; do
+	. $srcdir/diag.sh init
+	rm -f rsyslog.out.*.log
+	cat > testconf.conf <<CONF
+\$IncludeConfig diag-common.conf
+main_queue(queue.dequeueBatchSize="32")
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+if not (\$msg contains "msgnum:") then stop
+set \$.n = cnum(field(\$msg, 58, 2)) % $NACT;
+CONF
+	generate_actions 0 $(( NACT - 1 )) >> testconf.conf
+	. $srcdir/diag.sh startup
+	START=`now_ms`
+	. $srcdir/diag.sh injectmsg 0 $NUMMSGS
+	. $srcdir/diag.sh wait-queueempty
+	END=`now_ms` # do not count shutdown, which closes all output files
+	. $srcdir/diag.sh shutdown-when-empty
+	. $srcdir/diag.sh wait-shutdown
+	cat rsyslog.out.*.log > rsyslog.out.log
+	rm -f rsyslog.out.*.log
+	. $srcdir/diag.sh seq-check 0 $(( NUMMSGS - 1 ))
+	echo "$NACT actions: $(( END - START )) ms" | tee -a action-commit-bench.result
+done
+cat action-commit-bench.result
+rm -f action-commit-bench.result
+. $srcdir/diag.sh exit
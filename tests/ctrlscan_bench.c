@@ -0,0 +1,208 @@
+/* Micro-benchmark for the control character scanners in runtime/ctrlscan.c.
+ * A buffer of syslog-like messages is swept the way SanitizeMsg() does it,
+ * with each scanner available on this machine, and the throughput is
+ * reported in MB/s. By default, a synthetic mix of RFC3164, RFC5424, key=value
+ * and JSON messages is used; with -f, the messages are read from a file
+ * (one per line), so that a real corpus can be measured. The hit counts of
+ * all scanners are compared, so a wrong result makes the program fail.
+ *
+ * Usage: ctrlscan_bench [-f corpus-file] [-s buffersize-in-MB] [-r rounds]
+ *
+ * This file is part of the rsyslog project, released under ASL 2.0
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "ctrlscan.h"
+
+/* message templates for the synthetic corpus. Some contain tabs or UTF-8,
+ * which SanitizeMsg() must stop at, depending on the configuration.
+ */
+static const char *tmpls[] = {
+	"<34>Oct 11 22:14:15 mymachine su: 'su root' failed for lonvick on /dev/pts/8",
+	"<165>1 2003-10-11T22:14:15.003Z mymachine.example.com evntslog - ID47 "
+		"[exampleSDID@32473 iut=\"3\" eventSource=\"Application\" eventID=\"1011\"] "
+		"An application event log entry...",
+	"<13>Jan 12 08:01:44 fw01 kernel: IN=eth0 OUT= MAC=00:16:3e:5a:2b:01 SRC=10.0.0.12 "
+		"DST=10.0.0.1 LEN=60 TOS=0x00 PREC=0x00 TTL=64 ID=4711 DF PROTO=TCP SPT=51234 "
+		"DPT=22 WINDOW=29200 RES=0x00 SYN URGP=0",
+	"<14>Jan 12 08:01:45 app01 web[2211]: @cee: {\"level\":\"info\",\"msg\":\"request done\","
+		"\"path\":\"/api/v1/items\",\"status\":200,\"duration_ms\":12.7,\"user\":\"j\\u00f6rg\"}",
+	"<30>Jan 12 08:01:46 db01 postgres[812]: LOG:\tduration: 0.412 ms\tstatement: SELECT 1",
+	"<28>Jan 12 08:01:47 nas01 smbd[77]: user=J\xc3\xb6rg share=\xc3\x9c""bersicht action=open",
+	NULL
+};
+
+static double
+timeDiff(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* fill buf with LF-terminated messages from the synthetic corpus */
+static int
+fillSynthetic(unsigned char *buf, const int len)
+{
+	int nTmpls;
+	int i = 0;
+	int n;
+
+	for(nTmpls = 0 ; tmpls[nTmpls] != NULL ; ++nTmpls)
+		/* just count */;
+	while(1) {
+		const char *const t = tmpls[rand() % nTmpls];
+		n = strlen(t);
+		if(i + n + 1 > len)
+			break;
+		memcpy(buf + i, t, n);
+		i += n;
+		buf[i++] = '\n';
+	}
+	return i;
+}
+
+/* fill buf with the lines of a file, repeated until buf is full */
+static int
+fillFromFile(unsigned char *buf, const int len, const char *fn)
+{
+	FILE *fp;
+	int i = 0;
+	int n;
+
+	if((fp = fopen(fn, "r")) == NULL) {
+		perror(fn);
+		exit(1);
+	}
+	while(i < len) {
+		n = fread(buf + i, 1, len - i, fp);
+		if(n == 0) {
+			if(i == 0) {
+				fprintf(stderr, "%s: file is empty\n", fn);
+				exit(1);
+			}
+			rewind(fp);
+		}
+		i += n;
+	}
+	fclose(fp);
+	return i;
+}
+
+/* record the start offset of each message in buf, the end of the
+ * last one is stored in the final entry. Returns the number of messages.
+ */
+static int
+findMsgs(const unsigned char *buf, const int len, int **pOffs)
+{
+	int *offs;
+	int nMsgs = 0;
+	int i;
+
+	for(i = 0 ; i < len ; ++i)
+		if(buf[i] == '\n')
+			++nMsgs;
+	if((offs = malloc((nMsgs + 1) * sizeof(int))) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	offs[0] = 0;
+	nMsgs = 0;
+	for(i = 0 ; i < len ; ++i)
+		if(buf[i] == '\n')
+			offs[++nMsgs] = i + 1;
+	*pOffs = offs;
+	return nMsgs;
+}
+
+/* sweep over all messages in buf like SanitizeMsg() does and return
+ * the number of characters the scanner stopped at.
+ */
+static long
+sweepMsgs(ctrlScanFunc_t scan, const unsigned char *buf, const int *offs,
+	const int nMsgs, const int bHigh)
+{
+	long nHits = 0;
+	int msgEnd;
+	int i, m;
+
+	for(m = 0 ; m < nMsgs ; ++m) {
+		msgEnd = offs[m + 1] - 1; /* without the LF */
+		for(i = offs[m] ; (i += scan(buf + i, msgEnd - i, bHigh)) < msgEnd ; ++i)
+			++nHits;
+	}
+	return nHits;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct ctrlScanImpl_s *impls;
+	struct timespec start, end;
+	const char *fn = NULL;
+	int bufSize = 64;
+	int nRounds = 5;
+	long nHits = 0, nHitsRef;
+	unsigned char *buf;
+	int *offs;
+	int nMsgs;
+	int len;
+	int opt;
+	int bHigh, j, r;
+	int ret = 0;
+
+	while((opt = getopt(argc, argv, "f:s:r:")) != -1) {
+		switch(opt) {
+		case 'f': fn = optarg; break;
+		case 's': bufSize = atoi(optarg); break;
+		case 'r': nRounds = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: ctrlscan_bench [-f corpus-file] [-s buffersize-in-MB] "
+				"[-r rounds]\n");
+			exit(1);
+		}
+	}
+	if(nRounds < 1 || bufSize < 1) {
+		fprintf(stderr, "ctrlscan_bench: rounds and buffer size must be at least 1\n");
+		exit(1);
+	}
+	bufSize *= 1024 * 1024;
+	if((buf = malloc(bufSize)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	len = (fn == NULL) ? fillSynthetic(buf, bufSize) : fillFromFile(buf, bufSize, fn);
+	nMsgs = findMsgs(buf, len, &offs);
+	len = offs[nMsgs];
+
+	impls = ctrlScanGetImpls();
+	printf("%8s", "8bit");
+	for(j = 0 ; impls[j].name != NULL ; ++j)
+		printf(" %12s", impls[j].name);
+	printf("   (MB/s)\n");
+
+	for(bHigh = 0 ; bHigh < 2 ; ++bHigh) {
+		printf("%8s", bHigh ? "on" : "off");
+		nHitsRef = -1;
+		for(j = 0 ; impls[j].name != NULL ; ++j) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for(r = 0 ; r < nRounds ; ++r)
+				nHits = sweepMsgs(impls[j].scan, buf, offs, nMsgs, bHigh);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			printf(" %12.1f", (double) len * nRounds / (1024 * 1024) / timeDiff(&start, &end));
+			if(nHitsRef == -1) {
+				nHitsRef = nHits;
+			} else if(nHits != nHitsRef) {
+				printf("\nerror: %s stopped at %ld characters, %s at %ld\n",
+				       impls[j].name, nHits, impls[0].name, nHitsRef);
+				ret = 1;
+			}
+		}
+		printf("\n");
+	}
+	free(offs);
+	free(buf);
+	return ret;
+}
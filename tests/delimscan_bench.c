@@ -0,0 +1,116 @@
+/* Micro-benchmark for the frame delimiter scanners in runtime/delimscan.c.
+ * For a range of message sizes, a buffer of LF-terminated frames is split
+ * into frames with each scanner available on this machine, and the
+ * throughput is reported in MB/s. The frame counts of all scanners are
+ * compared, so a wrong result makes the program fail.
+ *
+ * Usage: delimscan_bench [-s buffersize-in-MB] [-r rounds]
+ *
+ * This file is part of the rsyslog project, released under ASL 2.0
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "delimscan.h"
+
+static const int msgSizes[] = { 16, 64, 128, 256, 512, 1024, 4096, 16384, 0 };
+
+static double
+timeDiff(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* fill buf with frames of (roughly) the given size */
+static void
+fillBuf(char *buf, const int len, const int msgSize)
+{
+	int i;
+	int nextLF = msgSize;
+	for(i = 0 ; i < len ; ++i) {
+		if(i == nextLF) {
+			buf[i] = '\n';
+			/* vary the frame size by up to +/- 1/8 */
+			nextLF = i + 1 + msgSize - msgSize / 8 + rand() % (msgSize / 4 + 1);
+		} else {
+			buf[i] = ' ' + rand() % 95;
+		}
+	}
+}
+
+static long
+splitFrames(delimScanFunc_t scan, const char *buf, const int len)
+{
+	long nFrames = 0;
+	int pos = 0;
+	while(pos < len) {
+		pos += scan(buf + pos, len - pos, '\n') + 1;
+		++nFrames;
+	}
+	return nFrames;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct delimScanImpl_s *impls;
+	struct timespec start, end;
+	int bufSize = 64;
+	int nRounds = 5;
+	long nFrames = 0, nFramesRef;
+	char *buf;
+	int opt;
+	int i, j, r;
+	int ret = 0;
+
+	while((opt = getopt(argc, argv, "s:r:")) != -1) {
+		switch(opt) {
+		case 's': bufSize = atoi(optarg); break;
+		case 'r': nRounds = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: delimscan_bench [-s buffersize-in-MB] [-r rounds]\n");
+			exit(1);
+		}
+	}
+	if(nRounds < 1 || bufSize < 1) {
+		fprintf(stderr, "delimscan_bench: rounds and buffer size must be at least 1\n");
+		exit(1);
+	}
+	bufSize *= 1024 * 1024;
+	if((buf = malloc(bufSize)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	impls = delimScanGetImpls();
+	printf("%8s", "msgsize");
+	for(j = 0 ; impls[j].name != NULL ; ++j)
+		printf(" %12s", impls[j].name);
+	printf("   (MB/s)\n");
+
+	for(i = 0 ; msgSizes[i] != 0 ; ++i) {
+		fillBuf(buf, bufSize, msgSizes[i]);
+		printf("%8d", msgSizes[i]);
+		nFramesRef = -1;
+		for(j = 0 ; impls[j].name != NULL ; ++j) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for(r = 0 ; r < nRounds ; ++r)
+				nFrames = splitFrames(impls[j].scan, buf, bufSize);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			printf(" %12.1f", (double) bufSize * nRounds / (1024 * 1024) / timeDiff(&start, &end));
+			if(nFramesRef == -1) {
+				nFramesRef = nFrames;
+			} else if(nFrames != nFramesRef) {
+				printf("\nerror: %s found %ld frames, %s found %ld\n",
+				       impls[j].name, nFrames, impls[0].name, nFramesRef);
+				ret = 1;
+			}
+		}
+		printf("\n");
+	}
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,16 @@
+#!/bin/bash
+# Test for disk-only queue mode with binary record format
+# This test checks if binary queue records can be correctly written
+# and read back.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-binary.sh\]: testing queue disk-only mode, binary format
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup diskqueue-binary.conf
+# 20000 messages should be enough - the disk test is slow enough ;)
+sleep 4
+. $srcdir/diag.sh tcpflood -m20000
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 19999
+. $srcdir/diag.sh exit
@@ -0,0 +1,55 @@
+#!/bin/bash
+# Benchmark for the disk queue record formats. For each format, messages
+# are first enqueued while the queue is not permitted to dequeue (via the
+# dequeue time window), then rsyslog is restarted and the queue drained.
+# Enqueue and dequeue throughput are reported in MB/s of queue file data.
+# This is not part of the regular testbench, as it takes quite a while and
+# the results are only meaningful on an otherwise idle machine. Run it
+# from the tests directory via
+#   srcdir=. ./diskqueue-format-bench.sh [number-of-messages]
+# This file is part of the rsyslog project, released  under GPLv3
+NUMMSGS=${1:-200000}
+HOUR=`date +%-H`
+WINFROM=$(( (HOUR + 2) % 24 ))
+WINTO=$(( (HOUR + 3) % 24 ))
+echo ===============================================================================
+echo \[diskqueue-format-bench.sh\]: benchmarking disk queue formats, $NUMMSGS messages
+
+now_ms() {
+	echo $(( `date +%s%N` / 1000000 ))
+}
+
+for FORMAT in text binary; do
+	. $srcdir/diag.sh init
+	echo "main_queue(queue.type=\"disk\" queue.filename=\"mainq\" queue.diskformat=\"$FORMAT\"
+		   queue.maxfilesize=\"100m\" queue.dequeuetimebegin=\"$WINFROM\"
+		   queue.dequeuetimeend=\"$WINTO\")" > work-queueformat.conf
+	. $srcdir/diag.sh startup diskqueue-format-bench.conf
+	START=`now_ms`
+	. $srcdir/diag.sh injectmsg 0 $NUMMSGS
+	END=`now_ms`
+	ENQMS=$(( END - START ))
+	. $srcdir/diag.sh shutdown-immediate
+	. $srcdir/diag.sh wait-shutdown
+	. $srcdir/diag.sh check-mainq-spool
+	BYTES=`cat test-spool/mainq.0* | wc -c`
+
+	echo "main_queue(queue.type=\"disk\" queue.filename=\"mainq\" queue.diskformat=\"$FORMAT\"
+		   queue.maxfilesize=\"100m\")" > work-queueformat.conf
+	START=`now_ms`
+	. $srcdir/diag.sh startup diskqueue-format-bench.conf
+	. $srcdir/diag.sh shutdown-when-empty
+	. $srcdir/diag.sh wait-shutdown
+	END=`now_ms`
+	DEQMS=$(( END - START ))
+	. $srcdir/diag.sh seq-check 0 $(( NUMMSGS - 1 ))
+
+	[ $ENQMS -eq 0 ] && ENQMS=1
+	[ $DEQMS -eq 0 ] && DEQMS=1
+	echo "format $FORMAT: $BYTES bytes on disk, enqueue $ENQMS ms" \
+	     "($(( BYTES / 1000 / ENQMS )) MB/s), dequeue $DEQMS ms ($(( BYTES / 1000 / DEQMS )) MB/s)" \
+	     | tee -a diskqueue-format-bench.result
+done
+cat diskqueue-format-bench.result
+rm -f diskqueue-format-bench.result
+. $srcdir/diag.sh exit
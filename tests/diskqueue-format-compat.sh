@@ -0,0 +1,27 @@
+#!/bin/bash
+# Test for mixing disk queue record formats. The first instance writes
+# text records and is shut down before it can process them. The second
+# instance is configured for the binary format, so it must read the old
+# text records and the new binary ones from the same queue files.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-format-compat.sh\]: testing text and binary records in one disk queue
+. $srcdir/diag.sh init
+
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.diskformat="text")' > work-queueformat.conf
+echo "*.*     :omtesting:sleep 0 1000" > work-delay.conf
+. $srcdir/diag.sh startup diskqueue-format-compat.conf
+. $srcdir/diag.sh injectmsg 0 5000
+. $srcdir/diag.sh shutdown-immediate
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh check-mainq-spool
+
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.diskformat="binary")' > work-queueformat.conf
+echo "#" > work-delay.conf
+. $srcdir/diag.sh startup diskqueue-format-compat.conf
+. $srcdir/diag.sh injectmsg 5000 5000
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown
+# duplicates are permitted due to the forced shutdown (see queue-persist-drvr.sh)
+. $srcdir/diag.sh seq-check 0 9999 -d
+. $srcdir/diag.sh exit
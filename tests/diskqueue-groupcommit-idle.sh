@@ -0,0 +1,25 @@
+#!/bin/bash
+# Test for disk queue group commit: if no new messages arrive, the
+# pending writes must still be synced once the sync interval expires,
+# not only when the queue is shut down. We check this via the "syncs"
+# counter of the queue, which we take from the stats output before
+# shutdown begins.
+# This file is part of the rsyslog project, released  under GPLv3
+echo \[diskqueue-groupcommit-idle.sh\]: testing queue disk group commit timed sync
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup diskqueue-groupcommit-idle.conf
+. $srcdir/diag.sh injectmsg 0 1000
+. $srcdir/diag.sh wait-queueempty
+./msleep 3000 # sync interval is 1 second, stats interval also 1 second
+cp rsyslog.out.stats.log rsyslog.out.stats-idle.log
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 999
+syncs=$(grep "groupcommit queue" rsyslog.out.stats-idle.log | tail -n1 | sed -e 's/.* syncs=\([0-9]*\).*/\1/')
+if [ "x$syncs" == "x" ] || [ "$syncs" -lt 1 ]; then
+	echo "FAIL: no group commit before shutdown, syncs='$syncs', stats:"
+	cat rsyslog.out.stats-idle.log
+	. $srcdir/diag.sh error-exit 1
+fi
+rm -f rsyslog.out.stats-idle.log
+. $srcdir/diag.sh exit
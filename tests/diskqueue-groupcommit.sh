@@ -0,0 +1,14 @@
+#!/bin/bash
+# Test for disk-only queue mode with fsync for queue files, but
+# with group commit, so that not each single write is synced.
+# This file is part of the rsyslog project, released  under GPLv3
+echo \[diskqueue-groupcommit.sh\]: testing queue disk-only mode, group commit case
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup diskqueue-groupcommit.conf
+# thanks to group commit, we can use much more messages than in
+# diskqueue-fsync.sh
+. $srcdir/diag.sh injectmsg 0 20000
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 19999
+. $srcdir/diag.sh exit
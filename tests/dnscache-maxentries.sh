@@ -0,0 +1,27 @@
+#!/bin/bash
+# Test for dnscache.maxentries: the cache must not grow beyond its
+# limit, but evict the least recently used entries instead. We send
+# from 40 different addresses with a limit of 16 entries, so at least
+# 24 entries must have been evicted (checked via the dnscache stats).
+# Note: the imdiag control connection may cause an additional lookup.
+# This file is part of the rsyslog project, released  under GPLv3
+echo \[dnscache-maxentries.sh\]: testing dnscache eviction at maxentries
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup dnscache-maxentries.conf
+for i in $(seq 1 40); do
+	. $srcdir/diag.sh tcpflood -T udp -A 127.0.0.$i -m1 -i$i
+done
+. $srcdir/diag.sh wait-queueempty
+./msleep 1500 # wait for stats flush
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown
+misses=$(grep "dnscache:" rsyslog.out.stats.log | tail -n1 | sed -e 's/.* misses=\([0-9]*\).*/\1/')
+evictions=$(grep "dnscache:" rsyslog.out.stats.log | tail -n1 | sed -e 's/.* evictions=\([0-9]*\).*/\1/')
+if [ "x$misses" == "x" ] || [ "$misses" -lt 40 ] || \
+   [ "x$evictions" == "x" ] || [ "$evictions" -lt 24 ]; then
+	echo "FAIL: expected at least 40 misses and at least 24 evictions, got misses='$misses'" \
+	     "evictions='$evictions', stats:"
+	grep "dnscache:" rsyslog.out.stats.log
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh exit
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Test for dnscache.negativettl: a failed reverse lookup is cached only
+# for the negative TTL. We send from 127.0.0.2, which normally has no PTR
+# record, wait until the negative TTL has passed and send again. The
+# second lookup must find the entry expired, which we check via the
+# "expired" counter of the dnscache stats.
+# This file is part of the rsyslog project, released  under GPLv3
+echo \[dnscache-negttl.sh\]: testing dnscache negative TTL expiry
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup dnscache-negttl.conf
+. $srcdir/diag.sh tcpflood -T udp -A 127.0.0.2 -m1 -i0
+. $srcdir/diag.sh wait-queueempty
+if ! grep -q "^127.0.0.2 00000000" rsyslog.out.log; then
+	echo "127.0.0.2 has a PTR record on this machine, can not test negative TTL:"
+	cat rsyslog.out.log
+	. $srcdir/diag.sh shutdown-immediate
+	. $srcdir/diag.sh wait-shutdown
+	exit 77
+fi
+./msleep 2500 # negative TTL is 1 second
+. $srcdir/diag.sh tcpflood -T udp -A 127.0.0.2 -m1 -i1
+. $srcdir/diag.sh wait-queueempty
+./msleep 1500 # wait for stats flush
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh content-check "127.0.0.2 00000001"
+expired=$(grep "dnscache:" rsyslog.out.stats.log | tail -n1 | sed -e 's/.* expired=\([0-9]*\).*/\1/')
+if [ "x$expired" != "x1" ]; then
+	echo "FAIL: expected exactly one expired dnscache entry, got '$expired', stats:"
+	grep "dnscache:" rsyslog.out.stats.log
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh exit
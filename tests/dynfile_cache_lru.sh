@@ -0,0 +1,15 @@
+#!/bin/bash
+# Check dynafile cache lookup and LRU eviction. We write round-robin to
+# more files than the cache can hold, so that every few messages an entry
+# must be evicted, mixed with hits on the files still in the cache.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[dynfile_cache_lru.sh\]: test dynafile cache eviction
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup dynfile_cache_lru.conf
+. $srcdir/diag.sh injectmsg  0 10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+cat rsyslog.out.*.log > rsyslog.out.log
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Checks that dyn-stats counts are exact while several worker threads
+# increment the same metrics and the bucket is purged under load.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[dynstats_stress.sh\]: test for exact dyn-stats counts under concurrent load
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup dynstats_stress.conf
+. $srcdir/diag.sh wait-for-stats-flush 'rsyslog.out.stats.log'
+. $srcdir/diag.sh injectmsg 0 200000
+. $srcdir/diag.sh wait-queueempty
+. $srcdir/diag.sh msleep 2100 # make sure all counts were reported
+. $srcdir/diag.sh wait-for-stats-flush 'rsyslog.out.stats.log'
+echo doing shutdown
+. $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+. $srcdir/diag.sh wait-shutdown
+if [ -e rsyslog.out.log ]; then
+	echo "error: some dyn_inc() calls failed:"
+	head rsyslog.out.log
+	. $srcdir/diag.sh error-exit 1
+fi
+for i in 0 1 2 3 4 5 6 7 8 9; do
+	. $srcdir/diag.sh first-column-sum-check "s/.*k$i=\([0-9]\+\)/\1/g" "k$i=" 'rsyslog.out.stats.log' 20000
+done
+. $srcdir/diag.sh first-column-sum-check 's/.*ops_overflow=\([0-9]\+\)/\1/g' 'ops_overflow=' 'rsyslog.out.stats.log' 0
+. $srcdir/diag.sh first-column-sum-check 's/.*ops_ignored=\([0-9]\+\)/\1/g' 'ops_ignored=' 'rsyslog.out.stats.log' 0
+. $srcdir/diag.sh exit
@@ -0,0 +1,9 @@
+#!/bin/bash
+# Benchmark of the frame delimiter scanners used by imptcp for LF-framed
+# data. This is not part of the regular testbench; run it manually after
+# "make check" has built delimscan_bench, e.g.
+#   ./imptcp-delimscan-bench.sh -s 256 -r 10
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[imptcp-delimscan-bench.sh\]: benchmark frame delimiter scanning
+./delimscan_bench "$@"
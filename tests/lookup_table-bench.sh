@@ -0,0 +1,63 @@
+#!/bin/bash
+# Benchmark for lookup tables. For a number of table sizes and main queue
+# worker thread counts, messages are run through a ruleset doing several
+# lookup() calls each and the time needed to process them is reported.
+# Results are also checked, so a wrong lookup result makes the run fail.
+# This is not part of the regular testbench, as it takes quite a while and
+# the results are only meaningful on an otherwise idle machine. Run it
+# from the tests directory via
+#   srcdir=. ./lookup_table-bench.sh [number-of-messages]
+# This file is part of the rsyslog project, released under ASL 2.0
+NUMMSGS=${1:-500000}
+SIZES="1000 20000 200000"
+WORKERS="1 4 8"
+echo ===============================================================================
+echo \[lookup_table-bench.sh\]: benchmarking lookup tables, $NUMMSGS messages
+
+now_ms() {
+	echo $(( `date +%s%N` / 1000000 ))
+}
+
+# keys are k0...k<size-1>, each value is the key's number
+generate_table() {
+	echo '{ "version": 1, "nomatch": "unknown", "type": "string", "table": [' > lookup-bench.lkp_tbl
+	seq 0 $(( $1 - 1 )) | awk '{ printf("%s{\"index\": \"k%d\", \"value\": \"%d\"}\n", (NR > 1) ? "," : "", $1, $1) }' \
+		>> lookup-bench.lkp_tbl
+	echo ']}' >> lookup-bench.lkp_tbl
+}
+
+rm -f lookup_table-bench.result
+for SIZE in $SIZES; do
+	generate_table $SIZE
+	for NWORKERS in $WORKERS; do
+		. $srcdir/diag.sh init
+		cat > testconf.conf <<CONF
+\$IncludeConfig diag-common.conf
+main_queue(queue.workerThreads="$NWORKERS" queue.dequeueBatchSize="128")
+lookup_table(name="bench" file="lookup-bench.lkp_tbl")
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+if not (\$msg contains "msgnum:") then stop
+set \$.num = cnum(field(\$msg, 58, 2));
+set \$.v1 = lookup("bench", "k" & (\$.num % $SIZE));
+set \$.v2 = lookup("bench", "k" & ((\$.num + 1) % $SIZE));
+set \$.v3 = lookup("bench", "k" & ((\$.num + 2) % $SIZE));
+set \$.v4 = lookup("bench", "k" & ((\$.num + 3) % $SIZE));
+set \$.v5 = lookup("bench", "k" & ((\$.num + 4) % $SIZE));
+set \$.v6 = lookup("bench", "x" & \$.num);
+if \$.v1 == \$.num % $SIZE and \$.v6 == "unknown" then
+	action(type="omfile" file="./rsyslog.out.log" template="outfmt")
+CONF
+		. $srcdir/diag.sh startup
+		START=`now_ms`
+		. $srcdir/diag.sh injectmsg 0 $NUMMSGS
+		. $srcdir/diag.sh wait-queueempty
+		END=`now_ms`
+		. $srcdir/diag.sh shutdown-when-empty
+		. $srcdir/diag.sh wait-shutdown
+		. $srcdir/diag.sh seq-check 0 $(( NUMMSGS - 1 ))
+		echo "size $SIZE, $NWORKERS workers: $(( END - START )) ms" | tee -a lookup_table-bench.result
+	done
+done
+cat lookup_table-bench.result
+rm -f lookup_table-bench.result lookup-bench.lkp_tbl
+. $srcdir/diag.sh exit
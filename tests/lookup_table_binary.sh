@@ -0,0 +1,56 @@
+#!/bin/bash
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[lookup_table_binary.sh\]: test for binary lookup table images and HUP based reloading of them
+. $srcdir/diag.sh init
+../tools/rslookuputil -o $srcdir/xlate.lkp_img $srcdir/testsuites/xlate.lkp_tbl
+if [ $? -ne 0 ]; then
+	echo "FAIL: rslookuputil could not compile lookup table"
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh startup lookup_table_binary.conf
+. $srcdir/diag.sh injectmsg  0 3
+. $srcdir/diag.sh wait-queueempty
+. $srcdir/diag.sh content-check "msgnum:00000000: foo_old"
+. $srcdir/diag.sh content-check "msgnum:00000001: bar_old"
+. $srcdir/diag.sh assert-content-missing "baz"
+../tools/rslookuputil -o $srcdir/xlate.lkp_img $srcdir/testsuites/xlate_more.lkp_tbl
+. $srcdir/diag.sh issue-HUP
+. $srcdir/diag.sh await-lookup-table-reload
+. $srcdir/diag.sh injectmsg  0 3
+. $srcdir/diag.sh wait-queueempty
+. $srcdir/diag.sh content-check "msgnum:00000000: foo_new"
+. $srcdir/diag.sh content-check "msgnum:00000001: bar_new"
+. $srcdir/diag.sh content-check "msgnum:00000002: baz"
+# a damaged image must be rejected, the current table stays in use
+head -c 100 $srcdir/xlate.lkp_img > $srcdir/xlate.lkp_img.tmp
+mv $srcdir/xlate.lkp_img.tmp $srcdir/xlate.lkp_img
+. $srcdir/diag.sh issue-HUP
+. $srcdir/diag.sh await-lookup-table-reload
+. $srcdir/diag.sh injectmsg  1 1
+. $srcdir/diag.sh wait-queueempty
+if [ $(grep -c "msgnum:00000001: bar_new" rsyslog.out.log) -ne 2 ]; then
+	echo "FAIL: table not kept after loading damaged image, content is"
+	cat rsyslog.out.log
+	. $srcdir/diag.sh error-exit 1
+fi
+../tools/rslookuputil -o $srcdir/xlate.lkp_img $srcdir/testsuites/xlate_more_with_duplicates_and_nomatch.lkp_tbl
+. $srcdir/diag.sh issue-HUP
+. $srcdir/diag.sh await-lookup-table-reload
+. $srcdir/diag.sh injectmsg  0 10
+echo doing shutdown
+. $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh content-check "msgnum:00000000: foo_latest"
+. $srcdir/diag.sh content-check "msgnum:00000001: quux"
+. $srcdir/diag.sh content-check "msgnum:00000002: baz_latest"
+. $srcdir/diag.sh content-check "msgnum:00000003: foo_latest"
+. $srcdir/diag.sh content-check "msgnum:00000004: foo_latest"
+. $srcdir/diag.sh content-check "msgnum:00000005: baz_latest"
+. $srcdir/diag.sh content-check "msgnum:00000006: foo_latest"
+. $srcdir/diag.sh content-check "msgnum:00000007: baz_latest"
+. $srcdir/diag.sh content-check "msgnum:00000008: baz_latest"
+. $srcdir/diag.sh content-check "msgnum:00000009: quux"
+rm -f $srcdir/xlate.lkp_img
+. $srcdir/diag.sh exit
@@ -0,0 +1,36 @@
+#!/bin/bash
+# Checks that lookups stay correct while a large string table is reloaded
+# repeatedly and several worker threads use it at the same time.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[lookup_table_reload_stress.sh\]: test for lookup-table reload under concurrent use
+
+# all versions map the same keys to the same values, but are built in a
+# different order, so each reload creates a different table layout
+generate_table() {
+	echo '{ "version": 1, "nomatch": "unknown", "type": "string", "table": [' > xlate_stress.lkp_tbl
+	seq 0 19999 | $1 | awk '{ printf("%s{\"index\": \"%08d\", \"value\": \"%d\"}\n", (NR > 1) ? "," : "", $1, $1) }' \
+		>> xlate_stress.lkp_tbl
+	echo ']}' >> xlate_stress.lkp_tbl
+}
+
+. $srcdir/diag.sh init
+generate_table cat
+. $srcdir/diag.sh startup lookup_table_reload_stress.conf
+for i in 0 1 2 3 4; do
+	. $srcdir/diag.sh injectmsg $(( i * 4000 )) 4000
+	if [ $(( i % 2 )) -eq 0 ]; then
+		generate_table "sort -rn"
+	else
+		generate_table cat
+	fi
+	. $srcdir/diag.sh issue-HUP
+done
+. $srcdir/diag.sh await-lookup-table-reload
+echo doing shutdown
+. $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 19999
+rm -f xlate_stress.lkp_tbl
+. $srcdir/diag.sh exit
@@ -0,0 +1,15 @@
+#!/bin/bash
+# Check that a message and its duplicate (created by calling a ruleset
+# with its own queue) do not see each other's modifications of the
+# JSON tree, which is shared between them until it is modified.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[msgdup-json-cow.sh\]: test copy-on-write of JSON trees in duplicated msgs
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup msgdup-json-cow.conf
+. $srcdir/diag.sh injectmsg  0 10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check  0 9999
+. $srcdir/diag.sh seq-check2  0 9999
+. $srcdir/diag.sh exit
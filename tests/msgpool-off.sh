@@ -0,0 +1,20 @@
+#!/bin/bash
+# Test for global(msg.pool="off"): messages must still be processed
+# correctly, but no msg object is taken from the pool.
+# This file is part of the rsyslog project, released  under GPLv3
+echo \[msgpool-off.sh\]: testing msg object pool turned off
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup msgpool-off.conf
+. $srcdir/diag.sh injectmsg 0 20000
+. $srcdir/diag.sh wait-queueempty
+./msleep 2000 # wait for stats flush
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 19999
+. $srcdir/diag.sh custom-content-check 'msgpool: origin=core.msg hits=0 ' 'rsyslog.out.stats.log'
+if grep "msgpool:" rsyslog.out.stats.log | grep -qv " hits=0 "; then
+	echo "FAIL: msg objects taken from pool although it is turned off, stats:"
+	grep "msgpool:" rsyslog.out.stats.log
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh exit
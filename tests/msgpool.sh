@@ -0,0 +1,22 @@
+#!/bin/bash
+# Test for the msg object pool. Messages are created on the imdiag
+# thread and destructed on the main queue worker, so they must travel
+# from the worker's cache via the global pool back to the input
+# thread's cache. We check this via the "hits" counter of the pool.
+# This file is part of the rsyslog project, released  under GPLv3
+echo \[msgpool.sh\]: testing msg object pool
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup msgpool.conf
+. $srcdir/diag.sh injectmsg 0 20000
+. $srcdir/diag.sh wait-queueempty
+./msleep 2000 # wait for stats flush
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 19999
+hits=$(grep "msgpool:" rsyslog.out.stats.log | tail -n1 | sed -e 's/.* hits=\([0-9]*\).*/\1/')
+if [ "x$hits" == "x" ] || [ "$hits" -lt 10000 ]; then
+	echo "FAIL: msg objects were not re-used, hits='$hits', stats:"
+	grep "msgpool:" rsyslog.out.stats.log
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh exit
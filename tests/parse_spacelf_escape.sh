@@ -0,0 +1,14 @@
+#!/bin/bash
+# Test for parser.SpaceLFOnReceive together with control character and
+# 8-bit escaping: LFs must be replaced by spaces, also after the first
+# character that needs escaping, and all other control characters and
+# 8-bit characters must still be escaped.
+# This is UDP only, as the LFs would break TCP framing.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[parse_spacelf_escape.sh\]: test for SpaceLFOnReceive with escaping
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-HOSTNAME
+. $srcdir/diag.sh nettester parse_spacelf_escape udp
+rm -f HOSTNAME
+. $srcdir/diag.sh exit
@@ -0,0 +1,16 @@
+#!/bin/bash
+# Test for the ringbuffer queue mode, both for the main queue
+# (multiple workers) and for an action queue.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[ringbufferqueue.sh\]: testing queue ringbuffer queue mode
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup ringbufferqueue.conf
+
+# 40000 messages should be enough
+. $srcdir/diag.sh injectmsg  0 40000
+
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown 
+. $srcdir/diag.sh seq-check 0 39999
+. $srcdir/diag.sh exit
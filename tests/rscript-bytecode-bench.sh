@@ -0,0 +1,40 @@
+#!/bin/bash
+# Benchmark for the rainerscript bytecode compiler. Runs a number of the
+# rscript test configurations with script.bytecode turned on and off and
+# reports the time needed to process the messages. Results are also
+# checked, so both runs must produce the same output.
+# This is not part of the regular testbench, as it takes quite a while and
+# the results are only meaningful on an otherwise idle machine. Run it
+# from the tests directory via
+#   srcdir=. ./rscript-bytecode-bench.sh [number-of-messages]
+# This file is part of the rsyslog project, released under ASL 2.0
+NUMMSGS=${1:-500000}
+CONFS="rscript_contains rscript_field rscript_set_modify rscript_unaffected_reset
+       rscript_eq_var rscript_ne_var rscript_lt_var rscript_le_var rscript_gt_var
+       rscript_ge_var"
+echo ===============================================================================
+echo \[rscript-bytecode-bench.sh\]: benchmarking rainerscript bytecode, $NUMMSGS messages
+
+now_ms() {
+	echo $(( `date +%s%N` / 1000000 ))
+}
+
+rm -f rscript-bytecode-bench.result
+for CONF in $CONFS; do
+	for MODE in off on; do
+		. $srcdir/diag.sh init
+		echo "global(script.bytecode=\"$MODE\")" > testconf.conf
+		cat $srcdir/testsuites/$CONF.conf >> testconf.conf
+		. $srcdir/diag.sh startup
+		START=`now_ms`
+		. $srcdir/diag.sh injectmsg 0 $NUMMSGS
+		. $srcdir/diag.sh shutdown-when-empty
+		. $srcdir/diag.sh wait-shutdown
+		END=`now_ms`
+		. $srcdir/diag.sh seq-check 0 $(( NUMMSGS - 1 ))
+		echo "$CONF bytecode=$MODE: $(( END - START )) ms" | tee -a rscript-bytecode-bench.result
+	done
+done
+cat rscript-bytecode-bench.result
+rm -f rscript-bytecode-bench.result
+. $srcdir/diag.sh exit
@@ -0,0 +1,17 @@
+#!/bin/bash
+# Check that script expressions give the same results with the bytecode
+# compiler turned on (the default) and off.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_bytecode.sh\]: test rainerscript bytecode against interpreter
+for MODE in on off; do
+	. $srcdir/diag.sh init
+	echo "global(script.bytecode=\"$MODE\")" > work-bytecode.conf
+	. $srcdir/diag.sh startup rscript_bytecode.conf
+	. $srcdir/diag.sh injectmsg  0 1
+	. $srcdir/diag.sh shutdown-when-empty
+	. $srcdir/diag.sh wait-shutdown
+	. $srcdir/diag.sh content-check "7,abc5,0,2,1,1,1,1,1,5,0-1"
+done
+rm -f work-bytecode.conf
+. $srcdir/diag.sh exit
@@ -0,0 +1,17 @@
+#!/bin/bash
+# Check that string operations on message properties, which the bytecode
+# works on without copying them, give the same results as the interpreter.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_bytecode_strview.sh\]: test rainerscript string views
+for MODE in on off; do
+	. $srcdir/diag.sh init
+	echo "global(script.bytecode=\"$MODE\")" > work-bytecode.conf
+	. $srcdir/diag.sh startup rscript_bytecode_strview.conf
+	. $srcdir/diag.sh injectmsg  0 1
+	. $srcdir/diag.sh shutdown-when-empty
+	. $srcdir/diag.sh wait-shutdown
+	. $srcdir/diag.sh content-check "1,12,1,1,1,1,tag-172.20.245.8,1,0,1,172.20.245.8"
+done
+rm -f work-bytecode.conf
+. $srcdir/diag.sh exit
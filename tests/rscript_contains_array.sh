@@ -0,0 +1,16 @@
+#!/bin/bash
+# Check "contains" against constant arrays, which are compiled into a
+# multi-pattern matcher, and the "contains" property filter.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_contains_array.sh\]: test for contains with string arrays
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup rscript_contains_array.conf
+. $srcdir/diag.sh injectmsg  0 5000
+echo doing shutdown
+. $srcdir/diag.sh shutdown-when-empty
+echo wait on shutdown
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check  100 199
+. $srcdir/diag.sh seq-check2  100 299
+. $srcdir/diag.sh exit
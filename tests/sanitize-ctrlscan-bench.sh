@@ -0,0 +1,10 @@
+#!/bin/bash
+# Benchmark of the control character scanners used when sanitizing
+# received messages. This is not part of the regular testbench; run it
+# manually after "make check" has built ctrlscan_bench, e.g.
+#   ./sanitize-ctrlscan-bench.sh -r 10
+#   ./sanitize-ctrlscan-bench.sh -f /var/log/messages
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sanitize-ctrlscan-bench.sh\]: benchmark control character scanning
+./ctrlscan_bench "$@"
@@ -0,0 +1,103 @@
+/* Micro-benchmark for the sharded stats counters in runtime/shardctr.c.
+ * For 1 to 64 threads, all threads increment the same counter, once as a
+ * plain (atomic) stats counter and once as a sharded counter. The number
+ * of updates per second is reported for both. The final counter values
+ * are checked, so lost updates make the program fail.
+ *
+ * Usage: shardctr_bench [-n million-updates-per-thread]
+ *
+ * This file is part of the rsyslog project, released under ASL 2.0
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "shardctr.h"
+
+static const int nThrdsTab[] = { 1, 2, 4, 8, 16, 32, 64, 0 };
+static long nUpdates = 10 * 1000 * 1000;
+
+static uint64 plainCtr;
+DEF_ATOMIC_HELPER_MUT64(mutPlainCtr)
+static shardctr_t shardCtr;
+
+static double
+timeDiff(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void *
+thrdPlain(void __attribute__((unused)) *arg)
+{
+	long i;
+	for(i = 0 ; i < nUpdates ; ++i)
+		ATOMIC_INC_uint64(&plainCtr, &mutPlainCtr);
+	return NULL;
+}
+
+static void *
+thrdSharded(void __attribute__((unused)) *arg)
+{
+	long i;
+	for(i = 0 ; i < nUpdates ; ++i)
+		shardCtrAdd(&shardCtr, 1);
+	return NULL;
+}
+
+/* run nThrds threads of func and return updates per second */
+static double
+runThrds(void *(*func)(void*), const int nThrds)
+{
+	pthread_t thrds[64];
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0 ; i < nThrds ; ++i)
+		pthread_create(&thrds[i], NULL, func, NULL);
+	for(i = 0 ; i < nThrds ; ++i)
+		pthread_join(thrds[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (double) nUpdates * nThrds / timeDiff(&start, &end);
+}
+
+int
+main(int argc, char *argv[])
+{
+	double plainRate, shardRate;
+	uint64 expected;
+	int opt;
+	int i;
+	int ret = 0;
+
+	while((opt = getopt(argc, argv, "n:")) != -1) {
+		switch(opt) {
+		case 'n': nUpdates = atol(optarg) * 1000 * 1000; break;
+		default:
+			fprintf(stderr, "usage: shardctr_bench [-n million-updates-per-thread]\n");
+			exit(1);
+		}
+	}
+
+	INIT_ATOMIC_HELPER_MUT64(mutPlainCtr);
+	shardCtrInit(&shardCtr);
+	printf("%8s %14s %14s %8s   (million updates/s)\n", "threads", "atomic", "sharded", "speedup");
+	for(i = 0 ; nThrdsTab[i] != 0 ; ++i) {
+		plainCtr = 0;
+		shardCtrReset(&shardCtr);
+		plainRate = runThrds(thrdPlain, nThrdsTab[i]);
+		shardRate = runThrds(thrdSharded, nThrdsTab[i]);
+		printf("%8d %14.1f %14.1f %7.1fx\n", nThrdsTab[i], plainRate / 1e6,
+		       shardRate / 1e6, shardRate / plainRate);
+		expected = (uint64) nUpdates * nThrdsTab[i];
+		if(plainCtr != expected || shardCtrGet(&shardCtr) != expected) {
+			printf("error: expected %llu, atomic counter %llu, sharded counter %llu\n",
+			       expected, plainCtr, shardCtrGet(&shardCtr));
+			ret = 1;
+		}
+	}
+	return ret;
+}
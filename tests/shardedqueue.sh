@@ -0,0 +1,17 @@
+#!/bin/bash
+# Test for sharded queues: the main queue is split into four shards,
+# messages are routed by hostname and idle workers steal from other
+# shards. An action queue is sharded by producer thread.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[shardedqueue.sh\]: testing sharded queue mode
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup shardedqueue.conf
+
+# 40000 messages should be enough
+. $srcdir/diag.sh injectmsg  0 40000
+
+. $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+. $srcdir/diag.sh wait-shutdown 
+. $srcdir/diag.sh seq-check 0 39999
+. $srcdir/diag.sh exit
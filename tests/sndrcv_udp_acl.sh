@@ -0,0 +1,10 @@
+#!/bin/bash
+# This sends and receives messages via UDP with an allowed sender list.
+# The sender (127.0.0.1) is permitted by one of several IP/CIDR entries,
+# so all messages must pass the ACL check.
+# Note that with UDP we can always have message loss, see sndrcv_udp.sh.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sndrcv_udp_acl.sh\]: testing imudp with allowed sender list
+export TCPFLOOD_EXTRA_OPTS="-b1 -W1"
+. $srcdir/sndrcv_drvr.sh sndrcv_udp_acl 500
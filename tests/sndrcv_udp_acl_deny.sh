@@ -0,0 +1,30 @@
+#!/bin/bash
+# This sends messages via UDP to a receiver whose allowed sender list
+# permits the networks around, but not 127.0.0.0/8. No message must
+# arrive, but the receiver must have complained about the disallowed
+# sender (which shows that the messages actually reached it).
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sndrcv_udp_acl_deny.sh\]: testing imudp with allowed sender list denying the sender
+export TCPFLOOD_EXTRA_OPTS="-b1 -W1"
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup sndrcv_udp_acl_deny_rcvr.conf
+. $srcdir/diag.sh wait-startup
+. $srcdir/diag.sh startup sndrcv_udp_acl_sender.conf 2
+. $srcdir/diag.sh wait-startup 2
+. $srcdir/diag.sh tcpflood -m100 -i1
+sleep 2 # make sure all data is received in input buffers
+. $srcdir/diag.sh shutdown-when-empty 2
+. $srcdir/diag.sh wait-shutdown 2
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+if [ -s rsyslog.out.log ]; then
+	echo "FAIL: messages from a disallowed sender were accepted:"
+	head rsyslog.out.log
+	. $srcdir/diag.sh error-exit 1
+fi
+if ! grep -q "disallowed sender" rsyslog.out.denied.log; then
+	echo "FAIL: receiver did not report the disallowed sender"
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh exit
@@ -0,0 +1,12 @@
+#!/bin/bash
+# This sends and receives messages via UDP with the main queue's DNS
+# prefetch stage enabled. The receiver only writes messages whose
+# fromhost was resolved to a name (127.0.0.1 must have one, usually
+# "localhost"), so a broken prefetch stage, which falls back to the IP
+# address as name, shows up as message loss.
+# Note that with UDP we can always have message loss, see sndrcv_udp.sh.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sndrcv_udp_dnsprefetch.sh\]: testing main queue DNS prefetch
+export TCPFLOOD_EXTRA_OPTS="-b1 -W1"
+. $srcdir/sndrcv_drvr.sh sndrcv_udp_dnsprefetch 500
@@ -0,0 +1,19 @@
+#!/bin/bash
+# This sends and receives messages via UDP with a per-sender ratelimit
+# in place. The burst is large enough that nothing must be dropped, so
+# this checks that the keyed limiter passes traffic within its limit.
+# A second ratelimit() with a burst of 100 (and an interval long enough
+# that no tokens are refilled during the test) must drop the excess.
+# It is used at two call sites, which must share the 100 messages.
+# Note that with UDP we can always have message loss, see sndrcv_udp.sh.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sndrcv_udp_keyratelimit.sh\]: testing imudp with per-key ratelimit
+export TCPFLOOD_EXTRA_OPTS="-b1 -W1"
+. $srcdir/sndrcv_drvr_noexit.sh sndrcv_udp_keyratelimit 500
+lines=$(cat rsyslog.out.limited.log rsyslog.out.limited2.log | wc -l)
+if [ "$lines" -ne 100 ]; then
+	echo "FAIL: ratelimit() with burst 100 passed $lines of 500 messages"
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh exit
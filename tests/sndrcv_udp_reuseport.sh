@@ -0,0 +1,9 @@
+#!/bin/bash
+# This sends and receives messages via UDP to a listener that binds several
+# SO_REUSEPORT sockets, which are spread over multiple imudp workers.
+# Note that with UDP we can always have message loss, see sndrcv_udp.sh.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sndrcv_udp_reuseport.sh\]: testing imudp reuseport.threads
+export TCPFLOOD_EXTRA_OPTS="-b1 -W1"
+. $srcdir/sndrcv_drvr.sh sndrcv_udp_reuseport 500
@@ -0,0 +1,12 @@
+#!/bin/bash
+# This sends and receives messages via UDP with imudp's zero-copy receive
+# slabs enabled. Messages are made larger than the msg object's inline raw
+# buffer, so that they really reference the slabs. Only two slabs per
+# worker are configured, which also exercises the fallback to copying
+# while all slabs are in use.
+# Note that with UDP we can always have message loss, see sndrcv_udp.sh.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sndrcv_udp_zerocopy.sh\]: testing imudp zero-copy receive slabs
+export TCPFLOOD_EXTRA_OPTS="-b1 -W1 -d200"
+. $srcdir/sndrcv_drvr.sh sndrcv_udp_zerocopy 500
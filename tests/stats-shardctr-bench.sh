@@ -0,0 +1,9 @@
+#!/bin/bash
+# Benchmark of sharded vs. plain atomic stats counters with 1 to 64
+# threads. This is not part of the regular testbench; run it manually
+# after "make check" has built shardctr_bench, e.g.
+#   ./stats-shardctr-bench.sh -n 20
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[stats-shardctr-bench.sh\]: benchmark sharded stats counters
+./shardctr_bench "$@"
@@ -49,6 +49,8 @@
  *      Average,min,max
  * -T   transport to use. Currently supported: "udp", "tcp" (default)
  *      Note: UDP supports a single target port, only
+ * -A	source address to send from (UDP only, default: chosen by the OS). Any
+ *      127.x.y.z address can be used to simulate different senders.
  * -W	wait time between sending batches of messages, in microseconds (Default: 0)
  * -b   number of messages within a batch (default: 100,000,000 millions)
  * -Y	use multiple threads, one per connection (which means 1 if one only connection
@@ -133,6 +135,7 @@ char *test_rs_strerror_r(int errnum, char *buf, size_t buflen) {
 #define MAX_SENDBUF 2 * MAX_EXTRADATA_LEN
 
 static char *targetIP = "127.0.0.1";
+static char *sourceIP = NULL;
 static char *msgPRI = "167";
 static int targetPort = 13514;
 static int numTargetPorts = 1;
@@ -225,6 +228,20 @@ setupUDP(void)
 		return(1);
 	}
 
+	if(sourceIP != NULL) {
+		struct sockaddr_in src;
+		memset((char *) &src, 0, sizeof(src));
+		src.sin_family = AF_INET;
+		if(inet_aton(sourceIP, &src.sin_addr)==0) {
+			fprintf(stderr, "inet_aton() failed for source address\n");
+			return(1);
+		}
+		if(bind(udpsock, (struct sockaddr*)&src, sizeof(src)) != 0) {
+			perror("bind() to source address");
+			return(1);
+		}
+	}
+
 	return 0;
 }
 
@@ -931,8 +948,10 @@ int main(int argc, char *argv[])
 
 	setvbuf(stdout, buf, _IONBF, 48);
 	
-	while((opt = getopt(argc, argv, "b:ef:F:t:p:c:C:m:i:I:P:d:Dn:l:L:M:rsBR:S:T:XW:yYz:Z:j:O")) != -1) {
+	while((opt = getopt(argc, argv, "A:b:ef:F:t:p:c:C:m:i:I:P:d:Dn:l:L:M:rsBR:S:T:XW:yYz:Z:j:O")) != -1) {
 		switch (opt) {
+		case 'A':	sourceIP = optarg;
+				break;
 		case 'b':	batchsize = atoll(optarg);
 				break;
 		case 't':	targetIP = optarg;
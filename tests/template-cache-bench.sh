@@ -0,0 +1,65 @@
+#!/bin/bash
+# Benchmark for the template cache: a number of actions write each message
+# with a (JSON) template. In the "shared" run, all actions use the same
+# template, which is thus rendered only once per message. In the
+# "separate" run, each action uses its own copy of the template, so that
+# every action renders it.
+# This is not part of the regular testbench, as it takes quite a while and
+# the results are only meaningful on an otherwise idle machine. Run it
+# from the tests directory via
+#   srcdir=. ./template-cache-bench.sh [number-of-messages]
+# This file is part of the rsyslog project, released under ASL 2.0
+NUMMSGS=${1:-200000}
+NUMACTIONS=10
+echo ===============================================================================
+echo \[template-cache-bench.sh\]: benchmarking template cache, $NUMMSGS messages, $NUMACTIONS actions
+
+now_ms() {
+	echo $(( `date +%s%N` / 1000000 ))
+}
+
+# print a JSON template named $1
+generate_template() {
+	cat <<CONF
+template(name="$1" type="list") {
+	constant(value="{\"msgnum\":\"")	property(name="msg" field.delimiter="58" field.number="2")
+	constant(value="\",\"host\":\"")	property(name="hostname" format="json")
+	constant(value="\",\"tag\":\"")		property(name="syslogtag" format="json")
+	constant(value="\",\"time\":\"")	property(name="timereported" dateFormat="rfc3339")
+	constant(value="\",\"pri\":\"")		property(name="syslogpriority-text")
+	constant(value="\",\"msg\":\"")		property(name="msg" format="json")
+	constant(value="\"}\n")
+}
+CONF
+}
+
+rm -f template-cache-bench.result
+for MODE in shared separate; do
+	. $srcdir/diag.sh init
+	echo '$IncludeConfig diag-common.conf' > testconf.conf
+	echo 'if not ($msg contains "msgnum:") then stop' >> testconf.conf
+	for i in $(seq 0 $(( NUMACTIONS - 1 ))); do
+		if [ $MODE == shared ]; then
+			TPL=outfmt
+			[ $i -eq 0 ] && generate_template $TPL >> testconf.conf
+		else
+			TPL=outfmt$i
+			generate_template $TPL >> testconf.conf
+		fi
+		echo "action(type=\"omfile\" file=\"./rsyslog.out.$i.log\" template=\"$TPL\")" >> testconf.conf
+	done
+	. $srcdir/diag.sh startup
+	START=`now_ms`
+	. $srcdir/diag.sh injectmsg 0 $NUMMSGS
+	. $srcdir/diag.sh wait-queueempty
+	END=`now_ms`
+	. $srcdir/diag.sh shutdown-when-empty
+	. $srcdir/diag.sh wait-shutdown
+	sed 's/^{"msgnum":"\([0-9]*\)".*/\1/' < rsyslog.out.$(( NUMACTIONS - 1 )).log > rsyslog.out.log
+	rm -f rsyslog.out.*.log
+	. $srcdir/diag.sh seq-check 0 $(( NUMMSGS - 1 ))
+	echo "$MODE templates: $(( END - START )) ms" | tee -a template-cache-bench.result
+done
+cat template-cache-bench.result
+rm -f template-cache-bench.result
+. $srcdir/diag.sh exit
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Check the template cache stats: with two direct actions sharing a
+# template, each message is rendered once (miss) and copied once (hit).
+# A third action with its own queue uses the same template, but must not
+# use the cache. If no template is shared, the stats object must not be
+# registered at all, so that the stats output stays unchanged.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[template-cache-stats.sh\]: testing template cache stats
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup template-cache-stats.conf
+. $srcdir/diag.sh injectmsg 0 100
+. $srcdir/diag.sh wait-queueempty
+./msleep 1500 # wait for the queued action and stats flush
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 99
+hits=$(grep "template cache:" rsyslog.out.stats.log | tail -n1 | sed -e 's/.* hits=\([0-9]*\).*/\1/')
+misses=$(grep "template cache:" rsyslog.out.stats.log | tail -n1 | sed -e 's/.* misses=\([0-9]*\).*/\1/')
+if [ "x$hits" != "x100" ] || [ "x$misses" != "x100" ]; then
+	echo "FAIL: expected 100 template cache hits and misses, got hits='$hits' misses='$misses'"
+	. $srcdir/diag.sh error-exit 1
+fi
+
+rm -f rsyslog.out.log rsyslog2.out.log rsyslog.out.stats.log
+. $srcdir/diag.sh startup template-cache-nostats.conf
+. $srcdir/diag.sh injectmsg 0 100
+. $srcdir/diag.sh wait-queueempty
+./msleep 1500 # wait for stats flush
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 99
+if ! grep -q "dynstats\|resource-usage" rsyslog.out.stats.log; then
+	echo "FAIL: no stats were written"
+	. $srcdir/diag.sh error-exit 1
+fi
+if grep -q "template cache:" rsyslog.out.stats.log; then
+	echo "FAIL: template cache stats present, but no template is shared"
+	. $srcdir/diag.sh error-exit 1
+fi
+. $srcdir/diag.sh exit
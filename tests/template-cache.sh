@@ -0,0 +1,14 @@
+#!/bin/bash
+# Check that actions sharing a template get the correct strings from the
+# template cache, also if the message is modified between the actions.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[template-cache.sh\]: testing template cache shared by actions
+. $srcdir/diag.sh init
+. $srcdir/diag.sh startup template-cache.conf
+. $srcdir/diag.sh injectmsg  0 100
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown 
+. $srcdir/diag.sh seq-check  0 99
+. $srcdir/diag.sh seq-check2  0 99
+. $srcdir/diag.sh exit
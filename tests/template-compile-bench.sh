@@ -0,0 +1,80 @@
+#!/bin/bash
+# Benchmark for compiled templates. Each message is written by several
+# actions with
+# - the built-in RSYSLOG_FileFormat template, which is implemented by a
+#   strgen (hand-written C code)
+# - an equivalent list template, compiled and not compiled
+# - a JSON template, compiled and not compiled
+# Each action uses its own copy of the template, as the template cache
+# would otherwise render it only once per message.
+# This is not part of the regular testbench, as it takes quite a while and
+# the results are only meaningful on an otherwise idle machine. Run it
+# from the tests directory via
+#   srcdir=. ./template-compile-bench.sh [number-of-messages]
+# This file is part of the rsyslog project, released under ASL 2.0
+NUMMSGS=${1:-200000}
+NUMACTIONS=10
+echo ===============================================================================
+echo \[template-compile-bench.sh\]: benchmarking compiled templates, $NUMMSGS messages, $NUMACTIONS actions
+
+now_ms() {
+	echo $(( `date +%s%N` / 1000000 ))
+}
+
+# print the template definitions, suffixing their names with $1
+generate_templates() {
+	cat <<CONF
+template(name="strgen$1" type="plugin" plugin="RSYSLOG_FileFormat")
+template(name="fileformat$1" type="list") {
+	property(name="timestamp" dateFormat="rfc3339")
+	constant(value=" ")
+	property(name="hostname")
+	constant(value=" ")
+	property(name="syslogtag")
+	property(name="msg" spifno1stsp="on")
+	property(name="msg" droplastlf="on")
+	constant(value="\n")
+}
+template(name="json$1" type="list") {
+	constant(value="{")
+	property(outname="time" name="timereported" dateFormat="rfc3339" format="jsonf")
+	constant(value=",")
+	property(outname="host" name="hostname" format="jsonf")
+	constant(value=",")
+	property(outname="tag" name="syslogtag" format="jsonf")
+	constant(value=",\"pri\":\"")
+	property(name="syslogpriority-text")
+	constant(value="\",")
+	property(outname="msg" name="msg" format="jsonf")
+	constant(value="}\n")
+}
+CONF
+}
+
+rm -f template-compile-bench.result
+for RUN in strgen:strgen:on list:fileformat:off list:fileformat:on \
+	   json:json:off json:json:on; do
+	IFS=: read NAME TPL COMPILE <<< "$RUN"
+	. $srcdir/diag.sh init
+	echo "global(template.compile=\"$COMPILE\")" > testconf.conf
+	echo '$IncludeConfig diag-common.conf' >> testconf.conf
+	echo 'if not ($msg contains "msgnum:") then stop' >> testconf.conf
+	for i in $(seq 0 $(( NUMACTIONS - 1 ))); do
+		generate_templates $i >> testconf.conf
+		echo "action(type=\"omfile\" file=\"./rsyslog.out.$i.log\" template=\"$TPL$i\")" >> testconf.conf
+	done
+	. $srcdir/diag.sh startup
+	START=`now_ms`
+	. $srcdir/diag.sh injectmsg 0 $NUMMSGS
+	. $srcdir/diag.sh wait-queueempty
+	END=`now_ms`
+	. $srcdir/diag.sh shutdown-when-empty
+	. $srcdir/diag.sh wait-shutdown
+	sed 's/.*msgnum:\([0-9]*\):.*/\1/' < rsyslog.out.$(( NUMACTIONS - 1 )).log > rsyslog.out.log
+	rm -f rsyslog.out.*.log
+	. $srcdir/diag.sh seq-check 0 $(( NUMMSGS - 1 ))
+	echo "$NAME template $TPL, template.compile=$COMPILE: $(( END - START )) ms" | tee -a template-compile-bench.result
+done
+cat template-compile-bench.result
+rm -f template-compile-bench.result
+. $srcdir/diag.sh exit
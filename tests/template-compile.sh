@@ -0,0 +1,39 @@
+#!/bin/bash
+# Check that compiled templates produce exactly the same output as the
+# generic template code, for plain properties as well as for properties
+# which are JSON or SQL escaped. Each template writes to its own file,
+# so that the files can be compared line by line.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[template-compile.sh\]: testing compiled templates
+TEMPLATES="plain json sql stdsql jsonopt"
+rm -f template-compile.off.*
+for MODE in off on; do
+	. $srcdir/diag.sh init
+	echo "global(template.compile=\"$MODE\")" > testconf.conf
+	cat $srcdir/testsuites/template-compile.conf >> testconf.conf
+	. $srcdir/diag.sh startup
+	. $srcdir/diag.sh injectmsg  0 100
+	. $srcdir/diag.sh shutdown-when-empty
+	. $srcdir/diag.sh wait-shutdown
+	. $srcdir/diag.sh seq-check  0 99
+	if [ $MODE == off ]; then
+		for TPL in $TEMPLATES; do
+			mv rsyslog.out.$TPL.log template-compile.off.$TPL
+		done
+	fi
+done
+for TPL in $TEMPLATES; do
+	if [ `wc -l < template-compile.off.$TPL` -ne 100 ]; then
+		echo "unexpected number of lines in output of generic template $TPL:"
+		cat template-compile.off.$TPL
+		. $srcdir/diag.sh error-exit 1
+	fi
+	if ! cmp template-compile.off.$TPL rsyslog.out.$TPL.log; then
+		echo "compiled template $TPL generates different output:"
+		diff template-compile.off.$TPL rsyslog.out.$TPL.log
+		. $srcdir/diag.sh error-exit 1
+	fi
+done
+rm -f template-compile.off.*
+. $srcdir/diag.sh exit
@@ -85,47 +85,24 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(strm)
 DEFobjCurrIf(statsobj)
 
-/* for our current LRU mechanism, we need a monotonically increasing counters. We use
- * it much like a "Lamport logical clock": we do not need the actual time, we just need
- * to know the sequence in which files were accessed. So we use a simple counter to
- * create that sequence. We use an unsigned 64 bit value which is extremely unlike to
- * wrap within the lifetime of a process. If we process 1,000,000 file writes per
- * second, the process could still exist over 500,000 years before a wrap to 0 happens.
- * That should be sufficient (and even than, there would no really bad effect ;)).
- * The variable below is the global counter/clock.
- */
-#if HAVE_ATOMIC_BUILTINS64
-static uint64 clockFileAccess = 0;
-#else
-static unsigned clockFileAccess = 0;
-#endif
-/* and the "tick" function */
-#ifndef HAVE_ATOMIC_BUILTINS
-static pthread_mutex_t mutClock;
-#endif
-static inline uint64
-getClockFileAccess(void)
-{
-#if HAVE_ATOMIC_BUILTINS64
-	return ATOMIC_INC_AND_FETCH_uint64(&clockFileAccess, &mutClock);
-#else
-	return ATOMIC_INC_AND_FETCH_unsigned(&clockFileAccess, &mutClock);
-#endif
-}
-
-
-/* The following structure is a dynafile name cache entry.
+/* The following structure is a dynafile name cache entry. Entries are
+ * linked by their index into the cache array, both into the hash chains
+ * used for lookup and into the LRU list used for eviction.
  */
 struct s_dynaFileCacheEntry {
 	uchar *pName;		/* name currently open, if dynamic name */
 	strm_t	*pStrm;		/* our output stream */
 	void	*sigprovFileData;	/* opaque data ptr for provider use */
-	uint64	clkTickAccessed;/* for LRU - based on clockFileAccess */
+	unsigned hash;		/* hash value of pName */
+	int	hashNext;	/* next entry in same hash bucket, -1 = none */
+	int	lruPrev;	/* next more recently used entry, -1 = none */
+	int	lruNext;	/* next less recently used entry, -1 = none */
 	short nInactive;	/* number of minutes not writen - for close timeout */
 };
 typedef struct s_dynaFileCacheEntry dynaFileCacheEntry;
 
 
+#define DYNAFILE_CACHE_MAX 100000 /* max number of entries in dynafile cache */
 #define IOBUF_DFLT_SIZE 4096	/* default size for io buffers */
 #define FLUSH_INTRVL_DFLT 1 	/* default buffer flush interval (in seconds) */
 #define USE_ASYNCWRITER_DFLT 0 	/* default buffer use async writer */
@@ -165,9 +142,17 @@ typedef struct _instanceData {
 	int	iDynaFileCacheSize; /* size of file handle cache */
 	/* The cache is implemented as an array. An empty element is indicated
 	 * by a NULL pointer. Memory is allocated as needed. The following
-	 * pointer points to the overall structure.
+	 * pointer points to the overall structure. Open files are found via
+	 * a hash table and the least recently used one via a doubly linked
+	 * list, so that neither lookup nor eviction needs to scan the array.
 	 */
 	dynaFileCacheEntry **dynCache;
+	int	*dynHashTbl;	/* hash buckets, index of first entry, -1 = empty */
+	unsigned dynHashMask;	/* number of buckets - 1 */
+	int	lruHead;	/* most recently used entry, -1 = none */
+	int	lruTail;	/* least recently used entry, -1 = none */
+	int	*dynFreeSlots;	/* stack of empty elements below iCurrCacheSize */
+	int	nDynFreeSlots;
 	off_t	iSizeLimit;		/* file size limit, 0 = no limit */
 	uchar	*pszSizeLimitCmd;	/* command to carry out when size limit is reached */
 	int 	iZipLevel;		/* zip mode to use for this selector */
@@ -375,12 +360,13 @@ rsRetVal setDynaFileCacheSize(void __attribute__((unused)) *pVal, int iNewVal)
 		         "DynaFileCacheSize must be greater 0 (%d given), changed to 1.", iNewVal);
 		iRet = RS_RET_VAL_OUT_OF_RANGE;
 		iNewVal = 1;
-	} else if(iNewVal > 1000) {
+	} else if(iNewVal > DYNAFILE_CACHE_MAX) {
 		errno = 0;
 		errmsg.LogError(0, RS_RET_VAL_OUT_OF_RANGE,
-		         "DynaFileCacheSize maximum is 1,000 (%d given), changed to 1,000.", iNewVal);
+		         "DynaFileCacheSize maximum is %d (%d given), changed to %d.",
+			 DYNAFILE_CACHE_MAX, iNewVal, DYNAFILE_CACHE_MAX);
 		iRet = RS_RET_VAL_OUT_OF_RANGE;
-		iNewVal = 1000;
+		iNewVal = DYNAFILE_CACHE_MAX;
 	}
 
 	cs.iDynaFileCacheSize = iNewVal;
@@ -447,6 +433,115 @@ finalize_it:
 }
 
 
+/* hash function for the dynafile cache (FNV-1a) */
+static inline unsigned
+dynaFileHash(const uchar *__restrict__ pName)
+{
+	unsigned hash = 2166136261u;
+	for( ; *pName ; ++pName) {
+		hash ^= *pName;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+/* allocate the dynafile cache structures for pData->iDynaFileCacheSize
+ * entries.
+ */
+static rsRetVal
+dynaFileAllocCache(instanceData *__restrict__ const pData)
+{
+	unsigned nBuckets;
+	unsigned i;
+	DEFiRet;
+
+	/* keep the load factor at or below 0.5 */
+	for(nBuckets = 4 ; nBuckets < 2 * (unsigned) pData->iDynaFileCacheSize ; nBuckets *= 2)
+		/* just count */;
+	CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
+			calloc(pData->iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
+	CHKmalloc(pData->dynHashTbl = malloc(nBuckets * sizeof(int)));
+	CHKmalloc(pData->dynFreeSlots = malloc(pData->iDynaFileCacheSize * sizeof(int)));
+	for(i = 0 ; i < nBuckets ; ++i)
+		pData->dynHashTbl[i] = -1;
+	pData->dynHashMask = nBuckets - 1;
+	pData->nDynFreeSlots = 0;
+	pData->lruHead = pData->lruTail = -1;
+	pData->iCurrElt = -1; /* no current element */
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* add an entry with a name to the hash table and make it the most
+ * recently used one.
+ */
+static inline void
+dynaFileLinkEntry(instanceData *__restrict__ const pData, const int iEntry)
+{
+	dynaFileCacheEntry *const pEntry = pData->dynCache[iEntry];
+	int *const pBucket = &pData->dynHashTbl[pEntry->hash & pData->dynHashMask];
+
+	pEntry->hashNext = *pBucket;
+	*pBucket = iEntry;
+	pEntry->lruPrev = -1;
+	pEntry->lruNext = pData->lruHead;
+	if(pData->lruHead == -1)
+		pData->lruTail = iEntry;
+	else
+		pData->dynCache[pData->lruHead]->lruPrev = iEntry;
+	pData->lruHead = iEntry;
+}
+
+
+/* remove an entry from the LRU list */
+static inline void
+dynaFileLRURemove(instanceData *__restrict__ const pData, const int iEntry)
+{
+	dynaFileCacheEntry *const pEntry = pData->dynCache[iEntry];
+
+	if(pEntry->lruPrev == -1)
+		pData->lruHead = pEntry->lruNext;
+	else
+		pData->dynCache[pEntry->lruPrev]->lruNext = pEntry->lruNext;
+	if(pEntry->lruNext == -1)
+		pData->lruTail = pEntry->lruPrev;
+	else
+		pData->dynCache[pEntry->lruNext]->lruPrev = pEntry->lruPrev;
+}
+
+
+/* remove an entry from the hash table and the LRU list */
+static inline void
+dynaFileUnlinkEntry(instanceData *__restrict__ const pData, const int iEntry)
+{
+	dynaFileCacheEntry *const pEntry = pData->dynCache[iEntry];
+	int *pLink = &pData->dynHashTbl[pEntry->hash & pData->dynHashMask];
+
+	while(*pLink != iEntry)
+		pLink = &pData->dynCache[*pLink]->hashNext;
+	*pLink = pEntry->hashNext;
+	dynaFileLRURemove(pData, iEntry);
+}
+
+
+/* find the entry for a file name, returns -1 if there is none */
+static inline int
+dynaFileLookup(instanceData *__restrict__ const pData, const uchar *__restrict__ const pName,
+	const unsigned hash)
+{
+	int i;
+
+	for(i = pData->dynHashTbl[hash & pData->dynHashMask] ; i != -1 ; i = pData->dynCache[i]->hashNext) {
+		if(pData->dynCache[i]->hash == hash && !ustrcmp(pName, pData->dynCache[i]->pName))
+			break;
+	}
+	return i;
+}
+
+
 /* This function deletes an entry from the dynamic file name
  * cache. A pointer to the cache must be passed in as well
  * as the index of the to-be-deleted entry. This index may
@@ -468,6 +563,7 @@ dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry,
 		pCache[iEntry]->pName == NULL ? UCHAR_CONSTANT("[OPEN FAILED]") : pCache[iEntry]->pName);
 
 	if(pCache[iEntry]->pName != NULL) {
+		dynaFileUnlinkEntry(pData, iEntry);
 		d_free(pCache[iEntry]->pName);
 		pCache[iEntry]->pName = NULL;
 	}
@@ -483,6 +579,7 @@ dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry,
 	if(bFreeEntry) {
 		d_free(pCache[iEntry]);
 		pCache[iEntry] = NULL;
+		pData->dynFreeSlots[pData->nDynFreeSlots++] = iEntry;
 	}
 
 finalize_it:
@@ -504,6 +601,9 @@ dynaFileFreeCacheEntries(instanceData *__restrict__ const pData)
 	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
 		dynaFileDelCacheEntry(pData, i, 1);
 	}
+	/* the cache is empty now, so we can start over */
+	pData->iCurrCacheSize = 0;
+	pData->nDynFreeSlots = 0;
 	pData->iCurrElt = -1; /* invalidate current element */
 	ENDfunc;
 }
@@ -519,6 +619,8 @@ static void dynaFileFreeCache(instanceData *__restrict__ const pData)
 	dynaFileFreeCacheEntries(pData);
 	if(pData->dynCache != NULL)
 		d_free(pData->dynCache);
+	free(pData->dynHashTbl);
+	free(pData->dynFreeSlots);
 	ENDfunc;
 }
 
@@ -657,10 +759,9 @@ finalize_it:
 static inline rsRetVal
 prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__ const newFileName)
 {
-	uint64 ctOldest; /* "timestamp" of oldest element */
-	int iOldest;
+	unsigned hash;
 	int i;
-	int iFirstFree;
+	int iFree;
 	rsRetVal localRet;
 	dynaFileCacheEntry **pCache;
 	DEFiRet;
@@ -670,43 +771,34 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 
 	pCache = pData->dynCache;
 
-	/* first check, if we still have the current file */
+	/* first check, if we still have the current file. Note that the
+	 * current element always is the head of the LRU list.
+	 */
 	if(   (pData->iCurrElt != -1)
 	   && !ustrcmp(newFileName, pCache[pData->iCurrElt]->pName)) {
 	   	/* great, we are all set */
-		pCache[pData->iCurrElt]->clkTickAccessed = getClockFileAccess();
 		STATSCOUNTER_INC(pData->ctrLevel0, pData->mutCtrLevel0);
-		/* LRU needs only a strictly monotonically increasing counter, so such a one could do */
 		FINALIZE;
 	}
 
-	/* ok, no luck. Now let's search the table if we find a matching spot.
-	 * While doing so, we also prepare for creation of a new one.
-	 */
+	/* ok, no luck. Now let's see if the file is in the cache. */
 	pData->iCurrElt = -1;	/* invalid current element pointer */
-	iFirstFree = -1; /* not yet found */
-	iOldest = 0; /* we assume the first element to be the oldest - that will change as we loop */
-	ctOldest = getClockFileAccess(); /* there must always be an older one */
-	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
-		if(pCache[i] == NULL || pCache[i]->pName == NULL) {
-			if(iFirstFree == -1)
-				iFirstFree = i;
-		} else { /* got an element, let's see if it matches */
-			if(!ustrcmp(newFileName, pCache[i]->pName)) {
-				/* we found our element! */
-				pData->pStrm = pCache[i]->pStrm;
-				if(pData->useSigprov)
-					pData->sigprovFileData = pCache[i]->sigprovFileData;
-				pData->iCurrElt = i;
-				pCache[i]->clkTickAccessed = getClockFileAccess(); /* update "timestamp" for LRU */
-				FINALIZE;
-			}
-			/* did not find it - so lets keep track of the counters for LRU */
-			if(pCache[i]->clkTickAccessed < ctOldest) {
-				ctOldest = pCache[i]->clkTickAccessed;
-				iOldest = i;
-				}
+	hash = dynaFileHash(newFileName);
+	i = dynaFileLookup(pData, newFileName, hash);
+	if(i != -1) {
+		/* we found our element! */
+		pData->pStrm = pCache[i]->pStrm;
+		if(pData->useSigprov)
+			pData->sigprovFileData = pCache[i]->sigprovFileData;
+		pData->iCurrElt = i;
+		if(pData->lruHead != i) { /* make it the most recently used one */
+			dynaFileLRURemove(pData, i);
+			pCache[i]->lruNext = pData->lruHead;
+			pCache[i]->lruPrev = -1;
+			pCache[pData->lruHead]->lruPrev = i;
+			pData->lruHead = i;
 		}
+		FINALIZE;
 	}
 
 	/* we have not found an entry */
@@ -719,23 +811,28 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 	 */
 	pData->pStrm = NULL, pData->sigprovFileData = NULL;
 
-	if(iFirstFree == -1 && (pData->iCurrCacheSize < pData->iDynaFileCacheSize)) {
-		/* there is space left, so set it to that index */
-		iFirstFree = pData->iCurrCacheSize++;
-		STATSCOUNTER_SETMAX_NOMUT(pData->ctrMax, (unsigned) pData->iCurrCacheSize);
-	}
-
 	/* Note that the following code sequence does not work with the cache entry itself,
 	 * but rather with pData->pStrm, the (sole) stream pointer in the non-dynafile case.
 	 * The cache array is only updated after the open was successful. -- rgerhards, 2010-03-21
 	 */
-	if(iFirstFree == -1) {
-		dynaFileDelCacheEntry(pData, iOldest, 0);
-		STATSCOUNTER_INC(pData->ctrEvict, pData->mutCtrEvict);
-		iFirstFree = iOldest; /* this one *is* now free ;) */
+	if(pData->nDynFreeSlots > 0) {
+		iFree = pData->dynFreeSlots[--pData->nDynFreeSlots];
+	} else if(pData->iCurrCacheSize < pData->iDynaFileCacheSize) {
+		/* there is space left, so set it to that index */
+		iFree = pData->iCurrCacheSize++;
+		STATSCOUNTER_SETMAX_NOMUT(pData->ctrMax, (unsigned) pData->iCurrCacheSize);
 	} else {
+		iFree = pData->lruTail;
+		dynaFileDelCacheEntry(pData, iFree, 0);
+		STATSCOUNTER_INC(pData->ctrEvict, pData->mutCtrEvict);
+	}
+
+	if(pCache[iFree] == NULL) {
 		/* we need to allocate memory for the cache structure */
-		CHKmalloc(pCache[iFirstFree] = (dynaFileCacheEntry*) calloc(1, sizeof(dynaFileCacheEntry)));
+		if((pCache[iFree] = (dynaFileCacheEntry*) calloc(1, sizeof(dynaFileCacheEntry))) == NULL) {
+			pData->dynFreeSlots[pData->nDynFreeSlots++] = iFree;
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
 	}
 
 	/* Ok, we finally can open the file */
@@ -747,19 +844,22 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 		 * will take care of too-frequent error messages.
 		 */
 		errmsg.LogError(0, localRet, "Could not open dynamic file '%s' [state %d] - discarding message", newFileName, localRet);
+		dynaFileDelCacheEntry(pData, iFree, 1);
 		ABORT_FINALIZE(localRet);
 	}
 
-	if((pCache[iFirstFree]->pName = ustrdup(newFileName)) == NULL) {
+	if((pCache[iFree]->pName = ustrdup(newFileName)) == NULL) {
 		closeFile(pData); /* need to free failed entry! */
+		dynaFileDelCacheEntry(pData, iFree, 1);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
-	pCache[iFirstFree]->pStrm = pData->pStrm;
+	pCache[iFree]->pStrm = pData->pStrm;
 	if(pData->useSigprov)
-		pCache[iFirstFree]->sigprovFileData = pData->sigprovFileData;
-	pCache[iFirstFree]->clkTickAccessed = getClockFileAccess();
-	pData->iCurrElt = iFirstFree;
-	DBGPRINTF("Added new entry %d for file cache, file '%s'.\n", iFirstFree, newFileName);
+		pCache[iFree]->sigprovFileData = pData->sigprovFileData;
+	pCache[iFree]->hash = hash;
+	dynaFileLinkEntry(pData, iFree);
+	pData->iCurrElt = iFree;
+	DBGPRINTF("Added new entry %d for file cache, file '%s'.\n", iFree, newFileName);
 
 finalize_it:
 	if(iRet == RS_RET_OK)
@@ -1233,7 +1333,14 @@ CODESTARTnewActInst
 		if(!pvals[i].bUsed)
 			continue;
 		if(!strcmp(actpblk.descr[i].name, "dynafilecachesize")) {
-			pData->iDynaFileCacheSize = (int) pvals[i].val.d.n;
+			if(pvals[i].val.d.n < 1 || pvals[i].val.d.n > DYNAFILE_CACHE_MAX) {
+				pData->iDynaFileCacheSize = (pvals[i].val.d.n < 1) ? 1 : DYNAFILE_CACHE_MAX;
+				errmsg.LogError(0, RS_RET_VAL_OUT_OF_RANGE, "omfile: dynafilecachesize "
+					"must be between 1 and %d (%lld given), changed to %d",
+					DYNAFILE_CACHE_MAX, pvals[i].val.d.n, pData->iDynaFileCacheSize);
+			} else {
+				pData->iDynaFileCacheSize = (int) pvals[i].val.d.n;
+			}
 		} else if(!strcmp(actpblk.descr[i].name, "ziplevel")) {
 			pData->iZipLevel = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "flushinterval")) {
@@ -1318,11 +1425,8 @@ CODESTARTnewActInst
 		 */
 		CHKiRet(OMSRsetEntry(*ppOMSR, 1, ustrdup(pData->fname), OMSR_NO_RQD_TPL_OPTS));
 		pData->iNumTpls = 2;
-		// TODO: create unified code for this (legacy+v6 system)
 		/* we now allocate the cache table */
-		CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
-				calloc(pData->iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
-		pData->iCurrElt = -1;		  /* no current element */
+		CHKiRet(dynaFileAllocCache(pData));
 	}
 // TODO: add	pData->iSizeLimit = 0; /* default value, use outchannels to configure! */
 	setupInstStatsCtrs(pData);
@@ -1397,8 +1501,8 @@ CODESTARTparseSelectorAct
 		 */
 		CHKiRet(OMSRsetEntry(*ppOMSR, 1, ustrdup(pData->fname), OMSR_NO_RQD_TPL_OPTS));
 		/* we now allocate the cache table */
-		CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
-				calloc(cs.iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
+		pData->iDynaFileCacheSize = cs.iDynaFileCacheSize;
+		CHKiRet(dynaFileAllocCache(pData));
 		break;
 
 	case '/':
@@ -1480,7 +1584,6 @@ CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(strm, CORE_COMPONENT);
 	objRelease(statsobj, CORE_COMPONENT);
-	DESTROY_ATOMIC_HELPER_MUT(mutClock);
 ENDmodExit
 
 
@@ -1504,8 +1607,6 @@ INITLegCnfVars
 	CHKiRet(objUse(strm, CORE_COMPONENT));
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
-	INIT_ATOMIC_HELPER_MUT(mutClock);
-
 	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
 	DBGPRINTF("omfile: %susing transactional output interface.\n", bCoreSupportsBatching ? "" : "not ");
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"dynafilecachesize", 0, eCmdHdlrInt, (void*) setDynaFileCacheSize, NULL, STD_LOADABLE_MODULE_ID));
@@ -0,0 +1,320 @@
+/* This is a tool for compiling rsyslog lookup tables into binary images,
+ * which rsyslogd can load without parsing (lookup_table(format="binary")).
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <json.h>
+
+#include "rsyslog.h"
+#include "lookupimg.h"
+
+
+static enum { MD_COMPILE, MD_VERIFY
+} mode = MD_COMPILE;
+static int verbose = 0;
+static char *outfile = NULL;
+
+
+/* read and parse the JSON table definition in file fn. Returns NULL on
+ * error, which is already reported.
+ */
+static struct json_object *
+readJSON(const char *fn)
+{
+	struct json_tokener *tokener = NULL;
+	struct json_object *json = NULL;
+	char *iobuf = NULL;
+	struct stat sb;
+	ssize_t nread;
+	int fd = -1;
+
+	if((fd = open(fn, O_RDONLY)) == -1 || fstat(fd, &sb) == -1) {
+		perror(fn);
+		goto done;
+	}
+	if((iobuf = malloc(sb.st_size)) == NULL) {
+		fprintf(stderr, "%s: out of memory\n", fn);
+		goto done;
+	}
+	nread = read(fd, iobuf, sb.st_size);
+	if(nread != (ssize_t) sb.st_size) {
+		fprintf(stderr, "%s: read error\n", fn);
+		goto done;
+	}
+	tokener = json_tokener_new();
+	json = json_tokener_parse_ex(tokener, iobuf, sb.st_size);
+	if(json == NULL)
+		fprintf(stderr, "%s: json parsing error\n", fn);
+
+done:
+	if(tokener != NULL)
+		json_tokener_free(tokener);
+	free(iobuf);
+	if(fd != -1)
+		close(fd);
+	return json;
+}
+
+
+/* fill the builder from the table definition. This follows what
+ * rsyslogd does when it loads a (version 1) table from JSON.
+ * Returns 0 on success, something else otherwise.
+ */
+static int
+buildTable(const char *fn, struct json_object *jroot, lkpimgBuilder_t **ppBuilder)
+{
+	struct json_object *jversion, *jnomatch, *jtype, *jtab;
+	struct json_object *jrow, *jindex, *jvalue;
+	const char *table_type;
+	lkpimgBuilder_t *builder = NULL;
+	int type;
+	int version = 1;
+	int nmemb;
+	int i;
+	rsRetVal localRet;
+	int r = 1;
+
+	jversion = json_object_object_get(jroot, "version");
+	if(jversion != NULL && !json_object_is_type(jversion, json_type_null)) {
+		version = json_object_get_int(jversion);
+	} else {
+		fprintf(stderr, "%s: table doesn't specify version (will use "
+			"default value: %d)\n", fn, version);
+	}
+	if(version != 1) {
+		fprintf(stderr, "%s: unsupported version: %d\n", fn, version);
+		goto done;
+	}
+
+	jnomatch = json_object_object_get(jroot, "nomatch");
+	jtype = json_object_object_get(jroot, "type");
+	jtab = json_object_object_get(jroot, "table");
+	if(jtab == NULL || !json_object_is_type(jtab, json_type_array)) {
+		fprintf(stderr, "%s: invalid table definition\n", fn);
+		goto done;
+	}
+	table_type = json_object_get_string(jtype);
+	if(table_type == NULL)
+		table_type = "string";
+	if(!strcmp(table_type, "string")) {
+		type = LKPIMG_TYPE_STRING;
+	} else if(!strcmp(table_type, "array")) {
+		type = LKPIMG_TYPE_ARRAY;
+	} else if(!strcmp(table_type, "sparseArray")) {
+		type = LKPIMG_TYPE_SPARSE_ARRAY;
+	} else {
+		fprintf(stderr, "%s: unsupported type: '%s'\n", fn, table_type);
+		goto done;
+	}
+
+	if(lkpimgBuilderConstruct(&builder, type) != RS_RET_OK) {
+		fprintf(stderr, "%s: out of memory\n", fn);
+		goto done;
+	}
+	if(jnomatch != NULL && !json_object_is_type(jnomatch, json_type_null))
+		lkpimgBuilderSetNomatch(builder, json_object_get_string(jnomatch));
+	nmemb = json_object_array_length(jtab);
+	for(i = 0 ; i < nmemb ; ++i) {
+		jrow = json_object_array_get_idx(jtab, i);
+		jindex = json_object_object_get(jrow, "index");
+		jvalue = json_object_object_get(jrow, "value");
+		if(jvalue == NULL || json_object_is_type(jvalue, json_type_null)) {
+			fprintf(stderr, "%s: '%s' table has record(s) without 'value' "
+				"field\n", fn, table_type);
+			goto done;
+		}
+		if(jindex == NULL || json_object_is_type(jindex, json_type_null)) {
+			fprintf(stderr, "%s: '%s' table has record(s) without 'index' "
+				"field\n", fn, table_type);
+			goto done;
+		}
+		if(type == LKPIMG_TYPE_STRING) {
+			localRet = lkpimgBuilderAddStr(builder, json_object_get_string(jindex),
+				json_object_get_string(jvalue));
+		} else {
+			localRet = lkpimgBuilderAddUint(builder, (uint32_t) json_object_get_int(jindex),
+				json_object_get_string(jvalue));
+		}
+		if(localRet != RS_RET_OK) {
+			fprintf(stderr, "%s: error %d adding record %d\n", fn, localRet, i);
+			goto done;
+		}
+	}
+	if(verbose)
+		fprintf(stderr, "%s: '%s' table with %d records\n", fn, table_type, nmemb);
+	*ppBuilder = builder;
+	builder = NULL;
+	r = 0;
+
+done:
+	lkpimgBuilderDestruct(builder);
+	return r;
+}
+
+
+static int
+compile(const char *fn)
+{
+	struct json_object *json;
+	lkpimgBuilder_t *builder = NULL;
+	char errMsg[1024];
+	rsRetVal localRet;
+	int r = 1;
+
+	if((json = readJSON(fn)) == NULL)
+		goto done;
+	if(buildTable(fn, json, &builder) != 0)
+		goto done;
+	/* the builder references the strings inside the JSON object, so
+	 * it must not be released before the image is written */
+	localRet = lkpimgBuilderWrite(builder, outfile, errMsg, sizeof(errMsg));
+	if(localRet != RS_RET_OK) {
+		fprintf(stderr, "%s: error %d writing image '%s': %s\n", fn,
+			localRet, outfile, errMsg);
+		goto done;
+	}
+	if(verbose)
+		fprintf(stderr, "%s: image written to '%s'\n", fn, outfile);
+	r = 0;
+
+done:
+	lkpimgBuilderDestruct(builder);
+	if(json != NULL)
+		json_object_put(json);
+	return r;
+}
+
+
+static int
+verify(const char *fn)
+{
+	const lkpimg_hdr_t *hdr;
+	const char *errMsg;
+	struct stat sb;
+	void *addr = MAP_FAILED;
+	int fd = -1;
+	int r = 1;
+
+	if((fd = open(fn, O_RDONLY)) == -1 || fstat(fd, &sb) == -1) {
+		perror(fn);
+		goto done;
+	}
+	if(sb.st_size < (off_t) sizeof(lkpimg_hdr_t)) {
+		fprintf(stderr, "%s: not a lookup table image\n", fn);
+		goto done;
+	}
+	if((addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror(fn);
+		goto done;
+	}
+	if(lkpimgValidate(addr, sb.st_size, &errMsg) != RS_RET_OK) {
+		fprintf(stderr, "%s: invalid image: %s\n", fn, errMsg);
+		goto done;
+	}
+	hdr = (const lkpimg_hdr_t*) addr;
+	printf("%s: OK, %s table, %u entries, %s nomatch value, %lld bytes\n", fn,
+		(hdr->type == LKPIMG_TYPE_STRING) ? "string" :
+			(hdr->type == LKPIMG_TYPE_ARRAY) ? "array" : "sparseArray",
+		hdr->nmemb, (hdr->nomatch == LKPIMG_NO_VALUE) ? "no" : "with",
+		(long long) sb.st_size);
+	r = 0;
+
+done:
+	if(addr != MAP_FAILED)
+		munmap(addr, sb.st_size);
+	if(fd != -1)
+		close(fd);
+	return r;
+}
+
+
+static struct option long_options[] =
+{
+	{"verbose", no_argument, NULL, 'v'},
+	{"version", no_argument, NULL, 'V'},
+	{"compile", no_argument, NULL, 'c'},
+	{"verify", no_argument, NULL, 't'},
+	{"output", required_argument, NULL, 'o'},
+	{NULL, 0, NULL, 0}
+};
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+	int opt;
+	int r = 0;
+
+	while(1) {
+		opt = getopt_long(argc, argv, "co:tvV", long_options, NULL);
+		if(opt == -1)
+			break;
+		switch(opt) {
+		case 'c':
+			mode = MD_COMPILE;
+			break;
+		case 't':
+			mode = MD_VERIFY;
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'V':
+			fprintf(stderr, "rslookuputil " VERSION "\n");
+			exit(0);
+			break;
+		case '?':
+			break;
+		default:fprintf(stderr, "getopt_long() returns unknown value %d\n", opt);
+			return 1;
+		}
+	}
+
+	if(mode == MD_COMPILE) {
+		if(outfile == NULL || optind != argc - 1) {
+			fprintf(stderr, "ERROR: compile mode requires exactly one table "
+				"file and an output file (--output)\n");
+			exit(1);
+		}
+		r = compile(argv[optind]);
+	} else {
+		if(optind == argc) {
+			fprintf(stderr, "ERROR: no image files given\n");
+			exit(1);
+		}
+		for(i = optind ; i < argc ; ++i)
+			r |= verify(argv[i]);
+	}
+
+	return r;
+}
@@ -509,6 +509,49 @@ finalize_it:
 	RETiRet;
 }
 
+/* resolve the sender names of a batch in parallel before the batch is
+ * processed (dnscache.prefetch). Without this, the first lookup of a new
+ * sender blocks the whole batch while the worker waits for DNS. Lookups
+ * which do not complete within dnscache.prefetch.timeout use the IP
+ * address as name; they continue in the background and are cached for
+ * later messages. Messages which need a hostname-based ACL check are
+ * prefetched, but left to the (synchronous) ACL code.
+ */
+static void
+prefetchBatchDNS(batch_t *pBatch, int *pbShutdownImmediate)
+{
+	struct sockaddr_storage **addrs;
+	prop_t *ip;
+	prop_t *localName;
+	msg_t *pMsg;
+	int nAddrs = 0;
+	int i;
+
+	if((addrs = malloc(pBatch->nElem * sizeof(struct sockaddr_storage*))) == NULL)
+		return;
+	for(i = 0 ; i < pBatch->nElem ; i++) {
+		pMsg = pBatch->pElem[i].pMsg;
+		if(pMsg->msgFlags & NEEDS_DNSRESOL)
+			addrs[nAddrs++] = pMsg->rcvFrom.pfrominet;
+	}
+	if(nAddrs == 0 || dnscachePrefetch(addrs, nAddrs, glblDNSPrefetchTimeout) != RS_RET_OK)
+		goto done;
+
+	for(i = 0 ; i < pBatch->nElem && !*pbShutdownImmediate ; i++) {
+		pMsg = pBatch->pElem[i].pMsg;
+		if((pMsg->msgFlags & (NEEDS_DNSRESOL | NEEDS_ACLCHK_U)) != NEEDS_DNSRESOL)
+			continue;
+		if(dnscacheLookupNoWait(pMsg->rcvFrom.pfrominet, &localName, &ip) != RS_RET_OK)
+			continue;
+		MsgSetRcvFromIP(pMsg, ip);
+		MsgSetRcvFrom(pMsg, localName);
+		prop.Destruct(&ip);
+		prop.Destruct(&localName);
+	}
+done:
+	free(addrs);
+}
+
 /* preprocess a batch of messages, that is ready them for actual processing. This is done
  * as a first stage and totally in parallel to any other worker active in the system. So
  * it helps us keep up the overall concurrency level.
@@ -527,6 +570,8 @@ preprocessBatch(batch_t *pBatch, int *pbShutdownImmediate) {
 	rsRetVal localRet;
 	DEFiRet;
 
+	if(glblDNSPrefetch)
+		prefetchBatchDNS(pBatch, pbShutdownImmediate);
 	for(i = 0 ; i < pBatch->nElem  && !*pbShutdownImmediate ; i++) {
 		pMsg = pBatch->pElem[i].pMsg;
 		if((pMsg->msgFlags & NEEDS_ACLCHK_U) != 0) {